@@ -0,0 +1,135 @@
+#!/bin/bash
+
+# Usage: ./bench.sh [lines] [runs]
+# Compares the dynamic, static-registry and monolithic builds on the
+# workload from bench/workload.sh; results are also saved to bench_output.txt
+# Then compares the keywords plugin's Aho-Corasick automaton with a naive
+# per-keyword strstr (bench/keywords_bench.c), and newline-delimited with
+# varint-framed ingest and sink output (bench/frame_lines.c)
+# The dynamic build is also measured at -O2, so that the monolithic build's
+# gain can be split between optimization level and the plugin boundary
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+print_status() {
+    echo -e "${GREEN}[BENCH]${NC} $1"
+}
+print_error() {
+    echo -e "${RED}[BENCH ERROR]${NC} $1"
+}
+print_info() {
+    echo -e "${BLUE}[INFO]${NC} $1"
+}
+
+LINES="${1:-200000}"
+RUNS="${2:-3}"
+QUEUE_SIZE=256
+CHAINS=("uppercaser rotator flipper expander" "uppercaser rotator flipper expander logger")
+
+print_status "Building all targets..."
+./build.sh all >/dev/null || exit 1
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Plugins are loaded from ./output, so the -O2 dynamic build gets its own tree
+print_status "Building dynamic target at -O2..."
+mkdir -p "$WORK_DIR/O2/output"
+gcc -O2 -o "$WORK_DIR/O2/output/analyzer" main.c runtime/output_sink.c runtime/framing.c runtime/scheduler.c runtime/daemon.c runtime/shm_channel.c runtime/remote_stage.c runtime/intern_table.c runtime/replicas.c runtime/load_generator.c plugins/sync/consumer_producer.c plugins/sync/spill_file.c plugins/sync/monitor.c -ldl -lpthread -lm || exit 1
+for plugin_name in uppercaser rotator flipper expander logger; do
+    gcc -O2 -fPIC -shared -o "$WORK_DIR/O2/output/${plugin_name}.so" plugins/${plugin_name}.c \
+        plugins/plugin_common.c plugins/result_cache.c plugins/sync/monitor.c plugins/sync/consumer_producer.c plugins/sync/spill_file.c -ldl -lpthread || {
+        print_error "Failed to build $plugin_name at -O2"
+        exit 1
+    }
+done
+
+WORKLOAD="$WORK_DIR/workload.txt"
+bash bench/workload.sh "$LINES" > "$WORKLOAD"
+
+# Variants: label, directory to run from, binary
+VARIANTS=(
+    "dynamic       $PWD           analyzer"
+    "dynamic-O2    $WORK_DIR/O2   analyzer"
+    "static        $PWD           analyzer-static"
+    "mono          $PWD           analyzer-mono"
+)
+
+# Best wall-clock time in seconds over $RUNS runs
+best_time() {
+    local dir="$1"
+    local binary="$2"
+    local chain="$3"
+    local best=""
+    for run in $(seq 1 "$RUNS"); do
+        local start=$(date +%s%N)
+        (cd "$dir" && ./output/$binary $QUEUE_SIZE $chain < "$WORKLOAD" >/dev/null 2>&1)
+        local end=$(date +%s%N)
+        local elapsed=$((end - start))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+    done
+    awk -v ns="$best" 'BEGIN { printf "%.3f", ns / 1e9 }'
+}
+
+{
+    print_info "$LINES lines, queue size $QUEUE_SIZE, best of $RUNS runs"
+    for chain in "${CHAINS[@]}"; do
+        print_info "Chain: $chain"
+        baseline=""
+        for variant in "${VARIANTS[@]}"; do
+            read -r label dir binary <<< "$variant"
+            seconds=$(best_time "$dir" "$binary" "$chain")
+            [ -z "$baseline" ] && baseline=$seconds
+            awk -v name="$label" -v s="$seconds" -v base="$baseline" -v lines="$LINES" \
+                'BEGIN { printf "  %-12s %8.3f s  %10.0f lines/s  %5.2fx\n", name, s, lines / s, base / s }'
+        done
+    done
+} | tee bench_output.txt
+
+print_status "Building the keyword matching benchmark..."
+gcc -O2 -o "$WORK_DIR/keywords_bench" bench/keywords_bench.c plugins/aho_corasick.c || exit 1
+{
+    for keywords in 100 1000 10000; do
+        print_info "Keyword matching: $keywords keywords, $LINES lines"
+        "$WORK_DIR/keywords_bench" "$keywords" 5000 < "$WORKLOAD" || exit 1
+    done
+} | tee -a bench_output.txt
+
+print_status "Building the framed record converter..."
+gcc -O2 -o "$WORK_DIR/frame_lines" bench/frame_lines.c runtime/framing.c || exit 1
+FRAMED_WORKLOAD="$WORK_DIR/workload.bin"
+"$WORK_DIR/frame_lines" < "$WORKLOAD" > "$FRAMED_WORKLOAD"
+
+# Best wall-clock time in seconds over $RUNS runs of a sink-only chain
+best_format_time() {
+    local input="$1"
+    shift
+    local best=""
+    for run in $(seq 1 "$RUNS"); do
+        local start=$(date +%s%N)
+        ./output/analyzer "$@" --sink=/dev/null $QUEUE_SIZE uppercaser < "$input" >/dev/null 2>&1
+        local end=$(date +%s%N)
+        local elapsed=$((end - start))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+    done
+    awk -v ns="$best" 'BEGIN { printf "%.3f", ns / 1e9 }'
+}
+
+{
+    print_info "Record format: $LINES lines through uppercaser into the sink"
+    lines_seconds=$(best_format_time "$WORKLOAD")
+    framed_seconds=$(best_format_time "$FRAMED_WORKLOAD" --input-format=framed --sink-format=framed)
+    for result in "lines $lines_seconds" "framed $framed_seconds"; do
+        read -r label seconds <<< "$result"
+        awk -v name="$label" -v s="$seconds" -v base="$lines_seconds" -v lines="$LINES" \
+            'BEGIN { printf "  %-12s %8.3f s  %10.0f lines/s  %5.2fx\n", name, s, lines / s, base / s }'
+    done
+} | tee -a bench_output.txt
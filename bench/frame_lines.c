@@ -0,0 +1,29 @@
+/**
+ * Usage: frame_lines < lines > records
+ * Rewrites newline-terminated lines as varint-length-prefixed records (see
+ * runtime/framing.h), stopping at "<END>", for the ingest format benchmark.
+ */
+#define _GNU_SOURCE
+#include "../runtime/framing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(void) {
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, stdin)) >= 0) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        if (strcmp(line, "<END>") == 0) {
+            break;
+        }
+        unsigned char header[FRAMING_MAX_VARINT];
+        fwrite(header, 1, framing_encode_length((uint64_t)length, header), stdout);
+        fwrite(line, 1, (size_t)length, stdout);
+    }
+    free(line);
+    return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * Usage: keywords_bench <keywords> [naive_lines] < workload
+ * Compares the keywords plugin's Aho-Corasick automaton with a naive strstr
+ * of every keyword on every line: build time, and scan throughput on the
+ * workload (the naive scan only on its first naive_lines lines, default 20000).
+ * The keywords are tokens of the workload's shape plus random ones; both
+ * scans must agree on the lines that contain any keyword.
+ */
+#define _GNU_SOURCE
+#include "../plugins/aho_corasick.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+ * Deterministic keyword list
+ */
+static char** make_keywords(int count) {
+    static const char* shapes[] = {"user=%d ", "/v1/items/%d ", "took %dms", "[svc%d]", "code-%d"};
+    char** keywords = malloc((size_t)count * sizeof(char*));
+    srand(7);
+    for (int i = 0; i < count; i++) {
+        char buffer[64];
+        if (i % 3 == 2) {
+            int length = 4 + rand() % 8;
+            for (int j = 0; j < length; j++) {
+                buffer[j] = (char)('a' + rand() % 26);
+            }
+            buffer[length] = '\0';
+        } else {
+            snprintf(buffer, sizeof(buffer), shapes[i % 5], rand() % 10000);
+        }
+        keywords[i] = strdup(buffer);
+    }
+    return keywords;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <keywords> [naive_lines] < workload\n", argv[0]);
+        return 1;
+    }
+    int keyword_count = atoi(argv[1]);
+    long naive_limit = argc > 2 ? atol(argv[2]) : 20000;
+    if (keyword_count < 1) {
+        fprintf(stderr, "Invalid keyword count\n");
+        return 1;
+    }
+
+    // Load the workload
+    char** lines = NULL;
+    long line_count = 0;
+    long capacity = 0;
+    size_t bytes = 0;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, stdin)) >= 0) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        if (strcmp(line, "<END>") == 0) {
+            break;
+        }
+        if (line_count == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            lines = realloc(lines, (size_t)capacity * sizeof(char*));
+        }
+        lines[line_count++] = strdup(line);
+        bytes += (size_t)length;
+    }
+    free(line);
+
+    char** keywords = make_keywords(keyword_count);
+
+    double start = now_seconds();
+    const char* error = NULL;
+    aho_corasick_t* automaton = aho_corasick_build((const char* const*)keywords, keyword_count, &error);
+    double build_seconds = now_seconds() - start;
+    if (!automaton) {
+        fprintf(stderr, "Build failed: %s\n", error);
+        return 1;
+    }
+
+    long ac_matched = 0;
+    start = now_seconds();
+    for (long i = 0; i < line_count; i++) {
+        ac_matched += aho_corasick_scan(automaton, lines[i], strlen(lines[i]), NULL, NULL) > 0;
+    }
+    double ac_seconds = now_seconds() - start;
+
+    long naive_lines = line_count < naive_limit ? line_count : naive_limit;
+    long naive_matched = 0;
+    long ac_matched_prefix = 0;
+    start = now_seconds();
+    for (long i = 0; i < naive_lines; i++) {
+        for (int k = 0; k < keyword_count; k++) {
+            if (strstr(lines[i], keywords[k])) {
+                naive_matched++;
+                break;
+            }
+        }
+    }
+    double naive_seconds = now_seconds() - start;
+    for (long i = 0; i < naive_lines; i++) {
+        ac_matched_prefix += aho_corasick_scan(automaton, lines[i], strlen(lines[i]), NULL, NULL) > 0;
+    }
+
+    double ac_rate = (double)line_count / ac_seconds;
+    double naive_rate = (double)naive_lines / naive_seconds;
+    printf("  keywords     %d (%d states, %.1f KiB table), built in %.2f ms\n", keyword_count,
+           aho_corasick_states(automaton), (double)aho_corasick_bytes(automaton) / 1024.0, build_seconds * 1000.0);
+    printf("  aho-corasick %10.0f lines/s  %7.1f MB/s  (%ld of %ld lines matched)\n", ac_rate,
+           (double)bytes / ac_seconds / 1e6, ac_matched, line_count);
+    printf("  naive strstr %10.0f lines/s  %7.1f MB/s  (first %ld lines)  %.1fx slower\n", naive_rate,
+           (double)bytes / line_count * naive_lines / naive_seconds / 1e6, naive_lines, ac_rate / naive_rate);
+    if (naive_matched != ac_matched_prefix) {
+        fprintf(stderr, "Mismatch: naive %ld, aho-corasick %ld matched lines\n", naive_matched, ac_matched_prefix);
+        return 1;
+    }
+
+    aho_corasick_destroy(automaton);
+    for (int k = 0; k < keyword_count; k++) {
+        free(keywords[k]);
+    }
+    free(keywords);
+    for (long i = 0; i < line_count; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# Usage: bench/workload.sh [lines]
+# Prints a deterministic, log-like workload followed by <END>
+# Used by bench.sh and by the PGO training run of "./build.sh pgo"
+
+LINES="${1:-100000}"
+
+awk -v n="$LINES" 'BEGIN {
+    split("INFO WARN ERROR DEBUG", level, " ")
+    split("auth db cache api scheduler billing", service, " ")
+    split("GET POST PUT DELETE", method, " ")
+    srand(42)
+    for (i = 1; i <= n; i++) {
+        printf "2024-01-01T%02d:%02d:%02d %s [%s] %s /v1/items/%d user=%d took %dms\n",
+            int(i / 3600) % 24, int(i / 60) % 60, i % 60,
+            level[int(rand() * 4) + 1], service[int(rand() * 6) + 1], method[int(rand() * 4) + 1],
+            int(rand() * 10000), int(rand() * 500), int(rand() * 900)
+    }
+    print "<END>"
+}'
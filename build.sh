@@ -1,5 +1,13 @@
 #!/bin/bash
 
+# Usage: ./build.sh [dynamic|static|mono|pgo|all]
+#   dynamic - output/analyzer plus one output/<plugin>.so per plugin (default)
+#   static  - output/analyzer-static with the built-in plugins linked in
+#   mono    - output/analyzer-mono: like static, but optimized, LTO-linked and
+#             with each plugin's transform inlined into its consumer loop
+#   pgo     - mono, trained with bench/workload.sh and rebuilt with the profile
+#   all     - dynamic, static and mono
+
 # Exit on any error
 set -e
 
@@ -22,29 +30,153 @@ print_error() {
     echo -e "${RED}[ERROR]${NC} $1"
 }
 
+TARGET="${1:-dynamic}"
+
+PLUGINS="logger uppercaser rotator flipper expander typewriter grep keywords aggregate"
+PLUGIN_COMMON_SOURCES="plugins/plugin_common.c plugins/result_cache.c plugins/aho_corasick.c plugins/sync/monitor.c plugins/sync/consumer_producer.c plugins/sync/spill_file.c"
+# Main-side modules linked into every analyzer
+RUNTIME_SOURCES="runtime/output_sink.c runtime/framing.c runtime/scheduler.c runtime/daemon.c runtime/shm_channel.c runtime/remote_stage.c runtime/intern_table.c runtime/replicas.c runtime/load_generator.c plugins/sync/consumer_producer.c plugins/sync/spill_file.c plugins/sync/monitor.c"
+# Symbols main.c resolves in a plugin; renamed to <plugin>_<symbol> for the static build
+PLUGIN_EXPORTS="plugin_init plugin_fini plugin_place_work plugin_attach plugin_wait_finished
+                plugin_get_name plugin_configure plugin_get_stat plugin_transform plugin_get_properties
+                plugin_abort plugin_flush plugin_get_capabilities"
+MONO_CFLAGS="-O2"
+PGO_TRAINING_CHAIN="uppercaser rotator flipper expander logger"
+
+# Arguments for objcopy renaming a plugin's exports and hiding everything else
+rename_exports_args() {
+    local plugin_name="$1"
+    local args=""
+    for symbol in $PLUGIN_EXPORTS; do
+        args="$args --redefine-sym ${symbol}=${plugin_name}_${symbol}"
+        args="$args --keep-global-symbol=${plugin_name}_${symbol}"
+    done
+    echo "$args"
+}
+
+build_dynamic() {
+    # Build main application
+    print_status "Building main application..."
+    gcc -o output/analyzer main.c $RUNTIME_SOURCES -ldl -lpthread -lm || {
+        print_error "Failed to build main application"
+        exit 1
+    }
+
+    # Build each plugin
+    for plugin_name in $PLUGINS; do
+        print_status "Building plugin: $plugin_name"
+        gcc -fPIC -shared -o output/${plugin_name}.so \
+            plugins/${plugin_name}.c \
+            $PLUGIN_COMMON_SOURCES \
+            -ldl -lpthread || {
+            print_error "Failed to build $plugin_name"
+            exit 1
+        }
+    done
+}
+
+build_static() {
+    mkdir -p output/builtin
+    local objects=""
+
+    # Each plugin becomes one relocatable object with its own copy of the
+    # common code; everything but the renamed exports is made local
+    for plugin_name in $PLUGINS; do
+        print_status "Building built-in plugin: $plugin_name"
+        local object="output/builtin/${plugin_name}.o"
+        gcc -r -o "$object" plugins/${plugin_name}.c $PLUGIN_COMMON_SOURCES &&
+            objcopy $(rename_exports_args "$plugin_name") "$object" || {
+            print_error "Failed to build built-in $plugin_name"
+            exit 1
+        }
+        objects="$objects $object"
+    done
+
+    print_status "Building main application with built-in plugins..."
+    gcc -DBUILTIN_PLUGINS -o output/analyzer-static main.c $RUNTIME_SOURCES $objects -ldl -lpthread -lm || {
+        print_error "Failed to build static main application"
+        exit 1
+    }
+}
+
+# $1: extra compiler flags (profile generation or use)
+build_mono() {
+    local extra_flags="$1"
+    mkdir -p output/mono
+    local objects=""
+
+    # Same layout as the static build, but each plugin is compiled together
+    # with the common code as one translation unit, so its transform is
+    # inlined into the consumer loop. The unit is compiled for LTO and
+    # optimized by an LTO partial link of its own, which yields plain code
+    # objcopy can rename (it cannot rename symbols inside LTO bytecode);
+    # the final link is LTO too
+    for plugin_name in $PLUGINS; do
+        print_status "Building optimized built-in plugin: $plugin_name"
+        local object="output/mono/${plugin_name}.o"
+        local lto_object="output/mono/${plugin_name}-lto.o"
+        # Feature macros have to precede the first system header of the unit
+        local unity_args="-D_GNU_SOURCE"
+        for source in $PLUGIN_COMMON_SOURCES; do
+            unity_args="$unity_args -include $source"
+        done
+        gcc $MONO_CFLAGS -flto $extra_flags -DPLUGIN_TRANSFORM_DIRECT -c -o "$lto_object" \
+            $unity_args plugins/${plugin_name}.c &&
+            gcc $MONO_CFLAGS -flto $extra_flags -r -nostdlib -flinker-output=nolto-rel \
+                -o "$object" "$lto_object" &&
+            objcopy $(rename_exports_args "$plugin_name") "$object" || {
+            print_error "Failed to build optimized $plugin_name"
+            exit 1
+        }
+        objects="$objects $object"
+    done
+
+    print_status "Building optimized monolithic application..."
+    gcc $MONO_CFLAGS -flto $extra_flags -DBUILTIN_PLUGINS -o output/analyzer-mono main.c $RUNTIME_SOURCES $objects -ldl -lpthread -lm || {
+        print_error "Failed to build monolithic application"
+        exit 1
+    }
+}
+
+build_pgo() {
+    rm -f output/mono/*.gcda output/*.gcda
+    build_mono "-fprofile-generate -fprofile-update=atomic"
+
+    print_status "Training with bench/workload.sh..."
+    bash bench/workload.sh 200000 | ./output/analyzer-mono 256 $PGO_TRAINING_CHAIN >/dev/null || {
+        print_error "PGO training run failed"
+        exit 1
+    }
+
+    build_mono "-fprofile-use -fprofile-partial-training -Wno-missing-profile"
+}
+
 # Create output directory if it doesn't exist
 print_status "Creating output directory..."
 mkdir -p output
 
-# Build main application
-print_status "Building main application..."
-gcc -o output/analyzer main.c -ldl -lpthread || {
-    print_error "Failed to build main application"
-    exit 1
-}
-
-# Build each plugin
-for plugin_name in logger uppercaser rotator flipper expander typewriter; do
-    print_status "Building plugin: $plugin_name"
-    gcc -fPIC -shared -o output/${plugin_name}.so \
-        plugins/${plugin_name}.c \
-        plugins/plugin_common.c \
-        plugins/sync/monitor.c \
-        plugins/sync/consumer_producer.c \
-        -ldl -lpthread || {
-        print_error "Failed to build $plugin_name"
+case "$TARGET" in
+    dynamic)
+        build_dynamic
+        ;;
+    static)
+        build_static
+        ;;
+    mono)
+        build_mono ""
+        ;;
+    pgo)
+        build_pgo
+        ;;
+    all)
+        build_dynamic
+        build_static
+        build_mono ""
+        ;;
+    *)
+        print_error "Unknown build target '$TARGET' (expected dynamic, static, mono, pgo or all)"
         exit 1
-    }
-done
+        ;;
+esac
 
-print_status "Build completed successfully!"
\ No newline at end of file
+print_status "Build completed successfully!"
@@ -3,6 +3,19 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include "runtime/output_sink.h"
+#include "runtime/framing.h"
+#include "runtime/scheduler.h"
+#include "runtime/daemon.h"
+#include "runtime/replicas.h"
+#include "runtime/load_generator.h"
+#include "runtime/remote_stage.h"
+#include "plugins/plugin_sdk.h"
 
 // Plugin interface function pointers
 typedef const char* (*plugin_init_func_t)(int);
@@ -10,6 +23,13 @@ typedef const char* (*plugin_fini_func_t)(void);
 typedef const char* (*plugin_place_work_func_t)(const char*);
 typedef void (*plugin_attach_func_t)(const char* (*)(const char*));
 typedef const char* (*plugin_wait_finished_func_t)(void);
+typedef const char* (*plugin_configure_func_t)(const char*, const char*);
+typedef const char* (*plugin_get_stat_func_t)(int, unsigned long long*);
+typedef const char* (*plugin_transform_func_t)(const char*);
+typedef unsigned (*plugin_get_properties_func_t)(void);
+typedef const char* (*plugin_abort_func_t)(unsigned long long*);
+typedef const char* (*plugin_flush_func_t)(void);
+typedef const plugin_capabilities_t* (*plugin_get_capabilities_func_t)(void);
 
 // Plugin handle structure
 typedef struct {
@@ -18,22 +38,223 @@ typedef struct {
     plugin_place_work_func_t place_work;
     plugin_attach_func_t attach;
     plugin_wait_finished_func_t wait_finished;
+    plugin_configure_func_t configure;     // Optional
+    plugin_get_stat_func_t get_stat;       // Optional
+    plugin_transform_func_t transform;     // Optional, required on the worker pool
+    plugin_get_properties_func_t get_properties;  // Optional, read by the chain optimizer
+    plugin_abort_func_t abort;             // Optional, needed to cut a drain short
+    plugin_flush_func_t flush;             // Optional, called at <END> by hosts running transform
+    plugin_get_capabilities_func_t get_capabilities;  // Optional, read once the plugin is initialized
+    const plugin_capabilities_t* capabilities;     // What get_capabilities returned, or NULL
     char* name;
+    const char* options;                   // Stage options from the command line, or NULL
+    int lossy;                             // Stage uses a non-blocking overload policy
+    overload_policy_t policy;              // Overload policy, applied by the worker pool
+    int sample_rate;
+    size_t queue_bytes;                    // Byte budget of the stage's queue (0: none)
+    int builtin;                           // Linked into the binary (no handle)
+    int isolated;                          // Runs in a worker process (--isolate)
     void* handle;
 } plugin_handle_t;
 
+#ifdef BUILTIN_PLUGINS
+/**
+ * Plugins linked into the binary by "./build.sh static"
+ * Their exported symbols are renamed to <plugin>_<symbol> at build time
+ */
+#define BUILTIN_PLUGIN_LIST(X) X(logger) X(typewriter) X(uppercaser) X(rotator) X(flipper) X(expander) X(grep) X(keywords) X(aggregate)
+
+#define DECLARE_BUILTIN_PLUGIN(plugin) \
+    const char* plugin##_plugin_init(int); \
+    const char* plugin##_plugin_fini(void); \
+    const char* plugin##_plugin_place_work(const char*); \
+    void plugin##_plugin_attach(const char* (*)(const char*)); \
+    const char* plugin##_plugin_wait_finished(void); \
+    const char* plugin##_plugin_configure(const char*, const char*); \
+    const char* plugin##_plugin_get_stat(int, unsigned long long*); \
+    const char* plugin##_plugin_transform(const char*); \
+    unsigned plugin##_plugin_get_properties(void); \
+    const char* plugin##_plugin_abort(unsigned long long*); \
+    const char* plugin##_plugin_flush(void); \
+    const plugin_capabilities_t* plugin##_plugin_get_capabilities(void);
+
+BUILTIN_PLUGIN_LIST(DECLARE_BUILTIN_PLUGIN)
+
+#define BUILTIN_PLUGIN_ENTRY(plugin) \
+    { #plugin, { plugin##_plugin_init, plugin##_plugin_fini, plugin##_plugin_place_work, \
+                 plugin##_plugin_attach, plugin##_plugin_wait_finished, \
+                 plugin##_plugin_configure, plugin##_plugin_get_stat, \
+                 plugin##_plugin_transform, plugin##_plugin_get_properties, \
+                 plugin##_plugin_abort, plugin##_plugin_flush, \
+                 plugin##_plugin_get_capabilities } },
+
+typedef struct {
+    const char* name;
+    plugin_handle_t functions;
+} builtin_plugin_t;
+
+static const builtin_plugin_t builtin_plugins[] = {
+    BUILTIN_PLUGIN_LIST(BUILTIN_PLUGIN_ENTRY)
+};
+#endif
+
 // Global variables
 static plugin_handle_t* plugins = NULL;
 static int plugin_count = 0;
+static int pipeline_queue_size = 0;
+
+// Command line options
+static const char* swap_control_path = NULL;       // --swap-file: hot swap requests, read on SIGHUP
+static int stats_enabled = 0;                      // --stats: report startup time and all counters
+static const char* sink_target = NULL;             // --sink: the last stage writes raw records here
+static const char* sink_delimiter = "\\n";         // --sink-delimiter: written after every record
+static sink_flush_policy_t sink_flush_policy = SINK_FLUSH_BATCH;  // --sink-flush
+static record_format_t sink_format = RECORD_FORMAT_LINES;         // --sink-format
+static record_format_t input_format = RECORD_FORMAT_LINES;        // --input-format
+static int pool_workers = 0;                       // --workers: run stages on a worker pool (0: a thread per stage)
+static int pool_batch_size = 32;                   // --batch: items per stage activation on the pool
+static int adaptive_enabled = 0;                   // --adaptive: fuse and split pool stages while running
+static const char* listen_path = NULL;             // --listen: serve clients on a Unix socket
+static const char* connect_path = NULL;            // --connect: be a client of a daemon
+static const char* isolate_list = NULL;            // --isolate: stages that run in worker processes
+static int optimize_enabled = 0;                   // --optimize: rewrite the chain before loading it
+static long drain_timeout_ms = -1;                 // --drain-timeout: longest drain after <END> (-1: no limit)
+static int queue_lanes = 1;                        // --lanes: priority lanes per stage queue on the pool
+static const char* queue_bytes_option = NULL;       // --queue-bytes: default byte budget of every stage queue
+static lane_policy_t queue_lane_policy = LANE_STRICT;
+static int replica_count = 0;                      // --replicas: copies of the chain, lines sharded among them
+static int shard_field = 0;                        // --shard-key: field hashed to pick a replica (0: the line)
+static int shard_key_given = 0;
+static replica_merge_t replica_merge = REPLICA_MERGE_KEY;  // --merge
+static int replica_merge_given = 0;
+static double load_rates[LOAD_MAX_STEPS];          // --load: offered rates, one step each (0 steps: read stdin)
+static int load_step_count = 0;
+static load_arrivals_t load_arrivals = LOAD_ARRIVALS_FIXED;  // --arrivals
+static long load_duration_ms = 1000;               // --load-duration: how long each step sends
+static long load_stall_ms = 5000;                  // --load-stall: how long a step waits for an output
+static int load_option_given = 0;                  // --arrivals, --load-duration or --load-stall was given
+
+// Chain optimizer state
+#define CHAIN_MAX_SHIFT 1000000                    // Largest shift a ROTATION stage accepts
+static char** chain_plan = NULL;                   // Rewritten stage specifications (owned)
+static int chain_plan_count = 0;
+
+// Worker pool state
+static scheduler_stage_t* pool_stages = NULL;
+static pthread_mutex_t* pool_stage_locks = NULL;   // Daemon: serialize the stages that are not thread-safe
+static scheduler_pipeline_t* pool_pipeline = NULL; // The pipeline fed from stdin
+static replicas_t* pool_replicas = NULL;           // With --replicas, the pipelines fed from stdin instead
+
+// Hot swap state
+static pthread_t swap_thread;
+static int swap_thread_running = 0;
+static volatile sig_atomic_t swap_shutdown = 0;
+static pthread_mutex_t swap_lock = PTHREAD_MUTEX_INITIALIZER;     // Serializes swaps against end of input
+static pthread_mutex_t ingest_lock = PTHREAD_MUTEX_INITIALIZER;   // Guards plugins[0].place_work for ingest
+static int input_finished = 0;
+static plugin_place_work_func_t swap_downstream = NULL;           // Where the retiring stage forwards to
+static plugin_place_work_func_t swap_hold_target = NULL;          // Where held records go once released
+static char** swap_held = NULL;                                   // Records held while the retiring stage drains
+static int swap_held_count = 0;
+static int swap_hold_open = 1;
+static pthread_mutex_t swap_hold_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t swap_hold_cond = PTHREAD_COND_INITIALIZER;
+
+// Shutdown state
+#define DRAIN_POLL_MS 20                           // How often a drain checks its deadline and signals
+static volatile sig_atomic_t shutdown_signals = 0; // SIGINT/SIGTERM received so far
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_cond = PTHREAD_COND_INITIALIZER;
+static int drain_done = 0;
+static int drain_result = 0;
 
 /**
  * Print usage information to stdout
  */
 void print_usage(const char* program_name) {
-    printf("Usage: %s <queue_size> <plugin1> <plugin2> ... <pluginN>\n", program_name);
+    printf("Usage: %s [options] <queue_size> <plugin1> <plugin2> ... <pluginN>\n", program_name);
+    printf("Options:\n");
+    printf("  --swap-file=<path>  On SIGHUP, replace the stage named in <path> (\"<plugin> [<file.so>]\")\n");
+    printf("                      with a freshly loaded copy of its shared object\n");
+    printf("  --stats             Report startup time, stage capabilities and the counters of every stage\n");
+    printf("  --sink=<path|->     Write the last stage's records, without any prefix, to a file\n");
+    printf("                      or to stdout (-), in large batches\n");
+    printf("  --sink-delimiter=<text>  Written after every record (default \\n; \\t, \\r, \\0 and \\\\ are decoded)\n");
+    printf("  --sink-flush=<policy>    batch (default): write when a batch is full and at <END>,\n");
+    printf("                           record: write every record at once\n");
+    printf("  --sink-format=<lines|framed>  framed: write each record as a varint length and its\n");
+    printf("                           bytes instead of following it with the delimiter\n");
+    printf("  --input-format=<lines|framed>  framed: read stdin as varint-length-prefixed records\n");
+    printf("                      (newlines allowed, up to 16 MiB); end of input ends the stream\n");
+    printf("                      (a record equal to <END> is skipped; not with --isolate)\n");
+    printf("  --workers=<n|auto>  Run the stages as tasks on a pool of n work-stealing worker\n");
+    printf("                      threads (auto: one per CPU) instead of one thread per stage\n");
+    printf("  --batch=<n>         Items a stage processes per turn on the worker pool (default 32)\n");
+    printf("  --adaptive          On the worker pool, time the stages while running: fuse a stage\n");
+    printf("                      into the one before it when its transform costs less than a queue\n");
+    printf("                      hop, split it off again when it becomes the bottleneck (order and\n");
+    printf("                      items are preserved; needs --workers, --replicas or --listen)\n");
+    printf("  --listen=<path>     Daemon: serve a pipeline per connection on a Unix socket until\n");
+    printf("                      SIGINT/SIGTERM (implies --workers=auto unless given)\n");
+    printf("  --connect=<path>    Client: send stdin to a daemon and print the results\n");
+    printf("                      (takes no other arguments)\n");
+    printf("  --isolate=<stage>[,<stage>...]  Run these stages in worker processes connected\n");
+    printf("                      through shared memory; a crashing stage is cut out\n");
+    printf("  --optimize          Rewrite the chain into a cheaper equivalent before starting it,\n");
+    printf("                      using the algebraic properties the plugins declare\n");
+    printf("  --drain-timeout=<ms>  After <END>, SIGINT or SIGTERM, wait at most this long for the\n");
+    printf("                      stages to drain, then discard what is still queued and report\n");
+    printf("                      it per stage (default: no limit; a second signal cuts it short)\n");
+    printf("  --queue-bytes=<size>  Also bound every stage queue by the bytes it holds, e.g. 16m\n");
+    printf("                      (a stage's queue_bytes option takes precedence)\n");
+    printf("  --lanes=<n>[:strict|weighted]  Split every stage queue into n (2-4) priority lanes;\n");
+    printf("                      a line starting with <pK> enters lane K (0 most urgent), others\n");
+    printf("                      the last lane. strict always serves the most urgent lane, weighted\n");
+    printf("                      serves lane K 2^(n-1-K) times per round (needs --workers or --listen)\n");
+    printf("  --replicas=<n>      Run n (1-64) copies of the whole chain on the worker pool, each pinned\n");
+    printf("                      to its own worker and CPU (implies --workers=<n> unless given; at most\n");
+    printf("                      n workers); lines are sharded among them by the hash of a key\n");
+    printf("  --shard-key=<key>   line (default): the whole line; field:<n>: its n-th whitespace-\n");
+    printf("                      separated token, so lines with the same token keep their order\n");
+    printf("  --merge=<mode>      key (default): pass results on as each replica finishes them (order\n");
+    printf("                      kept per key); input: release them in input order (needs --sink and\n");
+    printf("                      blocking stage queues)\n");
+    printf("  --load=<rate>[,<rate>...]  Instead of streaming stdin, replay its lines into the first\n");
+    printf("                      stage at each rate in turn (records/s, k and m suffixes), open loop,\n");
+    printf("                      and report latency percentiles from each record's intended send time\n");
+    printf("                      (the chain must keep every line in order: blocking or spilling queues)\n");
+    printf("  --arrivals=<fixed|poisson>  Spacing of the send times (default fixed)\n");
+    printf("  --load-duration=<ms>  How long each rate is offered (default 1000); a rate ends once its\n");
+    printf("                      records are out\n");
+    printf("  --load-stall=<ms>   Fail a rate when no record comes out for this long (default 5000)\n");
+    printf("\n");
     printf("Arguments:\n");
     printf("  queue_size    Maximum number of items in each plugin's queue\n");
-    printf("  plugin1..N    Names of plugins to load (without .so extension)\n");
+    printf("  plugin1..N    Names of plugins to load (without .so extension),\n");
+    printf("                optionally followed by :key=value[,key=value...]\n");
+    printf("\n");
+    printf("Stage options:\n");
+    printf("  overload=<policy>  What to do when the stage's queue is full:\n");
+    printf("                     block (default), drop-newest, drop-oldest, sample:N,\n");
+    printf("                     spill (overflow to a file in $TMPDIR, read back in order)\n");
+    printf("  queue_bytes=<size> Byte budget of the stage's queue, e.g. 64k or 16m: when the next\n");
+    printf("                     item does not fit, the queue is full and overload= applies;\n");
+    printf("                     --stats then reports queued_bytes and peak_bytes\n");
+    printf("  cache=<size>       Memory for remembered results of a memoizable plugin (uppercaser,\n");
+    printf("                     rotator, flipper, expander), e.g. 4m; repeated inputs skip the work\n");
+    printf("  shift=<n>          rotator only: move every character n positions (default 1,\n");
+    printf("                     negative: to the left)\n");
+    printf("  reverse=<0|1>      rotator only: reverse the string before rotating it\n");
+    printf("  pattern=<text>     grep only (required): keep the lines containing text (no commas)\n");
+    printf("  invert=<0|1>       grep only: keep the lines that do not contain it instead\n");
+    printf("  patterns=<file>    keywords only (required): one keyword per line, its ID is the line number\n");
+    printf("  emit=<mode>        keywords only: annotate (default) appends \" [keywords=<id>,...]\" to\n");
+    printf("                     matching lines; ids outputs only the IDs and drops the other lines\n");
+    printf("  window=<n|ns|nms>  aggregate only: close a window every n lines (default 1000) or\n");
+    printf("                     once it is n seconds / milliseconds old\n");
+    printf("  top=<n>            aggregate only: tokens listed per summary (default 10)\n");
+    printf("  max_keys=<n>       aggregate only: distinct tokens tracked (default 4096)\n");
+    printf("  field=<n>          aggregate only: count the n-th token of each line (default 0: all)\n");
     printf("\n");
     printf("Available plugins:\n");
     printf("  logger        - Logs all strings that pass through\n");
@@ -42,9 +263,160 @@ void print_usage(const char* program_name) {
     printf("  rotator       - Move every character to the right. Last character moves to the beginning.\n");
     printf("  flipper       - Reverses the order of characters\n");
     printf("  expander      - Expands each character with spaces\n");
+    printf("  grep          - Keeps the lines containing a pattern, drops the others\n");
+    printf("  keywords      - Tags lines with the keywords of a list they contain (Aho-Corasick)\n");
+    printf("  aggregate     - Replaces each window of lines with a summary of its most frequent tokens\n");
     printf("\n");
     printf("Example:\n");
     printf("  %s 20 uppercaser rotator logger\n", program_name);
+    printf("  %s 20 uppercaser:overload=drop-oldest logger:overload=sample:10\n", program_name);
+    printf("  %s --optimize 20 rotator rotator flipper flipper uppercaser logger\n", program_name);
+    printf("  %s --replicas=4 --merge=input --sink=- 64 uppercaser rotator\n", program_name);
+    printf("  %s --load=10k,50k,100k --arrivals=poisson 64 uppercaser rotator < sample.log\n", program_name);
+}
+
+/**
+ * Parse leading --option arguments
+ * Returns the index of the first positional argument, -1 on failure
+ */
+int parse_options(int argc, char* argv[]) {
+    int index = 1;
+    while (index < argc && strncmp(argv[index], "--", 2) == 0) {
+        const char* option = argv[index];
+        if (strncmp(option, "--swap-file=", 12) == 0 && option[12] != '\0') {
+            swap_control_path = option + 12;
+        } else if (strcmp(option, "--stats") == 0) {
+            stats_enabled = 1;
+        } else if (strncmp(option, "--sink=", 7) == 0 && option[7] != '\0') {
+            sink_target = option + 7;
+        } else if (strncmp(option, "--sink-delimiter=", 17) == 0) {
+            sink_delimiter = option + 17;
+        } else if (strncmp(option, "--sink-flush=", 13) == 0) {
+            const char* error = output_sink_parse_flush_policy(option + 13, &sink_flush_policy);
+            if (error) {
+                fprintf(stderr, "Error: %s '%s'\n", error, option + 13);
+                return -1;
+            }
+        } else if (strncmp(option, "--sink-format=", 14) == 0 || strncmp(option, "--input-format=", 15) == 0) {
+            int is_sink = option[2] == 's';
+            const char* name = option + (is_sink ? 14 : 15);
+            const char* error = framing_parse_format(name, is_sink ? &sink_format : &input_format);
+            if (error) {
+                fprintf(stderr, "Error: %s '%s'\n", error, name);
+                return -1;
+            }
+        } else if (strncmp(option, "--workers=", 10) == 0) {
+            char* endptr;
+            long workers = strtol(option + 10, &endptr, 10);
+            if (strcmp(option + 10, "auto") == 0) {
+                workers = sysconf(_SC_NPROCESSORS_ONLN);
+                workers = workers > 0 ? workers : 1;
+            } else if (option[10] == '\0' || *endptr != '\0' || workers < 1 || workers > 1024) {
+                fprintf(stderr, "Error: Invalid worker count '%s'\n", option + 10);
+                return -1;
+            }
+            pool_workers = (int)workers;
+        } else if (strncmp(option, "--batch=", 8) == 0) {
+            char* endptr;
+            long batch = strtol(option + 8, &endptr, 10);
+            if (option[8] == '\0' || *endptr != '\0' || batch < 1 || batch > 1000000) {
+                fprintf(stderr, "Error: Invalid batch size '%s'\n", option + 8);
+                return -1;
+            }
+            pool_batch_size = (int)batch;
+        } else if (strcmp(option, "--adaptive") == 0) {
+            adaptive_enabled = 1;
+        } else if (strncmp(option, "--listen=", 9) == 0 && option[9] != '\0') {
+            listen_path = option + 9;
+        } else if (strncmp(option, "--connect=", 10) == 0 && option[10] != '\0') {
+            connect_path = option + 10;
+        } else if (strncmp(option, "--isolate=", 10) == 0 && option[10] != '\0') {
+            isolate_list = option + 10;
+        } else if (strcmp(option, "--optimize") == 0) {
+            optimize_enabled = 1;
+        } else if (strncmp(option, "--drain-timeout=", 16) == 0) {
+            char* endptr;
+            long timeout = strtol(option + 16, &endptr, 10);
+            if (option[16] == '\0' || *endptr != '\0' || timeout < 0 || timeout > 86400000) {
+                fprintf(stderr, "Error: Invalid drain timeout '%s'\n", option + 16);
+                return -1;
+            }
+            drain_timeout_ms = timeout;
+        } else if (strncmp(option, "--queue-bytes=", 14) == 0) {
+            size_t bytes;
+            const char* error = consumer_producer_parse_bytes(option + 14, &bytes);
+            if (error) {
+                fprintf(stderr, "Error: %s '%s'\n", error, option + 14);
+                return -1;
+            }
+            queue_bytes_option = option + 14;
+        } else if (strncmp(option, "--replicas=", 11) == 0) {
+            char* endptr;
+            long replicas = strtol(option + 11, &endptr, 10);
+            if (option[11] == '\0' || *endptr != '\0' || replicas < 1 || replicas > REPLICAS_MAX) {
+                fprintf(stderr, "Error: Invalid replica count '%s'\n", option + 11);
+                return -1;
+            }
+            replica_count = (int)replicas;
+        } else if (strncmp(option, "--shard-key=", 12) == 0) {
+            const char* error = replicas_parse_key(option + 12, &shard_field);
+            if (error) {
+                fprintf(stderr, "Error: %s '%s'\n", error, option + 12);
+                return -1;
+            }
+            shard_key_given = 1;
+        } else if (strncmp(option, "--merge=", 8) == 0) {
+            const char* error = replicas_parse_merge(option + 8, &replica_merge);
+            if (error) {
+                fprintf(stderr, "Error: %s '%s'\n", error, option + 8);
+                return -1;
+            }
+            replica_merge_given = 1;
+        } else if (strncmp(option, "--load=", 7) == 0) {
+            const char* error = load_generator_parse_rates(option + 7, load_rates, &load_step_count);
+            if (error) {
+                fprintf(stderr, "Error: %s '%s'\n", error, option + 7);
+                return -1;
+            }
+        } else if (strncmp(option, "--arrivals=", 11) == 0) {
+            const char* error = load_generator_parse_arrivals(option + 11, &load_arrivals);
+            if (error) {
+                fprintf(stderr, "Error: %s '%s'\n", error, option + 11);
+                return -1;
+            }
+            load_option_given = 1;
+        } else if (strncmp(option, "--load-duration=", 16) == 0) {
+            char* endptr;
+            long duration = strtol(option + 16, &endptr, 10);
+            if (option[16] == '\0' || *endptr != '\0' || duration < 1 || duration > 3600000) {
+                fprintf(stderr, "Error: Invalid load duration '%s'\n", option + 16);
+                return -1;
+            }
+            load_duration_ms = duration;
+            load_option_given = 1;
+        } else if (strncmp(option, "--load-stall=", 13) == 0) {
+            char* endptr;
+            long stall = strtol(option + 13, &endptr, 10);
+            if (option[13] == '\0' || *endptr != '\0' || stall < 1 || stall > 3600000) {
+                fprintf(stderr, "Error: Invalid load stall timeout '%s'\n", option + 13);
+                return -1;
+            }
+            load_stall_ms = stall;
+            load_option_given = 1;
+        } else if (strncmp(option, "--lanes=", 8) == 0) {
+            const char* error = consumer_producer_parse_lanes(option + 8, &queue_lanes, &queue_lane_policy);
+            if (error) {
+                fprintf(stderr, "Error: %s '%s'\n", error, option + 8);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", option);
+            return -1;
+        }
+        index++;
+    }
+
+    return index;
 }
 
 /**
@@ -73,20 +445,19 @@ int parse_arguments(int argc, char* argv[], char*** plugin_names, int* num_plugi
 }
 
 /**
- * Load a single plugin
+ * Get the length of the plugin name part of a stage specification (name[:options])
+ */
+size_t stage_name_length(const char* spec) {
+    const char* colon = strchr(spec, ':');
+    return colon ? (size_t)(colon - spec) : strlen(spec);
+}
+
+/**
+ * Resolve the functions of a freshly opened plugin and store its name
+ * Closes the handle on failure
  * Returns 0 on success, 1 on failure
  */
-int load_plugin(const char* plugin_name, plugin_handle_t* plugin) {
-    char filename[256];
-    snprintf(filename, sizeof(filename), "./output/%s.so", plugin_name);
-    
-    // Load the shared object
-    plugin->handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
-    if (!plugin->handle) {
-        fprintf(stderr, "Error loading plugin %s: %s\n", plugin_name, dlerror());
-        return 1;
-    }
-    
+int resolve_plugin(const char* plugin_name, plugin_handle_t* plugin) {
     // Clear any existing error
     dlerror();
     
@@ -113,6 +484,16 @@ int load_plugin(const char* plugin_name, plugin_handle_t* plugin) {
         plugin->handle = NULL;
         return 1;
     }
+
+    // Optional functions
+    plugin->configure = (plugin_configure_func_t)dlsym(plugin->handle, "plugin_configure");
+    plugin->get_stat = (plugin_get_stat_func_t)dlsym(plugin->handle, "plugin_get_stat");
+    plugin->transform = (plugin_transform_func_t)dlsym(plugin->handle, "plugin_transform");
+    plugin->get_properties = (plugin_get_properties_func_t)dlsym(plugin->handle, "plugin_get_properties");
+    plugin->abort = (plugin_abort_func_t)dlsym(plugin->handle, "plugin_abort");
+    plugin->flush = (plugin_flush_func_t)dlsym(plugin->handle, "plugin_flush");
+    plugin->get_capabilities = (plugin_get_capabilities_func_t)dlsym(plugin->handle, "plugin_get_capabilities");
+    dlerror();
     
     // Store plugin name
     plugin->name = strdup(plugin_name);
@@ -127,210 +508,1902 @@ int load_plugin(const char* plugin_name, plugin_handle_t* plugin) {
 }
 
 /**
- * Load all plugins
+ * Load a single plugin
+ * Returns 0 on success, 1 on failure
+ */
+int load_plugin(const char* stage_spec, plugin_handle_t* plugin) {
+    char plugin_name[128];
+    size_t name_length = stage_name_length(stage_spec);
+    if (name_length == 0 || name_length >= sizeof(plugin_name)) {
+        fprintf(stderr, "Error: Invalid plugin name '%s'\n", stage_spec);
+        return 1;
+    }
+    memcpy(plugin_name, stage_spec, name_length);
+    plugin_name[name_length] = '\0';
+    plugin->options = stage_spec[name_length] == ':' ? stage_spec + name_length + 1 : NULL;
+
+#ifdef BUILTIN_PLUGINS
+    // Built-in plugins need no dlopen
+    for (size_t i = 0; i < sizeof(builtin_plugins) / sizeof(builtin_plugins[0]); i++) {
+        if (strcmp(builtin_plugins[i].name, plugin_name) == 0) {
+            const char* options = plugin->options;
+            *plugin = builtin_plugins[i].functions;
+            plugin->options = options;
+            plugin->builtin = 1;
+            plugin->name = strdup(plugin_name);
+            if (!plugin->name) {
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                return 1;
+            }
+            return 0;
+        }
+    }
+#endif
+
+    char filename[256];
+    snprintf(filename, sizeof(filename), "./output/%s.so", plugin_name);
+    
+    // Load the shared object
+    plugin->handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if (!plugin->handle) {
+        fprintf(stderr, "Error loading plugin %s: %s\n", plugin_name, dlerror());
+        return 1;
+    }
+    
+    return resolve_plugin(plugin_name, plugin);
+}
+
+// Work item for loading or initializing one plugin on its own thread
+typedef struct {
+    pthread_t thread;
+    plugin_handle_t* plugin;
+    const char* stage_spec;
+    int queue_size;
+    int result;
+    const char* error;
+} plugin_task_t;
+
+/**
+ * Thread body: load one plugin
+ */
+void* load_plugin_task(void* arg) {
+    plugin_task_t* task = (plugin_task_t*)arg;
+    task->result = load_plugin(task->stage_spec, task->plugin);
+    return NULL;
+}
+
+/**
+ * Thread body: initialize one plugin
+ */
+void* init_plugin_task(void* arg) {
+    plugin_task_t* task = (plugin_task_t*)arg;
+    task->error = task->plugin->init(task->queue_size);
+    return NULL;
+}
+
+/**
+ * Thread body: finalize one plugin
+ */
+void* fini_plugin_task(void* arg) {
+    plugin_task_t* task = (plugin_task_t*)arg;
+    task->error = task->plugin->fini ? task->plugin->fini() : NULL;
+    return NULL;
+}
+
+/**
+ * Keep SIGINT and SIGTERM away from the threads the caller starts next,
+ * which inherit its mask; until the handler is installed they end the
+ * process from the main thread. The caller puts back saved afterwards
+ * Returns 0 on success, -1 on failure
+ */
+int block_shutdown_signals(sigset_t* saved) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &set, saved) != 0) {
+        fprintf(stderr, "Error: Failed to block SIGINT and SIGTERM\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Run a task for every plugin in parallel and wait for all of them
+ * A task whose thread cannot be started runs on the calling thread
+ */
+void run_plugin_tasks(plugin_task_t* tasks, int count, void* (*body)(void*)) {
+    // The threads a stage starts in its init inherit the mask of the task thread
+    sigset_t saved;
+    int blocked = block_shutdown_signals(&saved) == 0;
+    for (int i = 0; i < count; i++) {
+        if (pthread_create(&tasks[i].thread, NULL, body, &tasks[i]) != 0) {
+            body(&tasks[i]);
+            tasks[i].thread = pthread_self();
+        }
+    }
+    if (blocked) {
+        pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    }
+    for (int i = 0; i < count; i++) {
+        if (!pthread_equal(tasks[i].thread, pthread_self())) {
+            pthread_join(tasks[i].thread, NULL);
+        }
+    }
+}
+
+/**
+ * Load all plugins in parallel
  * Returns 0 on success, 1 on failure
  */
 int load_plugins(char** plugin_names, int num_plugins) {
-    plugins = calloc(num_plugins, sizeof(plugin_handle_t));
-    if (!plugins) {
+    plugins = calloc((size_t)num_plugins, sizeof(plugin_handle_t));
+    plugin_task_t* tasks = calloc((size_t)num_plugins, sizeof(plugin_task_t));
+    if (!plugins || !tasks) {
         fprintf(stderr, "Error: Memory allocation failed\n");
+        free(plugins);
+        free(tasks);
+        plugins = NULL;
         return 1;
     }
     
     plugin_count = num_plugins;
     
     for (int i = 0; i < num_plugins; i++) {
-        if (load_plugin(plugin_names[i], &plugins[i]) != 0) {
-            // Cleanup already loaded plugins
-            for (int j = 0; j < i; j++) {
-                if (plugins[j].handle) {
-                    dlclose(plugins[j].handle);
-                }
-                free(plugins[j].name);
+        tasks[i].plugin = &plugins[i];
+        tasks[i].stage_spec = plugin_names[i];
+    }
+    run_plugin_tasks(tasks, num_plugins, load_plugin_task);
+
+    int failed = 0;
+    for (int i = 0; i < num_plugins; i++) {
+        failed |= tasks[i].result != 0;
+    }
+    free(tasks);
+
+    if (failed) {
+        // Cleanup the plugins that did load
+        for (int i = 0; i < num_plugins; i++) {
+            if (plugins[i].handle) {
+                dlclose(plugins[i].handle);
             }
-            free(plugins);
-            plugins = NULL;
-            plugin_count = 0;
-            return 1;
+            free(plugins[i].name);
         }
+        free(plugins);
+        plugins = NULL;
+        plugin_count = 0;
+        return 1;
     }
     
     return 0;
 }
 
 /**
- * Initialize all plugins
+ * Pass the command line options of a stage to its plugin
+ * Options are a comma separated list of key=value pairs
  * Returns 0 on success, -1 on failure
  */
-int initialize_plugins(int queue_size) {
-    for (int i = 0; i < plugin_count; i++) {
-        const char* error = plugins[i].init(queue_size);
-        if (error){
-            fprintf(stderr, "Error initializing plugin %s: %s\n", plugins[i].name, error);
+int configure_plugin(plugin_handle_t* plugin) {
+    if (pool_workers > 0 || plugin->isolated) {
+        // The pool (or the worker process) calls the transform; the plugin must not start its own thread
+        const char* error = plugin->configure && plugin->transform
+                          ? plugin->configure("scheduler", "pool") : "No plugin_transform export";
+        if (error) {
+            fprintf(stderr, "Error: Plugin %s cannot run %s: %s\n", plugin->name,
+                    plugin->isolated ? "in a worker process" : "on the worker pool", error);
             return -1;
         }
     }
-    
-    return 0;
-}
+    if (queue_bytes_option) {
+        // The stage's own queue_bytes option replaces the default
+        const char* error = plugin->configure ? plugin->configure("queue_bytes", queue_bytes_option)
+                                              : "Plugin does not accept options";
+        if (error) {
+            fprintf(stderr, "Error configuring plugin %s: %s\n", plugin->name, error);
+            return -1;
+        }
+        consumer_producer_parse_bytes(queue_bytes_option, &plugin->queue_bytes);
+    }
+    if (!plugin->options) {
+        return 0;
+    }
+    if (!plugin->configure) {
+        fprintf(stderr, "Error: Plugin %s does not accept options\n", plugin->name);
+        return -1;
+    }
 
-/**
- * Attach plugins together in a chain
- */
-void attach_plugins(void) {
-    for (int i = 0; i < plugin_count - 1; i++) {
-        plugins[i].attach(plugins[i + 1].place_work);
+    char* options = strdup(plugin->options);
+    if (!options) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -1;
     }
-    // Last plugin is not attached to anything
-}
 
-/**
- * Process input from stdin
- * Returns 0 on success, -1 on failure
- */
-int process_input(void) {
-    char line[1025]; // 1024 characters + null terminator
-    
-    while (fgets(line, sizeof(line), stdin) != NULL) {
-        // Remove trailing newline
-        size_t len = strlen(line);
-        if (len > 0 && line[len - 1] == '\n') {
-            line[len - 1] = '\0';
+    char* saveptr = NULL;
+    for (char* option = strtok_r(options, ",", &saveptr); option; option = strtok_r(NULL, ",", &saveptr)) {
+        char* value = strchr(option, '=');
+        if (!value || value == option) {
+            fprintf(stderr, "Error: Invalid option '%s' for plugin %s\n", option, plugin->name);
+            free(options);
+            return -1;
         }
-        
-        // Send to first plugin with error checking
-        const char* error = plugins[0].place_work(line);
-        if (error != NULL) {
-            fprintf(stderr, "Error processing input '%s': %s\n", line, error);
+        *value++ = '\0';
+
+        const char* error = plugin->configure(option, value);
+        if (error) {
+            fprintf(stderr, "Error configuring plugin %s: %s\n", plugin->name, error);
+            free(options);
             return -1;
         }
-        
-        // Check for termination signal
-        if (strcmp(line, "<END>") == 0) {
-            break;
+
+        if (strcmp(option, "overload") == 0) {
+            plugin->lossy = strcmp(value, "block") != 0;
+            // Validated by the plugin at init
+            if (consumer_producer_parse_policy(value, &plugin->policy, &plugin->sample_rate) != NULL) {
+                plugin->policy = OVERLOAD_BLOCK;
+            }
+        } else if (strcmp(option, "queue_bytes") == 0) {
+            // Validated by the plugin at init
+            if (consumer_producer_parse_bytes(value, &plugin->queue_bytes) != NULL) {
+                plugin->queue_bytes = 0;
+            }
         }
     }
-    
+
+    free(options);
     return 0;
 }
 
 /**
- * Wait for all plugins to finish processing
+ * Pass the command line options of each stage to its plugin
  * Returns 0 on success, -1 on failure
  */
-int wait_for_plugins(void) {
+int configure_plugins(void) {
     for (int i = 0; i < plugin_count; i++) {
-        const char* error = plugins[i].wait_finished();
-        if (error != NULL) {
-            fprintf(stderr, "Error waiting for plugin %s: %s\n", plugins[i].name, error);
+        if (configure_plugin(&plugins[i]) != 0) {
             return -1;
         }
     }
-    
+
     return 0;
 }
 
 /**
- * Clean up all plugins
+ * Mark the stages named in --isolate
+ * Returns 0 on success, -1 on failure
  */
-void cleanup_plugins(void) {
-    if (plugins) {
+int mark_isolated_stages(void) {
+    char* names = strdup(isolate_list);
+    if (!names) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -1;
+    }
+
+    int result = 0;
+    char* saveptr = NULL;
+    for (char* name = strtok_r(names, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+        int found = 0;
         for (int i = 0; i < plugin_count; i++) {
-            if (plugins[i].fini) {
-                const char* error = plugins[i].fini();
-                if (error != NULL) {
-                    fprintf(stderr, "Warning: Error in plugin cleanup for %s: %s\n", 
-                           plugins[i].name ? plugins[i].name : "unknown", error);
-                }
-            }
-            if (plugins[i].handle) {
-                dlclose(plugins[i].handle);
-                plugins[i].handle = NULL;
-            }
-            if (plugins[i].name) {
-                free(plugins[i].name);
-                plugins[i].name = NULL;
+            if (strcmp(plugins[i].name, name) == 0) {
+                plugins[i].isolated = 1;
+                found = 1;
             }
         }
-        free(plugins);
-        plugins = NULL;
+        if (!found) {
+            fprintf(stderr, "Error: No stage named %s to isolate\n", name);
+            result = -1;
+            break;
+        }
     }
-    plugin_count = 0;
+
+    free(names);
+    return result;
 }
 
 /**
- * Check for duplicate plugin names
- * Returns 0 if no duplicates found, 1 if duplicates exist
+ * Fork a worker process for every isolated stage and put its proxy in
+ * place of the plugin; must run before any thread is started
+ * Returns 0 on success, -1 on failure
  */
-int check_duplicate_plugins(char** plugin_names, int num_plugins) {
-    for (int i = 0; i < num_plugins; i++) {
-        for (int j = i + 1; j < num_plugins; j++) {
-            if (strcmp(plugin_names[i], plugin_names[j]) == 0) {
-                fprintf(stderr, "Error: Duplicate plugin '%s' found\n", plugin_names[i]);
-                return 1;
-            }
+int start_isolated_stages(int queue_size) {
+    // Worker processes keep the mask they are forked with
+    sigset_t saved;
+    if (block_shutdown_signals(&saved) != 0) {
+        return -1;
+    }
+    int result = 0;
+    for (int i = 0; i < plugin_count; i++) {
+        plugin_handle_t* plugin = &plugins[i];
+        if (!plugin->isolated) {
+            continue;
         }
+        if (plugin->lossy) {
+            // The shared-memory channel replaces the stage's queue
+            fprintf(stderr, "Error: Stage %s cannot be isolated with a non-blocking overload policy\n", plugin->name);
+            result = -1;
+            break;
+        }
+
+        remote_stage_functions_t proxy;
+        const char* error = remote_stage_start(plugin->name, plugin->init, plugin->transform,
+                                               plugin->flush, plugin->fini, queue_size, &proxy);
+        if (error) {
+            fprintf(stderr, "Error isolating stage %s: %s\n", plugin->name, error);
+            result = -1;
+            break;
+        }
+        plugin->init = proxy.init;
+        plugin->fini = proxy.fini;
+        plugin->place_work = proxy.place_work;
+        plugin->attach = proxy.attach;
+        plugin->wait_finished = proxy.wait_finished;
+        plugin->get_stat = proxy.get_stat;
+        plugin->transform = NULL;
+        plugin->abort = NULL;
+        plugin->get_capabilities = NULL;
     }
-    return 0;
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return result;
 }
 
 /**
- * Main function
+ * Read what an initialized plugin declares about its transform; a
+ * descriptor older than the version known here is ignored
  */
-int main(int argc, char* argv[]) {
-    char** plugin_names;
-    int num_plugins;
-    int queue_size;
-    
-    // Step 1: Parse command line arguments
-    if (argc < 3) {
-        fprintf(stderr, "Error: Insufficient arguments\n");
-        print_usage(argv[0]); 
-        return 1;
+void read_capabilities(plugin_handle_t* plugin) {
+    const plugin_capabilities_t* capabilities = plugin->get_capabilities ? plugin->get_capabilities() : NULL;
+    if (capabilities && capabilities->version < PLUGIN_CAPABILITIES_VERSION) {
+        capabilities = NULL;
     }
+    plugin->capabilities = capabilities;
+}
 
-    queue_size = parse_arguments(argc, argv, &plugin_names, &num_plugins);
-    if (queue_size < 0 || num_plugins < 0) {
-        print_usage(argv[0]);
-        return 1;
+/**
+ * Initialize all plugins
+ * Returns 0 on success, -1 on failure
+ */
+int initialize_plugins(int queue_size) {
+    if (plugin_count <= 0) {
+        return 0;
     }
 
-    if (check_duplicate_plugins(plugin_names, num_plugins) != 0) {
-        print_usage(argv[0]);
-        return 1;
+    plugin_task_t* tasks = calloc((size_t)plugin_count, sizeof(plugin_task_t));
+    if (!tasks) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -1;
     }
-    
-    // Step 2: Load plugin shared objects
-    if (load_plugins(plugin_names, num_plugins) != 0) {
-        cleanup_plugins();
-        print_usage(argv[0]);
-        return 1;
+
+    for (int i = 0; i < plugin_count; i++) {
+        tasks[i].plugin = &plugins[i];
+        tasks[i].queue_size = queue_size;
     }
-    
-    // Step 3: Initialize plugins
-    if (initialize_plugins(queue_size) != 0) {
-        cleanup_plugins();
-        return 2;
+    run_plugin_tasks(tasks, plugin_count, init_plugin_task);
+
+    int result = 0;
+    for (int i = 0; i < plugin_count; i++) {
+        if (tasks[i].error) {
+            fprintf(stderr, "Error initializing plugin %s: %s\n", plugins[i].name, tasks[i].error);
+            result = -1;
+        } else {
+            read_capabilities(&plugins[i]);
+        }
+    }
+    // The stages that did start wait for records until their "<END>"
+    for (int i = 0; result != 0 && pool_workers == 0 && i < plugin_count; i++) {
+        if (!tasks[i].error) {
+            plugins[i].place_work("<END>");
+        }
     }
+    free(tasks);
     
-    // Step 4: Attach plugins together
-    attach_plugins();
+    return result;
+}
+
+/**
+ * Where a stage forwards its output: the next stage, the load generator or
+ * the sink after the last stage, or NULL if the last stage is not attached
+ * to anything
+ */
+plugin_place_work_func_t downstream_of(int index) {
+    if (index + 1 < plugin_count) {
+        return plugins[index + 1].place_work;
+    }
+    if (load_step_count > 0) {
+        return load_generator_complete;
+    }
+    return sink_target ? output_sink_place_work : NULL;
+}
+
+/**
+ * Attach plugins together in a chain
+ */
+void attach_plugins(void) {
+    for (int i = 0; i < plugin_count; i++) {
+        plugin_place_work_func_t downstream = downstream_of(i);
+        if (downstream) {
+            plugins[i].attach(downstream);
+        }
+    }
+}
+
+/**
+ * Output function of the stdin pipeline on the worker pool
+ */
+int pool_sink_output(void* context, const char* item) {
+    (void)context;
+    if (load_step_count > 0) {
+        load_generator_complete(item);
+    } else {
+        output_sink_place_work(item);
+    }
+    return 1;
+}
+
+/**
+ * Start the worker pool; unless serving clients, create the pipeline fed
+ * from stdin, whose last stage feeds the sink if there is one
+ * Returns 0 on success, -1 on failure
+ */
+int start_worker_pool(int queue_size) {
+    pool_stages = calloc((size_t)plugin_count, sizeof(scheduler_stage_t));
+    pool_stage_locks = calloc((size_t)plugin_count, sizeof(pthread_mutex_t));
+    if (!pool_stages || !pool_stage_locks) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -1;
+    }
+    for (int i = 0; i < plugin_count; i++) {
+        const plugin_capabilities_t* capabilities = plugins[i].capabilities;
+        pool_stages[i].transform = plugins[i].transform;
+        pool_stages[i].flush = plugins[i].flush;
+        pool_stages[i].capabilities = capabilities;
+        // Connections and replicas run a stage's transform at the same time unless it is held to one
+        pthread_mutex_init(&pool_stage_locks[i], NULL);
+        if ((listen_path || replica_count > 1) && !(capabilities && (capabilities->flags & PLUGIN_CAP_THREAD_SAFE))) {
+            pool_stages[i].serialize = &pool_stage_locks[i];
+        }
+        pool_stages[i].policy = plugins[i].policy;
+        pool_stages[i].sample_rate = plugins[i].sample_rate;
+        pool_stages[i].max_bytes = plugins[i].queue_bytes;
+    }
+
+    int pipelines = listen_path ? DAEMON_MAX_CLIENTS : replica_count > 0 ? replica_count : 1;
+    const char* error = scheduler_init(pool_workers, plugin_count * pipelines, pool_batch_size);
+    if (!error) {
+        error = scheduler_set_lanes(queue_lanes, queue_lane_policy);
+    }
+    if (!error) {
+        scheduler_set_adaptive(adaptive_enabled);
+        // A replica's worker stays on one CPU, with the replica's data in its caches
+        scheduler_set_affinity(replica_count > 0);
+        sigset_t saved;
+        int blocked = block_shutdown_signals(&saved) == 0;
+        error = blocked ? scheduler_start() : "Failed to block SIGINT and SIGTERM";
+        if (blocked) {
+            pthread_sigmask(SIG_SETMASK, &saved, NULL);
+        }
+    }
+    if (!error && replica_count > 0) {
+        pool_replicas = replicas_create(replica_count, pool_stages, plugin_count, queue_size, shard_field,
+                                        replica_merge, sink_target || load_step_count > 0 ? pool_sink_output : NULL, &error);
+    } else if (!error && !listen_path) {
+        pool_pipeline = scheduler_create_pipeline(pool_stages, plugin_count, queue_size,
+                                                  sink_target || load_step_count > 0 ? pool_sink_output : NULL,
+                                                  NULL, NULL, &error);
+    }
+    if (error) {
+        fprintf(stderr, "Error starting the worker pool: %s\n", error);
+        scheduler_shutdown();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Hand a record to the first stage: the replicas, the pool pipeline or
+ * plugins[0]
+ */
+const char* send_to_first_stage(const char* line) {
+    pthread_mutex_lock(&ingest_lock);
+    const char* error = pool_replicas ? replicas_place_work(pool_replicas, line) :
+                        pool_workers > 0 ? scheduler_place_work(pool_pipeline, line) : plugins[0].place_work(line);
+    pthread_mutex_unlock(&ingest_lock);
+    return error;
+}
+
+/**
+ * Send one input record to the first stage
+ * Returns 1 once "<END>" is sent, 0 for other records, -1 on failure
+ */
+int ingest_record(const char* line) {
+    // No stage may be swapped once the end signal is on its way
+    int is_end = strcmp(line, "<END>") == 0;
+    if (is_end) {
+        pthread_mutex_lock(&swap_lock);
+        input_finished = 1;
+        pthread_mutex_unlock(&swap_lock);
+    }
+
+    // Send to first plugin with error checking
+    const char* error = send_to_first_stage(line);
+    if (error != NULL) {
+        fprintf(stderr, "Error processing input '%s': %s\n", line, error);
+        return -1;
+    }
+    return is_end;
+}
+
+/**
+ * Process varint-framed records from stdin; the end of the input (or a
+ * corrupt record) ends the stream
+ * Returns 0 on success, -1 on failure
+ */
+int process_framed_input(void) {
+    const char* error = NULL;
+    framing_reader_t* reader = framing_reader_create(STDIN_FILENO, &error);
+    if (!reader) {
+        fprintf(stderr, "Error: %s\n", error);
+        return -1;
+    }
+
+    unsigned long long skipped = 0;
+    unsigned long long sentinels = 0;
+    int status = 0;
+    while (status == 0) {
+        const char* record;
+        size_t length;
+        int result = shutdown_signals == 0 ? framing_reader_next(reader, &record, &length, &error) : 0;
+        if (result == 1) {
+            if (memchr(record, '\0', length) != NULL) {
+                // Stages take NUL-terminated strings
+                skipped++;
+                continue;
+            }
+            if (strcmp(record, "<END>") == 0) {
+                // Only the end of the input ends a framed stream
+                sentinels++;
+                continue;
+            }
+            status = ingest_record(record);
+            continue;
+        }
+        if (shutdown_signals > 0) {
+            fprintf(stderr, "[shutdown] Signal received, draining the pipeline\n");
+        } else if (result < 0) {
+            fprintf(stderr, "Error reading framed input: %s; ending the stream\n", error);
+        }
+        status = ingest_record("<END>");
+    }
+    if (skipped > 0) {
+        fprintf(stderr, "[input] skipped %llu framed records containing NUL bytes\n", skipped);
+    }
+    if (sentinels > 0) {
+        fprintf(stderr, "[input] skipped %llu framed records equal to <END>\n", sentinels);
+    }
+
+    framing_reader_destroy(reader);
+    return status < 0 ? -1 : 0;
+}
+
+/**
+ * Process input from stdin
+ * Returns 0 on success, -1 on failure
+ */
+int process_input(void) {
+    if (input_format == RECORD_FORMAT_FRAMED) {
+        return process_framed_input();
+    }
+
+    char line[1025]; // 1024 characters + null terminator
+    
+    while (1) {
+        if (shutdown_signals == 0 && fgets(line, sizeof(line), stdin) != NULL) {
+            // Remove trailing newline
+            size_t len = strlen(line);
+            if (len > 0 && line[len - 1] == '\n') {
+                line[len - 1] = '\0';
+            }
+        } else if (shutdown_signals > 0) {
+            // Stopped by SIGINT/SIGTERM (the read was interrupted): end the stream here
+            fprintf(stderr, "[shutdown] Signal received, draining the pipeline\n");
+            strcpy(line, "<END>");
+        } else {
+            break;
+        }
+        
+        int status = ingest_record(line);
+        if (status < 0) {
+            return -1;
+        }
+        
+        // Check for termination signal
+        if (status > 0) {
+            break;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Load generator: read the records from stdin, offer them to the chain at
+ * each --load rate, then end the stream
+ * Returns 0 on success, 1 if a step failed (the stream still ended), -1 on failure
+ */
+int process_load(void) {
+    char line[1025];
+    unsigned long long ignored = 0;
+    while (shutdown_signals == 0 && fgets(line, sizeof(line), stdin) != NULL) {
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        if (strcmp(line, "<END>") == 0) {
+            break;
+        }
+        if (load_generator_add_record(line) != NULL) {
+            ignored++;
+        }
+    }
+    if (ignored > 0) {
+        fprintf(stderr, "[load] replaying the first %d lines, %llu more ignored\n", LOAD_MAX_RECORDS, ignored);
+    }
+
+    const char* error = shutdown_signals == 0 ?
+        load_generator_run(load_rates, load_step_count, load_arrivals, load_duration_ms, load_stall_ms,
+                           send_to_first_stage, &shutdown_signals) : NULL;
+    if (shutdown_signals > 0) {
+        fprintf(stderr, "[shutdown] Signal received, draining the pipeline\n");
+    }
+    if (error) {
+        fprintf(stderr, "Error: %s\n", error);
+    }
+    if (ingest_record("<END>") < 0) {
+        return -1;
+    }
+    return error ? 1 : 0;
+}
+
+/**
+ * Wait for all plugins to finish processing
+ * Returns 0 on success, -1 on failure
+ */
+int wait_for_plugins(void) {
+    if (pool_workers > 0) {
+        const char* error = pool_replicas ? replicas_wait_finished(pool_replicas) :
+                            scheduler_wait_finished(pool_pipeline);
+        if (error != NULL) {
+            fprintf(stderr, "Error waiting for the worker pool: %s\n", error);
+            return -1;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < plugin_count; i++) {
+        const char* error = plugins[i].wait_finished();
+        if (error != NULL) {
+            fprintf(stderr, "Error waiting for plugin %s: %s\n", plugins[i].name, error);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Forwarding target of a retiring stage: passes its backlog downstream but
+ * swallows its end signal, which only marks the end of the drain
+ */
+const char* swap_forward_drained(const char* str) {
+    if (strcmp(str, "<END>") == 0) {
+        return NULL;
+    }
+    return swap_downstream ? swap_downstream(str) : NULL;
+}
+
+/**
+ * Forwarding target during a swap: keeps a copy of each record until the
+ * retiring stage has drained, so order is preserved. Only a full hold (a
+ * queue's worth of records, as a full stage queue would) makes the sender wait
+ */
+const char* swap_hold_forward(const char* str) {
+    pthread_mutex_lock(&swap_hold_lock);
+    while (!swap_hold_open && swap_held_count >= pipeline_queue_size) {
+        pthread_cond_wait(&swap_hold_cond, &swap_hold_lock);
+    }
+    if (!swap_hold_open) {
+        char* copy = strdup(str);
+        if (copy) {
+            swap_held[swap_held_count++] = copy;
+        }
+        pthread_mutex_unlock(&swap_hold_lock);
+        return copy ? NULL : "Failed to hold record during swap";
+    }
+    pthread_mutex_unlock(&swap_hold_lock);
+
+    return swap_hold_target ? swap_hold_target(str) : NULL;
+}
+
+/**
+ * Start holding the records sent to swap_hold_forward
+ * Returns 0 on success, -1 on failure
+ */
+int swap_hold_begin(plugin_place_work_func_t target) {
+    swap_held = malloc((size_t)pipeline_queue_size * sizeof(char*));
+    if (!swap_held) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -1;
+    }
+    swap_held_count = 0;
+    swap_hold_target = target;
+    swap_hold_open = 0;
+    return 0;
+}
+
+/**
+ * Pass the held records on in order; later ones follow them directly
+ */
+void swap_hold_release(void) {
+    pthread_mutex_lock(&swap_hold_lock);
+    for (int i = 0; i < swap_held_count; i++) {
+        if (swap_hold_target) {
+            swap_hold_target(swap_held[i]);
+        }
+        free(swap_held[i]);
+    }
+    free(swap_held);
+    swap_held = NULL;
+    swap_held_count = 0;
+    swap_hold_open = 1;
+    pthread_cond_broadcast(&swap_hold_cond);
+    pthread_mutex_unlock(&swap_hold_lock);
+}
+
+/**
+ * Point whatever feeds a stage (ingest or the stage before it) at target;
+ * returns once nothing is being sent to the previous target anymore
+ */
+void redirect_upstream(int index, plugin_place_work_func_t target) {
+    if (index == 0) {
+        pthread_mutex_lock(&ingest_lock);
+        plugins[0].place_work = target;
+        pthread_mutex_unlock(&ingest_lock);
+    } else {
+        plugins[index - 1].attach(target);
+    }
+}
+
+/**
+ * Load a private copy of a plugin shared object
+ * The file is copied first so that dlopen maps a fresh instance even when
+ * the same path (or an older version of it) is already loaded
+ * Returns 0 on success, 1 on failure
+ */
+int load_plugin_copy(const char* path, const char* plugin_name, plugin_handle_t* plugin) {
+    char copy_path[] = "./output/.swap-XXXXXX.so";
+    int out = mkstemps(copy_path, 3);
+    if (out < 0) {
+        perror("Error creating plugin copy");
+        return 1;
+    }
+
+    int in = open(path, O_RDONLY);
+    if (in < 0) {
+        fprintf(stderr, "Error opening plugin %s: %s\n", path, strerror(errno));
+        close(out);
+        unlink(copy_path);
+        return 1;
+    }
+
+    char buffer[65536];
+    ssize_t n;
+    int failed = 0;
+    while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+        if (write(out, buffer, n) != n) {
+            failed = 1;
+            break;
+        }
+    }
+    if (n < 0) {
+        failed = 1;
+    }
+    close(in);
+    close(out);
+
+    if (failed) {
+        fprintf(stderr, "Error copying plugin %s\n", path);
+        unlink(copy_path);
+        return 1;
+    }
+
+    // The mapping stays valid after the file is removed
+    plugin->handle = dlopen(copy_path, RTLD_NOW | RTLD_LOCAL);
+    unlink(copy_path);
+    if (!plugin->handle) {
+        fprintf(stderr, "Error loading plugin %s: %s\n", path, dlerror());
+        return 1;
+    }
+
+    return resolve_plugin(plugin_name, plugin);
+}
+
+/**
+ * Replace a running stage with a new instance of its plugin
+ * Upstream is redirected to the new instance at once, the old one drains
+ * its queue downstream and is then finalized and unloaded. Until the drain
+ * is done the new instance's output is held back; the input of a stage
+ * with side effects is held instead, as its transform is itself output.
+ * Returns 0 on success, -1 on failure
+ */
+int swap_plugin(int index, const char* path) {
+    plugin_handle_t* old = &plugins[index];
+    plugin_handle_t replacement = {0};
+
+    if (load_plugin_copy(path, old->name, &replacement) != 0) {
+        return -1;
+    }
+    replacement.options = old->options;
+
+    if (configure_plugin(&replacement) != 0) {
+        if (replacement.fini) {
+            replacement.fini();
+        }
+        dlclose(replacement.handle);
+        free(replacement.name);
+        return -1;
+    }
+
+    const char* error = replacement.init(pipeline_queue_size);
+    if (error) {
+        fprintf(stderr, "Error initializing plugin %s: %s\n", replacement.name, error);
+        replacement.fini();
+        dlclose(replacement.handle);
+        free(replacement.name);
+        return -1;
+    }
+    read_capabilities(&replacement);
+
+    plugin_place_work_func_t downstream = downstream_of(index);
+    const plugin_capabilities_t* capabilities = replacement.capabilities;
+    int hold_input = capabilities && (capabilities->flags & PLUGIN_CAP_SIDE_EFFECTS);
+    int hold_output = !hold_input && downstream;
+    if ((hold_input || hold_output) && swap_hold_begin(hold_input ? replacement.place_work : downstream) != 0) {
+        replacement.fini();
+        dlclose(replacement.handle);
+        free(replacement.name);
+        return -1;
+    }
+    if (hold_output) {
+        replacement.attach(swap_hold_forward);
+    } else if (downstream) {
+        replacement.attach(downstream);
+    }
+
+    // The old stage keeps forwarding its backlog but not its end signal
+    swap_downstream = downstream;
+    old->attach(swap_forward_drained);
+
+    // Once nothing is sent to the old stage anymore, its end signal follows its last record
+    plugin_place_work_func_t retiring = old->place_work;
+    redirect_upstream(index, hold_input ? swap_hold_forward : replacement.place_work);
+    retiring("<END>");
+    error = old->wait_finished();
+
+    if (hold_input || hold_output) {
+        swap_hold_release();
+    }
+    if (hold_input) {
+        redirect_upstream(index, replacement.place_work);
+    } else if (hold_output) {
+        replacement.attach(downstream);
+    }
+
+    if (error) {
+        fprintf(stderr, "Warning: Error draining plugin %s: %s\n", old->name, error);
+    }
+
+    error = old->fini();
+    if (error) {
+        fprintf(stderr, "Warning: Error in plugin cleanup for %s: %s\n", old->name, error);
+    }
+    if (old->handle) {
+        dlclose(old->handle);
+    }
+    free(old->name);
+
+    replacement.lossy = old->lossy;
+    *old = replacement;
+
+    return 0;
+}
+
+/**
+ * Read the swap control file and perform the requested swap
+ * Format: "<plugin> [<path to .so>]", the path defaults to ./output/<plugin>.so
+ */
+void handle_swap_request(void) {
+    FILE* control = fopen(swap_control_path, "r");
+    if (!control) {
+        fprintf(stderr, "Error: Cannot open swap control file %s\n", swap_control_path);
+        return;
+    }
+
+    char name[128];
+    char path[256] = "";
+    int fields = fscanf(control, "%127s %255s", name, path);
+    fclose(control);
+    if (fields < 1) {
+        fprintf(stderr, "Error: Swap control file %s is empty\n", swap_control_path);
+        return;
+    }
+    if (fields < 2) {
+        snprintf(path, sizeof(path), "./output/%s.so", name);
+    }
+
+    pthread_mutex_lock(&swap_lock);
+    if (input_finished) {
+        pthread_mutex_unlock(&swap_lock);
+        fprintf(stderr, "Error: Pipeline is shutting down, swap of %s ignored\n", name);
+        return;
+    }
+
+    int index = -1;
+    for (int i = 0; i < plugin_count; i++) {
+        if (strcmp(plugins[i].name, name) == 0) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index < 0) {
+        fprintf(stderr, "Error: No stage named %s to swap\n", name);
+    } else if (plugins[index].isolated) {
+        fprintf(stderr, "Error: Stage %s runs in a worker process and cannot be swapped\n", name);
+    } else if (swap_plugin(index, path) == 0) {
+        fprintf(stderr, "[swap] %s replaced by %s\n", name, path);
+    }
+    pthread_mutex_unlock(&swap_lock);
+}
+
+/**
+ * Control thread: performs a swap on every SIGHUP
+ */
+void* swap_control_thread(void* arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+
+    while (1) {
+        int signal_number;
+        if (sigwait(&set, &signal_number) != 0 || swap_shutdown) {
+            break;
+        }
+        handle_swap_request();
+    }
+
+    return NULL;
+}
+
+/**
+ * Route SIGHUP to the swap control thread
+ * Must run before plugins start their threads so they inherit the mask
+ * Returns 0 on success, -1 on failure
+ */
+int block_swap_signal(void) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to block SIGHUP\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Start the swap control thread
+ * Returns 0 on success, -1 on failure
+ */
+int start_swap_control(void) {
+    sigset_t saved;
+    if (block_shutdown_signals(&saved) != 0) {
+        return -1;
+    }
+    int started = pthread_create(&swap_thread, NULL, swap_control_thread, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (!started) {
+        fprintf(stderr, "Error: Failed to start swap control thread\n");
+        return -1;
+    }
+    swap_thread_running = 1;
+    return 0;
+}
+
+/**
+ * Stop the swap control thread, letting a swap in progress complete
+ */
+void stop_swap_control(void) {
+    if (!swap_thread_running) {
+        return;
+    }
+    swap_shutdown = 1;
+    pthread_kill(swap_thread, SIGHUP);
+    pthread_join(swap_thread, NULL);
+    swap_thread_running = 0;
+}
+
+/**
+ * Milliseconds elapsed since a start time
+ */
+double elapsed_ms(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * Print how long loading, initializing and attaching the stages took
+ */
+void report_startup(const struct timespec* start) {
+    int builtin = 0;
+    for (int i = 0; i < plugin_count; i++) {
+        builtin += plugins[i].builtin;
+    }
+    fprintf(stderr, "[startup] %d stages (%d built-in, %d loaded) ready in %.3f ms\n",
+            plugin_count, builtin, plugin_count - builtin, elapsed_ms(start));
+
+    for (int i = 0; i < plugin_count; i++) {
+        const plugin_capabilities_t* capabilities = plugins[i].capabilities;
+        if (!capabilities) {
+            fprintf(stderr, "[startup] %s: no capabilities\n", plugins[i].name);
+            continue;
+        }
+        fprintf(stderr, "[startup] %s:%s%s%s%s%s%s", plugins[i].name,
+                capabilities->flags & PLUGIN_CAP_IN_PLACE ? " in-place" : "",
+                capabilities->flags & PLUGIN_CAP_MEMOIZABLE ? " memoizable" : "",
+                capabilities->flags & PLUGIN_CAP_THREAD_SAFE ? " thread-safe" : "",
+                capabilities->flags & PLUGIN_CAP_SIDE_EFFECTS ? " side-effects" : "",
+                capabilities->flags & PLUGIN_CAP_STATEFUL ? " stateful" : "",
+                capabilities->flags & PLUGIN_CAP_FILTER ? " filter" : "");
+        if (capabilities->output_factor > 0) {
+            fprintf(stderr, " output<=%zux+%zu", capabilities->output_factor, capabilities->output_extra);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+/**
+ * On the worker pool, items queue (and are dropped) in the scheduler: replace
+ * a stage's queue counter with the scheduler's, summed over the replicas
+ */
+void pool_stage_stat(int index, const char* stat_name, unsigned long long* value) {
+    int pipelines = pool_replicas ? replicas_count(pool_replicas) : 1;
+    int known = 1;
+    unsigned long long total = 0;
+    for (int r = 0; r < pipelines && known; r++) {
+        scheduler_pipeline_t* pipeline = pool_replicas ? replicas_pipeline(pool_replicas, r) : pool_pipeline;
+        if (strcmp(stat_name, "dropped") == 0) {
+            total += scheduler_dropped(pipeline, index);
+        } else if (strcmp(stat_name, "spilled") == 0) {
+            total += scheduler_spilled(pipeline, index);
+        } else if (strcmp(stat_name, "queued_bytes") == 0) {
+            total += scheduler_queued_bytes(pipeline, index);
+        } else if (strcmp(stat_name, "peak_bytes") == 0) {
+            size_t peak = scheduler_peak_bytes(pipeline, index);
+            total = peak > total ? peak : total;
+        } else {
+            known = 0;
+        }
+    }
+    if (known) {
+        *value = total;
+    }
+}
+
+/**
+ * Print the counters of every stage with a non-blocking overload policy to stderr
+ * (of every stage with --stats)
+ */
+void report_plugin_stats(void) {
+    for (int i = 0; i < plugin_count; i++) {
+        if ((!stats_enabled && !plugins[i].lossy) || !plugins[i].get_stat) {
+            continue;
+        }
+
+        fprintf(stderr, "[stats] %s:", plugins[i].name);
+        unsigned long long value;
+        const char* stat_name;
+        for (int j = 0; (stat_name = plugins[i].get_stat(j, &value)) != NULL; j++) {
+            if (pool_workers > 0) {
+                pool_stage_stat(i, stat_name, &value);
+            }
+            fprintf(stderr, " %s=%llu", stat_name, value);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (!stats_enabled || !pool_pipeline || queue_lanes <= 1) {
+        return;
+    }
+    for (int i = 0; i < plugin_count; i++) {
+        for (int lane = 0; lane < queue_lanes; lane++) {
+            consumer_producer_lane_stats_t lane_stats;
+            if (scheduler_lane_stats(pool_pipeline, i, lane, &lane_stats) == NULL) {
+                fprintf(stderr, "[stats] %s lane %d: served=%lu max_depth=%d avg_wait_us=%.0f\n",
+                        plugins[i].name, lane, lane_stats.served, lane_stats.max_depth,
+                        lane_stats.average_wait_us);
+            }
+        }
+    }
+}
+
+/**
+ * SIGINT/SIGTERM: the first one ends the input, another one cuts the drain short
+ */
+void handle_shutdown_signal(int signal_number) {
+    (void)signal_number;
+    shutdown_signals = shutdown_signals + 1;
+}
+
+/**
+ * Handle SIGINT and SIGTERM on the input thread, the only one that does
+ * not block them; a blocked read is interrupted rather than restarted
+ * Returns 0 on success, -1 on failure
+ */
+int install_shutdown_handler(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_shutdown_signal;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGINT, &action, NULL) != 0 || sigaction(SIGTERM, &action, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to install the SIGINT/SIGTERM handler\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Thread body: wait for the pipeline to drain
+ */
+void* drain_task(void* arg) {
+    (void)arg;
+    int result = wait_for_plugins();
+    pthread_mutex_lock(&drain_lock);
+    drain_result = result;
+    drain_done = 1;
+    pthread_cond_signal(&drain_cond);
+    pthread_mutex_unlock(&drain_lock);
+    return NULL;
+}
+
+/**
+ * Check whether every stage can be stopped without draining it
+ */
+int pipeline_abortable(void) {
+    if (pool_workers > 0) {
+        return 1;
+    }
+    for (int i = 0; i < plugin_count; i++) {
+        if (!plugins[i].abort) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Stop the pipeline without draining it and report what each stage still had queued
+ */
+void abort_pipeline(const char* reason) {
+    fprintf(stderr, "[shutdown] %s, discarding queued items\n", reason);
+
+    unsigned long long* queued = calloc((size_t)plugin_count, sizeof(unsigned long long));
+    if (pool_replicas) {
+        replicas_abort(pool_replicas, queued);
+    } else if (pool_workers > 0) {
+        scheduler_abort_pipeline(pool_pipeline, queued);
+    } else {
+        // Last stage first, so a stage blocked forwarding into a full queue is released
+        for (int i = plugin_count - 1; i >= 0; i--) {
+            unsigned long long discarded = 0;
+            const char* error = plugins[i].abort(&discarded);
+            if (error) {
+                fprintf(stderr, "Warning: Error aborting plugin %s: %s\n", plugins[i].name, error);
+            }
+            if (queued) {
+                queued[i] = discarded;
+            }
+        }
+    }
+
+    for (int i = 0; i < plugin_count && queued; i++) {
+        fprintf(stderr, "[shutdown] %s: queued=%llu\n", plugins[i].name, queued[i]);
+    }
+    free(queued);
+}
+
+/**
+ * Wait for the pipeline to drain after the end of input was sent, for at
+ * most --drain-timeout; a signal during the drain cuts it short
+ * Returns 0 on success, -1 on failure
+ */
+int drain_pipeline(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, drain_task, NULL) != 0) {
+        return wait_for_plugins();
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sig_atomic_t signals = shutdown_signals;
+    int stopping = 0;
+
+    pthread_mutex_lock(&drain_lock);
+    while (!drain_done) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += DRAIN_POLL_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&drain_cond, &drain_lock, &until);
+        if (drain_done || stopping) {
+            continue;
+        }
+
+        char reason[64];
+        if (shutdown_signals > signals) {
+            snprintf(reason, sizeof(reason), "Signal received during the drain");
+        } else if (drain_timeout_ms >= 0 && elapsed_ms(&start) >= (double)drain_timeout_ms) {
+            snprintf(reason, sizeof(reason), "Drain deadline of %ld ms passed", drain_timeout_ms);
+        } else {
+            continue;
+        }
+
+        stopping = 1;
+        if (!pipeline_abortable()) {
+            fprintf(stderr, "[shutdown] %s, but a stage cannot be aborted; still draining\n", reason);
+            continue;
+        }
+        pthread_mutex_unlock(&drain_lock);
+        abort_pipeline(reason);
+        pthread_mutex_lock(&drain_lock);
+    }
+    int result = drain_result;
+    pthread_mutex_unlock(&drain_lock);
+
+    pthread_join(thread, NULL);
+    return result;
+}
+
+/**
+ * End the stages of a chain that was initialized but never attached, so that
+ * cleanup_plugins can join their consumer threads; each stops at its own "<END>"
+ */
+void end_unattached_stages(void) {
+    for (int i = 0; pool_workers == 0 && i < plugin_count; i++) {
+        plugins[i].place_work("<END>");
+    }
+}
+
+/**
+ * Clean up all plugins
+ */
+void cleanup_plugins(void) {
+    // Workers may still hold the transforms of the plugins
+    scheduler_shutdown();
+    scheduler_destroy_pipeline(pool_pipeline);
+    pool_pipeline = NULL;
+    replicas_destroy(pool_replicas);
+    pool_replicas = NULL;
+    free(pool_stages);
+    pool_stages = NULL;
+    // Plain mutexes hold no resources; nothing uses them once the workers are gone
+    free(pool_stage_locks);
+    pool_stage_locks = NULL;
+
+    if (plugins) {
+        // Every stage has drained or was aborted, none forwards anymore: finalize them all at once
+        plugin_task_t* tasks = calloc((size_t)plugin_count, sizeof(plugin_task_t));
+        for (int i = 0; i < plugin_count && tasks; i++) {
+            tasks[i].plugin = &plugins[i];
+        }
+        if (tasks) {
+            run_plugin_tasks(tasks, plugin_count, fini_plugin_task);
+        }
+
+        for (int i = 0; i < plugin_count; i++) {
+            const char* error = tasks ? tasks[i].error : plugins[i].fini ? plugins[i].fini() : NULL;
+            if (error != NULL) {
+                fprintf(stderr, "Warning: Error in plugin cleanup for %s: %s\n", 
+                       plugins[i].name ? plugins[i].name : "unknown", error);
+            }
+            if (plugins[i].handle) {
+                dlclose(plugins[i].handle);
+                plugins[i].handle = NULL;
+            }
+            if (plugins[i].name) {
+                free(plugins[i].name);
+                plugins[i].name = NULL;
+            }
+        }
+        free(tasks);
+        free(plugins);
+        plugins = NULL;
+    }
+    plugin_count = 0;
+
+    // Stage options point into the rewritten chain
+    for (int i = 0; i < chain_plan_count; i++) {
+        free(chain_plan[i]);
+    }
+    free(chain_plan);
+    chain_plan = NULL;
+    chain_plan_count = 0;
+    // No stage completes records into the load generator anymore
+    load_generator_destroy();
+}
+
+// One stage of the chain as the optimizer sees it
+typedef struct {
+    const char* spec;                  // Stage specification from the command line
+    char name[128];
+    unsigned properties;               // Declared by the plugin; 0 makes the stage a barrier
+    long shift;                        // View of a PLUGIN_PROPERTY_ROTATION stage: reverse first
+    int reversed;                      // if reversed, then rotate right by shift
+    int rewritten;                     // Rotations and reversals were folded in; spec is out of date
+} chain_stage_t;
+
+/**
+ * Check whether a stage is named in --isolate
+ */
+int stage_is_isolated(const char* name) {
+    size_t length = strlen(name);
+    for (const char* entry = isolate_list; entry && *entry != '\0';) {
+        size_t entry_length = strcspn(entry, ",");
+        if (entry_length == length && strncmp(entry, name, length) == 0) {
+            return 1;
+        }
+        entry += entry_length;
+        entry += *entry == ',';
+    }
+    return 0;
+}
+
+/**
+ * Read the shift and reverse options of a rotation stage into its view
+ * Returns 0 if those are its only options and they are valid, -1 otherwise
+ */
+int parse_rotation_options(const char* options, chain_stage_t* stage) {
+    for (const char* option = options; *option != '\0';) {
+        size_t length = strcspn(option, ",");
+        char* endptr;
+        if (strncmp(option, "shift=", 6) == 0 && length > 6) {
+            stage->shift = strtol(option + 6, &endptr, 10);
+            if (endptr != option + length || labs(stage->shift) > CHAIN_MAX_SHIFT) {
+                return -1;
+            }
+        } else if (length == 9 && (strncmp(option, "reverse=0", 9) == 0 || strncmp(option, "reverse=1", 9) == 0)) {
+            stage->reversed = option[8] == '1';
+        } else {
+            return -1;
+        }
+        option += length;
+        option += *option == ',';
+    }
+    return 0;
+}
+
+/**
+ * Read the properties a stage's plugin declares, without initializing it
+ * Stages with options (other than a rotation's shift and reverse) and
+ * isolated stages are barriers
+ * Returns 0 on success, 1 on failure
+ */
+int probe_chain_stage(const char* spec, chain_stage_t* stage) {
+    plugin_handle_t probe;
+    memset(&probe, 0, sizeof(probe));
+    if (load_plugin(spec, &probe) != 0) {
+        return 1;
+    }
+
+    stage->spec = spec;
+    snprintf(stage->name, sizeof(stage->name), "%s", probe.name);
+    stage->properties = probe.get_properties ? probe.get_properties() : 0;
+    stage->shift = 1;
+    stage->reversed = 0;
+    stage->rewritten = 0;
+    if (probe.handle) {
+        dlclose(probe.handle);
+    }
+    free(probe.name);
+
+    if (!(stage->properties & PLUGIN_PROPERTY_PURE) || stage_is_isolated(stage->name)) {
+        stage->properties = 0;
+    } else if (probe.options && (!(stage->properties & PLUGIN_PROPERTY_ROTATION) ||
+                                 parse_rotation_options(probe.options, stage) != 0)) {
+        // Invalid rotation options are left for the plugin to reject
+        stage->properties = 0;
+    }
+    return 0;
+}
+
+/**
+ * Fold the stage after a rotation stage into the rotation's view; the view
+ * (reverse first, then rotate right by shift) is closed under both:
+ * rotating by j adds j to the shift, reversing flips the flag and negates it
+ * Returns 1 if the stage was folded in, 0 if the shift would be out of range
+ */
+int fold_into_view(chain_stage_t* view, const chain_stage_t* next) {
+    long shift = view->shift;
+    int reversed = view->reversed;
+    if (next->properties & PLUGIN_PROPERTY_ROTATION) {
+        // Reverse, rotate by k, then reverse and rotate by j: rotate by j - k from the unreversed input
+        shift = next->reversed ? next->shift - shift : shift + next->shift;
+        reversed ^= next->reversed;
+    } else {
+        shift = -shift;
+        reversed ^= 1;
+    }
+    if (labs(shift) > CHAIN_MAX_SHIFT) {
+        return 0;
+    }
+    view->shift = shift;
+    view->reversed = reversed;
+    view->rewritten = 1;
+    return 1;
+}
+
+/**
+ * Rewrite adjacent pure stages until no rule applies:
+ * a CHARWISE stage moves ahead of a POSITIONAL one (which never removes
+ * characters, so it sees as many or fewer), a repeated IDEMPOTENT stage runs
+ * once, a repeated INVOLUTION cancels out, and rotations and reversals fold
+ * into one rotation stage that materializes them in a single copy
+ * Returns the new stage count; the chain never becomes empty
+ */
+int rewrite_chain(chain_stage_t* stages, int count) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < count && !changed; i++) {
+            chain_stage_t* first = &stages[i];
+            if ((first->properties & PLUGIN_PROPERTY_ROTATION) && first->shift == 0 && !first->reversed &&
+                count > 1) {
+                // The identity
+                memmove(first, first + 1, (size_t)(count - i - 1) * sizeof(chain_stage_t));
+                count--;
+                changed = 1;
+                break;
+            }
+            if (i + 1 == count) {
+                break;
+            }
+
+            chain_stage_t* second = &stages[i + 1];
+            unsigned both = first->properties & second->properties;
+            unsigned either = first->properties | second->properties;
+            if (!(both & PLUGIN_PROPERTY_PURE)) {
+                continue;
+            }
+
+            int removed = 0;
+            if (strcmp(first->name, second->name) == 0 && (both & PLUGIN_PROPERTY_INVOLUTION) && count > 2) {
+                removed = 2;
+            } else if (strcmp(first->name, second->name) == 0 && (both & PLUGIN_PROPERTY_IDEMPOTENT)) {
+                removed = 1;
+            } else if ((either & PLUGIN_PROPERTY_ROTATION) &&
+                       (first->properties & (PLUGIN_PROPERTY_ROTATION | PLUGIN_PROPERTY_REVERSAL)) &&
+                       (second->properties & (PLUGIN_PROPERTY_ROTATION | PLUGIN_PROPERTY_REVERSAL))) {
+                if (!(first->properties & PLUGIN_PROPERTY_ROTATION)) {
+                    // A reversal followed by a rotation: the view reverses first anyway
+                    *first = *second;
+                    first->reversed ^= 1;
+                    first->rewritten = 1;
+                    removed = 1;
+                } else if (fold_into_view(first, second)) {
+                    removed = 1;
+                }
+            }
+
+            if (removed) {
+                memmove(&stages[i + 2 - removed], &stages[i + 2], (size_t)(count - i - 2) * sizeof(chain_stage_t));
+                count -= removed;
+                changed = 1;
+            } else if ((second->properties & PLUGIN_PROPERTY_CHARWISE) &&
+                       (first->properties & PLUGIN_PROPERTY_POSITIONAL) &&
+                       !(first->properties & PLUGIN_PROPERTY_CHARWISE)) {
+                chain_stage_t swapped = *first;
+                *first = *second;
+                *second = swapped;
+                changed = 1;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * Replace the stage specifications with an equivalent, cheaper chain (--optimize)
+ * Runs before anything is initialized; the plugins are only opened to read
+ * their properties
+ * Returns 0 on success, 1 on failure
+ */
+int optimize_chain(char*** plugin_names, int* num_plugins) {
+    int count = *num_plugins;
+    chain_stage_t* stages = calloc((size_t)count, sizeof(chain_stage_t));
+    if (!stages) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (probe_chain_stage((*plugin_names)[i], &stages[i]) != 0) {
+            free(stages);
+            return 1;
+        }
+    }
+
+    int optimized = rewrite_chain(stages, count);
+    chain_plan = calloc((size_t)optimized, sizeof(char*));
+    if (!chain_plan) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        free(stages);
+        return 1;
+    }
+    chain_plan_count = optimized;
+    for (int i = 0; i < optimized; i++) {
+        if (stages[i].rewritten) {
+            size_t size = strlen(stages[i].name) + sizeof(":shift=,reverse=1") + 20;
+            chain_plan[i] = malloc(size);
+            if (chain_plan[i]) {
+                snprintf(chain_plan[i], size, "%s:shift=%ld%s", stages[i].name, stages[i].shift,
+                         stages[i].reversed ? ",reverse=1" : "");
+            }
+        } else {
+            chain_plan[i] = strdup(stages[i].spec);
+        }
+        if (!chain_plan[i]) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            free(stages);
+            return 1;
+        }
+    }
+    free(stages);
+
+    if (stats_enabled) {
+        fprintf(stderr, "[optimize] %d stages rewritten to %d:", count, optimized);
+        for (int i = 0; i < optimized; i++) {
+            fprintf(stderr, " %s", chain_plan[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    *plugin_names = chain_plan;
+    *num_plugins = optimized;
+    return 0;
+}
+
+/**
+ * Check for duplicate plugin names
+ * Returns 0 if no duplicates found, 1 if duplicates exist
+ */
+int check_duplicate_plugins(char** plugin_names, int num_plugins) {
+    for (int i = 0; i < num_plugins; i++) {
+        size_t length = stage_name_length(plugin_names[i]);
+        for (int j = i + 1; j < num_plugins; j++) {
+            if (stage_name_length(plugin_names[j]) == length &&
+                strncmp(plugin_names[i], plugin_names[j], length) == 0) {
+                fprintf(stderr, "Error: Duplicate plugin '%.*s' found\n", (int)length, plugin_names[i]);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Main function
+ */
+int main(int argc, char* argv[]) {
+    char** plugin_names;
+    int num_plugins;
+    int queue_size;
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    
+    // Step 1: Parse command line arguments
+    int arg_index = parse_options(argc, argv);
+    if (arg_index < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (connect_path) {
+        if (arg_index < argc || input_format == RECORD_FORMAT_FRAMED) {
+            fprintf(stderr, "Error: --connect takes no other arguments\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        const char* error = daemon_client_run(connect_path);
+        if (error) {
+            fprintf(stderr, "Error: %s\n", error);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc - arg_index < 2) {
+        fprintf(stderr, "Error: Insufficient arguments\n");
+        print_usage(argv[0]); 
+        return 1;
+    }
+
+    queue_size = parse_arguments(argc - arg_index + 1, argv + arg_index - 1, &plugin_names, &num_plugins);
+    if (queue_size < 0 || num_plugins < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (optimize_enabled && optimize_chain(&plugin_names, &num_plugins) != 0) {
+        cleanup_plugins();
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (check_duplicate_plugins(plugin_names, num_plugins) != 0) {
+        cleanup_plugins();
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    pipeline_queue_size = queue_size;
+    if (swap_control_path && (pool_workers > 0 || listen_path)) {
+        fprintf(stderr, "Error: --swap-file cannot be combined with --workers or --listen\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (queue_lanes > 1 && pool_workers == 0 && !listen_path) {
+        // Thread-per-stage queues live inside the plugins, and the plugin ABI carries no lane
+        fprintf(stderr, "Error: --lanes needs --workers or --listen\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (isolate_list && (pool_workers > 0 || listen_path)) {
+        fprintf(stderr, "Error: --isolate cannot be combined with --workers or --listen\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (isolate_list && input_format == RECORD_FORMAT_FRAMED) {
+        // Worker channels are sized for input lines, framed records go up to FRAMING_MAX_RECORD
+        fprintf(stderr, "Error: --isolate cannot be combined with --input-format=framed\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (adaptive_enabled && pool_workers == 0 && replica_count == 0 && !listen_path) {
+        // Thread-per-stage consumer loops live inside the plugins; only the pool can regroup stages
+        fprintf(stderr, "Error: --adaptive needs --workers, --replicas or --listen\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if ((shard_key_given || replica_merge_given) && replica_count == 0) {
+        fprintf(stderr, "Error: --shard-key and --merge need --replicas\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (replica_count > 0) {
+        if (listen_path || swap_control_path || isolate_list || queue_lanes > 1) {
+            fprintf(stderr, "Error: --replicas cannot be combined with --listen, --swap-file, --isolate or --lanes\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (replica_merge == REPLICA_MERGE_INPUT && !sink_target) {
+            // Without a sink the results are whatever the stages print, in the order they run
+            fprintf(stderr, "Error: --merge=input needs --sink\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (pool_workers > replica_count) {
+            // Every stage of a replica runs on its home worker, the others would never get work
+            fprintf(stderr, "Error: --workers cannot exceed --replicas\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (pool_workers == 0) {
+            pool_workers = replica_count;
+        }
+    }
+    if (load_option_given && load_step_count == 0) {
+        fprintf(stderr, "Error: --arrivals, --load-duration and --load-stall need --load\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (load_step_count > 0) {
+        // Records are matched to their send times in order, so none may be reordered
+        if (listen_path || queue_lanes > 1 || input_format == RECORD_FORMAT_FRAMED) {
+            fprintf(stderr, "Error: --load cannot be combined with --listen, --lanes or --input-format\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (replica_count > 0 && replica_merge != REPLICA_MERGE_INPUT) {
+            fprintf(stderr, "Error: --load with --replicas needs --merge=input\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        load_generator_set_downstream(sink_target ? output_sink_place_work : NULL);
+    }
+    if (input_format == RECORD_FORMAT_FRAMED && listen_path) {
+        fprintf(stderr, "Error: --input-format cannot be combined with --listen\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (sink_format == RECORD_FORMAT_FRAMED && !sink_target) {
+        fprintf(stderr, "Error: --sink-format needs --sink\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (listen_path) {
+        if (sink_target) {
+            fprintf(stderr, "Error: --sink cannot be combined with --listen\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (pool_workers == 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            pool_workers = cpus > 0 ? (int)cpus : 1;
+        }
+        const char* error = daemon_block_signals();
+        if (error) {
+            fprintf(stderr, "Error: %s\n", error);
+            return 1;
+        }
+    }
+    if (listen_path && drain_timeout_ms >= 0) {
+        fprintf(stderr, "Error: --drain-timeout cannot be combined with --listen\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (swap_control_path && block_swap_signal() != 0) {
+        return 1;
+    }
+    
+    // Step 2: Load plugin shared objects
+    if (load_plugins(plugin_names, num_plugins) != 0) {
+        cleanup_plugins();
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    // Step 3: Configure and initialize plugins
+    if ((isolate_list && mark_isolated_stages() != 0) || configure_plugins() != 0) {
+        cleanup_plugins();
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < plugin_count && load_step_count > 0; i++) {
+        if (plugins[i].policy != OVERLOAD_BLOCK && plugins[i].policy != OVERLOAD_SPILL) {
+            fprintf(stderr, "Error: --load needs every stage to keep its records (stage %s drops them when full)\n",
+                    plugins[i].name);
+            cleanup_plugins();
+            return 1;
+        }
+    }
+
+    if (start_isolated_stages(queue_size) != 0) {
+        cleanup_plugins();
+        return 2;
+    }
+
+    if (initialize_plugins(queue_size) != 0) {
+        cleanup_plugins();
+        return 2;
+    }
+
+    // Every connection runs the one instance of each stage; replicas are one stream
+    // and flush such a stage once all of them are done
+    for (int i = 0; listen_path && i < plugin_count; i++) {
+        const plugin_capabilities_t* capabilities = plugins[i].capabilities;
+        if (capabilities && (capabilities->flags & PLUGIN_CAP_STATEFUL)) {
+            fprintf(stderr, "Error: --listen cannot share stage %s between connections, it keeps state across records\n",
+                    plugins[i].name);
+            cleanup_plugins();
+            return 1;
+        }
+    }
+
+    // Load steps match each output to the oldest record sent
+    for (int i = 0; i < plugin_count && load_step_count > 0; i++) {
+        const plugin_capabilities_t* capabilities = plugins[i].capabilities;
+        if (capabilities && (capabilities->flags & (PLUGIN_CAP_FILTER | PLUGIN_CAP_STATEFUL))) {
+            fprintf(stderr, "Error: --load needs every stage to pass each record on (stage %s filters or aggregates them)\n",
+                    plugins[i].name);
+            end_unattached_stages();
+            cleanup_plugins();
+            return 1;
+        }
+    }
+    
+    // Step 4: Open the sink and attach plugins together
+    if (sink_target) {
+        const char* error = output_sink_open(sink_target, sink_delimiter, sink_format, sink_flush_policy);
+        if (error) {
+            fprintf(stderr, "Error opening sink %s: %s\n", sink_target, error);
+            end_unattached_stages();
+            cleanup_plugins();
+            return 2;
+        }
+    }
+    if (pool_workers > 0) {
+        if (start_worker_pool(queue_size) != 0) {
+            output_sink_close();
+            cleanup_plugins();
+            return 2;
+        }
+    } else {
+        attach_plugins();
+    }
+    if (stats_enabled) {
+        report_startup(&start_time);
+    }
+
+    if (swap_control_path && start_swap_control() != 0) {
+        cleanup_plugins();
+        return 2;
+    }
+
+    // Daemon: serve clients until stopped instead of reading stdin
+    if (listen_path) {
+        const char* error = daemon_run(listen_path, pool_stages, plugin_count, queue_size);
+        if (error) {
+            fprintf(stderr, "Error: %s\n", error);
+            cleanup_plugins();
+            return 2;
+        }
+        if (stats_enabled) {
+            daemon_report();
+            scheduler_report();
+        }
+        cleanup_plugins();
+        printf("Pipeline shutdown complete\n");
+        return 0;
+    }
     
     // Step 5: Read input from STDIN
-    if (process_input() != 0) {
+    if (install_shutdown_handler() != 0) {
+        stop_swap_control();
+        cleanup_plugins();
+        return 2;
+    }
+    int input_status = load_step_count > 0 ? process_load() : process_input();
+    if (input_status < 0) {
+        stop_swap_control();
         cleanup_plugins();
     }
     
     // Step 6: Wait for plugins to finish
-    if (wait_for_plugins() != 0) {
+    stop_swap_control();
+    if (drain_pipeline() != 0) {
         cleanup_plugins();
     }
     
-    // Step 7: Cleanup
+    // Step 7: Report counters and cleanup
+    int sink_on_stdout = output_sink_uses_stdout();
+    output_sink_close();
+    report_plugin_stats();
+    if (stats_enabled && sink_target) {
+        output_sink_report();
+    }
+    if (stats_enabled && pool_workers > 0) {
+        replicas_report(pool_replicas);
+        scheduler_report();
+    }
     cleanup_plugins();
     
-    // Step 8: Finalize
-    printf("Pipeline shutdown complete\n");
+    // Step 8: Finalize (kept out of the records when they go to stdout)
+    fprintf(sink_on_stdout ? stderr : stdout, "Pipeline shutdown complete\n");
     
-    return 0;
+    // A load step that failed still drained the pipeline, but its numbers are not valid
+    return input_status > 0 ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,463 @@
+#include "plugin_common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * Aggregate plugin - counts the tokens of the lines in a window and emits
+ * one summary line per window instead of the lines themselves:
+ *   window=<k> lines=<n> tokens=<n> keys=<n> evicted=<n> top=<token>:<count>,...
+ * Option window=<n> closes a window every n lines; window=<n>s or <n>ms
+ * closes it at the first line that arrives once the window is that old.
+ * The window still open at "<END>" is emitted ahead of it.
+ * Option top=<n> (default 10) is the length of the top list, max_keys=<n>
+ * (default 4096) bounds the distinct tokens tracked: once full, a new token
+ * takes the slot of the least counted one and inherits its count (Space-Saving),
+ * so the counts of the top tokens are upper bounds off by at most the
+ * evicted count. Option field=<n> counts only the n-th whitespace-separated
+ * token of each line (default 0: all of them).
+ * The windows belong to the stage: in daemon mode every connection feeds them.
+ */
+
+#define AGGREGATE_TOKEN_MAX 64          // Longer tokens are counted by their first 63 bytes
+#define AGGREGATE_MAX_KEYS 1000000
+#define AGGREGATE_MAX_TOP 1000
+
+typedef struct {
+    char token[AGGREGATE_TOKEN_MAX];
+    unsigned long long count;
+    uint32_t hash;
+    int heap_index;                     // Position in aggregate_heap
+} aggregate_entry_t;
+
+static aggregate_entry_t* aggregate_entries = NULL;
+static int* aggregate_heap = NULL;      // Entry indices, min-heap on count
+static int* aggregate_slots = NULL;     // Open addressing (linear probing) on entry indices, -1 when free
+static size_t aggregate_slot_mask = 0;
+static int aggregate_key_count = 0;
+static int aggregate_max_keys = 4096;
+static int aggregate_top = 10;
+static int aggregate_field = 0;
+
+// Window: by record count, or by age (window_ns)
+static unsigned long long aggregate_window_lines = 1000;
+static unsigned long long aggregate_window_ns = 0;
+static unsigned long long aggregate_deadline = 0;
+static unsigned long long aggregate_index = 0;      // Windows emitted
+static unsigned long long aggregate_lines = 0;
+static unsigned long long aggregate_tokens = 0;
+static unsigned long long aggregate_evicted = 0;
+static pthread_mutex_t aggregate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_ullong aggregate_windows_total;
+static atomic_ullong aggregate_evicted_total;
+
+static unsigned long long aggregate_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+/**
+ * FNV-1a
+ */
+static uint32_t aggregate_hash(const char* token, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)token[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Find the slot holding a token, or the free slot where it belongs
+ */
+static size_t aggregate_probe(const char* token, size_t length, uint32_t hash) {
+    size_t slot = hash & aggregate_slot_mask;
+    while (aggregate_slots[slot] >= 0) {
+        const aggregate_entry_t* entry = &aggregate_entries[aggregate_slots[slot]];
+        if (entry->hash == hash && strncmp(entry->token, token, length) == 0 && entry->token[length] == '\0') {
+            break;
+        }
+        slot = (slot + 1) & aggregate_slot_mask;
+    }
+    return slot;
+}
+
+/**
+ * Free a slot, moving later entries of its probe run back so that no run
+ * is left with a hole
+ */
+static void aggregate_unlink(size_t slot) {
+    size_t hole = slot;
+    for (size_t next = (slot + 1) & aggregate_slot_mask; aggregate_slots[next] >= 0;
+         next = (next + 1) & aggregate_slot_mask) {
+        size_t home = aggregate_entries[aggregate_slots[next]].hash & aggregate_slot_mask;
+        // The entry may fill the hole if its home is not between the hole and itself
+        if (((next - home) & aggregate_slot_mask) >= ((next - hole) & aggregate_slot_mask)) {
+            aggregate_slots[hole] = aggregate_slots[next];
+            hole = next;
+        }
+    }
+    aggregate_slots[hole] = -1;
+}
+
+static void aggregate_heap_swap(int left, int right) {
+    int entry = aggregate_heap[left];
+    aggregate_heap[left] = aggregate_heap[right];
+    aggregate_heap[right] = entry;
+    aggregate_entries[aggregate_heap[left]].heap_index = left;
+    aggregate_entries[aggregate_heap[right]].heap_index = right;
+}
+
+static void aggregate_sift_up(int position) {
+    while (position > 0) {
+        int parent = (position - 1) / 2;
+        if (aggregate_entries[aggregate_heap[parent]].count <= aggregate_entries[aggregate_heap[position]].count) {
+            break;
+        }
+        aggregate_heap_swap(parent, position);
+        position = parent;
+    }
+}
+
+/**
+ * Restore the heap below a position whose count grew
+ */
+static void aggregate_sift_down(int position) {
+    while (1) {
+        int smallest = position;
+        for (int child = 2 * position + 1; child <= 2 * position + 2 && child < aggregate_key_count; child++) {
+            if (aggregate_entries[aggregate_heap[child]].count < aggregate_entries[aggregate_heap[smallest]].count) {
+                smallest = child;
+            }
+        }
+        if (smallest == position) {
+            return;
+        }
+        aggregate_heap_swap(position, smallest);
+        position = smallest;
+    }
+}
+
+/**
+ * Count one token (lock held)
+ */
+static void aggregate_count(const char* token, size_t length) {
+    if (length >= AGGREGATE_TOKEN_MAX) {
+        length = AGGREGATE_TOKEN_MAX - 1;
+    }
+    aggregate_tokens++;
+    uint32_t hash = aggregate_hash(token, length);
+    size_t slot = aggregate_probe(token, length, hash);
+    if (aggregate_slots[slot] >= 0) {
+        aggregate_entry_t* entry = &aggregate_entries[aggregate_slots[slot]];
+        entry->count++;
+        aggregate_sift_down(entry->heap_index);
+        return;
+    }
+
+    int index;
+    unsigned long long count = 1;
+    if (aggregate_key_count < aggregate_max_keys) {
+        index = aggregate_key_count++;
+        aggregate_heap[index] = index;
+        aggregate_entries[index].heap_index = index;
+    } else {
+        // Take over the least counted token's slot and its count
+        index = aggregate_heap[0];
+        aggregate_entry_t* victim = &aggregate_entries[index];
+        count = victim->count + 1;
+        aggregate_unlink(aggregate_probe(victim->token, strlen(victim->token), victim->hash));
+        // The unlink may have moved the run the new token probes
+        slot = aggregate_probe(token, length, hash);
+        aggregate_evicted++;
+        atomic_fetch_add_explicit(&aggregate_evicted_total, 1, memory_order_relaxed);
+    }
+    aggregate_entry_t* entry = &aggregate_entries[index];
+    memcpy(entry->token, token, length);
+    entry->token[length] = '\0';
+    entry->hash = hash;
+    entry->count = count;
+    aggregate_slots[slot] = index;
+    if (count == 1) {
+        aggregate_sift_up(entry->heap_index);
+    } else {
+        aggregate_sift_down(entry->heap_index);
+    }
+}
+
+/**
+ * Count the tokens of a line (lock held)
+ */
+static void aggregate_add_line(const char* line) {
+    int field = 0;
+    const char* cursor = line;
+    while (*cursor) {
+        while (*cursor == ' ' || *cursor == '\t') {
+            cursor++;
+        }
+        if (*cursor == '\0') {
+            break;
+        }
+        const char* start = cursor;
+        while (*cursor && *cursor != ' ' && *cursor != '\t') {
+            cursor++;
+        }
+        field++;
+        if (aggregate_field == 0 || field == aggregate_field) {
+            aggregate_count(start, (size_t)(cursor - start));
+            if (aggregate_field) {
+                break;
+            }
+        }
+    }
+    aggregate_lines++;
+}
+
+/**
+ * Order the summary: highest count first, then by token
+ */
+static int aggregate_compare(const void* left, const void* right) {
+    const aggregate_entry_t* a = *(const aggregate_entry_t* const*)left;
+    const aggregate_entry_t* b = *(const aggregate_entry_t* const*)right;
+    if (a->count != b->count) {
+        return a->count < b->count ? 1 : -1;
+    }
+    return strcmp(a->token, b->token);
+}
+
+/**
+ * Format the open window's summary and start a new window (lock held)
+ * Returns the summary, or NULL if it cannot be allocated (the window is lost)
+ */
+static char* aggregate_close(void) {
+    int shown = aggregate_key_count < aggregate_top ? aggregate_key_count : aggregate_top;
+    const aggregate_entry_t** ranked = malloc((size_t)(aggregate_key_count ? aggregate_key_count : 1) *
+                                              sizeof(aggregate_entry_t*));
+    // Each entry: the token, a colon, up to 20 digits and a comma
+    size_t capacity = 128 + (size_t)shown * (AGGREGATE_TOKEN_MAX + 22);
+    char* summary = ranked ? malloc(capacity) : NULL;
+    if (summary) {
+        for (int i = 0; i < aggregate_key_count; i++) {
+            ranked[i] = &aggregate_entries[i];
+        }
+        qsort(ranked, (size_t)aggregate_key_count, sizeof(aggregate_entry_t*), aggregate_compare);
+        size_t used = (size_t)snprintf(summary, capacity, "window=%llu lines=%llu tokens=%llu keys=%d evicted=%llu top=",
+                                       aggregate_index + 1, aggregate_lines, aggregate_tokens, aggregate_key_count,
+                                       aggregate_evicted);
+        for (int i = 0; i < shown; i++) {
+            used += (size_t)snprintf(summary + used, capacity - used, i == 0 ? "%s:%llu" : ",%s:%llu",
+                                     ranked[i]->token, ranked[i]->count);
+        }
+    }
+    free(ranked);
+
+    for (size_t slot = 0; slot <= aggregate_slot_mask; slot++) {
+        aggregate_slots[slot] = -1;
+    }
+    aggregate_key_count = 0;
+    aggregate_lines = 0;
+    aggregate_tokens = 0;
+    aggregate_evicted = 0;
+    aggregate_index++;
+    atomic_fetch_add_explicit(&aggregate_windows_total, 1, memory_order_relaxed);
+    return summary;
+}
+
+/**
+ * Plugin transformation function
+ * Consumes the line; returns the window's summary when the line closes it
+ */
+const char* plugin_transform(const char* input) {
+    if (!input) {
+        return NULL;
+    }
+
+    char* summary = NULL;
+    pthread_mutex_lock(&aggregate_lock);
+    if (aggregate_window_ns) {
+        unsigned long long now = aggregate_now_ns();
+        if (aggregate_lines > 0 && now >= aggregate_deadline) {
+            summary = aggregate_close();
+        }
+        if (aggregate_lines == 0) {
+            aggregate_deadline = now + aggregate_window_ns;
+        }
+        aggregate_add_line(input);
+    } else {
+        aggregate_add_line(input);
+        if (aggregate_lines >= aggregate_window_lines) {
+            summary = aggregate_close();
+        }
+    }
+    pthread_mutex_unlock(&aggregate_lock);
+    return summary ? summary : PLUGIN_DROP;
+}
+
+/**
+ * Emit the window still open at the end of the stream
+ */
+static const char* aggregate_flush(void) {
+    char* summary = NULL;
+    pthread_mutex_lock(&aggregate_lock);
+    if (aggregate_lines > 0) {
+        summary = aggregate_close();
+    }
+    pthread_mutex_unlock(&aggregate_lock);
+    return summary;
+}
+
+/**
+ * Get the plugin's own counters
+ */
+static const char* aggregate_get_stat(int index, unsigned long long* value) {
+    switch (index) {
+        case 0:
+            *value = atomic_load_explicit(&aggregate_windows_total, memory_order_relaxed);
+            return "windows";
+        case 1:
+            *value = atomic_load_explicit(&aggregate_evicted_total, memory_order_relaxed);
+            return "evicted";
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Free the tables when the plugin is finalized
+ */
+static void aggregate_fini(void) {
+    free(aggregate_entries);
+    aggregate_entries = NULL;
+    free(aggregate_heap);
+    aggregate_heap = NULL;
+    free(aggregate_slots);
+    aggregate_slots = NULL;
+}
+
+/**
+ * Parse a positive integer option no larger than max
+ * Returns 0 if it is not one
+ */
+static int aggregate_parse_count(const char* text, long max, long* value) {
+    char* endptr;
+    *value = strtol(text, &endptr, 10);
+    return text[0] != '\0' && *endptr == '\0' && *value >= 1 && *value <= max;
+}
+
+/**
+ * Parse window=<n>, <n>s or <n>ms
+ */
+static const char* aggregate_parse_window(const char* window) {
+    char* endptr;
+    long value = strtol(window, &endptr, 10);
+    if (window[0] < '0' || window[0] > '9' || value < 1 || value > 1000000000) {
+        return "Invalid window (expected <n>, <n>s or <n>ms)";
+    }
+    if (*endptr == '\0') {
+        aggregate_window_lines = (unsigned long long)value;
+        aggregate_window_ns = 0;
+    } else if (strcmp(endptr, "s") == 0) {
+        aggregate_window_ns = (unsigned long long)value * 1000000000ULL;
+    } else if (strcmp(endptr, "ms") == 0) {
+        aggregate_window_ns = (unsigned long long)value * 1000000ULL;
+    } else {
+        return "Invalid window (expected <n>, <n>s or <n>ms)";
+    }
+    return NULL;
+}
+
+// The state has its own lock but belongs to one stream; a summary is no longer
+// than output_extra (set at init)
+static plugin_capabilities_t aggregate_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_THREAD_SAFE | PLUGIN_CAP_STATEFUL,
+    1, 0, NULL
+};
+
+/**
+ * Get the algebraic properties of the transform
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return 0;
+}
+
+/**
+ * Initialize the plugin
+ */
+__attribute__((visibility("default")))
+const char* plugin_init(int queue_size) {
+    long value;
+    const char* window = common_plugin_get_setting("window");
+    if (window) {
+        const char* error = aggregate_parse_window(window);
+        if (error) {
+            return error;
+        }
+    }
+    const char* top = common_plugin_get_setting("top");
+    if (top) {
+        if (!aggregate_parse_count(top, AGGREGATE_MAX_TOP, &value)) {
+            return "Invalid top (expected 1 to 1000)";
+        }
+        aggregate_top = (int)value;
+    }
+    const char* max_keys = common_plugin_get_setting("max_keys");
+    if (max_keys) {
+        if (!aggregate_parse_count(max_keys, AGGREGATE_MAX_KEYS, &value)) {
+            return "Invalid max_keys (expected 1 to 1000000)";
+        }
+        aggregate_max_keys = (int)value;
+    }
+    const char* field = common_plugin_get_setting("field");
+    if (field) {
+        if (strcmp(field, "0") == 0) {
+            aggregate_field = 0;
+        } else if (!aggregate_parse_count(field, 1000000, &value)) {
+            return "Invalid field (expected 0 to 1000000)";
+        } else {
+            aggregate_field = (int)value;
+        }
+    }
+
+    // At most half the slots in use
+    size_t slot_count = 2;
+    while (slot_count < (size_t)aggregate_max_keys * 2) {
+        slot_count *= 2;
+    }
+    aggregate_entries = malloc((size_t)aggregate_max_keys * sizeof(aggregate_entry_t));
+    aggregate_heap = malloc((size_t)aggregate_max_keys * sizeof(int));
+    aggregate_slots = malloc(slot_count * sizeof(int));
+    if (!aggregate_entries || !aggregate_heap || !aggregate_slots) {
+        aggregate_fini();
+        return "Failed to allocate the aggregation tables";
+    }
+    aggregate_slot_mask = slot_count - 1;
+    for (size_t slot = 0; slot < slot_count; slot++) {
+        aggregate_slots[slot] = -1;
+    }
+    aggregate_key_count = 0;
+    aggregate_index = 0;
+    aggregate_lines = 0;
+    aggregate_tokens = 0;
+    aggregate_evicted = 0;
+
+    atomic_init(&aggregate_windows_total, 0);
+    atomic_init(&aggregate_evicted_total, 0);
+    common_plugin_set_stats(aggregate_get_stat);
+    common_plugin_set_fini(aggregate_fini);
+    common_plugin_set_flush(aggregate_flush);
+    aggregate_capabilities.output_extra = 128 + (size_t)aggregate_top * (AGGREGATE_TOKEN_MAX + 22);
+    common_plugin_set_capabilities(&aggregate_capabilities);
+    const char* error = common_plugin_init(plugin_transform, "aggregate", queue_size);
+    if (error) {
+        aggregate_fini();
+    }
+    return error;
+}
@@ -0,0 +1,233 @@
+#include "aho_corasick.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define AC_NO_STATE (-1)
+
+struct aho_corasick {
+    int32_t* delta;                    // states x classes transitions
+    int32_t* dictionary;               // Nearest proper suffix state that ends a pattern (0: none)
+    int32_t* match_start;              // Patterns ending in state s: match_ids[match_start[s] .. match_start[s + 1])
+    int32_t* match_ids;
+    int state_count;
+    int class_count;
+    uint8_t class_of[256];
+};
+
+/**
+ * Free the tables of a partly built automaton
+ */
+static void ac_free(aho_corasick_t* automaton) {
+    free(automaton->delta);
+    free(automaton->dictionary);
+    free(automaton->match_start);
+    free(automaton->match_ids);
+    free(automaton);
+}
+
+/**
+ * Compile a pattern list
+ */
+aho_corasick_t* aho_corasick_build(const char* const* patterns, int count, const char** error) {
+    const char* ignored;
+    error = error ? error : &ignored;
+    if (!patterns || count < 1) {
+        *error = "No patterns";
+        return NULL;
+    }
+
+    aho_corasick_t* automaton = calloc(1, sizeof(aho_corasick_t));
+    if (!automaton) {
+        *error = "Failed to allocate the automaton";
+        return NULL;
+    }
+
+    // Byte classes: each byte used by a pattern gets its own, the rest share class 0
+    size_t total_length = 0;
+    int class_count = 1;
+    for (int i = 0; i < count; i++) {
+        if (!patterns[i] || patterns[i][0] == '\0') {
+            ac_free(automaton);
+            *error = "Empty pattern";
+            return NULL;
+        }
+        for (const unsigned char* byte = (const unsigned char*)patterns[i]; *byte; byte++) {
+            if (!automaton->class_of[*byte]) {
+                automaton->class_of[*byte] = (uint8_t)class_count++;
+            }
+            total_length++;
+        }
+    }
+    if (total_length >= INT32_MAX / (size_t)class_count) {
+        ac_free(automaton);
+        *error = "Patterns too long";
+        return NULL;
+    }
+    automaton->class_count = class_count;
+
+    // Trie in insertion order; at most one state per pattern byte
+    size_t max_states = total_length + 1;
+    int32_t* trie = malloc(max_states * (size_t)class_count * sizeof(int32_t));
+    int32_t* terminal = malloc((size_t)count * sizeof(int32_t));
+    if (!trie || !terminal) {
+        free(trie);
+        free(terminal);
+        ac_free(automaton);
+        *error = "Failed to allocate the automaton";
+        return NULL;
+    }
+    for (size_t i = 0; i < (size_t)class_count; i++) {
+        trie[i] = AC_NO_STATE;
+    }
+    int trie_states = 1;
+    for (int i = 0; i < count; i++) {
+        int32_t state = 0;
+        for (const unsigned char* byte = (const unsigned char*)patterns[i]; *byte; byte++) {
+            int32_t* slot = &trie[(size_t)state * class_count + automaton->class_of[*byte]];
+            if (*slot == AC_NO_STATE) {
+                *slot = trie_states;
+                int32_t* row = &trie[(size_t)trie_states * class_count];
+                for (int c = 0; c < class_count; c++) {
+                    row[c] = AC_NO_STATE;
+                }
+                trie_states++;
+            }
+            state = *slot;
+        }
+        terminal[i] = state;
+    }
+
+    // Number the states breadth-first: order[new] = old, rank[old] = new
+    int32_t* order = malloc((size_t)trie_states * sizeof(int32_t));
+    int32_t* rank = malloc((size_t)trie_states * sizeof(int32_t));
+    int32_t* fail = malloc((size_t)trie_states * sizeof(int32_t));
+    automaton->delta = malloc((size_t)trie_states * class_count * sizeof(int32_t));
+    automaton->dictionary = malloc((size_t)trie_states * sizeof(int32_t));
+    automaton->match_start = calloc((size_t)trie_states + 1, sizeof(int32_t));
+    automaton->match_ids = malloc((size_t)count * sizeof(int32_t));
+    if (!order || !rank || !fail || !automaton->delta || !automaton->dictionary ||
+        !automaton->match_start || !automaton->match_ids) {
+        free(trie);
+        free(terminal);
+        free(order);
+        free(rank);
+        free(fail);
+        ac_free(automaton);
+        *error = "Failed to allocate the automaton";
+        return NULL;
+    }
+    order[0] = 0;
+    rank[0] = 0;
+    for (int head = 0, tail = 1; head < tail; head++) {
+        const int32_t* row = &trie[(size_t)order[head] * class_count];
+        for (int c = 0; c < class_count; c++) {
+            if (row[c] != AC_NO_STATE) {
+                rank[row[c]] = tail;
+                order[tail++] = row[c];
+            }
+        }
+    }
+
+    // Match lists, grouped by state (counting sort)
+    for (int i = 0; i < count; i++) {
+        automaton->match_start[rank[terminal[i]] + 1]++;
+    }
+    for (int s = 0; s < trie_states; s++) {
+        automaton->match_start[s + 1] += automaton->match_start[s];
+    }
+    // match_start[s] moves to the end of state s while its patterns are placed...
+    for (int i = 0; i < count; i++) {
+        automaton->match_ids[automaton->match_start[rank[terminal[i]]]++] = i;
+    }
+    // ...which is where state s + 1 starts
+    for (int s = trie_states; s > 0; s--) {
+        automaton->match_start[s] = automaton->match_start[s - 1];
+    }
+    automaton->match_start[0] = 0;
+
+    // Complete the transitions in breadth-first order: a state's failure
+    // state is shallower, so its row is already complete
+    fail[0] = 0;
+    automaton->dictionary[0] = 0;
+    for (int s = 0; s < trie_states; s++) {
+        const int32_t* trie_row = &trie[(size_t)order[s] * class_count];
+        int32_t* row = &automaton->delta[(size_t)s * class_count];
+        // The root has no failure state: its missing transitions stay at the root
+        const int32_t* fail_row = s == 0 ? NULL : &automaton->delta[(size_t)fail[s] * class_count];
+        for (int c = 0; c < class_count; c++) {
+            if (trie_row[c] == AC_NO_STATE) {
+                row[c] = fail_row ? fail_row[c] : 0;
+                continue;
+            }
+            int32_t child = rank[trie_row[c]];
+            int32_t child_fail = fail_row ? fail_row[c] : 0;
+            row[c] = child;
+            fail[child] = child_fail;
+            int ends_pattern = automaton->match_start[child_fail + 1] > automaton->match_start[child_fail];
+            automaton->dictionary[child] = ends_pattern ? child_fail : automaton->dictionary[child_fail];
+        }
+    }
+
+    free(trie);
+    free(terminal);
+    free(order);
+    free(rank);
+    free(fail);
+    automaton->state_count = trie_states;
+    return automaton;
+}
+
+/**
+ * Free an automaton
+ */
+void aho_corasick_destroy(aho_corasick_t* automaton) {
+    if (automaton) {
+        ac_free(automaton);
+    }
+}
+
+/**
+ * Report every occurrence of every pattern in a text
+ */
+size_t aho_corasick_scan(const aho_corasick_t* automaton, const char* text, size_t length,
+                         aho_corasick_match_func_t on_match, void* context) {
+    const int32_t* delta = automaton->delta;
+    const int32_t* match_start = automaton->match_start;
+    const int class_count = automaton->class_count;
+    size_t found = 0;
+    int32_t state = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        state = delta[(size_t)state * class_count + automaton->class_of[(unsigned char)text[i]]];
+        // The root never ends a pattern, so 0 ends the suffix chain
+        for (int32_t s = state; s != 0; s = automaton->dictionary[s]) {
+            for (int32_t m = match_start[s]; m < match_start[s + 1]; m++) {
+                found++;
+                if (on_match && on_match(context, automaton->match_ids[m], i + 1) != 0) {
+                    return found;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+/**
+ * Get the number of states
+ */
+int aho_corasick_states(const aho_corasick_t* automaton) {
+    return automaton ? automaton->state_count : 0;
+}
+
+/**
+ * Get the memory used by the tables
+ */
+size_t aho_corasick_bytes(const aho_corasick_t* automaton) {
+    if (!automaton) {
+        return 0;
+    }
+    size_t states = (size_t)automaton->state_count;
+    return states * (size_t)automaton->class_count * sizeof(int32_t) + states * 2 * sizeof(int32_t) +
+           (size_t)automaton->match_start[states] * sizeof(int32_t) + sizeof(aho_corasick_t);
+}
@@ -0,0 +1,70 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <stddef.h>
+
+/**
+ * Aho-Corasick automaton - finds every occurrence of a set of patterns in
+ * one pass over the text, whatever the number of patterns
+ *
+ * The trie is compiled into a complete DFA: one flat transition table with
+ * a row per state, states numbered breadth-first so the shallow ones the
+ * scan visits most share cache lines, and a column per byte class (bytes
+ * that occur in no pattern share one class). Patterns that end in a state
+ * are found through a dictionary suffix link instead of copied lists.
+ * Read-only once built: any number of threads may scan with it.
+ */
+
+typedef struct aho_corasick aho_corasick_t;
+
+/**
+ * Called for every occurrence of a pattern
+ * @param context The context passed to aho_corasick_scan
+ * @param id Index of the pattern in the list given to aho_corasick_build
+ * @param end Offset just past the occurrence in the text
+ * @return 0 to continue scanning, anything else to stop
+ */
+typedef int (*aho_corasick_match_func_t)(void* context, int id, size_t end);
+
+/**
+ * Compile a pattern list
+ * @param patterns Patterns (non-empty strings)
+ * @param count Number of patterns (>= 1)
+ * @param error Receives an error message on failure
+ * @return The automaton, or NULL on failure
+ */
+aho_corasick_t* aho_corasick_build(const char* const* patterns, int count, const char** error);
+
+/**
+ * Free an automaton
+ * @param automaton The automaton
+ */
+void aho_corasick_destroy(aho_corasick_t* automaton);
+
+/**
+ * Report every occurrence of every pattern in a text, in order of their end
+ * @param automaton The automaton
+ * @param text The text
+ * @param length Length of the text
+ * @param on_match Called for each occurrence
+ * @param context Passed to on_match
+ * @return Number of occurrences reported
+ */
+size_t aho_corasick_scan(const aho_corasick_t* automaton, const char* text, size_t length,
+                         aho_corasick_match_func_t on_match, void* context);
+
+/**
+ * Get the number of states
+ * @param automaton The automaton
+ * @return Number of states, root included
+ */
+int aho_corasick_states(const aho_corasick_t* automaton);
+
+/**
+ * Get the memory used by the transition table and the match lists
+ * @param automaton The automaton
+ * @return Size in bytes
+ */
+size_t aho_corasick_bytes(const aho_corasick_t* automaton);
+
+#endif // AHO_CORASICK_H
@@ -55,10 +55,26 @@ const char* plugin_transform(const char* input) {
     return result;
 }
 
+// Never longer than twice the input, so it cannot run in place
+static const plugin_capabilities_t expander_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_MEMOIZABLE | PLUGIN_CAP_THREAD_SAFE,
+    2, 0, NULL
+};
+
+/**
+ * Get the algebraic properties of the transform
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return PLUGIN_PROPERTY_PURE | PLUGIN_PROPERTY_POSITIONAL;
+}
+
 /**
  * Initialize the plugin
  */
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size) {
+    common_plugin_set_capabilities(&expander_capabilities);
     return common_plugin_init(plugin_transform, "expander", queue_size);
 }
\ No newline at end of file
@@ -32,10 +32,38 @@ const char* plugin_transform(const char* input) {
     return result;
 }
 
+/**
+ * Reverse the string in its own buffer
+ */
+static const char* flipper_in_place(char* buffer) {
+    size_t len = strlen(buffer);
+    for (size_t i = 0; i < len / 2; i++) {
+        char c = buffer[i];
+        buffer[i] = buffer[len - 1 - i];
+        buffer[len - 1 - i] = c;
+    }
+    return buffer;
+}
+
+static const plugin_capabilities_t flipper_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_IN_PLACE | PLUGIN_CAP_MEMOIZABLE | PLUGIN_CAP_THREAD_SAFE,
+    1, 0, flipper_in_place
+};
+
+/**
+ * Get the algebraic properties of the transform
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return PLUGIN_PROPERTY_PURE | PLUGIN_PROPERTY_INVOLUTION | PLUGIN_PROPERTY_POSITIONAL | PLUGIN_PROPERTY_REVERSAL;
+}
+
 /**
  * Initialize the plugin
  */
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size) {
+    common_plugin_set_capabilities(&flipper_capabilities);
     return common_plugin_init(plugin_transform, "flipper", queue_size);
 }
\ No newline at end of file
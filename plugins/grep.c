@@ -0,0 +1,180 @@
+// Already defined when the monolithic build compiles it into a plugin's unit
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "plugin_common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#define GREP_SSE2 1
+#endif
+
+/**
+ * Grep plugin - keeps the lines that contain pattern=<text> and drops the
+ * others (invert=1 keeps the lines that do not), so later stages never see
+ * them. The search compares the pattern's first and last byte against 16
+ * (SSE2) or 32 (AVX2) positions at once and checks the rest of the pattern
+ * only where both match.
+ */
+
+#define GREP_MAX_PATTERN 256
+
+static char grep_pattern[GREP_MAX_PATTERN + 1];
+static size_t grep_pattern_length = 0;
+static int grep_invert = 0;
+static int (*grep_search)(const char* text, size_t length) = NULL;
+
+// Selectivity: lines passed on and lines dropped
+static atomic_ullong grep_kept;
+static atomic_ullong grep_filtered;
+
+/**
+ * Scalar search, also used for the tail the vector loops cannot load
+ */
+static int grep_search_scalar(const char* text, size_t length) {
+    return memmem(text, length, grep_pattern, grep_pattern_length) != NULL;
+}
+
+#ifdef GREP_SSE2
+/**
+ * Check the candidates of one block: bit i set means the first and the last
+ * byte of the pattern match at text + i
+ */
+static int grep_check_candidates(const char* text, unsigned mask) {
+    while (mask) {
+        int offset = __builtin_ctz(mask);
+        // First and last byte already match
+        if (grep_pattern_length <= 2 ||
+            memcmp(text + offset + 1, grep_pattern + 1, grep_pattern_length - 2) == 0) {
+            return 1;
+        }
+        mask &= mask - 1;
+    }
+    return 0;
+}
+
+/**
+ * SSE2 search, 16 candidate positions per step
+ */
+static int grep_search_sse2(const char* text, size_t length) {
+    const __m128i first = _mm_set1_epi8(grep_pattern[0]);
+    const __m128i last = _mm_set1_epi8(grep_pattern[grep_pattern_length - 1]);
+    size_t i = 0;
+
+    for (; i + grep_pattern_length - 1 + 16 <= length; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(text + i + grep_pattern_length - 1));
+        __m128i both = _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last));
+        unsigned mask = (unsigned)_mm_movemask_epi8(both);
+        if (mask && grep_check_candidates(text + i, mask)) {
+            return 1;
+        }
+    }
+    return grep_search_scalar(text + i, length - i);
+}
+
+/**
+ * AVX2 search, 32 candidate positions per step
+ */
+__attribute__((target("avx2")))
+static int grep_search_avx2(const char* text, size_t length) {
+    const __m256i first = _mm256_set1_epi8(grep_pattern[0]);
+    const __m256i last = _mm256_set1_epi8(grep_pattern[grep_pattern_length - 1]);
+    size_t i = 0;
+
+    for (; i + grep_pattern_length - 1 + 32 <= length; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i*)(text + i + grep_pattern_length - 1));
+        __m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(both);
+        if (mask && grep_check_candidates(text + i, mask)) {
+            return 1;
+        }
+    }
+    return grep_search_sse2(text + i, length - i);
+}
+#endif
+
+/**
+ * Plugin transformation function
+ * Passes the line on unchanged if it matches, drops it otherwise
+ */
+const char* plugin_transform(const char* input) {
+    if (!input) {
+        return NULL;
+    }
+
+    if (grep_search(input, strlen(input)) != grep_invert) {
+        atomic_fetch_add_explicit(&grep_kept, 1, memory_order_relaxed);
+        return input;
+    }
+    atomic_fetch_add_explicit(&grep_filtered, 1, memory_order_relaxed);
+    return PLUGIN_DROP;
+}
+
+/**
+ * Get the plugin's own counters
+ */
+static const char* grep_get_stat(int index, unsigned long long* value) {
+    switch (index) {
+        case 0:
+            *value = atomic_load_explicit(&grep_kept, memory_order_relaxed);
+            return "kept";
+        case 1:
+            *value = atomic_load_explicit(&grep_filtered, memory_order_relaxed);
+            return "filtered";
+        default:
+            return NULL;
+    }
+}
+
+static const plugin_capabilities_t grep_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_THREAD_SAFE | PLUGIN_CAP_FILTER,
+    1, 0, NULL
+};
+
+/**
+ * Get the algebraic properties of the transform
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return PLUGIN_PROPERTY_PURE;
+}
+
+/**
+ * Initialize the plugin
+ */
+__attribute__((visibility("default")))
+const char* plugin_init(int queue_size) {
+    const char* pattern = common_plugin_get_setting("pattern");
+    if (!pattern || pattern[0] == '\0' || strlen(pattern) > GREP_MAX_PATTERN) {
+        return "Missing or invalid pattern (expected 1 to 256 characters)";
+    }
+    grep_pattern_length = strlen(pattern);
+    memcpy(grep_pattern, pattern, grep_pattern_length + 1);
+
+    const char* invert = common_plugin_get_setting("invert");
+    if (invert) {
+        if (strcmp(invert, "0") != 0 && strcmp(invert, "1") != 0) {
+            return "Invalid invert (expected 0 or 1)";
+        }
+        grep_invert = invert[0] == '1';
+    }
+
+    grep_search = grep_search_scalar;
+#ifdef GREP_SSE2
+    grep_search = __builtin_cpu_supports("avx2") ? grep_search_avx2 : grep_search_sse2;
+#endif
+
+    // Not memoizable for the cache option: it returns its input, and a lookup costs
+    // about as much as the search
+    atomic_init(&grep_kept, 0);
+    atomic_init(&grep_filtered, 0);
+    common_plugin_set_stats(grep_get_stat);
+    common_plugin_set_capabilities(&grep_capabilities);
+    return common_plugin_init(plugin_transform, "grep", queue_size);
+}
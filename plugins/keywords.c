@@ -0,0 +1,255 @@
+#include "plugin_common.h"
+#include "aho_corasick.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/**
+ * Keywords plugin - tags each line with the keywords it contains, found in
+ * a single pass whatever their number (Aho-Corasick)
+ * Option patterns=<file>: one keyword per line; a keyword's ID is its line
+ * number (blank lines are skipped but counted).
+ * Option emit=annotate (default) appends " [keywords=<id>,<id>...]" to the
+ * lines that contain any; emit=ids replaces them with the ID list and drops
+ * the other lines.
+ * A line is tagged with at most KEYWORDS_MAX_IDS keywords, the first found;
+ * the "truncated" counter tells how many lines had more.
+ */
+
+#define KEYWORDS_MAX_IDS 64            // Distinct keywords reported per line
+
+typedef struct {
+    int ids[KEYWORDS_MAX_IDS];
+    int count;
+    int truncated;                      // More distinct keywords than fit in ids
+} keywords_found_t;
+
+static aho_corasick_t* keywords_automaton = NULL;
+static int* keywords_lines = NULL;      // Line number of each compiled keyword (its ID)
+static int keywords_annotate = 1;
+
+static atomic_ullong keywords_matched;
+static atomic_ullong keywords_unmatched;
+static atomic_ullong keywords_truncated;
+
+/**
+ * Remember each keyword once, up to KEYWORDS_MAX_IDS
+ */
+static int keywords_collect(void* context, int id, size_t end) {
+    (void)end;
+    keywords_found_t* found = (keywords_found_t*)context;
+    int line = keywords_lines[id];
+    for (int i = 0; i < found->count; i++) {
+        if (found->ids[i] == line) {
+            return 0;
+        }
+    }
+    if (found->count < KEYWORDS_MAX_IDS) {
+        found->ids[found->count++] = line;
+    } else {
+        found->truncated = 1;
+    }
+    return 0;
+}
+
+/**
+ * Order IDs for the output
+ */
+static int keywords_compare(const void* left, const void* right) {
+    return *(const int*)left - *(const int*)right;
+}
+
+/**
+ * Plugin transformation function
+ * Appends (or, with emit=ids, returns) the IDs of the keywords in the line
+ */
+const char* plugin_transform(const char* input) {
+    if (!input) {
+        return NULL;
+    }
+
+    size_t len = strlen(input);
+    keywords_found_t found;
+    found.count = 0;
+    found.truncated = 0;
+    aho_corasick_scan(keywords_automaton, input, len, keywords_collect, &found);
+    if (found.count == 0) {
+        atomic_fetch_add_explicit(&keywords_unmatched, 1, memory_order_relaxed);
+        return keywords_annotate ? input : PLUGIN_DROP;
+    }
+    atomic_fetch_add_explicit(&keywords_matched, 1, memory_order_relaxed);
+    if (found.truncated) {
+        atomic_fetch_add_explicit(&keywords_truncated, 1, memory_order_relaxed);
+    }
+    qsort(found.ids, (size_t)found.count, sizeof(int), keywords_compare);
+
+    // Each ID: up to 10 digits and a comma
+    size_t capacity = (keywords_annotate ? len + sizeof(" [keywords=]") : 1) + (size_t)found.count * 11;
+    char* result = malloc(capacity);
+    if (!result) {
+        return NULL;
+    }
+    size_t used = 0;
+    if (keywords_annotate) {
+        memcpy(result, input, len);
+        used = len;
+        used += (size_t)snprintf(result + used, capacity - used, " [keywords=");
+    }
+    for (int i = 0; i < found.count; i++) {
+        used += (size_t)snprintf(result + used, capacity - used, i == 0 ? "%d" : ",%d", found.ids[i]);
+    }
+    if (keywords_annotate) {
+        snprintf(result + used, capacity - used, "]");
+    }
+    return result;
+}
+
+/**
+ * Get the plugin's own counters
+ */
+static const char* keywords_get_stat(int index, unsigned long long* value) {
+    switch (index) {
+        case 0:
+            *value = atomic_load_explicit(&keywords_matched, memory_order_relaxed);
+            return "matched";
+        case 1:
+            *value = atomic_load_explicit(&keywords_unmatched, memory_order_relaxed);
+            return "unmatched";
+        case 2:
+            *value = (unsigned long long)aho_corasick_states(keywords_automaton);
+            return "states";
+        case 3:
+            *value = atomic_load_explicit(&keywords_truncated, memory_order_relaxed);
+            return "truncated";
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Read the keyword file and compile it; blank lines are skipped but counted
+ */
+static const char* keywords_load(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return "Cannot open the patterns file";
+    }
+
+    char** patterns = NULL;
+    int count = 0;
+    int capacity = 0;
+    int line_number = 0;
+    const char* error = NULL;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, file)) >= 0) {
+        line_number++;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            char** grown_patterns = realloc(patterns, (size_t)capacity * sizeof(char*));
+            if (grown_patterns) {
+                patterns = grown_patterns;
+            }
+            int* grown_lines = realloc(keywords_lines, (size_t)capacity * sizeof(int));
+            if (grown_lines) {
+                keywords_lines = grown_lines;
+            }
+            if (!grown_patterns || !grown_lines) {
+                error = "Failed to allocate the patterns";
+                break;
+            }
+        }
+        patterns[count] = strdup(line);
+        if (!patterns[count]) {
+            error = "Failed to allocate the patterns";
+            break;
+        }
+        keywords_lines[count++] = line_number;
+    }
+    free(line);
+    fclose(file);
+
+    if (!error && count == 0) {
+        error = "The patterns file has no patterns";
+    }
+    if (!error) {
+        keywords_automaton = aho_corasick_build((const char* const*)patterns, count, &error);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(patterns[i]);
+    }
+    free(patterns);
+    return error;
+}
+
+/**
+ * Free the automaton when the plugin is finalized
+ */
+static void keywords_fini(void) {
+    aho_corasick_destroy(keywords_automaton);
+    keywords_automaton = NULL;
+    free(keywords_lines);
+    keywords_lines = NULL;
+}
+
+// Annotations add at most " [keywords=]" and an ID with a comma per keyword;
+// emit=ids makes it a filter (set at init)
+static plugin_capabilities_t keywords_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_THREAD_SAFE,
+    1, sizeof(" [keywords=]") + KEYWORDS_MAX_IDS * 11, NULL
+};
+
+/**
+ * Get the algebraic properties of the transform
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return PLUGIN_PROPERTY_PURE;
+}
+
+/**
+ * Initialize the plugin
+ */
+__attribute__((visibility("default")))
+const char* plugin_init(int queue_size) {
+    const char* emit = common_plugin_get_setting("emit");
+    if (emit) {
+        if (strcmp(emit, "annotate") != 0 && strcmp(emit, "ids") != 0) {
+            return "Invalid emit (expected annotate or ids)";
+        }
+        keywords_annotate = strcmp(emit, "annotate") == 0;
+    }
+
+    const char* path = common_plugin_get_setting("patterns");
+    if (!path || path[0] == '\0') {
+        return "Missing patterns file (patterns=<file>)";
+    }
+    const char* error = keywords_load(path);
+    if (error) {
+        keywords_fini();
+        return error;
+    }
+
+    atomic_init(&keywords_matched, 0);
+    atomic_init(&keywords_unmatched, 0);
+    atomic_init(&keywords_truncated, 0);
+    common_plugin_set_stats(keywords_get_stat);
+    common_plugin_set_fini(keywords_fini);
+    keywords_capabilities.flags = PLUGIN_CAP_THREAD_SAFE | (keywords_annotate ? 0 : PLUGIN_CAP_FILTER);
+    common_plugin_set_capabilities(&keywords_capabilities);
+    error = common_plugin_init(plugin_transform, "keywords", queue_size);
+    if (error) {
+        keywords_fini();
+    }
+    return error;
+}
@@ -25,10 +25,27 @@ const char* plugin_transform(const char* input) {
     return strdup(input);
 }
 
+// One printf per line, so lines of concurrent calls do not mix
+static const plugin_capabilities_t logger_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_THREAD_SAFE | PLUGIN_CAP_SIDE_EFFECTS,
+    1, 0, NULL
+};
+
+/**
+ * Get the algebraic properties of the transform
+ * Writes to stdout: a barrier for the chain optimizer
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return 0;
+}
+
 /**
  * Initialize the plugin
  */
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size) {
+    common_plugin_set_capabilities(&logger_capabilities);
     return common_plugin_init(plugin_transform, "logger", queue_size);
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "plugin_common.h"
+#include "sync/probes.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,105 @@
 
 static plugin_context_t* plugin_context = NULL;
 
+// Options received through plugin_configure before initialization
+typedef struct {
+    char* key;
+    char* value;
+    int consumed;
+} plugin_setting_t;
+
+static plugin_setting_t plugin_settings[PLUGIN_MAX_SETTINGS];
+static int plugin_settings_count = 0;
+static char plugin_settings_error[128];
+static const char* (*plugin_stats)(int, unsigned long long*) = NULL;  // Set by common_plugin_set_stats
+static void (*plugin_cleanup)(void) = NULL;    // Set by common_plugin_set_fini
+static const char* (*plugin_flush_hook)(void) = NULL;  // Set by common_plugin_set_flush
+static const plugin_capabilities_t* plugin_capabilities = NULL;  // Set by common_plugin_set_capabilities
+
+/**
+ * Release all stored options
+ */
+static void clear_settings(void) {
+    for (int i = 0; i < plugin_settings_count; i++) {
+        free(plugin_settings[i].key);
+        free(plugin_settings[i].value);
+        plugin_settings[i].key = NULL;
+        plugin_settings[i].value = NULL;
+    }
+    plugin_settings_count = 0;
+}
+
+/**
+ * Apply the options handled by the common infrastructure and reject unknown ones
+ */
+static const char* apply_common_settings(plugin_context_t* context) {
+    const char* overload = common_plugin_get_setting("overload");
+    if (overload) {
+        overload_policy_t policy;
+        int sample_rate;
+        const char* error = consumer_producer_parse_policy(overload, &policy, &sample_rate);
+        if (error) {
+            return error;
+        }
+        error = consumer_producer_set_policy(context->queue, policy, sample_rate);
+        if (error) {
+            return error;
+        }
+    }
+
+    const char* queue_bytes = common_plugin_get_setting("queue_bytes");
+    if (queue_bytes) {
+        size_t max_bytes;
+        const char* error = consumer_producer_parse_bytes(queue_bytes, &max_bytes);
+        if (error) {
+            return error;
+        }
+        error = consumer_producer_set_max_bytes(context->queue, max_bytes);
+        if (error) {
+            return error;
+        }
+    }
+
+    const char* scheduler = common_plugin_get_setting("scheduler");
+    if (scheduler) {
+        if (strcmp(scheduler, "pool") == 0) {
+            context->has_consumer_thread = 0;
+        } else if (strcmp(scheduler, "thread") != 0) {
+            return "Unknown scheduler (expected thread or pool)";
+        }
+    }
+
+    const char* cache = common_plugin_get_setting("cache");
+    if (cache) {
+        size_t bytes;
+        const char* error = result_cache_parse_size(cache, &bytes);
+        if (error) {
+            return error;
+        }
+        if (!plugin_capabilities || !(plugin_capabilities->flags & PLUGIN_CAP_MEMOIZABLE)) {
+            return "Plugin results are not memoizable, they cannot be cached";
+        }
+        if (!context->has_consumer_thread) {
+            // The host calls plugin_transform directly
+            return "The cache needs the plugin's consumer thread (scheduler=thread)";
+        }
+        context->cache = result_cache_create(bytes, &error);
+        if (!context->cache) {
+            return error;
+        }
+    }
+
+    for (int i = 0; i < plugin_settings_count; i++) {
+        if (!plugin_settings[i].consumed) {
+            snprintf(plugin_settings_error, sizeof(plugin_settings_error),
+                     "Unknown option '%s'", plugin_settings[i].key);
+            return plugin_settings_error;
+        }
+    }
+
+    return NULL;
+}
+
 /**
  * Print error message in the format [ERROR][Plugin Name] - message
  */
@@ -40,28 +140,79 @@ void* plugin_consumer_thread(void* arg) {
 
     log_info(context, "Consumer thread started");
 
+    // Items are this thread's own copies, so an in-place transform skips the
+    // allocation; not with a cache, whose key is the unmodified input
+    const char* (*in_place)(char*) = NULL;
+    if (plugin_runs_in_place(plugin_capabilities) && !context->cache) {
+        in_place = plugin_capabilities->transform_in_place;
+    }
+
     while (!context->finished) {
         // Get item from queue
         char* item = consumer_producer_get(context->queue);
         if (!item) {
-            // Queue is empty but not finished, keep waiting
-            continue; 
+            const char* failure = consumer_producer_failure(context->queue);
+            if (!failure) {
+                // Queue is empty but not finished, keep waiting
+                continue;
+            }
+            // The stream lost items: stop, and let the later stages finish what they have
+            log_error(context, failure);
+            pthread_mutex_lock(&context->attach_lock);
+            if (context->next_place_work) {
+                context->next_place_work("<END>");
+            }
+            pthread_mutex_unlock(&context->attach_lock);
+            context->finished = 1;
+            consumer_producer_signal_finished(context->queue);
+            break;
         }
 
         if (strcmp(item, "<END>") == 0) {
             log_info(context, "Received end signal, finishing the plugin");
+            PROBE1(stream_end, context->name);
+            const char* flushed = plugin_flush();
+            pthread_mutex_lock(&context->attach_lock);
+            if (context->next_place_work && flushed) {
+                context->next_place_work(flushed);
+            }
             if (context->next_place_work) {
                 context->next_place_work("<END>");
             }
+            pthread_mutex_unlock(&context->attach_lock);
 
             context->finished = 1;
             consumer_producer_signal_finished(context->queue);
+            free((void*)flushed);
             free(item);
 
             break;
         }
 
-        const char* result = context->process_function(item);
+        // A cached result is owned by the cache and forwarded as is
+        const char* cached = context->cache ? result_cache_lookup(context->cache, item) : NULL;
+        const char* result = cached;
+        PROBE2(transform_begin, context->name, item);
+        if (in_place) {
+            result = in_place(item);
+        } else if (!cached) {
+#ifdef PLUGIN_TRANSFORM_DIRECT
+            // Monolithic build: a direct call lets the transform be inlined here
+            result = plugin_transform(item);
+#else
+            result = context->process_function(item);
+#endif
+            if (result && result != PLUGIN_DROP && context->cache &&
+                result_cache_insert(context->cache, item, result)) {
+                cached = result;
+            }
+        }
+        PROBE2(transform_end, context->name, result);
+        if (result == PLUGIN_DROP) {
+            // Filtered out by the plugin, not an error
+            free(item);
+            continue;
+        }
         if (!result) {
             log_error(context, "Processing function returned NULL");
             free(item);
@@ -69,14 +220,16 @@ void* plugin_consumer_thread(void* arg) {
             continue;
         }
 
+        pthread_mutex_lock(&context->attach_lock);
         if (context->next_place_work) {
             const char* next_result = context->next_place_work(result);
             if (next_result) {
                 log_error(context, "Failed to call next_place_work");
             }
         }
+        pthread_mutex_unlock(&context->attach_lock);
 
-        if (result != item) {
+        if (result != item && result != cached) {
             free((void*)result);
         }
         
@@ -140,22 +293,54 @@ const char* common_plugin_init(const char* (*process_function)(const char*), con
         free((void*)plugin_context->name);
         free(plugin_context);
         plugin_context = NULL;
+        clear_settings();
+
+        return result;
+    }
+
+    plugin_context->has_consumer_thread = 1;
+    plugin_context->cache = NULL;
+    result = apply_common_settings(plugin_context);
+    if (result) {
+        result_cache_destroy(plugin_context->cache);
+        consumer_producer_destroy(plugin_context->queue);
+        free(plugin_context->queue);
+        free((void*)plugin_context->name);
+        free(plugin_context);
+        plugin_context = NULL;
+        clear_settings();
 
         return result;
     }
 
+    if (pthread_mutex_init(&plugin_context->attach_lock, NULL) != 0) {
+        result_cache_destroy(plugin_context->cache);
+        consumer_producer_destroy(plugin_context->queue);
+        free(plugin_context->queue);
+        free((void*)plugin_context->name);
+        free(plugin_context);
+        plugin_context = NULL;
+        clear_settings();
+
+        return "Failed to initialize the attach lock";
+    }
+
     plugin_context->next_place_work = NULL;
     plugin_context->process_function = process_function;
     plugin_context->initialized = 1;
     plugin_context->finished = 0;
 
     // Start consumer thread
-    if (pthread_create(&plugin_context->consumer_thread, NULL, plugin_consumer_thread, plugin_context) != 0) {
+    if (plugin_context->has_consumer_thread &&
+        pthread_create(&plugin_context->consumer_thread, NULL, plugin_consumer_thread, plugin_context) != 0) {
+        pthread_mutex_destroy(&plugin_context->attach_lock);
+        result_cache_destroy(plugin_context->cache);
         consumer_producer_destroy(plugin_context->queue);
         free(plugin_context->queue);
         free((void*)plugin_context->name);
         free(plugin_context);
         plugin_context = NULL;
+        clear_settings();
 
         return "Failed to create consumer thread";
     }
@@ -169,6 +354,7 @@ const char* common_plugin_init(const char* (*process_function)(const char*), con
  */
 const char* plugin_fini(void) {
     if (!plugin_context || !plugin_context->initialized || !plugin_context->queue) {
+        clear_settings();
         return "Plugin is not initialized";
     }
 
@@ -176,7 +362,8 @@ const char* plugin_fini(void) {
     consumer_producer_signal_finished(plugin_context->queue);
 
     // Wait for consumer thread to finish
-    if (pthread_join(plugin_context->consumer_thread, NULL) != 0) {
+    if (plugin_context->has_consumer_thread &&
+        pthread_join(plugin_context->consumer_thread, NULL) != 0) {
         log_error(plugin_context, "Failed to join consumer thread");
         return "Failed to join consumer thread";
     }
@@ -188,6 +375,15 @@ const char* plugin_fini(void) {
         free(plugin_context->queue);
     }
 
+    pthread_mutex_destroy(&plugin_context->attach_lock);
+    result_cache_destroy(plugin_context->cache);
+    if (plugin_cleanup) {
+        plugin_cleanup();
+        plugin_cleanup = NULL;
+    }
+    plugin_flush_hook = NULL;
+    plugin_capabilities = NULL;
+
     // Free name
     if (plugin_context->name) {
         free((char*)plugin_context->name);
@@ -196,6 +392,7 @@ const char* plugin_fini(void) {
     plugin_context->initialized = 0;
     free(plugin_context);
     plugin_context = NULL;
+    clear_settings();
 
     return NULL;
 }
@@ -235,7 +432,10 @@ void plugin_attach(const char* (*next_place_work)(const char*)) {
         return;
     }
 
+    // Wait for any item in flight to the previous target before switching
+    pthread_mutex_lock(&plugin_context->attach_lock);
     plugin_context->next_place_work = next_place_work;
+    pthread_mutex_unlock(&plugin_context->attach_lock);
     log_info(plugin_context, "Successfully attached to the next plugin");
 }
 
@@ -251,8 +451,204 @@ const char* plugin_wait_finished(void) {
         log_error(plugin_context, "Failed to wait for processing to finish");
         return "Failed to wait for processing to finish";
     }
+    const char* failure = consumer_producer_failure(plugin_context->queue);
+    if (failure) {
+        return failure;
+    }
 
     log_info(plugin_context, "Processing finished successfully");
     
     return NULL; 
-}
\ No newline at end of file
+}
+
+/**
+ * Stop processing without draining the queue
+ */
+const char* plugin_abort(unsigned long long* discarded) {
+    if (!plugin_context || !plugin_context->queue || !plugin_context->initialized) {
+        return "Plugin is not initialized";
+    }
+
+    // The consumer thread finishes its current item and sees the flag once get returns NULL
+    plugin_context->finished = 1;
+    unsigned long count = consumer_producer_close(plugin_context->queue);
+    if (discarded) {
+        *discarded = count;
+    }
+
+    // Forward nothing more: the next stage may be finalized while an item is
+    // still in progress. A forward in flight ends once the next stage is closed
+    pthread_mutex_lock(&plugin_context->attach_lock);
+    plugin_context->next_place_work = NULL;
+    pthread_mutex_unlock(&plugin_context->attach_lock);
+
+    consumer_producer_signal_finished(plugin_context->queue);
+
+    log_info(plugin_context, "Processing aborted");
+    return NULL;
+}
+
+/**
+ * Emit what the plugin still holds at the end of the stream
+ */
+const char* plugin_flush(void) {
+    return plugin_flush_hook ? plugin_flush_hook() : NULL;
+}
+
+/**
+ * Get the execution capabilities the plugin registered
+ */
+const plugin_capabilities_t* plugin_get_capabilities(void) {
+    return plugin_capabilities;
+}
+
+/**
+ * Store an option to be applied when the plugin is initialized
+ */
+const char* plugin_configure(const char* key, const char* value) {
+    if (!key || !value || key[0] == '\0') {
+        return "Invalid option";
+    }
+
+    if (plugin_context && plugin_context->initialized) {
+        return "Plugin is already initialized";
+    }
+
+    // A repeated key replaces the previous value
+    for (int i = 0; i < plugin_settings_count; i++) {
+        if (strcmp(plugin_settings[i].key, key) == 0) {
+            char* value_copy = strdup(value);
+            if (!value_copy) {
+                return "Failed to copy option value";
+            }
+            free(plugin_settings[i].value);
+            plugin_settings[i].value = value_copy;
+            return NULL;
+        }
+    }
+
+    if (plugin_settings_count >= PLUGIN_MAX_SETTINGS) {
+        return "Too many options";
+    }
+
+    char* key_copy = strdup(key);
+    char* value_copy = strdup(value);
+    if (!key_copy || !value_copy) {
+        free(key_copy);
+        free(value_copy);
+        return "Failed to copy option";
+    }
+
+    plugin_settings[plugin_settings_count].key = key_copy;
+    plugin_settings[plugin_settings_count].value = value_copy;
+    plugin_settings[plugin_settings_count].consumed = 0;
+    plugin_settings_count++;
+
+    return NULL;
+}
+
+/**
+ * Register the plugin's own counters
+ */
+void common_plugin_set_stats(const char* (*get_stat)(int index, unsigned long long* value)) {
+    plugin_stats = get_stat;
+}
+
+/**
+ * Register the plugin's own cleanup
+ */
+void common_plugin_set_fini(void (*fini)(void)) {
+    plugin_cleanup = fini;
+}
+
+/**
+ * Register the plugin's end-of-stream output
+ */
+void common_plugin_set_flush(const char* (*flush)(void)) {
+    plugin_flush_hook = flush;
+}
+
+/**
+ * Register the plugin's execution capabilities
+ */
+void common_plugin_set_capabilities(const plugin_capabilities_t* capabilities) {
+    plugin_capabilities = capabilities;
+}
+
+/**
+ * Look up an option stored by plugin_configure
+ */
+const char* common_plugin_get_setting(const char* key) {
+    if (!key) {
+        return NULL;
+    }
+
+    for (int i = 0; i < plugin_settings_count; i++) {
+        if (strcmp(plugin_settings[i].key, key) == 0) {
+            plugin_settings[i].consumed = 1;
+            return plugin_settings[i].value;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Get a runtime counter by index
+ */
+const char* plugin_get_stat(int index, unsigned long long* value) {
+    if (!plugin_context || !plugin_context->initialized || !value) {
+        return NULL;
+    }
+
+    // The plugin's own counters follow the queue's
+    if (index >= 2 && plugin_stats) {
+        int own = 0;
+        unsigned long long ignored;
+        while (plugin_stats(own, &ignored)) {
+            own++;
+        }
+        if (index < 2 + own) {
+            return plugin_stats(index - 2, value);
+        }
+        index -= own;
+    }
+
+    switch (index) {
+        case 0:
+            *value = consumer_producer_dropped(plugin_context->queue);
+            return "dropped";
+        case 1:
+            *value = consumer_producer_spilled(plugin_context->queue);
+            return "spilled";
+        default:
+            break;
+    }
+    index -= 2;
+
+    // Byte counters only exist with a byte budget (queue_bytes option)
+    if (plugin_context->queue->max_bytes > 0) {
+        if (index == 0) {
+            *value = consumer_producer_bytes(plugin_context->queue);
+            return "queued_bytes";
+        }
+        if (index == 1) {
+            *value = consumer_producer_peak_bytes(plugin_context->queue);
+            return "peak_bytes";
+        }
+        index -= 2;
+    }
+
+    // Cache counters only exist with the cache option
+    if (plugin_context->cache) {
+        if (index == 0) {
+            *value = result_cache_hits(plugin_context->cache);
+            return "cache_hits";
+        }
+        if (index == 1) {
+            *value = result_cache_misses(plugin_context->cache);
+            return "cache_misses";
+        }
+    }
+    return NULL;
+}
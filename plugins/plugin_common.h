@@ -2,23 +2,43 @@
 #define PLUGIN_COMMON_H
 
 #include <pthread.h>
+#include "plugin_sdk.h"
 #include "sync/consumer_producer.h"
+#include "result_cache.h"
 
 /**
  * Common SDK structures and functions for plugin implementation
  */
 
+// Maximum number of options accepted through plugin_configure
+#define PLUGIN_MAX_SETTINGS 16
+
 // Plugin context structure
 typedef struct {
     const char* name;                                         // Plugin name (for diagnosis)
     consumer_producer_t* queue;                               // Input queue
     pthread_t consumer_thread;                                // Consumer thread
+    int has_consumer_thread;                                  // 0 when the host runs plugin_transform itself
     const char* (*next_place_work)(const char*);              // Next plugin's place_work function
+    pthread_mutex_t attach_lock;                              // Guards next_place_work while forwarding
     const char* (*process_function)(const char*);             // Plugin-specific processing function
+    result_cache_t* cache;                                    // Results of a memoizable plugin (cache option), or NULL
     int initialized;                                          // Initialization flag
     int finished;                                             // Finished processing flag
 } plugin_context_t;
 
+#ifdef PLUGIN_TRANSFORM_DIRECT
+/**
+ * The plugin's transformation function, called directly by the consumer
+ * thread in the monolithic build instead of through process_function.
+ * That build compiles each plugin and the common code as one translation
+ * unit, so the transform is inlined into the consumer loop.
+ * @param input The string to transform
+ * @return The transformed string, or NULL on failure
+ */
+__attribute__((always_inline)) inline const char* plugin_transform(const char* input);
+#endif
+
 /**
  * Generic consumer thread function
  * This function runs in a separate thread and processes items from the queue
@@ -51,6 +71,44 @@ void log_info(plugin_context_t* context, const char* message);
 const char* common_plugin_init(const char* (*process_function)(const char*), 
                               const char* name, int queue_size);
 
+/**
+ * Register the plugin's own counters; plugin_get_stat reports them after the
+ * queue's. Call before common_plugin_init.
+ * @param get_stat Returns the name and value of counter index, or NULL past the last
+ */
+void common_plugin_set_stats(const char* (*get_stat)(int index, unsigned long long* value));
+
+/**
+ * Register the plugin's own cleanup; plugin_fini calls it once no item is
+ * being transformed anymore. Call before common_plugin_init.
+ * @param fini Frees what the plugin allocated in plugin_init
+ */
+void common_plugin_set_fini(void (*fini)(void));
+
+/**
+ * Register the plugin's end-of-stream output, returned by plugin_flush.
+ * Call before common_plugin_init.
+ * @param flush Returns a new string to forward ahead of "<END>", or NULL
+ */
+void common_plugin_set_flush(const char* (*flush)(void));
+
+/**
+ * Register the plugin's execution capabilities, returned by
+ * plugin_get_capabilities; with PLUGIN_CAP_IN_PLACE the consumer thread
+ * transforms its items in place. Call before common_plugin_init.
+ * @param capabilities The capabilities (must stay valid until plugin_fini)
+ */
+void common_plugin_set_capabilities(const plugin_capabilities_t* capabilities);
+
+/**
+ * Look up an option stored by plugin_configure and mark it as handled.
+ * Plugins read their own options here before calling common_plugin_init,
+ * which rejects any option nobody consumed.
+ * @param key Option name
+ * @return Option value, or NULL if the option was not given
+ */
+const char* common_plugin_get_setting(const char* key);
+
 /**
  * Finalize the plugin - drain queue and terminate thread gracefully (i.e. pthread_join)
  * @return NULL on success, error message on failure
@@ -68,6 +126,8 @@ const char* plugin_place_work(const char* str);
 
 /**
  * Attach this plugin to the next plugin in the chain
+ * May be called again while the plugin is running; returns only once no
+ * item is being forwarded to the previous target anymore
  * @param next_place_work Function pointer to the next plugin's place_work function
  */
 __attribute__((visibility("default")))
@@ -98,4 +158,55 @@ const char* plugin_init(int queue_size);
 __attribute__((visibility("default")))  
 const char* plugin_get_name(void); 
 
+/**
+ * Stop processing without draining the queue
+ * Items put afterwards are refused and nothing is forwarded anymore;
+ * the host calls plugin_fini next
+ * @param discarded Receives the number of items that were still queued
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_abort(unsigned long long* discarded);
+
+/**
+ * Emit what the plugin still holds at the end of the stream; the consumer
+ * thread calls it on "<END>", a host running plugin_transform itself does too
+ * @return A new string to forward ahead of "<END>", or NULL
+ */
+__attribute__((visibility("default")))
+const char* plugin_flush(void);
+
+/**
+ * Get the execution capabilities registered with common_plugin_set_capabilities
+ * @return The capabilities, or NULL
+ */
+__attribute__((visibility("default")))
+const plugin_capabilities_t* plugin_get_capabilities(void);
+
+/**
+ * Store an option for the plugin; must be called before plugin_init.
+ * Options handled by the common infrastructure:
+ *   overload - queue overload policy: block, drop-newest, drop-oldest, sample:N or spill
+ *   cache - memory for a result cache, e.g. 4m (PLUGIN_CAP_MEMOIZABLE plugins only); repeated inputs
+ *           skip the transform. Used by the consumer thread, not with scheduler=pool
+ *   scheduler - thread (default): items are processed by the plugin's consumer thread;
+ *               pool: set by a host that calls plugin_transform from its own worker
+ *               threads, one item at a time per pipeline (calls for different
+ *               pipelines may overlap); no consumer thread is started
+ * @param key Option name
+ * @param value Option value
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_configure(const char* key, const char* value);
+
+/**
+ * Get a runtime counter of the plugin
+ * @param index Counter index, starting at 0
+ * @param value Receives the counter value
+ * @return The counter name, or NULL if index is out of range
+ */
+__attribute__((visibility("default")))
+const char* plugin_get_stat(int index, unsigned long long* value);
+
 #endif // PLUGIN_COMMON_H
\ No newline at end of file
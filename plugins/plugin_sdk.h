@@ -1,6 +1,69 @@
 #ifndef PLUGIN_SDK_H
 #define PLUGIN_SDK_H
 
+#include <stddef.h>
+
+/**
+ * Algebraic properties of a transform, returned by plugin_get_properties.
+ * The chain optimizer (--optimize) uses them to rewrite a chain into a
+ * cheaper equivalent; a stage without PLUGIN_PROPERTY_PURE is a barrier.
+ */
+#define PLUGIN_PROPERTY_PURE        0x01u  // No side effects; the result depends only on the input
+#define PLUGIN_PROPERTY_IDEMPOTENT  0x02u  // Applying it twice equals applying it once
+#define PLUGIN_PROPERTY_INVOLUTION  0x04u  // Applying it twice is the identity
+#define PLUGIN_PROPERTY_CHARWISE    0x08u  // Maps every character on its own and leaves spaces alone
+#define PLUGIN_PROPERTY_POSITIONAL  0x10u  // Moves characters and inserts spaces without reading them
+#define PLUGIN_PROPERTY_ROTATION    0x20u  // Reverses if its reverse option is 1, then rotates right by
+                                           // its shift option (-1000000 to 1000000, default 1)
+#define PLUGIN_PROPERTY_REVERSAL    0x40u  // Reverses the string
+
+/**
+ * Returned by a transform to drop the item on purpose (a filter): nothing is
+ * forwarded, nothing is freed and no error is reported. NULL still means the
+ * transform failed.
+ */
+#define PLUGIN_DROP ((const char*)-1)
+
+/**
+ * Execution capabilities of a plugin, returned by plugin_get_capabilities.
+ * Hosts pick cheaper strategies from them (the cache option, in-place runs,
+ * shared stages) and refuse the ones they rule out; a plugin without the
+ * export gets none of them. Fields are only ever appended: a host reads the ones of the
+ * version it knows when the plugin's version is at least that.
+ */
+#define PLUGIN_CAPABILITIES_VERSION 2
+
+#define PLUGIN_CAP_IN_PLACE         0x01u  // transform_in_place rewrites a string in its own buffer
+#define PLUGIN_CAP_MEMOIZABLE       0x02u  // The result depends only on the input and is always a new
+                                           // string: the cache option may keep it
+#define PLUGIN_CAP_THREAD_SAFE      0x04u  // The transform may run on several threads at once
+#define PLUGIN_CAP_SIDE_EFFECTS     0x08u  // The transform writes output or sleeps (logger, typewriter)
+#define PLUGIN_CAP_STATEFUL         0x10u  // The transform keeps state across items of one stream and
+                                           // plugin_flush emits it (aggregate): daemon connections
+                                           // cannot share it
+#define PLUGIN_CAP_FILTER           0x20u  // The transform may return PLUGIN_DROP (grep)
+
+typedef struct {
+    unsigned version;                      // PLUGIN_CAPABILITIES_VERSION the plugin was built with
+    unsigned flags;                        // PLUGIN_CAP_* flags
+    // Output length bound: at most output_factor * input length + output_extra
+    // bytes (output_factor 0: no bound known)
+    size_t output_factor;
+    size_t output_extra;
+    // With PLUGIN_CAP_IN_PLACE: transform the string in buffer, which the host
+    // owns; returns buffer, PLUGIN_DROP or NULL
+    const char* (*transform_in_place)(char* buffer);
+} plugin_capabilities_t;
+
+/**
+ * Check whether a host may hand its own copy of the input to
+ * transform_in_place: the output must fit where the input is
+ */
+static inline int plugin_runs_in_place(const plugin_capabilities_t* capabilities) {
+    return capabilities && (capabilities->flags & PLUGIN_CAP_IN_PLACE) && capabilities->transform_in_place &&
+           capabilities->output_factor == 1 && capabilities->output_extra == 0;
+}
+
 /**
  * Get the plugin's name
  * @return The plugin's name (should not be modified or freed)
@@ -40,4 +103,60 @@ void plugin_attach(const char* (*next_place_work)(const char*));
  */
 const char* plugin_wait_finished(void);
 
+/**
+ * Optional: store an option for the plugin before plugin_init is called
+ * @param key Option name (e.g. "overload")
+ * @param value Option value (e.g. "drop-oldest")
+ * @return NULL on success, error message on failure
+ */
+const char* plugin_configure(const char* key, const char* value);
+
+/**
+ * Optional: get a runtime counter of the plugin (e.g. items dropped by the overload policy)
+ * @param index Counter index, starting at 0
+ * @param value Receives the counter value
+ * @return The counter name, or NULL if index is out of range
+ */
+const char* plugin_get_stat(int index, unsigned long long* value);
+
+/**
+ * Optional: transform one item; called by a host that runs the plugin on its
+ * own worker threads after configuring it with scheduler=pool
+ * @param input The string to transform
+ * @return The input itself, a new string the host frees, PLUGIN_DROP to
+ *         filter the item out, or NULL on failure
+ */
+const char* plugin_transform(const char* input);
+
+/**
+ * Optional: stop processing without draining: discard the queued items, let
+ * the item in progress finish and end the consumer thread; plugin_wait_finished
+ * returns and plugin_fini must still be called. Nothing is forwarded once it
+ * returns; the host aborts the stages from the last one to the first
+ * @param discarded Receives the number of items that were still queued
+ * @return NULL on success, error message on failure
+ */
+const char* plugin_abort(unsigned long long* discarded);
+
+/**
+ * Optional: called once "<END>" reaches the stage, before it is passed on,
+ * so that a stage aggregating its input can emit what it still holds
+ * @return A new string the host forwards ahead of "<END>" and frees, or NULL for nothing
+ */
+const char* plugin_flush(void);
+
+/**
+ * Optional: get the algebraic properties of the transform; may be called
+ * before plugin_init
+ * @return A combination of PLUGIN_PROPERTY_* flags
+ */
+unsigned plugin_get_properties(void);
+
+/**
+ * Optional: get the execution capabilities of the plugin; valid once
+ * plugin_init succeeded, until plugin_fini
+ * @return The capabilities (owned by the plugin), or NULL for none
+ */
+const plugin_capabilities_t* plugin_get_capabilities(void);
+
 #endif // PLUGIN_SDK_H
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "result_cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define CACHE_MIN_BYTES 4096
+#define CACHE_BYTES_PER_ENTRY 256      // Expected footprint of an entry; sizes the table
+#define CACHE_NO_ENTRY (-1)
+
+typedef struct {
+    uint64_t hash;
+    char* key;
+    char* value;
+    size_t key_length;
+    size_t bytes;                      // Strings charged to the budget
+    int next;                          // Bucket chain, or free list when unused
+    unsigned char used;
+    unsigned char referenced;          // Hit since the clock hand last passed
+} cache_entry_t;
+
+struct result_cache {
+    cache_entry_t* entries;
+    int entry_count;
+    int* buckets;
+    uint64_t bucket_mask;
+    int free_list;
+    int hand;                          // CLOCK position
+    size_t bytes;
+    size_t max_bytes;                  // Budget for the strings (the tables are fixed)
+    unsigned long long hits;
+    unsigned long long misses;
+};
+
+/**
+ * Hash a string a word at a time
+ */
+static uint64_t cache_hash(const char* input, size_t length) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, input + i, sizeof(word));
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, input + i, length - i);
+    hash = (hash ^ tail) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * Remove an entry from its bucket chain and free its strings
+ */
+static void cache_evict(result_cache_t* cache, int index) {
+    cache_entry_t* entry = &cache->entries[index];
+    int* link = &cache->buckets[entry->hash & cache->bucket_mask];
+    while (*link != index) {
+        link = &cache->entries[*link].next;
+    }
+    *link = entry->next;
+
+    cache->bytes -= entry->bytes;
+    free(entry->key);
+    free(entry->value);
+    entry->key = NULL;
+    entry->value = NULL;
+    entry->used = 0;
+    entry->next = cache->free_list;
+    cache->free_list = index;
+}
+
+/**
+ * Parse a cache size
+ */
+const char* result_cache_parse_size(const char* spec, size_t* bytes) {
+    if (!spec || !bytes) {
+        return "Null cache size argument";
+    }
+
+    char* endptr;
+    unsigned long long size = strtoull(spec, &endptr, 10);
+    if (endptr == spec || spec[0] == '-') {
+        return "Invalid cache size";
+    }
+    if (*endptr == 'k' || *endptr == 'K') {
+        size *= 1024;
+        endptr++;
+    } else if (*endptr == 'm' || *endptr == 'M') {
+        size *= 1024 * 1024;
+        endptr++;
+    }
+    if (*endptr != '\0' || size < CACHE_MIN_BYTES || size > (1ULL << 40)) {
+        return "Invalid cache size (expected at least 4k, e.g. 4m)";
+    }
+
+    *bytes = (size_t)size;
+    return NULL;
+}
+
+/**
+ * Create an empty cache
+ */
+result_cache_t* result_cache_create(size_t max_bytes, const char** error) {
+    const char* ignored;
+    error = error ? error : &ignored;
+
+    result_cache_t* cache = calloc(1, sizeof(result_cache_t));
+    if (!cache) {
+        *error = "Failed to allocate the cache";
+        return NULL;
+    }
+
+    cache->entry_count = (int)(max_bytes / CACHE_BYTES_PER_ENTRY);
+    uint64_t bucket_count = 16;
+    while (bucket_count < (uint64_t)cache->entry_count) {
+        bucket_count <<= 1;
+    }
+    size_t table_bytes = (size_t)cache->entry_count * sizeof(cache_entry_t) + bucket_count * sizeof(int);
+
+    cache->entries = calloc((size_t)cache->entry_count, sizeof(cache_entry_t));
+    cache->buckets = malloc(bucket_count * sizeof(int));
+    if (!cache->entries || !cache->buckets || table_bytes >= max_bytes) {
+        free(cache->entries);
+        free(cache->buckets);
+        free(cache);
+        *error = "Failed to allocate the cache";
+        return NULL;
+    }
+
+    for (uint64_t i = 0; i < bucket_count; i++) {
+        cache->buckets[i] = CACHE_NO_ENTRY;
+    }
+    for (int i = 0; i < cache->entry_count; i++) {
+        cache->entries[i].next = i + 1 < cache->entry_count ? i + 1 : CACHE_NO_ENTRY;
+    }
+    cache->bucket_mask = bucket_count - 1;
+    cache->free_list = 0;
+    cache->max_bytes = max_bytes - table_bytes;
+    return cache;
+}
+
+/**
+ * Free the cache and every cached result
+ */
+void result_cache_destroy(result_cache_t* cache) {
+    if (!cache) {
+        return;
+    }
+    for (int i = 0; i < cache->entry_count; i++) {
+        free(cache->entries[i].key);
+        free(cache->entries[i].value);
+    }
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+}
+
+/**
+ * Look up the result for an input
+ */
+const char* result_cache_lookup(result_cache_t* cache, const char* input) {
+    size_t length = strlen(input);
+    uint64_t hash = cache_hash(input, length);
+
+    for (int index = cache->buckets[hash & cache->bucket_mask]; index != CACHE_NO_ENTRY;
+         index = cache->entries[index].next) {
+        cache_entry_t* entry = &cache->entries[index];
+        if (entry->hash == hash && entry->key_length == length && memcmp(entry->key, input, length) == 0) {
+            entry->referenced = 1;
+            cache->hits++;
+            return entry->value;
+        }
+    }
+
+    cache->misses++;
+    return NULL;
+}
+
+/**
+ * Remember the result for an input
+ */
+int result_cache_insert(result_cache_t* cache, const char* input, const char* result) {
+    size_t length = strlen(input);
+    size_t value_length = result == input ? length : strlen(result);
+    size_t bytes = length + value_length + 2;
+    if (bytes > cache->max_bytes / 2) {
+        return 0;
+    }
+
+    // CLOCK: sweep until there is a free entry and room for the strings
+    while (cache->free_list == CACHE_NO_ENTRY || cache->bytes + bytes > cache->max_bytes) {
+        cache_entry_t* entry = &cache->entries[cache->hand];
+        if (entry->used && entry->referenced) {
+            entry->referenced = 0;
+        } else if (entry->used) {
+            cache_evict(cache, cache->hand);
+        }
+        cache->hand = (cache->hand + 1) % cache->entry_count;
+    }
+
+    char* key = malloc(length + 1);
+    char* value = result == input ? malloc(length + 1) : (char*)result;
+    if (!key || !value) {
+        free(key);
+        if (value != result) {
+            free(value);
+        }
+        return 0;
+    }
+    memcpy(key, input, length + 1);
+    if (result == input) {
+        memcpy(value, input, length + 1);
+    }
+
+    int index = cache->free_list;
+    cache_entry_t* entry = &cache->entries[index];
+    cache->free_list = entry->next;
+
+    entry->hash = cache_hash(input, length);
+    entry->key = key;
+    entry->value = value;
+    entry->key_length = length;
+    entry->bytes = bytes;
+    entry->used = 1;
+    entry->referenced = 0;
+    entry->next = cache->buckets[entry->hash & cache->bucket_mask];
+    cache->buckets[entry->hash & cache->bucket_mask] = index;
+    cache->bytes += bytes;
+
+    return result != input;
+}
+
+/**
+ * Get the number of lookups that found a result
+ */
+unsigned long long result_cache_hits(const result_cache_t* cache) {
+    return cache ? cache->hits : 0;
+}
+
+/**
+ * Get the number of lookups that found nothing
+ */
+unsigned long long result_cache_misses(const result_cache_t* cache) {
+    return cache ? cache->misses : 0;
+}
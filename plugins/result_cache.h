@@ -0,0 +1,71 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stddef.h>
+
+/**
+ * Result cache - remembers the output of a memoizable transform per input string
+ *
+ * A hash table bounded by the bytes it holds (strings plus bookkeeping).
+ * When a new result does not fit, entries are evicted in CLOCK order: a
+ * recently hit entry gets a second chance before it is dropped.
+ * Not thread-safe; each stage's consumer thread owns its cache.
+ */
+
+typedef struct result_cache result_cache_t;
+
+/**
+ * Parse a cache size: a byte count with an optional k or m suffix
+ * @param spec Size specification (e.g. "4m")
+ * @param bytes Receives the size in bytes
+ * @return NULL on success, error message on failure
+ */
+const char* result_cache_parse_size(const char* spec, size_t* bytes);
+
+/**
+ * Create an empty cache
+ * @param max_bytes Most memory the cached strings and their entries may use
+ * @param error Receives an error message on failure
+ * @return The cache, or NULL on failure
+ */
+result_cache_t* result_cache_create(size_t max_bytes, const char** error);
+
+/**
+ * Free the cache and every cached result
+ * @param cache The cache
+ */
+void result_cache_destroy(result_cache_t* cache);
+
+/**
+ * Look up the result for an input; counts a hit or a miss
+ * @param cache The cache
+ * @param input The input string
+ * @return The cached result, valid until the next result_cache_insert, or NULL
+ */
+const char* result_cache_lookup(result_cache_t* cache, const char* input);
+
+/**
+ * Remember the result for an input that result_cache_lookup just missed
+ * @param cache The cache
+ * @param input The input string (copied)
+ * @param result The result; the cache takes ownership unless it is the input itself
+ * @return 1 if the cache now owns result, 0 if the caller still does
+ *         (not cached, or result is the input and was copied)
+ */
+int result_cache_insert(result_cache_t* cache, const char* input, const char* result);
+
+/**
+ * Get the number of lookups that found a result
+ * @param cache The cache
+ * @return Number of hits
+ */
+unsigned long long result_cache_hits(const result_cache_t* cache);
+
+/**
+ * Get the number of lookups that found nothing
+ * @param cache The cache
+ * @return Number of misses
+ */
+unsigned long long result_cache_misses(const result_cache_t* cache);
+
+#endif // RESULT_CACHE_H
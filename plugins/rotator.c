@@ -6,11 +6,20 @@
 /**
  * Rotator plugin - moves every character one position to the right
  * The last character wraps around to the front
+ * Option shift=<n> moves every character n positions instead (left if n < 0);
+ * option reverse=1 reverses the string first. Together they express any
+ * sequence of rotator and flipper stages, which the chain optimizer folds
+ * into one rotator stage: a single copy instead of one per stage
  */
 
+#define ROTATOR_MAX_SHIFT 1000000
+
+static long rotator_shift = 1;
+static int rotator_reverse = 0;
+
 /**
  * Plugin transformation function
- * Rotates the string one character to the right
+ * Rotates the string shift characters to the right, reversing it first if asked to
  */
 const char* plugin_transform(const char* input) {
     if (!input) {
@@ -30,10 +39,18 @@ const char* plugin_transform(const char* input) {
         return NULL;
     }
     
-    // Rotate: move last character to front, shift others right
-    result[0] = input[len - 1];
-    for (size_t i = 1; i < len; i++) {
-        result[i] = input[i - 1];
+    size_t shift = (size_t)(((rotator_shift % (long)len) + (long)len) % (long)len);
+    if (!rotator_reverse) {
+        // Rotate: the last shift characters move to the front, the others shift right
+        memcpy(result, input + len - shift, shift);
+        memcpy(result + shift, input, len - shift);
+    } else {
+        // Reverse and rotate in one pass: input[i] lands at (len - 1 - i + shift) % len
+        size_t position = (len - 1 + shift) % len;
+        for (size_t i = 0; i < len; i++) {
+            result[position] = input[i];
+            position = position == 0 ? len - 1 : position - 1;
+        }
     }
     
     result[len] = '\0';
@@ -41,10 +58,87 @@ const char* plugin_transform(const char* input) {
     return result;
 }
 
+/**
+ * Reverse buffer[start, end)
+ */
+static void rotator_reverse_range(char* buffer, size_t start, size_t end) {
+    while (start + 1 < end) {
+        char c = buffer[start];
+        buffer[start++] = buffer[--end];
+        buffer[end] = c;
+    }
+}
+
+#define ROTATOR_IN_PLACE_RUN 256         // Longest run set aside to rotate with one memmove
+
+/**
+ * Transform the string in its own buffer. A plain rotation sets the shorter
+ * of the two runs aside and moves the other one over; rotating right by
+ * shift is also reversing the whole string, then its first shift characters
+ * and the rest separately, which is what reverse=1 and long runs use
+ */
+static const char* rotator_in_place(char* buffer) {
+    size_t len = strlen(buffer);
+    if (len <= 1) {
+        return buffer;
+    }
+    size_t shift = (size_t)(((rotator_shift % (long)len) + (long)len) % (long)len);
+    if (!rotator_reverse) {
+        char run[ROTATOR_IN_PLACE_RUN];
+        if (shift <= ROTATOR_IN_PLACE_RUN) {
+            memcpy(run, buffer + len - shift, shift);
+            memmove(buffer + shift, buffer, len - shift);
+            memcpy(buffer, run, shift);
+            return buffer;
+        }
+        if (len - shift <= ROTATOR_IN_PLACE_RUN) {
+            memcpy(run, buffer, len - shift);
+            memmove(buffer, buffer + len - shift, shift);
+            memcpy(buffer + shift, run, len - shift);
+            return buffer;
+        }
+        rotator_reverse_range(buffer, 0, len);
+    }
+    rotator_reverse_range(buffer, 0, shift);
+    rotator_reverse_range(buffer, shift, len);
+    return buffer;
+}
+
+static const plugin_capabilities_t rotator_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_IN_PLACE | PLUGIN_CAP_MEMOIZABLE | PLUGIN_CAP_THREAD_SAFE,
+    1, 0, rotator_in_place
+};
+
+/**
+ * Get the algebraic properties of the transform
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return PLUGIN_PROPERTY_PURE | PLUGIN_PROPERTY_POSITIONAL | PLUGIN_PROPERTY_ROTATION;
+}
+
 /**
  * Initialize the plugin
  */
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size) {
+    const char* shift = common_plugin_get_setting("shift");
+    if (shift) {
+        char* endptr;
+        long value = strtol(shift, &endptr, 10);
+        if (shift[0] == '\0' || *endptr != '\0' || value < -ROTATOR_MAX_SHIFT || value > ROTATOR_MAX_SHIFT) {
+            return "Invalid shift (expected -1000000 to 1000000)";
+        }
+        rotator_shift = value;
+    }
+    const char* reverse = common_plugin_get_setting("reverse");
+    if (reverse) {
+        if (strcmp(reverse, "0") != 0 && strcmp(reverse, "1") != 0) {
+            return "Invalid reverse (expected 0 or 1)";
+        }
+        rotator_reverse = reverse[0] == '1';
+    }
+    common_plugin_set_capabilities(&rotator_capabilities);
     return common_plugin_init(plugin_transform, "rotator", queue_size);
 }
\ No newline at end of file
@@ -1,7 +1,191 @@
 #include "consumer_producer.h"
+#include "probes.h"
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+
+/**
+ * Default release function: items are malloc'ed copies
+ */
+static void release_copy(char* item) {
+    free(item);
+}
+
+/**
+ * Monotonic clock in nanoseconds, for lane wait times
+ */
+static unsigned long long lane_clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+/**
+ * Free the rings of a multi-lane queue
+ */
+static void free_lanes(consumer_producer_lane_t* lanes, int lane_count) {
+    if (!lanes) {
+        return;
+    }
+    for (int i = 0; i < lane_count; i++) {
+        free(lanes[i].items);
+        free(lanes[i].sizes);
+        free(lanes[i].enqueued_ns);
+    }
+    free(lanes);
+}
+
+/**
+ * Check whether an item of size bytes has to wait for room (lock must be held)
+ * Under a byte budget an empty queue always takes the item, however large
+ */
+static int queue_is_full(const consumer_producer_t* queue, size_t size) {
+    return queue->count >= queue->capacity ||
+           (queue->max_bytes > 0 && queue->count > 0 && queue->bytes + size > queue->max_bytes);
+}
+
+/**
+ * Append an item of size bytes to a lane, or to the single ring (lock must be held)
+ */
+static void queue_push(consumer_producer_t* queue, char* item, size_t size, int lane) {
+    queue->count++;
+    queue->bytes += size;
+    if (queue->bytes > queue->peak_bytes) {
+        queue->peak_bytes = queue->bytes;
+    }
+    if (!queue->lanes) {
+        PROBE5(queue_enqueue, queue, item, lane, queue->count, queue->pushed);
+        queue->pushed++;
+        queue->items[queue->tail] = item;
+        queue->sizes[queue->tail] = size;
+        queue->tail = (queue->tail + 1) % queue->capacity;
+        return;
+    }
+
+    consumer_producer_lane_t* target = &queue->lanes[lane];
+    PROBE5(queue_enqueue, queue, item, lane, queue->count, target->pushed);
+    target->pushed++;
+    target->items[target->tail] = item;
+    target->sizes[target->tail] = size;
+    target->enqueued_ns[target->tail] = lane_clock_ns();
+    target->tail = (target->tail + 1) % queue->capacity;
+    target->count++;
+    if (target->count > target->max_depth) {
+        target->max_depth = target->count;
+    }
+}
+
+/**
+ * Choose the lane the next item comes from (lock must be held, queue not empty)
+ * A lane whose next item is the end marker waits until every other lane is empty
+ */
+static int queue_pick_lane(consumer_producer_t* queue) {
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < queue->lane_count; i++) {
+            consumer_producer_lane_t* lane = &queue->lanes[i];
+            if (lane->count == 0 ||
+                (queue->count > lane->count && strcmp(lane->items[lane->head], "<END>") == 0)) {
+                continue;
+            }
+            if (queue->lane_policy == LANE_STRICT || lane->credits > 0) {
+                return i;
+            }
+        }
+        // Every eligible lane used up its turns: start a new round
+        for (int i = 0; i < queue->lane_count; i++) {
+            queue->lanes[i].credits = 1 << (queue->lane_count - 1 - i);
+        }
+    }
+    return queue->lane_count - 1;
+}
+
+/**
+ * Remove the next item (lock must be held, queue not empty)
+ */
+static char* queue_pop(consumer_producer_t* queue, int* lane) {
+    queue->count--;
+    if (!queue->lanes) {
+        char* item = queue->items[queue->head];
+        PROBE5(queue_dequeue, queue, item, 0, queue->count, queue->popped);
+        queue->popped++;
+        queue->bytes -= queue->sizes[queue->head];
+        queue->items[queue->head] = NULL;
+        queue->head = (queue->head + 1) % queue->capacity;
+        *lane = 0;
+        return item;
+    }
+
+    *lane = queue_pick_lane(queue);
+    consumer_producer_lane_t* source = &queue->lanes[*lane];
+    char* item = source->items[source->head];
+    PROBE5(queue_dequeue, queue, item, *lane, queue->count, source->popped);
+    source->popped++;
+    queue->bytes -= source->sizes[source->head];
+    source->items[source->head] = NULL;
+    source->waited_ns += lane_clock_ns() - source->enqueued_ns[source->head];
+    source->head = (source->head + 1) % queue->capacity;
+    source->count--;
+    source->served++;
+    if (source->credits > 0) {
+        source->credits--;
+    }
+    return item;
+}
+
+/**
+ * Release every queued item (lock must be held)
+ */
+static void queue_discard_all(consumer_producer_t* queue) {
+    int lane;
+    while (queue->count > 0) {
+        queue->release(queue_pop(queue, &lane));
+    }
+}
+
+/**
+ * Evict the oldest item of the least urgent lane that has one (lock must be held)
+ * Returns 0 if an item was evicted, -1 if only end markers are queued
+ */
+static int queue_evict_oldest(consumer_producer_t* queue) {
+    // The end marker is always the last item of its lane, never evict it
+    if (!queue->lanes) {
+        if (strcmp(queue->items[queue->head], "<END>") == 0) {
+            return -1;
+        }
+        queue->bytes -= queue->sizes[queue->head];
+        queue->release(queue->items[queue->head]);
+        queue->popped++;
+        queue->items[queue->head] = NULL;
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        return 0;
+    }
+
+    for (int i = queue->lane_count - 1; i >= 0; i--) {
+        consumer_producer_lane_t* lane = &queue->lanes[i];
+        if (lane->count == 0 || strcmp(lane->items[lane->head], "<END>") == 0) {
+            continue;
+        }
+        queue->bytes -= lane->sizes[lane->head];
+        queue->release(lane->items[lane->head]);
+        lane->popped++;
+        lane->items[lane->head] = NULL;
+        lane->head = (lane->head + 1) % queue->capacity;
+        lane->count--;
+        queue->count--;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Map a requested lane to a valid one: anything out of range is the least urgent
+ */
+static int clamp_lane(const consumer_producer_t* queue, int lane) {
+    return lane >= 0 && lane < queue->lane_count ? lane : queue->lane_count - 1;
+}
 
 /**
  * Initialize a consumer-producer queue
@@ -17,27 +201,54 @@ const char* consumer_producer_init(consumer_producer_t* queue, int capacity) {
     
     // Allocate items array
     queue->items = (char**)calloc(capacity, sizeof(char*));
-    if (!queue->items) {
+    queue->sizes = (size_t*)calloc(capacity, sizeof(size_t));
+    if (!queue->items || !queue->sizes) {
+        free(queue->items);
+        free(queue->sizes);
+        queue->items = NULL;
+        queue->sizes = NULL;
         return "Failed to allocate memory for queue items";
     }
     
     // Initialize queue parameters
     queue->capacity = capacity;
     queue->count = 0;
+    queue->bytes = 0;
+    queue->max_bytes = 0;
+    queue->peak_bytes = 0;
     queue->head = 0;
     queue->tail = 0;
+    queue->pushed = 0;
+    queue->popped = 0;
+    queue->policy = OVERLOAD_BLOCK;
+    queue->sample_rate = 1;
+    queue->sample_counter = 0;
+    queue->dropped = 0;
+    queue->offer_admitted = 0;
+    queue->spilled = 0;
+    queue->release = release_copy;
+    queue->closed = 0;
+    queue->failure = NULL;
+    queue->lanes = NULL;
+    queue->lane_count = 1;
+    queue->lane_policy = LANE_STRICT;
+    spill_file_init(&queue->spill);
     
     // Initialize monitors
     if (monitor_init(&queue->not_full_monitor) != 0) {
         free(queue->items);
+        free(queue->sizes);
         queue->items = NULL;
+        queue->sizes = NULL;
         return "Failed to initialize not_full monitor";
     }
     
     if (monitor_init(&queue->not_empty_monitor) != 0) {
         monitor_destroy(&queue->not_full_monitor);
         free(queue->items);
+        free(queue->sizes);
         queue->items = NULL;
+        queue->sizes = NULL;
         return "Failed to initialize not_empty monitor";
     }
     
@@ -45,7 +256,9 @@ const char* consumer_producer_init(consumer_producer_t* queue, int capacity) {
         monitor_destroy(&queue->not_full_monitor);
         monitor_destroy(&queue->not_empty_monitor);
         free(queue->items);
+        free(queue->sizes);
         queue->items = NULL;
+        queue->sizes = NULL;
         return "Failed to initialize finished monitor";
     }
 
@@ -54,7 +267,9 @@ const char* consumer_producer_init(consumer_producer_t* queue, int capacity) {
         monitor_destroy(&queue->not_empty_monitor);
         monitor_destroy(&queue->finished_monitor);
         free(queue->items);
-        queue->items = NULL; 
+        free(queue->sizes);
+        queue->items = NULL;
+        queue->sizes = NULL;
         return "Failed to initilize the lock";
     }
 
@@ -71,14 +286,16 @@ void consumer_producer_destroy(consumer_producer_t* queue) {
     
     // Free any remaining items
     if (queue->items) {
-        for (int i = 0; i < queue->count; i++) {
-            int index = (queue->head + i) % queue->capacity;
-            free(queue->items[index]);
-            queue->items[index] = NULL;
-        }
+        queue_discard_all(queue);
         free(queue->items);
+        free(queue->sizes);
         queue->items = NULL;
+        queue->sizes = NULL;
     }
+    free_lanes(queue->lanes, queue->lane_count);
+    queue->lanes = NULL;
+    queue->lane_count = 1;
+    spill_file_destroy(&queue->spill);
     
     // Destroy monitors
     monitor_destroy(&queue->not_full_monitor);
@@ -96,9 +313,374 @@ void consumer_producer_destroy(consumer_producer_t* queue) {
 }
 
 /**
- * Add an item to the queue (producer)
+ * Parse an overload policy specification
  */
-const char* consumer_producer_put(consumer_producer_t* queue, const char* item) {
+const char* consumer_producer_parse_policy(const char* spec, overload_policy_t* policy, int* sample_rate) {
+    if (!spec || !policy || !sample_rate) {
+        return "Null policy argument";
+    }
+
+    *sample_rate = 1;
+
+    if (strcmp(spec, "block") == 0) {
+        *policy = OVERLOAD_BLOCK;
+    } else if (strcmp(spec, "drop-newest") == 0) {
+        *policy = OVERLOAD_DROP_NEWEST;
+    } else if (strcmp(spec, "drop-oldest") == 0) {
+        *policy = OVERLOAD_DROP_OLDEST;
+    } else if (strncmp(spec, "sample:", 7) == 0) {
+        char* endptr;
+        long rate = strtol(spec + 7, &endptr, 10);
+        if (spec[7] == '\0' || *endptr != '\0' || rate <= 0 || rate > 1000000) {
+            return "Invalid sample rate";
+        }
+        *policy = OVERLOAD_SAMPLE;
+        *sample_rate = (int)rate;
+    } else if (strcmp(spec, "spill") == 0) {
+        *policy = OVERLOAD_SPILL;
+    } else {
+        return "Unknown overload policy";
+    }
+
+    return NULL;
+}
+
+/**
+ * Set the overload policy of a queue
+ */
+const char* consumer_producer_set_policy(consumer_producer_t* queue, overload_policy_t policy, int sample_rate) {
+    if (!queue) {
+        return "Null queue pointer";
+    }
+    if (policy == OVERLOAD_SAMPLE && sample_rate <= 0) {
+        return "Invalid sample rate";
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    if (policy == OVERLOAD_SPILL && queue->lanes) {
+        pthread_mutex_unlock(&queue->lock);
+        return "The spill policy cannot be combined with priority lanes";
+    }
+    queue->policy = policy;
+    queue->sample_rate = sample_rate > 0 ? sample_rate : 1;
+    queue->sample_counter = 0;
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+/**
+ * Parse a priority lane specification
+ */
+const char* consumer_producer_parse_lanes(const char* spec, int* lanes, lane_policy_t* policy) {
+    if (!spec || !lanes || !policy) {
+        return "Null lanes argument";
+    }
+
+    char* endptr;
+    long count = strtol(spec, &endptr, 10);
+    if (endptr == spec || count < 2 || count > CONSUMER_PRODUCER_MAX_LANES) {
+        return "Invalid lane count (expected 2 to 4)";
+    }
+
+    if (*endptr == '\0' || strcmp(endptr, ":strict") == 0) {
+        *policy = LANE_STRICT;
+    } else if (strcmp(endptr, ":weighted") == 0) {
+        *policy = LANE_WEIGHTED;
+    } else {
+        return "Unknown lane policy (expected strict or weighted)";
+    }
+
+    *lanes = (int)count;
+    return NULL;
+}
+
+/**
+ * Split an empty queue into priority lanes
+ */
+const char* consumer_producer_set_lanes(consumer_producer_t* queue, int lanes, lane_policy_t policy) {
+    if (!queue) {
+        return "Null queue pointer";
+    }
+    if (lanes < 1 || lanes > CONSUMER_PRODUCER_MAX_LANES) {
+        return "Invalid lane count";
+    }
+
+    consumer_producer_lane_t* created = NULL;
+    if (lanes > 1) {
+        created = calloc((size_t)lanes, sizeof(consumer_producer_lane_t));
+        for (int i = 0; created && i < lanes; i++) {
+            created[i].items = calloc((size_t)queue->capacity, sizeof(char*));
+            created[i].sizes = calloc((size_t)queue->capacity, sizeof(size_t));
+            created[i].enqueued_ns = calloc((size_t)queue->capacity, sizeof(unsigned long long));
+            created[i].credits = 1 << (lanes - 1 - i);
+            if (!created[i].items || !created[i].sizes || !created[i].enqueued_ns) {
+                free_lanes(created, i + 1);
+                created = NULL;
+            }
+        }
+        if (!created) {
+            return "Failed to allocate memory for queue lanes";
+        }
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    const char* error = NULL;
+    if (queue->count > 0 || queue->spill.count > 0) {
+        error = "Queue is not empty";
+    } else if (lanes > 1 && queue->policy == OVERLOAD_SPILL) {
+        error = "The spill policy cannot be combined with priority lanes";
+    } else {
+        free_lanes(queue->lanes, queue->lane_count);
+        queue->lanes = created;
+        queue->lane_count = lanes;
+        queue->lane_policy = policy;
+        created = NULL;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    free_lanes(created, lanes);
+    return error;
+}
+
+/**
+ * Get the counters of one lane
+ */
+const char* consumer_producer_lane_stats(consumer_producer_t* queue, int lane, consumer_producer_lane_stats_t* stats) {
+    if (!queue || !stats) {
+        return "Null lane stats argument";
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->lanes || lane < 0 || lane >= queue->lane_count) {
+        pthread_mutex_unlock(&queue->lock);
+        return "No such lane";
+    }
+    consumer_producer_lane_t* source = &queue->lanes[lane];
+    stats->depth = source->count;
+    stats->max_depth = source->max_depth;
+    stats->served = source->served;
+    stats->average_wait_us = source->served ? (double)source->waited_ns / source->served / 1000.0 : 0.0;
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+/**
+ * Parse a byte budget
+ */
+const char* consumer_producer_parse_bytes(const char* spec, size_t* bytes) {
+    if (!spec || !bytes) {
+        return "Null byte budget argument";
+    }
+
+    char* endptr;
+    errno = 0;
+    unsigned long long size = strtoull(spec, &endptr, 10);
+    if (endptr == spec || spec[0] == '-') {
+        return "Invalid byte budget";
+    }
+    unsigned long long multiplier = 1;
+    if (*endptr == 'k' || *endptr == 'K') {
+        multiplier = 1024;
+        endptr++;
+    } else if (*endptr == 'm' || *endptr == 'M') {
+        multiplier = 1024 * 1024;
+        endptr++;
+    } else if (*endptr == 'g' || *endptr == 'G') {
+        multiplier = 1024 * 1024 * 1024;
+        endptr++;
+    }
+    // Checked before multiplying, so a huge count cannot wrap around to a small budget
+    if (errno == ERANGE || *endptr != '\0' || size == 0 || size > (1ULL << 40) / multiplier) {
+        return "Invalid byte budget (expected e.g. 64k, 16m or 1g)";
+    }
+    size *= multiplier;
+
+    *bytes = (size_t)size;
+    return NULL;
+}
+
+/**
+ * Bound the queue by the bytes of its items
+ */
+const char* consumer_producer_set_max_bytes(consumer_producer_t* queue, size_t max_bytes) {
+    if (!queue) {
+        return "Null queue pointer";
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->max_bytes = max_bytes;
+    pthread_mutex_unlock(&queue->lock);
+
+    // A raised budget may make room for a blocked producer
+    monitor_signal(&queue->not_full_monitor);
+    return NULL;
+}
+
+/**
+ * Get the bytes of the items queued now
+ */
+size_t consumer_producer_bytes(consumer_producer_t* queue) {
+    if (!queue) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    size_t bytes = queue->bytes;
+    pthread_mutex_unlock(&queue->lock);
+
+    return bytes;
+}
+
+/**
+ * Get the most bytes queued at once so far
+ */
+size_t consumer_producer_peak_bytes(consumer_producer_t* queue) {
+    if (!queue) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    size_t peak_bytes = queue->peak_bytes;
+    pthread_mutex_unlock(&queue->lock);
+
+    return peak_bytes;
+}
+
+/**
+ * Get the number of items discarded by the overload policy so far
+ */
+unsigned long consumer_producer_dropped(consumer_producer_t* queue) {
+    if (!queue) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    unsigned long dropped = queue->dropped;
+    pthread_mutex_unlock(&queue->lock);
+
+    return dropped;
+}
+
+/**
+ * Get the number of items that overflowed into the spill file so far
+ */
+unsigned long consumer_producer_spilled(consumer_producer_t* queue) {
+    if (!queue) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    unsigned long spilled = queue->spilled;
+    pthread_mutex_unlock(&queue->lock);
+
+    return spilled;
+}
+
+/**
+ * Get the reason the queue closed itself, or NULL
+ */
+const char* consumer_producer_failure(consumer_producer_t* queue) {
+    if (!queue) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    const char* failure = queue->failure;
+    pthread_mutex_unlock(&queue->lock);
+
+    return failure;
+}
+
+/**
+ * Append an item to the spill file if the queue is full or already spilling
+ * (lock must be held); the end marker follows the same path to stay last
+ * Returns 1 if the item was spilled, 0 if it has to go into the queue
+ * (a record too large to spill then waits for space like OVERLOAD_BLOCK)
+ */
+static int spill_if_full(consumer_producer_t* queue, const char* item, size_t size) {
+    if (queue->policy != OVERLOAD_SPILL ||
+        (!queue_is_full(queue, size) && queue->spill.count == 0)) {
+        return 0;
+    }
+    if (spill_file_append(&queue->spill, item, size - 1) != NULL) {
+        return 0;
+    }
+    queue->spilled++;
+    return 1;
+}
+
+/**
+ * Move the oldest spilled item into the slot a consumer just freed (lock must be held)
+ * Under a byte budget it waits until the queue is below the budget; it may then
+ * exceed it by up to one item
+ */
+static void refill_from_spill(consumer_producer_t* queue) {
+    if (queue->spill.count == 0 || queue_is_full(queue, 1)) {
+        return;
+    }
+    size_t length;
+    char* item = spill_file_take(&queue->spill, &length);
+    if (!item) {
+        // The stream has a hole now: fail the queue instead of waiting for the rest forever
+        queue->dropped += queue->spill.count;
+        spill_file_destroy(&queue->spill);
+        queue->failure = "Failed to read back a spilled item";
+        queue->closed = 1;
+        monitor_signal(&queue->not_full_monitor);
+        monitor_signal(&queue->not_empty_monitor);
+        return;
+    }
+    queue_push(queue, item, length + 1, 0);
+}
+
+/**
+ * Apply a non-blocking overload policy to a queue too full for an item of size bytes (lock must be held)
+ * Returns 1 if the new item should be discarded, 0 if it may be added now,
+ * -1 if the caller has to wait for space
+ */
+static int apply_overload_policy(consumer_producer_t* queue, size_t size) {
+    switch (queue->policy) {
+        case OVERLOAD_DROP_NEWEST:
+            return 1;
+
+        case OVERLOAD_DROP_OLDEST:
+            // One eviction frees a slot; the byte budget may need more
+            do {
+                if (queue_evict_oldest(queue) != 0) {
+                    return -1;
+                }
+                queue->dropped++;
+            } while (queue_is_full(queue, size));
+            return 0;
+
+        case OVERLOAD_SAMPLE:
+            // Keep one of every N arrivals while full; it takes the place of the oldest
+            queue->sample_counter++;
+            if (queue->sample_counter % (unsigned long)queue->sample_rate != 0) {
+                return 1;
+            }
+            do {
+                if (queue_evict_oldest(queue) != 0) {
+                    return -1;
+                }
+                queue->dropped++;
+            } while (queue_is_full(queue, size));
+            return 0;
+
+        case OVERLOAD_SPILL:           // Only a record too large to spill gets here
+        case OVERLOAD_BLOCK:
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Add an item to a lane of the queue, copying it unless owned is set (then owned == item)
+ * An owned item passes to the queue unless an error is returned
+ */
+static const char* put_item(consumer_producer_t* queue, const char* item, char* owned, int lane) {
     if (!queue) {
         return "Null queue pointer";
     }
@@ -109,33 +691,69 @@ const char* consumer_producer_put(consumer_producer_t* queue, const char* item)
         return "Queue has been destroyed";
     }
 
+    // The end-of-stream signal must always get through
+    int is_end = (strcmp(item, "<END>") == 0);
+    size_t size = strlen(item) + 1;
+
     pthread_mutex_lock(&queue->lock);
 
+    if (queue->closed) {
+        const char* error = queue->failure ? queue->failure : "Queue is closed";
+        pthread_mutex_unlock(&queue->lock);
+        return error;
+    }
+
+    if (spill_if_full(queue, item, size)) {
+        pthread_mutex_unlock(&queue->lock);
+        if (owned) {
+            queue->release(owned);
+        }
+        return NULL;
+    }
+
+    if (queue_is_full(queue, size) && !is_end) {
+        int action = apply_overload_policy(queue, size);
+        if (action > 0) {
+            queue->dropped++;
+            pthread_mutex_unlock(&queue->lock);
+            if (owned) {
+                queue->release(owned);
+            }
+            return NULL;
+        }
+    }
+
     // Wait until queue is not full
-    while (queue->count >= queue->capacity) {
+    while (queue_is_full(queue, size)) {
+        PROBE2(queue_full, queue, queue->count);
         pthread_mutex_unlock(&queue->lock);
         if (monitor_wait(&queue->not_full_monitor) != 0) {
             return "Wait for not_full failed";
         }
         pthread_mutex_lock(&queue->lock);
+        if (queue->closed) {
+            // Pass the wake-up on to any other blocked producer
+            const char* error = queue->failure ? queue->failure : "Queue is closed";
+            monitor_signal(&queue->not_full_monitor);
+            pthread_mutex_unlock(&queue->lock);
+            return error;
+        }
     }
 
     // Duplicate the item to take ownership
-    char* item_copy = strdup(item);
+    char* item_copy = owned ? owned : strdup(item);
     if (!item_copy) {
         pthread_mutex_unlock(&queue->lock);
         return "Memory allocation failed for item";
     }
     
     // Add item to queue (make a copy to ensure ownership)
-    queue->items[queue->tail] = item_copy;
-    queue->tail = (queue->tail + 1) % queue->capacity;
-    queue->count++;
+    queue_push(queue, item_copy, size, clamp_lane(queue, lane));
     
     // Signal that queue is not empty
     monitor_signal(&queue->not_empty_monitor);
 
-    if (queue->count < queue->capacity) {
+    if (!queue_is_full(queue, 1)) {
         monitor_signal(&queue->not_full_monitor);
     }
 
@@ -144,6 +762,132 @@ const char* consumer_producer_put(consumer_producer_t* queue, const char* item)
     return NULL;
 }
 
+/**
+ * Add an item to a lane of the queue without waiting, copying it unless owned is set
+ * An owned item passes to the queue if *taken is set
+ */
+static const char* offer_item(consumer_producer_t* queue, const char* item, char* owned, int lane, int* taken) {
+    if (!queue || !taken) {
+        return "Null queue pointer";
+    }
+    if (!item) {
+        return "Null item pointer";
+    }
+    if (!queue->items) {
+        return "Queue has been destroyed";
+    }
+
+    *taken = 0;
+    int is_end = (strcmp(item, "<END>") == 0);
+    size_t size = strlen(item) + 1;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->closed) {
+        const char* error = queue->failure ? queue->failure : "Queue is closed";
+        pthread_mutex_unlock(&queue->lock);
+        return error;
+    }
+
+    if (spill_if_full(queue, item, size)) {
+        pthread_mutex_unlock(&queue->lock);
+        if (owned) {
+            queue->release(owned);
+        }
+        *taken = 1;
+        return NULL;
+    }
+
+    if (queue_is_full(queue, size) && !is_end && !queue->offer_admitted) {
+        int action = apply_overload_policy(queue, size);
+        if (action > 0) {
+            queue->dropped++;
+            pthread_mutex_unlock(&queue->lock);
+            if (owned) {
+                queue->release(owned);
+            }
+            *taken = 1;
+            return NULL;
+        }
+        if (action < 0) {
+            // Kept by the policy; the retry must not be sampled again
+            queue->offer_admitted = 1;
+        }
+    }
+
+    if (queue_is_full(queue, size)) {
+        pthread_mutex_unlock(&queue->lock);
+        return NULL;
+    }
+
+    char* item_copy = owned ? owned : strdup(item);
+    if (!item_copy) {
+        pthread_mutex_unlock(&queue->lock);
+        return "Memory allocation failed for item";
+    }
+
+    queue_push(queue, item_copy, size, clamp_lane(queue, lane));
+    queue->offer_admitted = 0;
+
+    monitor_signal(&queue->not_empty_monitor);
+
+    pthread_mutex_unlock(&queue->lock);
+
+    *taken = 1;
+    return NULL;
+}
+
+/**
+ * Add an item to the queue (producer)
+ */
+const char* consumer_producer_put(consumer_producer_t* queue, const char* item) {
+    return put_item(queue, item, NULL, -1);
+}
+
+/**
+ * Hand an item over to the queue (producer)
+ */
+const char* consumer_producer_put_owned(consumer_producer_t* queue, char* item) {
+    return put_item(queue, item, item, -1);
+}
+
+/**
+ * Hand an item over to one lane of the queue (producer)
+ */
+const char* consumer_producer_put_owned_lane(consumer_producer_t* queue, char* item, int lane) {
+    return put_item(queue, item, item, lane);
+}
+
+/**
+ * Add an item to the queue without waiting (producer)
+ */
+const char* consumer_producer_offer(consumer_producer_t* queue, const char* item, int* taken) {
+    return offer_item(queue, item, NULL, -1, taken);
+}
+
+/**
+ * Hand an item over to the queue without waiting (producer)
+ */
+const char* consumer_producer_offer_owned(consumer_producer_t* queue, char* item, int* taken) {
+    return offer_item(queue, item, item, -1, taken);
+}
+
+/**
+ * Hand an item over to one lane without waiting (producer)
+ */
+const char* consumer_producer_offer_owned_lane(consumer_producer_t* queue, char* item, int lane, int* taken) {
+    return offer_item(queue, item, item, lane, taken);
+}
+
+/**
+ * Set how the queue frees the items it discards or still holds when destroyed
+ */
+void consumer_producer_set_release(consumer_producer_t* queue, void (*release)(char*)) {
+    if (queue) {
+        queue->release = release ? release : release_copy;
+    }
+}
+
 /**
  * Remove an item from the queue (consumer)
  */
@@ -154,8 +898,13 @@ char* consumer_producer_get(consumer_producer_t* queue) {
 
     pthread_mutex_lock(&queue->lock);
 
-    // Wait until the queue is not empty or finished
+    // Wait until the queue is not empty or closed
     while (queue->count <= 0) {
+        if (queue->closed) {
+            pthread_mutex_unlock(&queue->lock);
+            return NULL;
+        }
+        PROBE1(queue_empty, queue);
         pthread_mutex_unlock(&queue->lock);
         if (monitor_wait(&queue->not_empty_monitor) != 0) {
             return NULL;
@@ -164,10 +913,9 @@ char* consumer_producer_get(consumer_producer_t* queue) {
     }
 
     // Get item from queue
-    char* item = queue->items[queue->head];
-    queue->items[queue->head] = NULL;
-    queue->head = (queue->head + 1) % queue->capacity;
-    queue->count--;
+    int lane;
+    char* item = queue_pop(queue, &lane);
+    refill_from_spill(queue);
     
     // Signal that queue is not full
     monitor_signal(&queue->not_full_monitor);
@@ -181,6 +929,60 @@ char* consumer_producer_get(consumer_producer_t* queue) {
     return item;
 }
 
+/**
+ * Remove an item from the queue (consumer) without waiting
+ */
+char* consumer_producer_try_get(consumer_producer_t* queue) {
+    int lane;
+    return consumer_producer_try_get_lane(queue, &lane);
+}
+
+/**
+ * Remove an item from the queue (consumer) without waiting, and tell its lane
+ */
+char* consumer_producer_try_get_lane(consumer_producer_t* queue, int* lane) {
+    if (!queue || !lane) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->count <= 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return NULL;
+    }
+
+    char* item = queue_pop(queue, lane);
+    refill_from_spill(queue);
+
+    // A producer blocked in consumer_producer_put may continue
+    monitor_signal(&queue->not_full_monitor);
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+/**
+ * Close the queue and discard its items
+ */
+unsigned long consumer_producer_close(consumer_producer_t* queue) {
+    if (!queue || !queue->items) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    unsigned long discarded = (unsigned long)queue->count + queue->spill.count;
+    queue_discard_all(queue);
+    spill_file_destroy(&queue->spill);
+    queue->closed = 1;
+    pthread_mutex_unlock(&queue->lock);
+
+    monitor_signal(&queue->not_full_monitor);
+    monitor_signal(&queue->not_empty_monitor);
+    return discarded;
+}
+
 /**
  * Signal that processing is finished
  */
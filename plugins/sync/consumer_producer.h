@@ -2,21 +2,93 @@
 #define CONSUMER_PRODUCER_H
 
 #include "monitor.h"
+#include "spill_file.h"
+
+/**
+ * Overload policy applied by consumer_producer_put when the queue is full.
+ * The end-of-stream marker "<END>" is never dropped, whatever the policy.
+ */
+typedef enum {
+    OVERLOAD_BLOCK = 0,                /* Wait for space (default back-pressure) */
+    OVERLOAD_DROP_NEWEST,              /* Discard the item being added */
+    OVERLOAD_DROP_OLDEST,              /* Evict the oldest queued item to make room */
+    OVERLOAD_SAMPLE,                   /* Admit 1 in N arriving items in place of the oldest, discard the rest */
+    OVERLOAD_SPILL                     /* Append items to a spill file on disk until the queue drains */
+} overload_policy_t;
+
+/**
+ * How consumers choose among the priority lanes of a multi-lane queue
+ * (lane 0 is the most urgent). "<END>" is taken only once every other lane is empty.
+ */
+typedef enum {
+    LANE_STRICT = 0,                   /* Always serve the most urgent non-empty lane */
+    LANE_WEIGHTED                      /* Per round, serve lane i up to 2^(lanes-1-i) times */
+} lane_policy_t;
+
+#define CONSUMER_PRODUCER_MAX_LANES 4
+
+/**
+ * One priority lane of a multi-lane queue
+ */
+typedef struct {
+    char** items;                      /* Ring of capacity string pointers */
+    size_t* sizes;                     /* Bytes of each item, terminator included */
+    unsigned long long* enqueued_ns;   /* When each item was queued */
+    int head;
+    int tail;
+    unsigned long long pushed;         /* Items that entered the ring (the next one's sequence number) */
+    unsigned long long popped;         /* Items that left it, taken or evicted */
+    int count;
+    int credits;                       /* Turns left in the current round (LANE_WEIGHTED) */
+    int max_depth;                     /* Most items queued at once */
+    unsigned long served;              /* Items taken out */
+    unsigned long long waited_ns;      /* Time the served items spent queued */
+} consumer_producer_lane_t;
+
+/**
+ * Per-lane counters of a multi-lane queue
+ */
+typedef struct {
+    int depth;                         /* Items queued now */
+    int max_depth;                     /* Most items queued at once */
+    unsigned long served;              /* Items taken out */
+    double average_wait_us;            /* Mean time a served item spent queued */
+} consumer_producer_lane_stats_t;
 
 /**
  * Consumer-Producer queue structure for thread-safe producer-consumer pattern
  * Uses monitors for simpler implementation
  */
 typedef struct {
-    char** items;                      /* Array of string pointers */
+    char** items;                      /* Array of string pointers (single lane) */
+    size_t* sizes;                     /* Bytes of each item, terminator included (single lane) */
     int capacity;                      /* Maximum number of items */
-    int count;                         /* Current number of items */
-    int head;                          /* Index of first item */
-    int tail;                          /* Index of next insertion point */
+    int count;                         /* Current number of items (in all lanes) */
+    size_t bytes;                      /* Bytes of the queued items, terminators included */
+    size_t max_bytes;                  /* Byte budget, or 0 to bound by capacity only */
+    size_t peak_bytes;                 /* Most bytes queued at once */
+    int head;                          /* Index of first item (single lane) */
+    int tail;                          /* Index of next insertion point (single lane) */
+    unsigned long long pushed;         /* Items that entered the single ring (sequence numbers) */
+    unsigned long long popped;         /* Items that left it, taken or evicted */
+    consumer_producer_lane_t* lanes;   /* Priority lanes, or NULL when items is one FIFO */
+    int lane_count;                    /* 1 unless consumer_producer_set_lanes was called */
+    lane_policy_t lane_policy;
     monitor_t not_full_monitor;        /* Monitor for "not full" state */
     monitor_t not_empty_monitor;       /* Monitor for "not empty" state */
     monitor_t finished_monitor;        /* Monitor for finished signal */
     pthread_mutex_t lock;
+    overload_policy_t policy;          /* What to do when the queue is full */
+    int sample_rate;                   /* N for OVERLOAD_SAMPLE */
+    unsigned long sample_counter;      /* Arrivals seen while full (OVERLOAD_SAMPLE) */
+    unsigned long dropped;             /* Items discarded by the overload policy */
+    int offer_admitted;                /* An offered item passed the policy but found no space */
+    spill_file_t spill;                /* Items behind the full queue (OVERLOAD_SPILL); while it
+                                          holds any, the queue stays full and new items go here */
+    unsigned long spilled;             /* Items that went through the spill file */
+    void (*release)(char*);            /* Frees a discarded or leftover item (default free) */
+    int closed;                        /* Set by consumer_producer_close: no more items in or out */
+    const char* failure;               /* Why the queue closed itself (a spilled item was lost), or NULL */
 } consumer_producer_t;
 
 /**
@@ -33,15 +105,178 @@ const char* consumer_producer_init(consumer_producer_t* queue, int capacity);
  */
 void consumer_producer_destroy(consumer_producer_t* queue);
 
+/**
+ * Parse an overload policy specification
+ * Accepted forms: "block", "drop-newest", "drop-oldest", "sample:N" (N >= 1), "spill"
+ * @param spec Policy specification
+ * @param policy Receives the parsed policy
+ * @param sample_rate Receives N for "sample:N", 1 otherwise
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_parse_policy(const char* spec, overload_policy_t* policy, int* sample_rate);
+
+/**
+ * Set the overload policy of a queue
+ * @param queue Pointer to queue structure
+ * @param policy Policy to apply when the queue is full
+ * @param sample_rate N for OVERLOAD_SAMPLE (ignored by other policies)
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_set_policy(consumer_producer_t* queue, overload_policy_t policy, int sample_rate);
+
+/**
+ * Parse a priority lane specification: "N", "N:strict" or "N:weighted"
+ * with 2 <= N <= CONSUMER_PRODUCER_MAX_LANES
+ * @param spec Lane specification
+ * @param lanes Receives N
+ * @param policy Receives the scheduling policy (strict by default)
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_parse_lanes(const char* spec, int* lanes, lane_policy_t* policy);
+
+/**
+ * Split an empty queue into priority lanes; the capacity bounds all lanes
+ * together. Plain put and offer use the least urgent lane.
+ * Cannot be combined with OVERLOAD_SPILL.
+ * @param queue Pointer to queue structure
+ * @param lanes Number of lanes (1 to CONSUMER_PRODUCER_MAX_LANES)
+ * @param policy How get chooses a lane
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_set_lanes(consumer_producer_t* queue, int lanes, lane_policy_t policy);
+
+/**
+ * Get the counters of one lane of a multi-lane queue
+ * @param queue Pointer to queue structure
+ * @param lane Lane index (0 is the most urgent)
+ * @param stats Receives the counters
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_lane_stats(consumer_producer_t* queue, int lane, consumer_producer_lane_stats_t* stats);
+
+/**
+ * Parse a byte budget: a number of bytes with an optional k, m or g suffix
+ * @param spec Budget specification, e.g. "64k" or "16m"
+ * @param bytes Receives the budget
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_parse_bytes(const char* spec, size_t* bytes);
+
+/**
+ * Bound the queue by the bytes of its items as well as by their number.
+ * When the next item does not fit the budget the queue counts as full (the
+ * overload policy applies); an item larger than the whole budget still
+ * enters an empty queue.
+ * @param queue Pointer to queue structure
+ * @param max_bytes Byte budget, or 0 for none
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_set_max_bytes(consumer_producer_t* queue, size_t max_bytes);
+
+/**
+ * Get the bytes of the items queued now, terminators included
+ * @param queue Pointer to queue structure
+ * @return Queued bytes
+ */
+size_t consumer_producer_bytes(consumer_producer_t* queue);
+
+/**
+ * Get the most bytes queued at once so far
+ * @param queue Pointer to queue structure
+ * @return Peak queued bytes
+ */
+size_t consumer_producer_peak_bytes(consumer_producer_t* queue);
+
+/**
+ * Get the number of items discarded by the overload policy so far
+ * @param queue Pointer to queue structure
+ * @return Number of dropped items
+ */
+unsigned long consumer_producer_dropped(consumer_producer_t* queue);
+
+/**
+ * Get the number of items that overflowed into the spill file so far
+ * @param queue Pointer to queue structure
+ * @return Number of spilled items
+ */
+unsigned long consumer_producer_spilled(consumer_producer_t* queue);
+
+/**
+ * Get the reason the queue closed itself: a spilled item could not be read
+ * back, so the rest of the stream is incomplete. Producers then get this
+ * message as their error; the consumer gets the items still queued, then NULL.
+ * @param queue Pointer to queue structure
+ * @return The reason, or NULL if the queue has not failed
+ */
+const char* consumer_producer_failure(consumer_producer_t* queue);
+
 /**
  * Add an item to the queue (producer).
- * Blocks if queue is full.
+ * If the queue is full, blocks or discards an item according to the overload policy.
  * @param queue Pointer to queue structure
  * @param item String to add (queue takes ownership)
  * @return NULL on success, error message on failure
  */
 const char* consumer_producer_put(consumer_producer_t* queue, const char* item);
 
+/**
+ * Add an item to the queue without waiting (producer).
+ * Applies the overload policy like consumer_producer_put; where put would wait
+ * for space, returns with *taken = 0 instead and the caller has to offer the
+ * same item again later (the policy's decision to keep it is remembered).
+ * @param queue Pointer to queue structure
+ * @param item String to add (copied when added)
+ * @param taken Receives 1 if the item was added or discarded, 0 if the queue is full
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_offer(consumer_producer_t* queue, const char* item, int* taken);
+
+/**
+ * Hand an item over to the queue (producer): like consumer_producer_put, but
+ * the item itself is queued instead of a copy, or released if it is discarded
+ * @param queue Pointer to queue structure
+ * @param item Item to add; belongs to the queue unless an error is returned
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_put_owned(consumer_producer_t* queue, char* item);
+
+/**
+ * Hand an item over to the queue without waiting (producer): like
+ * consumer_producer_offer, but the item itself is queued instead of a copy
+ * @param queue Pointer to queue structure
+ * @param item Item to add; belongs to the queue once *taken is set
+ * @param taken Receives 1 if the item was added or discarded, 0 if the queue is full
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_offer_owned(consumer_producer_t* queue, char* item, int* taken);
+
+/**
+ * Hand an item over to one lane of the queue (producer); see consumer_producer_put_owned
+ * @param queue Pointer to queue structure
+ * @param item Item to add; belongs to the queue unless an error is returned
+ * @param lane Lane index; out of range means the least urgent lane
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_put_owned_lane(consumer_producer_t* queue, char* item, int lane);
+
+/**
+ * Hand an item over to one lane without waiting (producer); see consumer_producer_offer_owned
+ * @param queue Pointer to queue structure
+ * @param item Item to add; belongs to the queue once *taken is set
+ * @param lane Lane index; out of range means the least urgent lane
+ * @param taken Receives 1 if the item was added or discarded, 0 if the queue is full
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_offer_owned_lane(consumer_producer_t* queue, char* item, int lane, int* taken);
+
+/**
+ * Set how the queue frees items it discards, spills or still holds when
+ * destroyed; items taken out with get belong to the consumer
+ * @param queue Pointer to queue structure
+ * @param release Release function, or NULL for free
+ */
+void consumer_producer_set_release(consumer_producer_t* queue, void (*release)(char*));
+
 /**
  * Remove an item from the queue (consumer) and returns it.
  * Blocks if queue is empty.
@@ -50,6 +285,30 @@ const char* consumer_producer_put(consumer_producer_t* queue, const char* item);
  */
 char* consumer_producer_get(consumer_producer_t* queue);
 
+/**
+ * Remove an item from the queue (consumer) without waiting.
+ * @param queue Pointer to queue structure
+ * @return String item or NULL if queue is empty
+ */
+char* consumer_producer_try_get(consumer_producer_t* queue);
+
+/**
+ * Remove an item from the queue (consumer) without waiting, and tell its lane
+ * @param queue Pointer to queue structure
+ * @param lane Receives the item's lane (0 for a single-lane queue)
+ * @return String item or NULL if queue is empty
+ */
+char* consumer_producer_try_get_lane(consumer_producer_t* queue, int* lane);
+
+/**
+ * Close the queue: discard every queued (and spilled) item and wake a
+ * blocked producer and consumer. From then on put and offer fail with
+ * "Queue is closed" (an owned item stays with the caller) and get returns NULL.
+ * @param queue Pointer to queue structure
+ * @return Number of items discarded
+ */
+unsigned long consumer_producer_close(consumer_producer_t* queue);
+
 /**
  * Signal that processing is finished
  * @param queue Pointer to queue structure
@@ -0,0 +1,45 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/**
+ * Static tracepoints (USDT, provider "analyzer") on the queue and transform
+ * hot paths, for perf and bpftrace against a running analyzer; see
+ * trace/stage_latency.bt. With <sys/sdt.h> (systemtap-sdt-dev) a probe is a
+ * single nop plus a note section entry, so they stay compiled in; without it,
+ * or with -DANALYZER_NO_PROBES, they compile to nothing and their arguments
+ * are not evaluated.
+ *
+ *   queue_enqueue(queue, item, lane, count, seq)  item added; count after adding, seq
+ *                                             numbers the items of each lane in order
+ *   queue_dequeue(queue, item, lane, count, seq)  item taken; seq as given at enqueue
+ *   queue_full(queue, count)                  a producer blocks for space
+ *   queue_empty(queue)                        a consumer blocks for an item
+ *   transform_begin(name, item)               a consumer thread calls the transform
+ *   transform_end(name, result)               ...and it returned (PLUGIN_DROP is -1)
+ *   stage_begin(pipeline, index, item)        a worker runs stage index's transform
+ *   stage_end(pipeline, index, result)
+ *   stream_end(name)                          a consumer thread reached "<END>"
+ */
+
+#if !defined(ANALYZER_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ANALYZER_PROBES 1
+#endif
+#endif
+
+#ifdef ANALYZER_PROBES
+#define PROBE1(name, a) DTRACE_PROBE1(analyzer, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(analyzer, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(analyzer, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(analyzer, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(analyzer, name, a, b, c, d, e)
+#else
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#define PROBE5(name, a, b, c, d, e) do { } while (0)
+#endif
+
+#endif // PROBES_H
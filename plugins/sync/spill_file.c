@@ -0,0 +1,192 @@
+// Already defined when the monolithic build compiles it into a plugin's unit
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "spill_file.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define SPILL_HEADER_SIZE sizeof(uint32_t)
+#define SPILL_SEGMENT_END UINT32_MAX   /* The rest of the segment is unused */
+
+/**
+ * Map one segment of the file
+ */
+static char* spill_map_segment(spill_file_t* spill, unsigned long segment) {
+    void* map = mmap(NULL, SPILL_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     spill->fd, (off_t)segment * SPILL_SEGMENT_SIZE);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/**
+ * Create the unlinked temporary file
+ */
+static const char* spill_create_file(spill_file_t* spill) {
+    const char* directory = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/analyzer-spill-XXXXXX",
+             directory && directory[0] != '\0' ? directory : "/tmp");
+
+    spill->fd = mkstemp(path);
+    if (spill->fd < 0) {
+        return "Failed to create spill file";
+    }
+    unlink(path);
+    return NULL;
+}
+
+/**
+ * Start writing a new segment after the current one
+ */
+static const char* spill_next_write_segment(spill_file_t* spill) {
+    unsigned long segment = spill->write_map ? spill->write_segment + 1 : spill->write_segment;
+    if (ftruncate(spill->fd, (off_t)(segment + 1) * SPILL_SEGMENT_SIZE) != 0) {
+        return "Failed to grow spill file";
+    }
+
+    char* map = spill_map_segment(spill, segment);
+    if (!map) {
+        return "Failed to map spill file";
+    }
+    if (spill->write_map) {
+        // Written segments go to the page cache; only the reader maps them again
+        munmap(spill->write_map, SPILL_SEGMENT_SIZE);
+    }
+    spill->write_map = map;
+    spill->write_segment = segment;
+    spill->write_offset = 0;
+    return NULL;
+}
+
+/**
+ * Drop the mappings and truncate the file once every record has been read
+ */
+static void spill_reset(spill_file_t* spill) {
+    if (spill->read_map) {
+        munmap(spill->read_map, SPILL_SEGMENT_SIZE);
+    }
+    if (spill->write_map) {
+        munmap(spill->write_map, SPILL_SEGMENT_SIZE);
+    }
+    spill->read_map = NULL;
+    spill->write_map = NULL;
+    spill->read_segment = 0;
+    spill->write_segment = 0;
+    spill->read_offset = 0;
+    spill->write_offset = 0;
+    // On failure the space is still reused from the start
+    int truncated = ftruncate(spill->fd, 0);
+    (void)truncated;
+}
+
+/**
+ * Initialize an empty spill file
+ */
+void spill_file_init(spill_file_t* spill) {
+    memset(spill, 0, sizeof(*spill));
+    spill->fd = -1;
+}
+
+/**
+ * Release the mappings and close the file
+ */
+void spill_file_destroy(spill_file_t* spill) {
+    if (!spill || spill->fd < 0) {
+        return;
+    }
+    spill_reset(spill);
+    close(spill->fd);
+    spill_file_init(spill);
+}
+
+/**
+ * Append a record
+ */
+const char* spill_file_append(spill_file_t* spill, const char* record, size_t length) {
+    if (!spill || !record) {
+        return "Null spill argument";
+    }
+    if (length + SPILL_HEADER_SIZE > SPILL_SEGMENT_SIZE) {
+        return "Record too large to spill";
+    }
+
+    if (spill->fd < 0) {
+        const char* error = spill_create_file(spill);
+        if (error) {
+            return error;
+        }
+    }
+
+    // Records never cross a segment boundary
+    if (!spill->write_map || spill->write_offset + SPILL_HEADER_SIZE + length > SPILL_SEGMENT_SIZE) {
+        if (spill->write_map && spill->write_offset + SPILL_HEADER_SIZE <= SPILL_SEGMENT_SIZE) {
+            uint32_t end = SPILL_SEGMENT_END;
+            memcpy(spill->write_map + spill->write_offset, &end, sizeof(end));
+        }
+        const char* error = spill_next_write_segment(spill);
+        if (error) {
+            return error;
+        }
+    }
+
+    uint32_t header = (uint32_t)length;
+    memcpy(spill->write_map + spill->write_offset, &header, sizeof(header));
+    memcpy(spill->write_map + spill->write_offset + SPILL_HEADER_SIZE, record, length);
+    spill->write_offset += SPILL_HEADER_SIZE + length;
+    spill->count++;
+    return NULL;
+}
+
+/**
+ * Remove the oldest record
+ */
+char* spill_file_take(spill_file_t* spill, size_t* length) {
+    if (!spill || spill->count == 0) {
+        return NULL;
+    }
+
+    while (1) {
+        if (!spill->read_map) {
+            spill->read_map = spill_map_segment(spill, spill->read_segment);
+            if (!spill->read_map) {
+                return NULL;
+            }
+            spill->read_offset = 0;
+        }
+
+        uint32_t header = SPILL_SEGMENT_END;
+        if (spill->read_offset + SPILL_HEADER_SIZE <= SPILL_SEGMENT_SIZE) {
+            memcpy(&header, spill->read_map + spill->read_offset, sizeof(header));
+        }
+        if (header != SPILL_SEGMENT_END) {
+            char* record = malloc((size_t)header + 1);
+            if (!record) {
+                return NULL;
+            }
+            memcpy(record, spill->read_map + spill->read_offset + SPILL_HEADER_SIZE, header);
+            record[header] = '\0';
+            if (length) {
+                *length = header;
+            }
+            spill->read_offset += SPILL_HEADER_SIZE + header;
+            spill->count--;
+
+            if (spill->count == 0) {
+                spill_reset(spill);
+            }
+            return record;
+        }
+
+        // Segment done: give its blocks back and move on
+        munmap(spill->read_map, SPILL_SEGMENT_SIZE);
+        spill->read_map = NULL;
+        fallocate(spill->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t)spill->read_segment * SPILL_SEGMENT_SIZE, SPILL_SEGMENT_SIZE);
+        spill->read_segment++;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef SPILL_FILE_H
+#define SPILL_FILE_H
+
+#include <stddef.h>
+
+/**
+ * Spill file - an append-only FIFO of records in a memory-mapped temporary file
+ *
+ * The file is written and read in fixed-size segments; only the segment
+ * being written and the one being read are mapped. Segments that have been
+ * read are punched out of the file, and the file is truncated whenever the
+ * reader catches up, so disk use follows the backlog. The file is created
+ * (and immediately unlinked) in $TMPDIR, or /tmp, on the first append.
+ * Not thread-safe; the owner serializes access.
+ */
+
+// Size of a mapped segment; records must be smaller
+#define SPILL_SEGMENT_SIZE (1024 * 1024)
+
+typedef struct {
+    int fd;                            /* -1 until the first append */
+    char* write_map;                   /* Segment being written, or NULL */
+    unsigned long write_segment;
+    size_t write_offset;
+    char* read_map;                    /* Segment being read, or NULL */
+    unsigned long read_segment;
+    size_t read_offset;
+    unsigned long count;               /* Records in the file */
+} spill_file_t;
+
+/**
+ * Initialize an empty spill file (no file is created yet)
+ * @param spill Pointer to spill file structure
+ */
+void spill_file_init(spill_file_t* spill);
+
+/**
+ * Release the mappings and close the file; records still in it are lost
+ * @param spill Pointer to spill file structure
+ */
+void spill_file_destroy(spill_file_t* spill);
+
+/**
+ * Append a record
+ * @param spill Pointer to spill file structure
+ * @param record Record bytes
+ * @param length Record length
+ * @return NULL on success, error message on failure (the record was not added)
+ */
+const char* spill_file_append(spill_file_t* spill, const char* record, size_t length);
+
+/**
+ * Remove the oldest record
+ * @param spill Pointer to spill file structure
+ * @param length Receives the record length (may be NULL)
+ * @return The record as a new NUL-terminated string (caller frees), or NULL
+ *         if the file is empty or memory is exhausted
+ */
+char* spill_file_take(spill_file_t* spill, size_t* length);
+
+#endif // SPILL_FILE_H
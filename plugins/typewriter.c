@@ -42,10 +42,27 @@ const char* plugin_transform(const char* input) {
     return strdup(input);
 }
 
+// Not thread-safe: concurrent calls would interleave their characters
+static const plugin_capabilities_t typewriter_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_SIDE_EFFECTS,
+    1, 0, NULL
+};
+
+/**
+ * Get the algebraic properties of the transform
+ * Writes to stdout: a barrier for the chain optimizer
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return 0;
+}
+
 /**
  * Initialize the plugin
  */
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size) {
+    common_plugin_set_capabilities(&typewriter_capabilities);
     return common_plugin_init(plugin_transform, "typewriter", queue_size);
 }
\ No newline at end of file
@@ -34,10 +34,35 @@ const char* plugin_transform(const char* input) {
     return result;
 }
 
+/**
+ * Uppercase the string in its own buffer
+ */
+static const char* uppercaser_in_place(char* buffer) {
+    for (char* p = buffer; *p; p++) {
+        *p = (char)toupper((unsigned char)*p);
+    }
+    return buffer;
+}
+
+static const plugin_capabilities_t uppercaser_capabilities = {
+    PLUGIN_CAPABILITIES_VERSION,
+    PLUGIN_CAP_IN_PLACE | PLUGIN_CAP_MEMOIZABLE | PLUGIN_CAP_THREAD_SAFE,
+    1, 0, uppercaser_in_place
+};
+
+/**
+ * Get the algebraic properties of the transform
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_properties(void) {
+    return PLUGIN_PROPERTY_PURE | PLUGIN_PROPERTY_IDEMPOTENT | PLUGIN_PROPERTY_CHARWISE;
+}
+
 /**
  * Initialize the plugin
  */
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size) {
+    common_plugin_set_capabilities(&uppercaser_capabilities);
     return common_plugin_init(plugin_transform, "uppercaser", queue_size);
 }
\ No newline at end of file
@@ -0,0 +1,689 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define DAEMON_MAX_LINE 1024                    // Longer lines are split, like the stdin reader does
+#define DAEMON_INPUT_BUFFER (64 * 1024)
+#define DAEMON_OUTPUT_LIMIT (256 * 1024)        // Results buffered per connection before the last stage waits
+#define DAEMON_MAX_EVENTS 64
+#define CLIENT_BUFFER (64 * 1024)
+
+// epoll tokens of the descriptors that are not connections
+#define LISTEN_TOKEN UINT64_MAX
+#define WAKE_TOKEN (UINT64_MAX - 1)
+#define SIGNAL_TOKEN (UINT64_MAX - 2)
+
+typedef struct {
+    int fd;
+    int slot;
+    int registered;                             // fd is in the epoll set
+    uint32_t events;                            // Registered epoll events
+    scheduler_pipeline_t* pipeline;
+    char input[DAEMON_INPUT_BUFFER];            // Received, not yet queued
+    size_t input_used;
+    int input_closed;                           // Client shut down its sending side
+    int end_queued;                             // "<END>" reached the first stage
+    int ingest_stalled;                         // First stage full, waiting for on_space
+    pthread_mutex_t output_lock;
+    char* output;                               // Results not yet sent
+    size_t output_used;
+    size_t output_sent;
+    size_t output_capacity;
+    int output_blocked;                         // Last stage waits for room
+    int output_done;                            // "<END>" passed the last stage
+    int broken;                                 // Client went away; results are discarded
+    atomic_int wake;                            // A worker has news for the event loop
+    atomic_int space;                           // First stage has room again
+} connection_t;
+
+static connection_t* connections[DAEMON_MAX_CLIENTS];
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static unsigned long long connections_served = 0;
+static unsigned long long connections_rejected = 0;
+
+/**
+ * Let the event loop know that a connection needs attention
+ */
+static void notify_connection(connection_t* connection) {
+    if (!atomic_exchange(&connection->wake, 1)) {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+/**
+ * Output function of a connection's pipeline (worker threads)
+ */
+static int connection_output(void* context, const char* item) {
+    connection_t* connection = (connection_t*)context;
+    int taken = 1;
+    int was_empty = 0;
+
+    pthread_mutex_lock(&connection->output_lock);
+    if (strcmp(item, "<END>") == 0) {
+        connection->output_done = 1;
+        was_empty = 1;
+    } else if (!connection->broken) {
+        size_t length = strlen(item);
+        size_t needed = connection->output_used + length + 1;
+        if (connection->output_used > 0 && needed > DAEMON_OUTPUT_LIMIT) {
+            connection->output_blocked = 1;
+            taken = 0;
+        } else {
+            if (needed > connection->output_capacity) {
+                size_t capacity = connection->output_capacity ? connection->output_capacity * 2 : 4096;
+                while (capacity < needed) {
+                    capacity *= 2;
+                }
+                char* output = realloc(connection->output, capacity);
+                if (!output) {
+                    // Out of memory: lose the record rather than stall the connection
+                    pthread_mutex_unlock(&connection->output_lock);
+                    return 1;
+                }
+                connection->output = output;
+                connection->output_capacity = capacity;
+            }
+            was_empty = connection->output_used == 0;
+            memcpy(connection->output + connection->output_used, item, length);
+            connection->output[connection->output_used + length] = '\n';
+            connection->output_used = needed;
+        }
+    }
+    pthread_mutex_unlock(&connection->output_lock);
+
+    if (was_empty) {
+        notify_connection(connection);
+    }
+    return taken;
+}
+
+/**
+ * Space function of a connection's pipeline (worker threads)
+ */
+static void connection_space(void* context) {
+    connection_t* connection = (connection_t*)context;
+    atomic_store(&connection->space, 1);
+    notify_connection(connection);
+}
+
+/**
+ * Register the epoll events the connection is ready for
+ */
+static void update_events(connection_t* connection) {
+    if (!connection->registered) {
+        return;
+    }
+
+    uint32_t events = 0;
+    if (!connection->input_closed && !connection->end_queued && !connection->ingest_stalled &&
+        connection->input_used < DAEMON_INPUT_BUFFER) {
+        events |= EPOLLIN;
+    }
+    pthread_mutex_lock(&connection->output_lock);
+    if (connection->output_sent < connection->output_used) {
+        events |= EPOLLOUT;
+    }
+    pthread_mutex_unlock(&connection->output_lock);
+
+    if (events != connection->events) {
+        struct epoll_event event = { .events = events, .data.u64 = (uint64_t)connection->slot };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = events;
+    }
+}
+
+/**
+ * The client went away: stop watching it and discard its results
+ */
+static void mark_broken(connection_t* connection) {
+    if (connection->registered) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+        connection->registered = 0;
+    }
+    connection->input_closed = 1;
+
+    pthread_mutex_lock(&connection->output_lock);
+    connection->broken = 1;
+    connection->output_used = 0;
+    connection->output_sent = 0;
+    int resume = connection->output_blocked;
+    connection->output_blocked = 0;
+    pthread_mutex_unlock(&connection->output_lock);
+
+    if (resume) {
+        scheduler_resume_output(connection->pipeline);
+    }
+}
+
+/**
+ * Offer one record to the connection's pipeline
+ * Returns 0 if the first stage is full (on_space follows)
+ */
+static int offer_record(connection_t* connection, const char* record) {
+    int taken = 1;
+    if (scheduler_offer(connection->pipeline, record, &taken) != NULL) {
+        return 1;
+    }
+    if (!taken) {
+        connection->ingest_stalled = 1;
+    }
+    return taken;
+}
+
+/**
+ * Queue the complete lines received so far, and "<END>" after the last one
+ */
+static void pump_input(connection_t* connection) {
+    size_t offset = 0;
+
+    while (!connection->end_queued && !connection->ingest_stalled) {
+        char* start = connection->input + offset;
+        size_t available = connection->input_used - offset;
+        size_t window = available < DAEMON_MAX_LINE + 1 ? available : DAEMON_MAX_LINE + 1;
+        char* newline = memchr(start, '\n', window);
+
+        size_t length;
+        size_t consumed;
+        if (newline) {
+            length = (size_t)(newline - start);
+            consumed = length + 1;
+        } else if (available >= DAEMON_MAX_LINE || (connection->input_closed && available > 0)) {
+            length = available < DAEMON_MAX_LINE ? available : DAEMON_MAX_LINE;
+            consumed = length;
+        } else if (connection->input_closed) {
+            // Input ended without "<END>"
+            if (offer_record(connection, "<END>")) {
+                connection->end_queued = 1;
+            }
+            break;
+        } else {
+            break;
+        }
+
+        char line[DAEMON_MAX_LINE + 1];
+        memcpy(line, start, length);
+        line[length] = '\0';
+        if (!offer_record(connection, line)) {
+            break;
+        }
+        offset += consumed;
+        if (strcmp(line, "<END>") == 0) {
+            connection->end_queued = 1;
+        }
+    }
+
+    if (connection->end_queued) {
+        // Anything after the end of the stream is ignored
+        connection->input_used = 0;
+    } else if (offset > 0) {
+        memmove(connection->input, connection->input + offset, connection->input_used - offset);
+        connection->input_used -= offset;
+    }
+}
+
+/**
+ * Receive what the client sent
+ */
+static void read_input(connection_t* connection) {
+    while (connection->input_used < DAEMON_INPUT_BUFFER) {
+        ssize_t received = recv(connection->fd, connection->input + connection->input_used,
+                                DAEMON_INPUT_BUFFER - connection->input_used, 0);
+        if (received > 0) {
+            connection->input_used += (size_t)received;
+        } else if (received == 0) {
+            connection->input_closed = 1;
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                mark_broken(connection);
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * Send buffered results; lets the last stage continue once there is room
+ */
+static void flush_output(connection_t* connection) {
+    int failed = 0;
+
+    pthread_mutex_lock(&connection->output_lock);
+    while (connection->output_sent < connection->output_used) {
+        ssize_t sent = send(connection->fd, connection->output + connection->output_sent,
+                            connection->output_used - connection->output_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0) {
+            connection->output_sent += (size_t)sent;
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else {
+            failed = sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+            break;
+        }
+    }
+
+    if (connection->output_sent > 0) {
+        memmove(connection->output, connection->output + connection->output_sent,
+                connection->output_used - connection->output_sent);
+        connection->output_used -= connection->output_sent;
+        connection->output_sent = 0;
+    }
+    int resume = connection->output_blocked && connection->output_used < DAEMON_OUTPUT_LIMIT;
+    if (resume) {
+        connection->output_blocked = 0;
+    }
+    pthread_mutex_unlock(&connection->output_lock);
+
+    if (failed) {
+        mark_broken(connection);
+    } else if (resume) {
+        scheduler_resume_output(connection->pipeline);
+    }
+}
+
+/**
+ * Release a connection whose pipeline has finished (or any, once the pool is stopped)
+ */
+static void close_connection(connection_t* connection) {
+    scheduler_destroy_pipeline(connection->pipeline);
+    if (connection->registered) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    }
+    close(connection->fd);
+    pthread_mutex_destroy(&connection->output_lock);
+    free(connection->output);
+    connections[connection->slot] = NULL;
+    free(connection);
+}
+
+/**
+ * Close the connection once all results are out; otherwise update its events
+ */
+static void settle_connection(connection_t* connection) {
+    pthread_mutex_lock(&connection->output_lock);
+    int finished = connection->output_done && connection->output_used == 0;
+    pthread_mutex_unlock(&connection->output_lock);
+
+    if (finished) {
+        connections_served++;
+        close_connection(connection);
+    } else {
+        update_events(connection);
+    }
+}
+
+/**
+ * Handle the news a worker left for a connection
+ */
+static void service_connection(connection_t* connection) {
+    if (atomic_exchange(&connection->space, 0) && connection->ingest_stalled) {
+        connection->ingest_stalled = 0;
+        pump_input(connection);
+    }
+    flush_output(connection);
+    settle_connection(connection);
+}
+
+/**
+ * Handle epoll events of a connection
+ */
+static void handle_connection_events(connection_t* connection, uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        mark_broken(connection);
+    } else if (events & EPOLLIN) {
+        read_input(connection);
+    }
+    pump_input(connection);
+    if (events & EPOLLOUT) {
+        flush_output(connection);
+    }
+    settle_connection(connection);
+}
+
+/**
+ * Accept new connections, each with its own pipeline
+ */
+static void accept_connections(int listen_fd, const scheduler_stage_t* stages, int stage_count, int queue_size) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+
+        int slot = -1;
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+            if (!connections[i]) {
+                slot = i;
+                break;
+            }
+        }
+
+        connection_t* connection = slot >= 0 ? calloc(1, sizeof(connection_t)) : NULL;
+        if (!connection) {
+            connections_rejected++;
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->slot = slot;
+        pthread_mutex_init(&connection->output_lock, NULL);
+        atomic_init(&connection->wake, 0);
+        atomic_init(&connection->space, 0);
+
+        const char* error = NULL;
+        connection->pipeline = scheduler_create_pipeline(stages, stage_count, queue_size,
+                                                         connection_output, connection_space,
+                                                         connection, &error);
+        struct epoll_event event = { .events = EPOLLIN, .data.u64 = (uint64_t)slot };
+        if (!connection->pipeline || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            if (connection->pipeline) {
+                scheduler_destroy_pipeline(connection->pipeline);
+            }
+            pthread_mutex_destroy(&connection->output_lock);
+            free(connection);
+            connections_rejected++;
+            close(fd);
+            continue;
+        }
+        connection->registered = 1;
+        connection->events = EPOLLIN;
+        connections[slot] = connection;
+    }
+}
+
+/**
+ * Create the listening socket, replacing a stale one
+ * Returns the socket, or -1 on failure
+ */
+static int open_listener(const char* socket_path, const char** error) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        *error = "Socket path is too long";
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        *error = "Failed to create socket";
+        return -1;
+    }
+
+    struct stat info;
+    if (stat(socket_path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        // Only replace a socket nobody listens on anymore
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (live) {
+            close(fd);
+            *error = "Socket is in use by another daemon";
+            return -1;
+        }
+        unlink(socket_path);
+    }
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        *error = "Failed to bind socket";
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Block SIGINT and SIGTERM, which stop the daemon
+ */
+const char* daemon_block_signals(void) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+        return "Failed to block SIGINT and SIGTERM";
+    }
+    return NULL;
+}
+
+/**
+ * Serve connections until SIGINT or SIGTERM
+ */
+const char* daemon_run(const char* socket_path, const scheduler_stage_t* stages, int stage_count, int queue_size) {
+    if (!socket_path || !stages || stage_count < 1) {
+        return "Invalid daemon arguments";
+    }
+
+    const char* error = NULL;
+    int listen_fd = open_listener(socket_path, &error);
+    if (listen_fd < 0) {
+        return error;
+    }
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    int signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    struct epoll_event listen_event = { .events = EPOLLIN, .data.u64 = LISTEN_TOKEN };
+    struct epoll_event wake_event = { .events = EPOLLIN, .data.u64 = WAKE_TOKEN };
+    struct epoll_event signal_event = { .events = EPOLLIN, .data.u64 = SIGNAL_TOKEN };
+    if (signal_fd < 0 || wake_fd < 0 || epoll_fd < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) != 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event) != 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &signal_event) != 0) {
+        error = "Failed to set up the event loop";
+    } else {
+        fprintf(stderr, "[daemon] listening on %s\n", socket_path);
+    }
+
+    int running = error == NULL;
+    while (running) {
+        struct epoll_event events[DAEMON_MAX_EVENTS];
+        int count = epoll_wait(epoll_fd, events, DAEMON_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = "Event loop failed";
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            uint64_t token = events[i].data.u64;
+            if (token == SIGNAL_TOKEN) {
+                running = 0;
+            } else if (token == LISTEN_TOKEN) {
+                accept_connections(listen_fd, stages, stage_count, queue_size);
+            } else if (token == WAKE_TOKEN) {
+                uint64_t value;
+                ssize_t got = read(wake_fd, &value, sizeof(value));
+                (void)got;
+                for (int slot = 0; slot < DAEMON_MAX_CLIENTS; slot++) {
+                    if (connections[slot] && atomic_exchange(&connections[slot]->wake, 0)) {
+                        service_connection(connections[slot]);
+                    }
+                }
+            } else if (token < DAEMON_MAX_CLIENTS && connections[token]) {
+                handle_connection_events(connections[token], events[i].events);
+            }
+        }
+    }
+
+    // Stop the workers first, then nothing references the pipelines
+    close(listen_fd);
+    unlink(socket_path);
+    scheduler_shutdown();
+    for (int slot = 0; slot < DAEMON_MAX_CLIENTS; slot++) {
+        if (connections[slot]) {
+            close_connection(connections[slot]);
+        }
+    }
+
+    if (signal_fd >= 0) {
+        close(signal_fd);
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+    wake_fd = -1;
+    epoll_fd = -1;
+
+    return error;
+}
+
+/**
+ * Print the daemon's counters to stderr
+ */
+void daemon_report(void) {
+    fprintf(stderr, "[stats] daemon: connections=%llu rejected=%llu\n",
+            connections_served, connections_rejected);
+}
+
+/**
+ * Write a whole buffer to a blocking descriptor
+ * Returns 0 on success, -1 on failure
+ */
+static int write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/**
+ * Client: send stdin to a daemon and copy the results to stdout
+ * Sending and receiving are interleaved so that neither side can fill up
+ * while the other waits
+ */
+const char* daemon_client_run(const char* socket_path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (!socket_path || strlen(socket_path) >= sizeof(address.sun_path)) {
+        return "Invalid socket path";
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return "Failed to create socket";
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return "Failed to connect to the daemon";
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    static char pending[CLIENT_BUFFER];
+    static char received[CLIENT_BUFFER];
+    size_t pending_used = 0;
+    size_t pending_sent = 0;
+    int input_done = 0;
+    int write_shut = 0;
+    const char* error = NULL;
+
+    while (1) {
+        int watch_stdin = !input_done && pending_used == 0;
+        struct pollfd fds[2] = {
+            { .fd = fd, .events = POLLIN | (pending_sent < pending_used ? POLLOUT : 0) },
+            { .fd = STDIN_FILENO, .events = POLLIN }
+        };
+        if (poll(fds, watch_stdin ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = "Poll failed";
+            break;
+        }
+
+        if (watch_stdin && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            ssize_t got = read(STDIN_FILENO, pending, sizeof(pending));
+            if (got > 0) {
+                pending_used = (size_t)got;
+                pending_sent = 0;
+            } else if (got == 0 || errno != EINTR) {
+                input_done = 1;
+            }
+        }
+
+        while (pending_sent < pending_used) {
+            ssize_t sent = send(fd, pending + pending_sent, pending_used - pending_sent, MSG_NOSIGNAL);
+            if (sent > 0) {
+                pending_sent += (size_t)sent;
+            } else if (sent < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    // The daemon closed the stream (e.g. after "<END>"); keep reading results
+                    pending_sent = pending_used;
+                    input_done = 1;
+                }
+                break;
+            }
+        }
+        if (pending_sent == pending_used) {
+            pending_used = 0;
+            pending_sent = 0;
+        }
+        if (input_done && pending_used == 0 && !write_shut) {
+            shutdown(fd, SHUT_WR);
+            write_shut = 1;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t got = recv(fd, received, sizeof(received), 0);
+            if (got > 0) {
+                if (write_all(STDOUT_FILENO, received, (size_t)got) != 0) {
+                    error = "Failed to write results";
+                    break;
+                }
+            } else if (got == 0) {
+                break;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                error = "Connection lost";
+                break;
+            }
+        }
+    }
+
+    close(fd);
+    return error;
+}
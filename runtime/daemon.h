@@ -0,0 +1,49 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "scheduler.h"
+
+/**
+ * Daemon mode - serves pipelines to clients over a Unix domain socket
+ *
+ * Every connection gets its own pipeline on the shared worker pool, built from
+ * the already loaded plugins. A client sends records as lines; the results
+ * stream back on the same connection as lines, and the server closes the
+ * connection once "<END>" (or the end of the client's input) has passed the
+ * last stage. One thread multiplexes all connections with epoll.
+ */
+
+// Most connections served at the same time
+#define DAEMON_MAX_CLIENTS 64
+
+/**
+ * Block SIGINT and SIGTERM, which stop the daemon
+ * Must run before any thread is started so that every thread inherits the mask
+ * @return NULL on success, error message on failure
+ */
+const char* daemon_block_signals(void);
+
+/**
+ * Serve connections until SIGINT or SIGTERM
+ * The worker pool must be running; it is shut down before returning
+ * @param socket_path Path of the listening socket (a stale socket is replaced)
+ * @param stages Setup of each stage of a connection's pipeline
+ * @param stage_count Number of stages
+ * @param queue_size Capacity of each stage's queue
+ * @return NULL on success, error message on failure
+ */
+const char* daemon_run(const char* socket_path, const scheduler_stage_t* stages, int stage_count, int queue_size);
+
+/**
+ * Print the daemon's counters to stderr
+ */
+void daemon_report(void);
+
+/**
+ * Client: send stdin to a daemon and copy the results to stdout
+ * @param socket_path Path of the daemon's socket
+ * @return NULL on success, error message on failure
+ */
+const char* daemon_client_run(const char* socket_path);
+
+#endif // DAEMON_H
@@ -0,0 +1,187 @@
+#include "framing.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define FRAMING_READ_SIZE (64 * 1024)          // Initial buffer; grows to the largest record
+
+struct framing_reader {
+    int fd;
+    unsigned char* buffer;
+    size_t capacity;                            // One byte more than is ever read, for the NUL
+    size_t start;                               // First byte not handed out
+    size_t end;                                 // End of the bytes read
+    int at_eof;
+    size_t saved_position;                      // Byte overwritten by the last record's NUL...
+    unsigned char saved_byte;                   // ...and its value, restored on the next call
+    int has_saved;
+};
+
+/**
+ * Parse a record format name
+ */
+const char* framing_parse_format(const char* name, record_format_t* format) {
+    if (!name || !format) {
+        return "Null record format argument";
+    }
+    if (strcmp(name, "lines") == 0) {
+        *format = RECORD_FORMAT_LINES;
+    } else if (strcmp(name, "framed") == 0) {
+        *format = RECORD_FORMAT_FRAMED;
+    } else {
+        return "Unknown record format";
+    }
+    return NULL;
+}
+
+/**
+ * Encode a record length
+ */
+size_t framing_encode_length(uint64_t length, unsigned char* out) {
+    size_t used = 0;
+    while (length >= 0x80) {
+        out[used++] = (unsigned char)(length | 0x80);
+        length >>= 7;
+    }
+    out[used++] = (unsigned char)length;
+    return used;
+}
+
+/**
+ * Decode a record length
+ */
+int framing_decode_length(const unsigned char* data, size_t available, uint64_t* length) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < available && i < FRAMING_MAX_VARINT; i++) {
+        value |= (uint64_t)(data[i] & 0x7f) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            *length = value;
+            return (int)i + 1;
+        }
+    }
+    return available >= FRAMING_MAX_VARINT ? -1 : 0;
+}
+
+/**
+ * Create a reader of framed records
+ */
+framing_reader_t* framing_reader_create(int fd, const char** error) {
+    framing_reader_t* reader = calloc(1, sizeof(framing_reader_t));
+    if (reader) {
+        reader->buffer = malloc(FRAMING_READ_SIZE + 1);
+    }
+    if (!reader || !reader->buffer) {
+        free(reader);
+        *error = "Failed to allocate the input buffer";
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->capacity = FRAMING_READ_SIZE + 1;
+    return reader;
+}
+
+/**
+ * Make room for at least `needed` unread bytes, moving them to the front
+ * Returns 0 on success, -1 if the buffer cannot grow
+ */
+static int make_room(framing_reader_t* reader, size_t needed) {
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    if (needed + 1 <= reader->capacity) {
+        return 0;
+    }
+    size_t capacity = reader->capacity;
+    while (capacity < needed + 1) {
+        capacity *= 2;
+    }
+    unsigned char* buffer = realloc(reader->buffer, capacity);
+    if (!buffer) {
+        return -1;
+    }
+    reader->buffer = buffer;
+    reader->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Get the next record
+ */
+int framing_reader_next(framing_reader_t* reader, const char** record, size_t* length, const char** error) {
+    if (reader->has_saved) {
+        reader->buffer[reader->saved_position] = reader->saved_byte;
+        reader->has_saved = 0;
+    }
+
+    while (1) {
+        size_t available = reader->end - reader->start;
+        uint64_t payload = 0;
+        int header = framing_decode_length(reader->buffer + reader->start, available, &payload);
+        if (header < 0) {
+            *error = "Malformed record length";
+            return -1;
+        }
+        if (header > 0 && payload > FRAMING_MAX_RECORD) {
+            *error = "Record longer than 16 MiB";
+            return -1;
+        }
+        size_t needed = header > 0 ? (size_t)header + (size_t)payload : available + FRAMING_MAX_VARINT;
+
+        if (header > 0 && available >= needed) {
+            // The byte after the payload (the next header, or spare room) becomes its terminator
+            size_t terminator = reader->start + needed;
+            if (terminator < reader->end) {
+                reader->saved_position = terminator;
+                reader->saved_byte = reader->buffer[terminator];
+                reader->has_saved = 1;
+            }
+            reader->buffer[terminator] = '\0';
+            *record = (const char*)reader->buffer + reader->start + header;
+            *length = (size_t)payload;
+            reader->start = terminator;
+            return 1;
+        }
+
+        if (reader->at_eof) {
+            if (available == 0) {
+                return 0;
+            }
+            *error = "Truncated record at the end of the input";
+            return -1;
+        }
+
+        // Read in bulk: as much as fits, at least enough for the record
+        if (needed < FRAMING_READ_SIZE) {
+            needed = FRAMING_READ_SIZE;
+        }
+        if (make_room(reader, needed) != 0) {
+            *error = "Failed to allocate the input buffer";
+            return -1;
+        }
+        ssize_t received = read(reader->fd, reader->buffer + reader->end, reader->capacity - 1 - reader->end);
+        if (received < 0) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            *error = "Failed to read the input";
+            return -1;
+        }
+        if (received == 0) {
+            reader->at_eof = 1;
+        }
+        reader->end += (size_t)received;
+    }
+}
+
+/**
+ * Free a reader
+ */
+void framing_reader_destroy(framing_reader_t* reader) {
+    if (reader) {
+        free(reader->buffer);
+        free(reader);
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Length-prefixed records - each record is its length as an unsigned LEB128
+ * varint (7 bits per byte, low group first, high bit set on all but the
+ * last byte) followed by that many payload bytes. Nothing in the payload
+ * is special, so records are read and written in bulk with no delimiter
+ * scanning and may contain newlines.
+ */
+
+#define FRAMING_MAX_VARINT 10                   // Bytes of the longest 64-bit varint
+#define FRAMING_MAX_RECORD (16 * 1024 * 1024)   // Larger lengths are treated as corrupt input
+
+/**
+ * How records are delimited on the input or in the sink
+ */
+typedef enum {
+    RECORD_FORMAT_LINES = 0,           /* Newline-terminated text */
+    RECORD_FORMAT_FRAMED               /* Varint length + payload */
+} record_format_t;
+
+typedef struct framing_reader framing_reader_t;
+
+/**
+ * Parse a record format name ("lines" or "framed")
+ * @param name Format name
+ * @param format Receives the parsed format
+ * @return NULL on success, error message on failure
+ */
+const char* framing_parse_format(const char* name, record_format_t* format);
+
+/**
+ * Encode a record length
+ * @param length The length
+ * @param out Receives at most FRAMING_MAX_VARINT bytes
+ * @return Number of bytes written
+ */
+size_t framing_encode_length(uint64_t length, unsigned char* out);
+
+/**
+ * Decode a record length
+ * @param data Bytes received so far
+ * @param available Number of bytes in data
+ * @param length Receives the length
+ * @return Bytes the varint took, 0 if it is not complete yet, -1 if it is malformed
+ */
+int framing_decode_length(const unsigned char* data, size_t available, uint64_t* length);
+
+/**
+ * Create a reader of framed records
+ * @param fd Descriptor to read (not closed by the reader)
+ * @param error Receives an error message on failure
+ * @return The reader, or NULL on failure
+ */
+framing_reader_t* framing_reader_create(int fd, const char** error);
+
+/**
+ * Get the next record; it stays valid until the next call and is followed
+ * by a NUL byte (payload bytes are not checked for NUL)
+ * @param reader The reader
+ * @param record Receives the payload
+ * @param length Receives the payload length
+ * @param error Receives an error message when -1 is returned
+ * @return 1 for a record, 0 at the end of the input or when a signal
+ *         interrupted the read, -1 for a malformed, oversized or truncated record
+ */
+int framing_reader_next(framing_reader_t* reader, const char** record, size_t* length, const char** error);
+
+/**
+ * Free a reader
+ * @param reader The reader
+ */
+void framing_reader_destroy(framing_reader_t* reader);
+
+#endif // FRAMING_H
@@ -0,0 +1,130 @@
+#include "intern_table.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+typedef struct {
+    atomic_int references;
+    uint32_t length;
+    char data[];
+} interned_string_t;
+
+struct intern_table {
+    interned_string_t** slots;
+    uint64_t* hashes;
+    uint64_t mask;
+};
+
+/**
+ * FNV-1a hash of a line
+ */
+static uint64_t intern_hash(const char* line, size_t length) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)line[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Header of a buffer handed out by the table
+ */
+static interned_string_t* intern_header(char* buffer) {
+    return (interned_string_t*)(buffer - offsetof(interned_string_t, data));
+}
+
+/**
+ * Create an empty table
+ */
+intern_table_t* intern_table_create(int slots, const char** error) {
+    const char* ignored;
+    error = error ? error : &ignored;
+
+    uint64_t count = 16;
+    while (count < (uint64_t)(slots > 0 ? slots : 1)) {
+        count <<= 1;
+    }
+
+    intern_table_t* table = malloc(sizeof(intern_table_t));
+    if (!table) {
+        *error = "Failed to allocate the intern table";
+        return NULL;
+    }
+    table->slots = calloc(count, sizeof(interned_string_t*));
+    table->hashes = calloc(count, sizeof(uint64_t));
+    if (!table->slots || !table->hashes) {
+        free(table->slots);
+        free(table->hashes);
+        free(table);
+        *error = "Failed to allocate the intern table";
+        return NULL;
+    }
+    table->mask = count - 1;
+    return table;
+}
+
+/**
+ * Drop the table's references
+ */
+void intern_table_destroy(intern_table_t* table) {
+    if (!table) {
+        return;
+    }
+    for (uint64_t i = 0; i <= table->mask; i++) {
+        if (table->slots[i]) {
+            intern_release(table->slots[i]->data);
+        }
+    }
+    free(table->slots);
+    free(table->hashes);
+    free(table);
+}
+
+/**
+ * Get the shared buffer for a line
+ */
+char* intern_table_acquire(intern_table_t* table, const char* line, int* shared) {
+    size_t length = strlen(line);
+    uint64_t hash = intern_hash(line, length);
+    uint64_t slot = hash & table->mask;
+    interned_string_t* resident = table->slots[slot];
+
+    if (resident && table->hashes[slot] == hash && resident->length == length &&
+        memcmp(resident->data, line, length) == 0) {
+        atomic_fetch_add_explicit(&resident->references, 1, memory_order_relaxed);
+        *shared = 1;
+        return resident->data;
+    }
+
+    *shared = 0;
+    interned_string_t* string = malloc(sizeof(interned_string_t) + length + 1);
+    if (!string) {
+        return NULL;
+    }
+    // One reference for the table, one for the caller
+    atomic_init(&string->references, 2);
+    string->length = (uint32_t)length;
+    memcpy(string->data, line, length + 1);
+
+    if (resident) {
+        intern_release(resident->data);
+    }
+    table->slots[slot] = string;
+    table->hashes[slot] = hash;
+    return string->data;
+}
+
+/**
+ * Give back a reference
+ */
+void intern_release(char* buffer) {
+    if (!buffer) {
+        return;
+    }
+    interned_string_t* string = intern_header(buffer);
+    if (atomic_fetch_sub_explicit(&string->references, 1, memory_order_acq_rel) == 1) {
+        free(string);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef INTERN_TABLE_H
+#define INTERN_TABLE_H
+
+/**
+ * Intern table - maps identical input lines to one shared, immutable,
+ * reference-counted buffer
+ *
+ * The table is direct-mapped: a line that hashes to an occupied slot with
+ * different content replaces it. The table holds one reference to every
+ * resident buffer; each holder of a buffer returned by intern_table_acquire
+ * holds another and gives it back with intern_release, from any thread.
+ * Only one thread may call intern_table_acquire on a table.
+ */
+
+typedef struct intern_table intern_table_t;
+
+/**
+ * Create an empty table
+ * @param slots Number of lines remembered, rounded up to a power of two
+ * @param error Receives an error message on failure
+ * @return The table, or NULL on failure
+ */
+intern_table_t* intern_table_create(int slots, const char** error);
+
+/**
+ * Drop the table's references; buffers still held elsewhere stay valid
+ * @param table The table
+ */
+void intern_table_destroy(intern_table_t* table);
+
+/**
+ * Get the shared buffer for a line, creating it if the line is not resident
+ * @param table The table
+ * @param line The line
+ * @param shared Receives 1 if an existing buffer was reused, 0 otherwise
+ * @return The buffer, with a reference for the caller, or NULL if memory is exhausted
+ */
+char* intern_table_acquire(intern_table_t* table, const char* line, int* shared);
+
+/**
+ * Give back a reference; the buffer is freed with the last one
+ * @param buffer A buffer returned by intern_table_acquire
+ */
+void intern_release(char* buffer);
+
+#endif // INTERN_TABLE_H
@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+#include "load_generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+
+#define LOAD_MAX_STEP_RECORDS (1ULL << 24)
+#define LOAD_POLL_NS 100000000ULL              // Longest sleep between checks of the stop flag
+#define LATENCY_SUB_BITS 4                      // Sub-buckets per power of two: 1/16 resolution
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    char** records;
+    int record_count;
+    int record_capacity;
+    load_forward_func_t downstream;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+    // The running step; completions are matched to send times in order
+    unsigned long long* offsets;                // Send time of each record, from the step start, in ns
+    unsigned long long start;
+    unsigned long long expected;                // Records to wait for (0: no step running)
+    unsigned long long completed;
+    unsigned long long last_completion;
+    unsigned long long max_latency;
+    unsigned long long buckets[LATENCY_BUCKETS];
+} load_generator_t;
+
+static load_generator_t generator = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .progress = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned long long clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+/**
+ * Histogram bucket of a latency: exact below 16 ns, then 16 buckets per
+ * power of two
+ */
+static int bucket_of(unsigned long long ns) {
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+    return (exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+/**
+ * Largest latency that falls into a bucket
+ */
+static unsigned long long bucket_top(int bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return (unsigned long long)bucket;
+    }
+    int exponent = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+    unsigned long long sub = (unsigned long long)(bucket % LATENCY_SUB_BUCKETS);
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << (exponent - LATENCY_SUB_BITS)) - 1;
+}
+
+/**
+ * Latency below which the given fraction of the step's records completed
+ */
+static unsigned long long percentile(double fraction) {
+    unsigned long long target = (unsigned long long)ceil(fraction * (double)generator.completed);
+    target = target > 0 ? target : 1;
+    unsigned long long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += generator.buckets[i];
+        if (seen >= target) {
+            unsigned long long top = bucket_top(i);
+            return top < generator.max_latency ? top : generator.max_latency;
+        }
+    }
+    return generator.max_latency;
+}
+
+static void format_duration(char* out, size_t size, unsigned long long ns) {
+    if (ns < 1000ULL) {
+        snprintf(out, size, "%lluns", ns);
+    } else if (ns < 1000000ULL) {
+        snprintf(out, size, "%.1fus", (double)ns / 1e3);
+    } else if (ns < 1000000000ULL) {
+        snprintf(out, size, "%.1fms", (double)ns / 1e6);
+    } else {
+        snprintf(out, size, "%.2fs", (double)ns / 1e9);
+    }
+}
+
+/**
+ * Sleep until an absolute CLOCK_MONOTONIC time (returns early on a signal)
+ */
+static void sleep_until(unsigned long long ns) {
+    struct timespec until = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+}
+
+/**
+ * Fill in the send times of a step's records
+ */
+static void schedule_step(unsigned long long count, double rate, load_arrivals_t arrivals, unsigned long long* seed) {
+    double gap = 1e9 / rate;
+    double offset = 0.0;
+    for (unsigned long long i = 0; i < count; i++) {
+        generator.offsets[i] = (unsigned long long)offset;
+        if (arrivals == LOAD_ARRIVALS_POISSON) {
+            // xorshift64*, then an exponential gap by inversion
+            *seed ^= *seed >> 12;
+            *seed ^= *seed << 25;
+            *seed ^= *seed >> 27;
+            double uniform = (double)((*seed * 0x2545F4914F6CDD1DULL) >> 11) * 0x1.0p-53;
+            offset += -log1p(-uniform) * gap;
+        } else {
+            offset = (double)(i + 1) * gap;
+        }
+    }
+}
+
+const char* load_generator_parse_rates(const char* spec, double* rates, int* count) {
+    *count = 0;
+    const char* cursor = spec;
+    while (1) {
+        char* endptr;
+        errno = 0;
+        double rate = strtod(cursor, &endptr);
+        if (endptr == cursor || errno != 0) {
+            return "Invalid load rate";
+        }
+        if (*endptr == 'k' || *endptr == 'K') {
+            rate *= 1e3;
+            endptr++;
+        } else if (*endptr == 'm' || *endptr == 'M') {
+            rate *= 1e6;
+            endptr++;
+        }
+        if (!(rate > 0.0) || rate > 1e8 || (*endptr != ',' && *endptr != '\0')) {
+            return "Invalid load rate";
+        }
+        if (*count == LOAD_MAX_STEPS) {
+            return "Too many load rates";
+        }
+        rates[(*count)++] = rate;
+        if (*endptr == '\0') {
+            return NULL;
+        }
+        cursor = endptr + 1;
+    }
+}
+
+const char* load_generator_parse_arrivals(const char* name, load_arrivals_t* arrivals) {
+    if (strcmp(name, "fixed") == 0) {
+        *arrivals = LOAD_ARRIVALS_FIXED;
+    } else if (strcmp(name, "poisson") == 0) {
+        *arrivals = LOAD_ARRIVALS_POISSON;
+    } else {
+        return "Unknown arrival process";
+    }
+    return NULL;
+}
+
+const char* load_generator_add_record(const char* record) {
+    if (generator.record_count == generator.record_capacity) {
+        if (generator.record_capacity == LOAD_MAX_RECORDS) {
+            return "Too many load records";
+        }
+        int capacity = generator.record_capacity ? generator.record_capacity * 2 : 64;
+        char** records = realloc(generator.records, (size_t)capacity * sizeof(char*));
+        if (!records) {
+            return "Memory allocation failed";
+        }
+        generator.records = records;
+        generator.record_capacity = capacity;
+    }
+    char* copy = strdup(record);
+    if (!copy) {
+        return "Memory allocation failed";
+    }
+    generator.records[generator.record_count++] = copy;
+    return NULL;
+}
+
+void load_generator_set_downstream(load_forward_func_t downstream) {
+    generator.downstream = downstream;
+}
+
+const char* load_generator_complete(const char* record) {
+    if (strcmp(record, "<END>") != 0) {
+        unsigned long long now = clock_ns();
+        pthread_mutex_lock(&generator.lock);
+        if (generator.completed < generator.expected) {
+            unsigned long long intended = generator.start + generator.offsets[generator.completed];
+            unsigned long long latency = now > intended ? now - intended : 0;
+            generator.buckets[bucket_of(latency)]++;
+            if (latency > generator.max_latency) {
+                generator.max_latency = latency;
+            }
+            generator.completed++;
+            generator.last_completion = now;
+            pthread_cond_signal(&generator.progress);
+        }
+        pthread_mutex_unlock(&generator.lock);
+    }
+    return generator.downstream ? generator.downstream(record) : NULL;
+}
+
+/**
+ * Send one step's records on schedule, wait for them to come out and
+ * report the step
+ */
+static const char* run_step(double rate, load_arrivals_t arrivals, long duration_ms, long stall_ms,
+                            load_forward_func_t send, const volatile sig_atomic_t* stop, unsigned long long* seed) {
+    double planned = rate * (double)duration_ms / 1000.0;
+    if (planned > (double)LOAD_MAX_STEP_RECORDS) {
+        return "Too many records in one load step (rate times duration above 16777216)";
+    }
+    unsigned long long count = planned < 1.0 ? 1 : (unsigned long long)(planned + 0.5);
+    unsigned long long* offsets = malloc(count * sizeof(unsigned long long));
+    if (!offsets) {
+        return "Memory allocation failed";
+    }
+
+    pthread_mutex_lock(&generator.lock);
+    free(generator.offsets);
+    generator.offsets = offsets;
+    schedule_step(count, rate, arrivals, seed);
+    memset(generator.buckets, 0, sizeof(generator.buckets));
+    generator.completed = 0;
+    generator.max_latency = 0;
+    generator.start = clock_ns();
+    generator.last_completion = generator.start;
+    generator.expected = count;
+    pthread_mutex_unlock(&generator.lock);
+
+    // Open loop: a record's send time never depends on when the previous one got in
+    const char* error = NULL;
+    unsigned long long sent = 0;
+    unsigned long long max_lag = 0;
+    while (sent < count && !*stop) {
+        unsigned long long intended = generator.start + offsets[sent];
+        unsigned long long now = clock_ns();
+        if (now < intended) {
+            sleep_until(intended - now > LOAD_POLL_NS ? now + LOAD_POLL_NS : intended);
+            continue;
+        }
+        if (now - intended > max_lag) {
+            max_lag = now - intended;
+        }
+        error = send(generator.records[sent % (unsigned long long)generator.record_count]);
+        if (error) {
+            break;
+        }
+        sent++;
+    }
+
+    // Wait for what was sent; a step stalls when nothing comes out for stall_ms
+    pthread_mutex_lock(&generator.lock);
+    generator.expected = sent;
+    unsigned long long progress_at = clock_ns();
+    unsigned long long progress_count = generator.completed;
+    while (!error && generator.completed < sent && !*stop) {
+        unsigned long long now = clock_ns();
+        if (generator.completed != progress_count) {
+            progress_count = generator.completed;
+            progress_at = now;
+        } else if (now - progress_at >= (unsigned long long)stall_ms * 1000000ULL) {
+            error = "Records did not come out of the last stage in time (dropped, reordered or stalled)";
+            break;
+        }
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += 10000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&generator.progress, &generator.lock, &until);
+    }
+
+    unsigned long long completed = generator.completed;
+    double elapsed = (double)(generator.last_completion - generator.start) / 1e9;
+    char p50[32], p90[32], p99[32], p999[32], max[32], lag[32];
+    format_duration(p50, sizeof(p50), percentile(0.50));
+    format_duration(p90, sizeof(p90), percentile(0.90));
+    format_duration(p99, sizeof(p99), percentile(0.99));
+    format_duration(p999, sizeof(p999), percentile(0.999));
+    format_duration(max, sizeof(max), generator.max_latency);
+    format_duration(lag, sizeof(lag), max_lag);
+    // Records still in the pipeline are not matched to this step any more
+    generator.expected = 0;
+    pthread_mutex_unlock(&generator.lock);
+
+    fprintf(stderr, "[load] rate=%.10g/s arrivals=%s sent=%llu done=%llu achieved=%.0f/s "
+            "p50=%s p90=%s p99=%s p99.9=%s max=%s max_lag=%s\n",
+            rate, arrivals == LOAD_ARRIVALS_POISSON ? "poisson" : "fixed", sent, completed,
+            elapsed > 0.0 ? (double)completed / elapsed : 0.0,
+            p50, p90, p99, p999, max, lag);
+    return error;
+}
+
+const char* load_generator_run(const double* rates, int step_count, load_arrivals_t arrivals, long duration_ms,
+                               long stall_ms, load_forward_func_t send, const volatile sig_atomic_t* stop) {
+    if (generator.record_count == 0) {
+        return "No load records";
+    }
+
+    // Wake up on time for closely spaced sends
+    int slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
+    unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+    const char* error = NULL;
+    for (int i = 0; i < step_count && !error && !*stop; i++) {
+        error = run_step(rates[i], arrivals, duration_ms, stall_ms, send, stop, &seed);
+    }
+
+    if (slack > 0) {
+        prctl(PR_SET_TIMERSLACK, (unsigned long)slack, 0, 0, 0);
+    }
+    return error;
+}
+
+void load_generator_destroy(void) {
+    for (int i = 0; i < generator.record_count; i++) {
+        free(generator.records[i]);
+    }
+    free(generator.records);
+    generator.records = NULL;
+    generator.record_count = 0;
+    generator.record_capacity = 0;
+    pthread_mutex_lock(&generator.lock);
+    free(generator.offsets);
+    generator.offsets = NULL;
+    generator.expected = 0;
+    pthread_mutex_unlock(&generator.lock);
+}
@@ -0,0 +1,100 @@
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include <signal.h>
+
+/**
+ * Open-loop load generator - replays a set of records into the first stage
+ * at a target arrival rate, fixed or Poisson, independent of how fast the
+ * pipeline takes them. Every record is stamped with the time it was meant
+ * to be sent; when it comes out of the last stage its latency is measured
+ * from that time, so a stall that holds the generator back is charged to
+ * every record scheduled behind it (no coordinated omission).
+ *
+ * Records are matched to their send times in order, which holds for chains
+ * that keep every record and do not reorder them: blocking or spilling
+ * stage queues, one lane. A step whose records do not all come out fails.
+ *
+ * Each rate is a step of its own: records are sent for the step's duration,
+ * then the pipeline drains before the next step starts. Each step reports
+ * offered and achieved rate and latency percentiles (within 1/16 of the
+ * exact value) on stderr.
+ */
+
+#define LOAD_MAX_STEPS 16
+#define LOAD_MAX_RECORDS 65536
+
+/**
+ * How the send times of a step are spaced
+ */
+typedef enum {
+    LOAD_ARRIVALS_FIXED = 0,           /* Evenly, 1/rate apart */
+    LOAD_ARRIVALS_POISSON              /* Exponentially distributed gaps with mean 1/rate */
+} load_arrivals_t;
+
+/**
+ * Function records are sent with, and finished records are passed on to
+ * (the signature of plugin_place_work)
+ */
+typedef const char* (*load_forward_func_t)(const char* record);
+
+/**
+ * Parse a comma-separated list of rates in records per second, each a
+ * number optionally followed by k (thousands) or m (millions)
+ * @param spec The list, e.g. "1000,5k,20k"
+ * @param rates Receives up to LOAD_MAX_STEPS rates
+ * @param count Receives the number of rates
+ * @return NULL on success, error message on failure
+ */
+const char* load_generator_parse_rates(const char* spec, double* rates, int* count);
+
+/**
+ * Parse an arrival process name ("fixed" or "poisson")
+ * @param name The name
+ * @param arrivals Receives the process
+ * @return NULL on success, error message on failure
+ */
+const char* load_generator_parse_arrivals(const char* name, load_arrivals_t* arrivals);
+
+/**
+ * Add a record to the set the steps cycle through
+ * @param record The record (copied)
+ * @return NULL on success, error message on failure (the set is full)
+ */
+const char* load_generator_add_record(const char* record);
+
+/**
+ * Set where finished records go after they are timed
+ * @param downstream The function, or NULL to discard them
+ */
+void load_generator_set_downstream(load_forward_func_t downstream);
+
+/**
+ * Take a record from the last stage: time it against its send time and
+ * pass it on; "<END>" and records arriving outside a step are only passed on
+ * Has the signature of plugin_place_work so the last stage can attach to it
+ * @param record The record
+ * @return NULL on success, error message from downstream on failure
+ */
+const char* load_generator_complete(const char* record);
+
+/**
+ * Run the steps, one per rate, and report each on stderr
+ * @param rates Records per second of each step
+ * @param step_count Number of steps
+ * @param arrivals How send times are spaced
+ * @param duration_ms How long each step sends
+ * @param stall_ms How long a step may wait for a record to come out before it fails
+ * @param send Sends a record to the first stage
+ * @param stop Sending stops when this becomes non-zero
+ * @return NULL on success, error message on failure
+ */
+const char* load_generator_run(const double* rates, int step_count, load_arrivals_t arrivals, long duration_ms,
+                               long stall_ms, load_forward_func_t send, const volatile sig_atomic_t* stop);
+
+/**
+ * Free the records and the timing state
+ */
+void load_generator_destroy(void);
+
+#endif // LOAD_GENERATOR_H
@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+#include "output_sink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define SINK_BUFFER_SIZE (64 * 1024)            // Batch size, a multiple of the page size
+#define SINK_DIRECT_THRESHOLD (16 * 1024)       // Records at least this long are not copied
+#define SINK_MAX_DELIMITER 16
+
+typedef struct {
+    int fd;
+    int owns_fd;                                // Opened by the sink, closed on close
+    int is_pipe;                                // Full batches are moved with vmsplice
+    int open;
+    char delimiter[SINK_MAX_DELIMITER];
+    size_t delimiter_length;
+    int framed;                                 // Length before each record, no delimiter
+    sink_flush_policy_t flush_policy;
+    char* buffer;                               // Batch being filled (anonymous mapping)
+    size_t buffer_size;
+    size_t used;                                // Bytes in the batch
+    pthread_mutex_t lock;
+    unsigned long long records;
+    unsigned long long bytes;
+    unsigned long long write_calls;
+    unsigned long long spliced_bytes;
+} output_sink_t;
+
+static output_sink_t sink = { .fd = -1 };
+
+/**
+ * Decode the C escapes of a delimiter
+ * Returns the decoded length, or -1 if it does not fit
+ */
+static int decode_delimiter(const char* text, char* out, size_t out_size) {
+    size_t length = 0;
+    for (const char* p = text; *p; p++) {
+        char c = *p;
+        if (c == '\\' && p[1]) {
+            p++;
+            switch (*p) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default:  c = *p;   break;
+            }
+        }
+        if (length >= out_size) {
+            return -1;
+        }
+        out[length++] = c;
+    }
+    return (int)length;
+}
+
+/**
+ * Write a whole iovec array, resuming after partial writes
+ */
+static const char* write_all(struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(sink.fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return "Failed to write output";
+        }
+        sink.write_calls++;
+
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Hand a full batch to the pipe without copying
+ * Falls back to writev if the pipe refuses vmsplice
+ */
+static const char* splice_all(char* data, size_t length) {
+    struct iovec iov = { data, length };
+    while (iov.iov_len > 0) {
+        ssize_t moved = vmsplice(sink.fd, &iov, 1, 0);
+        if (moved < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS || errno == EBADF) {
+                sink.is_pipe = 0;
+                return write_all(&iov, 1);
+            }
+            return "Failed to splice output";
+        }
+        sink.write_calls++;
+        sink.spliced_bytes += moved;
+        iov.iov_base = (char*)iov.iov_base + moved;
+        iov.iov_len -= moved;
+    }
+    return NULL;
+}
+
+/**
+ * Map a fresh batch buffer
+ * Returns NULL on failure
+ */
+static char* map_batch(size_t size) {
+    void* batch = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return batch == MAP_FAILED ? NULL : batch;
+}
+
+/**
+ * Write out the current batch
+ * A spliced batch stays referenced by the pipe for as long as the reader, or
+ * whatever the reader splices it on to, holds its pages, so it is never
+ * written again: it is unmapped (the pipe keeps the pages alive) and the next
+ * batch is filled in a fresh mapping. Partial batches are copied with writev
+ * and can be refilled at once.
+ */
+static const char* flush_buffer(void) {
+    if (sink.used == 0) {
+        return NULL;
+    }
+
+    const char* error;
+    char* fresh = sink.is_pipe && sink.used == sink.buffer_size ? map_batch(sink.buffer_size) : NULL;
+    if (fresh) {
+        error = splice_all(sink.buffer, sink.used);
+        munmap(sink.buffer, sink.buffer_size);
+        sink.buffer = fresh;
+    } else {
+        struct iovec iov = { sink.buffer, sink.used };
+        error = write_all(&iov, 1);
+    }
+
+    sink.used = 0;
+    return error;
+}
+
+/**
+ * Copy bytes into the batch, writing out every batch that fills up
+ */
+static const char* append(const char* data, size_t length) {
+    while (length > 0) {
+        size_t room = sink.buffer_size - sink.used;
+        size_t chunk = length < room ? length : room;
+        memcpy(sink.buffer + sink.used, data, chunk);
+        sink.used += chunk;
+        data += chunk;
+        length -= chunk;
+
+        if (sink.used == sink.buffer_size) {
+            const char* error = flush_buffer();
+            if (error) {
+                return error;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Parse a flush policy name
+ */
+const char* output_sink_parse_flush_policy(const char* name, sink_flush_policy_t* policy) {
+    if (!name || !policy) {
+        return "Null flush policy argument";
+    }
+    if (strcmp(name, "batch") == 0) {
+        *policy = SINK_FLUSH_BATCH;
+    } else if (strcmp(name, "record") == 0) {
+        *policy = SINK_FLUSH_RECORD;
+    } else {
+        return "Unknown flush policy";
+    }
+    return NULL;
+}
+
+/**
+ * Open the sink
+ */
+const char* output_sink_open(const char* target, const char* delimiter, record_format_t format,
+                             sink_flush_policy_t flush_policy) {
+    if (!target || !delimiter) {
+        return "Invalid sink arguments";
+    }
+    if (sink.open) {
+        return "Sink is already open";
+    }
+
+    int length = decode_delimiter(delimiter, sink.delimiter, sizeof(sink.delimiter));
+    if (length < 0) {
+        return "Delimiter is too long";
+    }
+    sink.delimiter_length = (size_t)length;
+    sink.framed = format == RECORD_FORMAT_FRAMED;
+    if (sink.framed) {
+        sink.delimiter_length = 0;
+    }
+    sink.flush_policy = flush_policy;
+
+    if (strcmp(target, "-") == 0) {
+        sink.fd = STDOUT_FILENO;
+        sink.owns_fd = 0;
+    } else {
+        sink.fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (sink.fd < 0) {
+            return "Failed to open sink file";
+        }
+        sink.owns_fd = 1;
+    }
+
+    struct stat info;
+    sink.is_pipe = fstat(sink.fd, &info) == 0 && S_ISFIFO(info.st_mode);
+    sink.buffer_size = SINK_BUFFER_SIZE;
+    sink.buffer = map_batch(sink.buffer_size);
+    if (!sink.buffer) {
+        if (sink.owns_fd) {
+            close(sink.fd);
+        }
+        sink.fd = -1;
+        return "Failed to allocate the sink buffer";
+    }
+
+    if (pthread_mutex_init(&sink.lock, NULL) != 0) {
+        munmap(sink.buffer, sink.buffer_size);
+        sink.buffer = NULL;
+        if (sink.owns_fd) {
+            close(sink.fd);
+        }
+        sink.fd = -1;
+        return "Failed to initialize the sink lock";
+    }
+
+    sink.used = 0;
+    sink.records = 0;
+    sink.bytes = 0;
+    sink.write_calls = 0;
+    sink.spliced_bytes = 0;
+    sink.open = 1;
+
+    return NULL;
+}
+
+/**
+ * Add a record to the sink
+ */
+const char* output_sink_place_work(const char* record) {
+    if (!sink.open) {
+        return "Sink is not open";
+    }
+    if (!record) {
+        return "Input string cannot be NULL";
+    }
+
+    if (strcmp(record, "<END>") == 0) {
+        return output_sink_flush();
+    }
+
+    size_t length = strlen(record);
+    unsigned char header[FRAMING_MAX_VARINT];
+    size_t header_length = sink.framed ? framing_encode_length(length, header) : 0;
+    const char* error;
+
+    pthread_mutex_lock(&sink.lock);
+
+    if (length >= SINK_DIRECT_THRESHOLD) {
+        // Large records go out straight from the caller's memory, behind the batch
+        struct iovec iov[4] = {
+            { sink.buffer, sink.used },
+            { header, header_length },
+            { (void*)record, length },
+            { sink.delimiter, sink.delimiter_length }
+        };
+        error = write_all(iov, 4);
+        sink.used = 0;
+    } else {
+        error = append((const char*)header, header_length);
+        if (!error) {
+            error = append(record, length);
+        }
+        if (!error) {
+            error = append(sink.delimiter, sink.delimiter_length);
+        }
+        if (!error && sink.flush_policy == SINK_FLUSH_RECORD) {
+            error = flush_buffer();
+        }
+    }
+
+    sink.records++;
+    sink.bytes += header_length + length + sink.delimiter_length;
+
+    pthread_mutex_unlock(&sink.lock);
+
+    return error;
+}
+
+/**
+ * Write out every buffered record
+ */
+const char* output_sink_flush(void) {
+    if (!sink.open) {
+        return "Sink is not open";
+    }
+
+    pthread_mutex_lock(&sink.lock);
+    const char* error = flush_buffer();
+    pthread_mutex_unlock(&sink.lock);
+
+    return error;
+}
+
+/**
+ * Flush and close the sink
+ */
+void output_sink_close(void) {
+    if (!sink.open) {
+        return;
+    }
+
+    output_sink_flush();
+    pthread_mutex_destroy(&sink.lock);
+
+    // Pages still queued in the pipe stay alive until they are read
+    munmap(sink.buffer, sink.buffer_size);
+    sink.buffer = NULL;
+    if (sink.owns_fd) {
+        close(sink.fd);
+    }
+    sink.fd = -1;
+    sink.open = 0;
+}
+
+/**
+ * Check whether the sink writes to stdout
+ */
+int output_sink_uses_stdout(void) {
+    return sink.open && !sink.owns_fd;
+}
+
+/**
+ * Print the sink's counters to stderr
+ */
+void output_sink_report(void) {
+    fprintf(stderr, "[stats] sink: records=%llu bytes=%llu write_calls=%llu spliced_bytes=%llu\n",
+            sink.records, sink.bytes, sink.write_calls, sink.spliced_bytes);
+}
@@ -0,0 +1,71 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include "framing.h"
+
+/**
+ * Output sink - the stage the last plugin attaches to
+ * Writes raw records followed by a delimiter (or preceded by their varint
+ * length, see framing.h) to stdout or a file, aggregated
+ * into large batches written with writev, or moved with vmsplice when the
+ * target is a pipe
+ */
+
+/**
+ * When buffered records are written out
+ */
+typedef enum {
+    SINK_FLUSH_BATCH = 0,              /* When the batch buffer is full and at end of stream */
+    SINK_FLUSH_RECORD                  /* After every record */
+} sink_flush_policy_t;
+
+/**
+ * Parse a flush policy name ("batch" or "record")
+ * @param name Policy name
+ * @param policy Receives the parsed policy
+ * @return NULL on success, error message on failure
+ */
+const char* output_sink_parse_flush_policy(const char* name, sink_flush_policy_t* policy);
+
+/**
+ * Open the sink
+ * @param target "-" for stdout, otherwise a file path (created or truncated)
+ * @param delimiter Delimiter written after every record; C escapes \n, \t, \r, \0 and \\ are decoded
+ * @param format RECORD_FORMAT_FRAMED writes a length before every record instead of the delimiter
+ * @param flush_policy When to write buffered records
+ * @return NULL on success, error message on failure
+ */
+const char* output_sink_open(const char* target, const char* delimiter, record_format_t format,
+                             sink_flush_policy_t flush_policy);
+
+/**
+ * Add a record to the sink; "<END>" flushes it instead of being written
+ * Has the signature of plugin_place_work so the last plugin can attach to it
+ * @param record The record (copied before returning)
+ * @return NULL on success, error message on failure
+ */
+const char* output_sink_place_work(const char* record);
+
+/**
+ * Write out every buffered record
+ * @return NULL on success, error message on failure
+ */
+const char* output_sink_flush(void);
+
+/**
+ * Flush and close the sink
+ */
+void output_sink_close(void);
+
+/**
+ * Check whether the sink writes to stdout
+ * @return 1 if the sink is open on stdout, 0 otherwise
+ */
+int output_sink_uses_stdout(void);
+
+/**
+ * Print the sink's counters to stderr
+ */
+void output_sink_report(void);
+
+#endif // OUTPUT_SINK_H
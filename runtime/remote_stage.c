@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+#include "remote_stage.h"
+#include "shm_channel.h"
+#include "../plugins/sync/monitor.h"
+#include "../plugins/plugin_sdk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#define REMOTE_RECORD_BYTES 2048               // Channel space per queued record
+#define REMOTE_MIN_CHANNEL (64 * 1024)
+#define REMOTE_POLL_MS 100                     // How often a waiting side checks for a dead peer
+
+typedef struct {
+    char name[64];
+    pid_t pid;
+    shm_channel_t* to_worker;
+    shm_channel_t* from_worker;
+    const char* (*init)(int);
+    const char* (*transform)(const char*);
+    const char* (*flush)(void);
+    const char* (*fini)(void);
+
+    // Parent side
+    pthread_t receiver;
+    int receiver_started;
+    pthread_mutex_t send_lock;                 // The channel has a single producer
+    pthread_mutex_t attach_lock;
+    const char* (*next_place_work)(const char*);
+    monitor_t finished_monitor;
+    atomic_int died;
+    int reaped;
+    atomic_ullong dropped;
+    char init_error[256];
+} remote_stage_t;
+
+static remote_stage_t remote_stages[REMOTE_MAX_STAGES];
+static int remote_stage_count = 0;
+
+/**
+ * Send a whole message, waiting for space as long as the peer is alive
+ * In the worker, the peer is the parent (its death kills the worker); in
+ * the parent, the proxy notices a dead worker through its died flag.
+ */
+static int send_message(remote_stage_t* stage, shm_channel_t* channel, const char* message) {
+    size_t length = strlen(message);
+    while (1) {
+        int result = shm_channel_send(channel, message, length, REMOTE_POLL_MS);
+        if (result != SHM_CHANNEL_TIMEOUT) {
+            return result;
+        }
+        if (atomic_load(&stage->died)) {
+            return SHM_CHANNEL_CLOSED;
+        }
+    }
+}
+
+/**
+ * Body of the worker process: transform records until "<END>" or until
+ * the parent closes the channels
+ */
+static void worker_main(remote_stage_t* stage, int queue_size) {
+    const char* error = stage->init(queue_size);
+    send_message(stage, stage->from_worker, error ? error : "");
+    if (error) {
+        fflush(stdout);
+        _exit(1);
+    }
+
+    while (1) {
+        const char* item;
+        size_t length;
+        int result = shm_channel_receive(stage->to_worker, &item, &length, REMOTE_POLL_MS);
+        if (result == SHM_CHANNEL_TIMEOUT) {
+            continue;
+        }
+        if (result != SHM_CHANNEL_OK) {
+            break;
+        }
+
+        if (strcmp(item, "<END>") == 0) {
+            const char* flushed = stage->flush ? stage->flush() : NULL;
+            if (flushed) {
+                send_message(stage, stage->from_worker, flushed);
+                free((void*)flushed);
+            }
+            send_message(stage, stage->from_worker, item);
+            shm_channel_release(stage->to_worker);
+            break;
+        }
+
+        const char* output = stage->transform(item);
+        if (output == PLUGIN_DROP) {
+            output = NULL;
+        }
+        result = output ? send_message(stage, stage->from_worker, output) : SHM_CHANNEL_OK;
+        if (output && output != item) {
+            free((void*)output);
+        }
+        shm_channel_release(stage->to_worker);
+        if (result == SHM_CHANNEL_CLOSED) {
+            break;
+        }
+        if (result == SHM_CHANNEL_TOO_LARGE) {
+            fprintf(stderr, "[isolate] stage %s: output too large for the channel, dropped\n", stage->name);
+        }
+    }
+
+    stage->fini();
+    fflush(stdout);
+    fflush(stderr);
+    shm_channel_close(stage->from_worker);
+    _exit(0);
+}
+
+/**
+ * Cut a dead worker's stage out of the pipeline: later records are dropped
+ * and the end signal is passed on in its place
+ */
+static void worker_died(remote_stage_t* stage, int status) {
+    atomic_store(&stage->died, 1);
+    shm_channel_close(stage->to_worker);
+
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "[isolate] stage %s (pid %d) died: killed by signal %d\n",
+                stage->name, (int)stage->pid, WTERMSIG(status));
+    } else {
+        fprintf(stderr, "[isolate] stage %s (pid %d) died: exited with status %d\n",
+                stage->name, (int)stage->pid, WEXITSTATUS(status));
+    }
+
+    pthread_mutex_lock(&stage->attach_lock);
+    if (stage->next_place_work) {
+        stage->next_place_work("<END>");
+    }
+    pthread_mutex_unlock(&stage->attach_lock);
+}
+
+/**
+ * Receiver thread: forwards the worker's output to the next stage
+ */
+static void* receiver_thread(void* arg) {
+    remote_stage_t* stage = arg;
+
+    while (1) {
+        const char* item;
+        size_t length;
+        int result = shm_channel_receive(stage->from_worker, &item, &length, REMOTE_POLL_MS);
+        if (result == SHM_CHANNEL_CLOSED) {
+            break;
+        }
+        if (result == SHM_CHANNEL_TIMEOUT) {
+            int status;
+            if (waitpid(stage->pid, &status, WNOHANG) == stage->pid) {
+                stage->reaped = 1;
+                worker_died(stage, status);
+                break;
+            }
+            continue;
+        }
+
+        int is_end = strcmp(item, "<END>") == 0;
+        pthread_mutex_lock(&stage->attach_lock);
+        if (stage->next_place_work) {
+            stage->next_place_work(item);
+        }
+        pthread_mutex_unlock(&stage->attach_lock);
+        shm_channel_release(stage->from_worker);
+        if (is_end) {
+            break;
+        }
+    }
+
+    monitor_signal(&stage->finished_monitor);
+    return NULL;
+}
+
+/**
+ * Proxy init: wait for the worker's plugin to initialize, then start receiving
+ */
+static const char* remote_init(remote_stage_t* stage, int queue_size) {
+    (void)queue_size;
+    while (1) {
+        const char* reply;
+        size_t length;
+        int result = shm_channel_receive(stage->from_worker, &reply, &length, REMOTE_POLL_MS);
+        if (result == SHM_CHANNEL_OK) {
+            snprintf(stage->init_error, sizeof(stage->init_error), "%s", reply);
+            shm_channel_release(stage->from_worker);
+            break;
+        }
+        int status;
+        if (result == SHM_CHANNEL_CLOSED || waitpid(stage->pid, &status, WNOHANG) == stage->pid) {
+            return "Worker process exited during initialization";
+        }
+    }
+    if (stage->init_error[0] != '\0') {
+        return stage->init_error;
+    }
+
+    if (pthread_create(&stage->receiver, NULL, receiver_thread, stage) != 0) {
+        return "Failed to create receiver thread";
+    }
+    stage->receiver_started = 1;
+    return NULL;
+}
+
+/**
+ * Proxy fini: stop the worker and release the channels
+ */
+static const char* remote_fini(remote_stage_t* stage) {
+    if (!stage->to_worker) {
+        return "Stage is not running";
+    }
+
+    // A worker that did not see "<END>" exits once the channels are closed
+    shm_channel_close(stage->to_worker);
+    shm_channel_close(stage->from_worker);
+    if (stage->receiver_started) {
+        pthread_join(stage->receiver, NULL);
+        stage->receiver_started = 0;
+    }
+    if (!stage->reaped) {
+        waitpid(stage->pid, NULL, 0);
+        stage->reaped = 1;
+    }
+
+    shm_channel_destroy(stage->to_worker);
+    shm_channel_destroy(stage->from_worker);
+    stage->to_worker = NULL;
+    stage->from_worker = NULL;
+    monitor_destroy(&stage->finished_monitor);
+    pthread_mutex_destroy(&stage->send_lock);
+    pthread_mutex_destroy(&stage->attach_lock);
+    return NULL;
+}
+
+/**
+ * Proxy place_work: copy the record into the worker's channel
+ */
+static const char* remote_place_work(remote_stage_t* stage, const char* str) {
+    if (!str) {
+        return "Invalid string";
+    }
+    int is_end = strcmp(str, "<END>") == 0;
+    if (atomic_load(&stage->died)) {
+        atomic_fetch_add(&stage->dropped, !is_end);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&stage->send_lock);
+    int result = send_message(stage, stage->to_worker, str);
+    pthread_mutex_unlock(&stage->send_lock);
+
+    if (result == SHM_CHANNEL_TOO_LARGE) {
+        atomic_fetch_add(&stage->dropped, 1);
+        return "Record too large for the channel";
+    }
+    if (result == SHM_CHANNEL_CLOSED) {
+        atomic_fetch_add(&stage->dropped, !is_end);
+    }
+    return NULL;
+}
+
+/**
+ * Proxy attach
+ */
+static void remote_attach(remote_stage_t* stage, const char* (*next_place_work)(const char*)) {
+    pthread_mutex_lock(&stage->attach_lock);
+    stage->next_place_work = next_place_work;
+    pthread_mutex_unlock(&stage->attach_lock);
+}
+
+/**
+ * Proxy wait_finished: "<END>" has passed the stage (or the worker died)
+ */
+static const char* remote_wait_finished(remote_stage_t* stage) {
+    if (monitor_wait(&stage->finished_monitor) != 0) {
+        return "Failed to wait for the stage";
+    }
+    return NULL;
+}
+
+/**
+ * Proxy get_stat: records lost to a dead worker or an oversized record
+ */
+static const char* remote_get_stat(remote_stage_t* stage, int index, unsigned long long* value) {
+    if (index != 0) {
+        return NULL;
+    }
+    *value = atomic_load(&stage->dropped);
+    return "dropped";
+}
+
+// The plugin interface has no context argument, so every slot gets its own entry points
+#define REMOTE_STAGE_SLOTS(X) X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)
+
+#define DEFINE_REMOTE_PROXY(slot) \
+    static const char* remote_init_##slot(int queue_size) { \
+        return remote_init(&remote_stages[slot], queue_size); } \
+    static const char* remote_fini_##slot(void) { \
+        return remote_fini(&remote_stages[slot]); } \
+    static const char* remote_place_work_##slot(const char* str) { \
+        return remote_place_work(&remote_stages[slot], str); } \
+    static void remote_attach_##slot(const char* (*next_place_work)(const char*)) { \
+        remote_attach(&remote_stages[slot], next_place_work); } \
+    static const char* remote_wait_finished_##slot(void) { \
+        return remote_wait_finished(&remote_stages[slot]); } \
+    static const char* remote_get_stat_##slot(int index, unsigned long long* value) { \
+        return remote_get_stat(&remote_stages[slot], index, value); }
+
+REMOTE_STAGE_SLOTS(DEFINE_REMOTE_PROXY)
+
+#define REMOTE_PROXY_ENTRY(slot) \
+    { remote_init_##slot, remote_fini_##slot, remote_place_work_##slot, \
+      remote_attach_##slot, remote_wait_finished_##slot, remote_get_stat_##slot },
+
+static const remote_stage_functions_t remote_proxies[REMOTE_MAX_STAGES] = {
+    REMOTE_STAGE_SLOTS(REMOTE_PROXY_ENTRY)
+};
+
+/**
+ * Fork a worker process for a stage
+ */
+const char* remote_stage_start(const char* name,
+                               const char* (*init)(int),
+                               const char* (*transform)(const char*),
+                               const char* (*flush)(void),
+                               const char* (*fini)(void),
+                               int queue_size,
+                               remote_stage_functions_t* functions) {
+    if (!name || !init || !transform || !fini || queue_size <= 0 || !functions) {
+        return "Invalid arguments";
+    }
+    if (remote_stage_count >= REMOTE_MAX_STAGES) {
+        return "Too many isolated stages";
+    }
+
+    remote_stage_t* stage = &remote_stages[remote_stage_count];
+    memset(stage, 0, sizeof(*stage));
+    snprintf(stage->name, sizeof(stage->name), "%s", name);
+    stage->init = init;
+    stage->transform = transform;
+    stage->flush = flush;
+    stage->fini = fini;
+
+    size_t capacity = (size_t)queue_size * REMOTE_RECORD_BYTES;
+    capacity = capacity > REMOTE_MIN_CHANNEL ? capacity : REMOTE_MIN_CHANNEL;
+    const char* error = NULL;
+    stage->to_worker = shm_channel_create(capacity, &error);
+    if (stage->to_worker) {
+        stage->from_worker = shm_channel_create(capacity, &error);
+    }
+    if (!stage->from_worker) {
+        shm_channel_destroy(stage->to_worker);
+        stage->to_worker = NULL;
+        return error;
+    }
+    if (monitor_init(&stage->finished_monitor) != 0) {
+        shm_channel_destroy(stage->to_worker);
+        shm_channel_destroy(stage->from_worker);
+        stage->to_worker = NULL;
+        stage->from_worker = NULL;
+        return "Failed to initialize the finished monitor";
+    }
+    pthread_mutex_init(&stage->send_lock, NULL);
+    pthread_mutex_init(&stage->attach_lock, NULL);
+
+    // Buffered output would otherwise be written by both processes
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        stage->reaped = 1;
+        remote_fini(stage);
+        return "Failed to fork worker process";
+    }
+    if (pid == 0) {
+        // The worker must not outlive the pipeline
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent) {
+            _exit(1);
+        }
+        worker_main(stage, queue_size);
+    }
+
+    stage->pid = pid;
+    *functions = remote_proxies[remote_stage_count];
+    remote_stage_count++;
+    return NULL;
+}
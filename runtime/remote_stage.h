@@ -0,0 +1,49 @@
+#ifndef REMOTE_STAGE_H
+#define REMOTE_STAGE_H
+
+/**
+ * Remote stages - run a stage's plugin in a forked worker process
+ *
+ * Records travel to the worker and back over two shared-memory channels.
+ * The parent gets a proxy with the plugin interface, so the stage attaches
+ * to its neighbours like any other. If the worker dies, its stage is cut out:
+ * the proxy drops what is sent to it and passes the end signal on, so the
+ * rest of the pipeline still shuts down cleanly.
+ */
+
+// Most stages that can run in worker processes
+#define REMOTE_MAX_STAGES 8
+
+// Plugin interface of a proxy
+typedef struct {
+    const char* (*init)(int);
+    const char* (*fini)(void);
+    const char* (*place_work)(const char*);
+    void (*attach)(const char* (*)(const char*));
+    const char* (*wait_finished)(void);
+    const char* (*get_stat)(int, unsigned long long*);
+} remote_stage_functions_t;
+
+/**
+ * Fork a worker process for a stage
+ * The plugin must be configured to run without its own thread (scheduler=pool);
+ * the worker initializes it and calls its transform for every record.
+ * Must be called while the calling process has a single thread.
+ * @param name Stage name, used in messages
+ * @param init The plugin's init, called in the worker
+ * @param transform The plugin's transform, called in the worker
+ * @param flush The plugin's flush, called in the worker at "<END>" (may be NULL)
+ * @param fini The plugin's fini, called in the worker
+ * @param queue_size Records the channel to the worker holds (at the longest input line)
+ * @param functions Receives the proxy's functions
+ * @return NULL on success, error message on failure
+ */
+const char* remote_stage_start(const char* name,
+                               const char* (*init)(int),
+                               const char* (*transform)(const char*),
+                               const char* (*flush)(void),
+                               const char* (*fini)(void),
+                               int queue_size,
+                               remote_stage_functions_t* functions);
+
+#endif // REMOTE_STAGE_H
@@ -0,0 +1,427 @@
+#include "replicas.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define REPLICAS_MAX_WINDOW 65536                   // Most lines in flight with merge=input
+
+typedef struct {
+    char* value;                                    // Output copy, or NULL if a stage dropped the line
+    int done;
+} reorder_slot_t;
+
+struct replicas {
+    int count;
+    int stage_count;
+    scheduler_stage_t* stages;                      // The caller's stages, sharing their flush
+    atomic_int* flush_arrivals;                     // Replicas that reached "<END>" at each stage
+    scheduler_pipeline_t* pipelines[REPLICAS_MAX];
+    unsigned long long routed[REPLICAS_MAX];        // Lines sent to each replica (ingest thread)
+    int field;
+    replica_merge_t merge;
+    scheduler_output_func_t output;
+    atomic_int ends;                                // Replicas whose "<END>" passed the last stage
+
+    // Reorder window (merge=input), all under lock
+    pthread_mutex_t lock;
+    pthread_cond_t space;
+    reorder_slot_t* window;
+    unsigned long long window_size;
+    unsigned long long next_ticket;                 // Ticket of the next input line
+    unsigned long long next_emit;                   // Ticket of the next output to release
+    unsigned long long held_back;                   // Outputs that waited for an earlier line
+    char** trailer;                                 // End-of-stream outputs of the stages, in arrival order
+    int trailer_count;
+    int trailer_capacity;
+    int aborted;
+};
+
+/**
+ * Parse a shard key specification
+ */
+const char* replicas_parse_key(const char* spec, int* field) {
+    if (!spec || !field) {
+        return "Null shard key argument";
+    }
+    if (strcmp(spec, "line") == 0) {
+        *field = 0;
+        return NULL;
+    }
+    if (strncmp(spec, "field:", 6) == 0) {
+        char* endptr;
+        long value = strtol(spec + 6, &endptr, 10);
+        if (spec[6] != '\0' && *endptr == '\0' && value >= 1 && value <= 1024) {
+            *field = (int)value;
+            return NULL;
+        }
+    }
+    return "Invalid shard key (expected line or field:<n>)";
+}
+
+/**
+ * Parse a merge mode name
+ */
+const char* replicas_parse_merge(const char* name, replica_merge_t* merge) {
+    if (!name || !merge) {
+        return "Null merge mode argument";
+    }
+    if (strcmp(name, "key") == 0) {
+        *merge = REPLICA_MERGE_KEY;
+    } else if (strcmp(name, "input") == 0) {
+        *merge = REPLICA_MERGE_INPUT;
+    } else {
+        return "Invalid merge mode (expected key or input)";
+    }
+    return NULL;
+}
+
+/**
+ * Find a line's shard key: the whole line, or its field-th whitespace-separated token
+ */
+static const char* shard_key(const char* line, int field, size_t* length) {
+    if (field == 0) {
+        *length = strlen(line);
+        return line;
+    }
+    const char* start = line;
+    for (int i = 1; ; i++) {
+        while (*start == ' ' || *start == '\t') {
+            start++;
+        }
+        const char* end = start;
+        while (*end != '\0' && *end != ' ' && *end != '\t') {
+            end++;
+        }
+        if (i == field || end == start) {
+            *length = (size_t)(end - start);
+            return start;
+        }
+        start = end;
+    }
+}
+
+/**
+ * Pick a line's replica by the FNV-1a hash of its key
+ */
+static int route(const replicas_t* replicas, const char* line) {
+    size_t length;
+    const unsigned char* key = (const unsigned char*)shard_key(line, replicas->field, &length);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= key[i];
+        hash *= 1099511628211ULL;
+    }
+    return (int)(hash % (uint64_t)replicas->count);
+}
+
+/**
+ * Output function of the replicas with merge=key (worker threads)
+ * Passes outputs on as they come; "<END>" only once every replica sent its own
+ */
+static int key_merge_output(void* context, const char* item) {
+    replicas_t* replicas = (replicas_t*)context;
+    if (strcmp(item, "<END>") == 0 && atomic_fetch_add(&replicas->ends, 1) + 1 < replicas->count) {
+        return 1;
+    }
+    return replicas->output ? replicas->output(NULL, item) : 1;
+}
+
+/**
+ * Release the outputs at the head of the window that are complete (under lock)
+ */
+static void release_ready(replicas_t* replicas) {
+    int released = 0;
+    while (1) {
+        reorder_slot_t* slot = &replicas->window[replicas->next_emit % replicas->window_size];
+        if (!slot->done) {
+            break;
+        }
+        if (slot->value && replicas->output) {
+            replicas->output(NULL, slot->value);
+        }
+        free(slot->value);
+        slot->value = NULL;
+        slot->done = 0;
+        replicas->next_emit++;
+        released = 1;
+    }
+    if (released) {
+        pthread_cond_signal(&replicas->space);
+    }
+}
+
+/**
+ * Retire function of the replicas with merge=input (worker threads)
+ * Outputs are held in the window until every earlier line has retired
+ */
+static int input_merge_retire(void* context, unsigned long long ticket, const char* item) {
+    replicas_t* replicas = (replicas_t*)context;
+    pthread_mutex_lock(&replicas->lock);
+
+    if (ticket == SCHEDULER_NO_TICKET) {
+        if (strcmp(item, "<END>") != 0) {
+            // A stage's end-of-stream output: after the last line
+            if (replicas->trailer_count == replicas->trailer_capacity) {
+                int capacity = replicas->trailer_capacity ? replicas->trailer_capacity * 2 : 8;
+                char** grown = realloc(replicas->trailer, (size_t)capacity * sizeof(char*));
+                if (grown) {
+                    replicas->trailer = grown;
+                    replicas->trailer_capacity = capacity;
+                }
+            }
+            if (replicas->trailer_count < replicas->trailer_capacity) {
+                char* copy = strdup(item);
+                if (copy) {
+                    replicas->trailer[replicas->trailer_count++] = copy;
+                }
+            }
+        } else if (atomic_fetch_add(&replicas->ends, 1) + 1 == replicas->count) {
+            // Every replica is done, so every line has retired
+            for (int i = 0; i < replicas->trailer_count; i++) {
+                if (replicas->output) {
+                    replicas->output(NULL, replicas->trailer[i]);
+                }
+                free(replicas->trailer[i]);
+            }
+            replicas->trailer_count = 0;
+            if (replicas->output) {
+                replicas->output(NULL, item);
+            }
+        }
+        pthread_mutex_unlock(&replicas->lock);
+        return 1;
+    }
+
+    reorder_slot_t* slot = &replicas->window[ticket % replicas->window_size];
+    // A copy that cannot be made counts as dropped rather than stalling the window
+    slot->value = item ? strdup(item) : NULL;
+    slot->done = 1;
+    if (ticket != replicas->next_emit) {
+        replicas->held_back++;
+    }
+    release_ready(replicas);
+
+    pthread_mutex_unlock(&replicas->lock);
+    return 1;
+}
+
+/**
+ * Create the replicas on the running worker pool
+ */
+replicas_t* replicas_create(int count, const scheduler_stage_t* stages, int stage_count, int queue_size,
+                            int field, replica_merge_t merge, scheduler_output_func_t output,
+                            const char** error) {
+    if (count < 1 || count > REPLICAS_MAX || !stages || stage_count < 1 || queue_size < 1) {
+        *error = "Invalid replica arguments";
+        return NULL;
+    }
+    replicas_t* replicas = calloc(1, sizeof(replicas_t));
+    if (!replicas) {
+        *error = "Failed to allocate the replicas";
+        return NULL;
+    }
+    replicas->stage_count = stage_count;
+    replicas->field = field;
+    replicas->merge = merge;
+    replicas->output = output;
+    atomic_init(&replicas->ends, 0);
+    pthread_mutex_init(&replicas->lock, NULL);
+    pthread_cond_init(&replicas->space, NULL);
+
+    // The replicas share the plugins' state, so a stage's flush must see them all done
+    replicas->stages = calloc((size_t)stage_count, sizeof(scheduler_stage_t));
+    replicas->flush_arrivals = calloc((size_t)stage_count, sizeof(atomic_int));
+    if (!replicas->stages || !replicas->flush_arrivals) {
+        replicas_destroy(replicas);
+        *error = "Failed to allocate the replicas";
+        return NULL;
+    }
+    for (int i = 0; i < stage_count; i++) {
+        replicas->stages[i] = stages[i];
+        atomic_init(&replicas->flush_arrivals[i], 0);
+        replicas->stages[i].flush_arrivals = &replicas->flush_arrivals[i];
+        replicas->stages[i].flush_parties = count;
+    }
+
+    if (merge == REPLICA_MERGE_INPUT) {
+        // Room for every line the replicas can hold at once, so the window rarely binds
+        unsigned long long size = (unsigned long long)count * (unsigned long long)stage_count *
+                                  (unsigned long long)(queue_size + 2);
+        replicas->window_size = size < REPLICAS_MAX_WINDOW ? size : REPLICAS_MAX_WINDOW;
+        replicas->window = calloc((size_t)replicas->window_size, sizeof(reorder_slot_t));
+        if (!replicas->window) {
+            replicas_destroy(replicas);
+            *error = "Failed to allocate the reorder window";
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        scheduler_pipeline_t* pipeline = scheduler_create_pipeline(replicas->stages, stage_count, queue_size,
+                                                                   key_merge_output, NULL, replicas, error);
+        if (!pipeline) {
+            replicas_destroy(replicas);
+            return NULL;
+        }
+        replicas->pipelines[replicas->count++] = pipeline;
+        // With fewer workers than replicas, some workers run two
+        *error = scheduler_pin_pipeline(pipeline, i % scheduler_worker_count());
+        if (!*error && merge == REPLICA_MERGE_INPUT) {
+            *error = scheduler_track_items(pipeline, input_merge_retire);
+        }
+        if (*error) {
+            replicas_destroy(replicas);
+            return NULL;
+        }
+    }
+    return replicas;
+}
+
+/**
+ * Route an input line to its replica
+ */
+const char* replicas_place_work(replicas_t* replicas, const char* item) {
+    if (!replicas) {
+        return "Replicas are not initialized";
+    }
+    if (!item) {
+        return "Input string cannot be NULL";
+    }
+
+    if (strcmp(item, "<END>") == 0) {
+        for (int i = 0; i < replicas->count; i++) {
+            const char* error = scheduler_place_work(replicas->pipelines[i], item);
+            if (error) {
+                return error;
+            }
+        }
+        return NULL;
+    }
+
+    int index = route(replicas, item);
+    replicas->routed[index]++;
+    if (replicas->merge == REPLICA_MERGE_KEY) {
+        return scheduler_place_work(replicas->pipelines[index], item);
+    }
+
+    pthread_mutex_lock(&replicas->lock);
+    while (!replicas->aborted && replicas->next_ticket - replicas->next_emit >= replicas->window_size) {
+        pthread_cond_wait(&replicas->space, &replicas->lock);
+    }
+    int aborted = replicas->aborted;
+    unsigned long long ticket = replicas->next_ticket;
+    pthread_mutex_unlock(&replicas->lock);
+    if (aborted) {
+        return "Replicas were aborted";
+    }
+
+    const char* error = scheduler_place_work_ticket(replicas->pipelines[index], item, ticket);
+    if (!error) {
+        // Only this thread advances the ticket; workers read it only through next_emit
+        pthread_mutex_lock(&replicas->lock);
+        replicas->next_ticket++;
+        pthread_mutex_unlock(&replicas->lock);
+    }
+    return error;
+}
+
+/**
+ * Wait until "<END>" has passed the last stage of every replica
+ */
+const char* replicas_wait_finished(replicas_t* replicas) {
+    if (!replicas) {
+        return "Replicas are not initialized";
+    }
+    for (int i = 0; i < replicas->count; i++) {
+        const char* error = scheduler_wait_finished(replicas->pipelines[i]);
+        if (error) {
+            return error;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Stop every replica without draining it
+ */
+void replicas_abort(replicas_t* replicas, unsigned long long* queued) {
+    if (!replicas) {
+        return;
+    }
+    pthread_mutex_lock(&replicas->lock);
+    replicas->aborted = 1;
+    pthread_cond_broadcast(&replicas->space);
+    pthread_mutex_unlock(&replicas->lock);
+
+    unsigned long long* discarded = calloc((size_t)replicas->stage_count, sizeof(unsigned long long));
+    for (int i = 0; i < replicas->count; i++) {
+        scheduler_abort_pipeline(replicas->pipelines[i], discarded);
+        for (int j = 0; j < replicas->stage_count && discarded && queued; j++) {
+            queued[j] += discarded[j];
+        }
+    }
+    free(discarded);
+}
+
+/**
+ * Get one replica's pipeline
+ */
+scheduler_pipeline_t* replicas_pipeline(replicas_t* replicas, int index) {
+    if (!replicas || index < 0 || index >= replicas->count) {
+        return NULL;
+    }
+    return replicas->pipelines[index];
+}
+
+/**
+ * Get the number of replicas
+ */
+int replicas_count(replicas_t* replicas) {
+    return replicas ? replicas->count : 0;
+}
+
+/**
+ * Destroy the replicas
+ */
+void replicas_destroy(replicas_t* replicas) {
+    if (!replicas) {
+        return;
+    }
+    for (int i = 0; i < replicas->count; i++) {
+        scheduler_destroy_pipeline(replicas->pipelines[i]);
+    }
+    for (unsigned long long i = 0; i < replicas->window_size; i++) {
+        free(replicas->window[i].value);
+    }
+    free(replicas->window);
+    for (int i = 0; i < replicas->trailer_count; i++) {
+        free(replicas->trailer[i]);
+    }
+    free(replicas->trailer);
+    free(replicas->stages);
+    free(replicas->flush_arrivals);
+    pthread_cond_destroy(&replicas->space);
+    pthread_mutex_destroy(&replicas->lock);
+    free(replicas);
+}
+
+/**
+ * Print the routing counters to stderr
+ */
+void replicas_report(replicas_t* replicas) {
+    if (!replicas) {
+        return;
+    }
+    fprintf(stderr, "[stats] replicas: count=%d merge=%s routed=", replicas->count,
+            replicas->merge == REPLICA_MERGE_INPUT ? "input" : "key");
+    for (int i = 0; i < replicas->count; i++) {
+        fprintf(stderr, i == 0 ? "%llu" : ",%llu", replicas->routed[i]);
+    }
+    if (replicas->merge == REPLICA_MERGE_INPUT) {
+        fprintf(stderr, " held_back=%llu", replicas->held_back);
+    }
+    fprintf(stderr, "\n");
+}
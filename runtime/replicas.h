@@ -0,0 +1,115 @@
+#ifndef REPLICAS_H
+#define REPLICAS_H
+
+#include "scheduler.h"
+
+/**
+ * Replicated chains - K complete copies of the chain as pipelines on the
+ * worker pool, each pinned to its own worker, with input lines partitioned
+ * among them by the FNV-1a hash of a key (the whole line or one of its
+ * fields). Lines with the same key always take the same replica, so their
+ * relative order survives. "<END>" goes to every replica.
+ *
+ * How the replicas' outputs are merged:
+ *   key    each replica hands its output on as soon as it is done; order is
+ *          kept among the lines of one key only (no extra cost)
+ *   input  a reorder window releases outputs in input order; dropped lines
+ *          free their slot, and end-of-stream outputs of the stages follow
+ *          the last line. Needs blocking, single-lane stage queues.
+ */
+
+typedef enum {
+    REPLICA_MERGE_KEY = 0,
+    REPLICA_MERGE_INPUT
+} replica_merge_t;
+
+#define REPLICAS_MAX 64
+
+typedef struct replicas replicas_t;
+
+/**
+ * Parse a shard key specification: "line" or "field:<n>" (the n-th
+ * whitespace-separated token, from 1; a line without it has an empty key)
+ * @param spec The specification
+ * @param field Receives the field number, 0 for the whole line
+ * @return NULL on success, error message on failure
+ */
+const char* replicas_parse_key(const char* spec, int* field);
+
+/**
+ * Parse a merge mode name ("key" or "input")
+ * @param name The name
+ * @param merge Receives the mode
+ * @return NULL on success, error message on failure
+ */
+const char* replicas_parse_merge(const char* name, replica_merge_t* merge);
+
+/**
+ * Create the replicas on the running worker pool; replica i is pinned to
+ * worker i modulo the worker count
+ * @param count Number of replicas (1 to REPLICAS_MAX)
+ * @param stages Setup of each stage of a replica
+ * @param stage_count Number of stages
+ * @param queue_size Capacity of each stage's queue
+ * @param field Shard key field, 0 for the whole line
+ * @param merge How the outputs are merged
+ * @param output Receives the merged output, "<END>" once at the end (NULL: discarded)
+ * @param error Receives an error message on failure
+ * @return The replicas, or NULL on failure
+ */
+replicas_t* replicas_create(int count, const scheduler_stage_t* stages, int stage_count, int queue_size,
+                            int field, replica_merge_t merge, scheduler_output_func_t output,
+                            const char** error);
+
+/**
+ * Route an input line to its replica ("<END>" to all of them); waits while
+ * the replica's first queue, or the reorder window, is full
+ * Only one thread may call this
+ * @param replicas The replicas
+ * @param item The line (copied)
+ * @return NULL on success, error message on failure
+ */
+const char* replicas_place_work(replicas_t* replicas, const char* item);
+
+/**
+ * Wait until "<END>" has passed the last stage of every replica
+ * @param replicas The replicas
+ * @return NULL on success, error message on failure
+ */
+const char* replicas_wait_finished(replicas_t* replicas);
+
+/**
+ * Stop every replica without draining it (see scheduler_abort_pipeline)
+ * @param replicas The replicas
+ * @param queued Receives, per stage, the items discarded by all replicas (may be NULL)
+ */
+void replicas_abort(replicas_t* replicas, unsigned long long* queued);
+
+/**
+ * Get one replica's pipeline, for its counters
+ * @param replicas The replicas
+ * @param index Replica index
+ * @return The pipeline, or NULL if there is no such replica
+ */
+scheduler_pipeline_t* replicas_pipeline(replicas_t* replicas, int index);
+
+/**
+ * Get the number of replicas
+ * @param replicas The replicas
+ * @return Number of replicas (0 for NULL)
+ */
+int replicas_count(replicas_t* replicas);
+
+/**
+ * Destroy the replicas (see scheduler_destroy_pipeline)
+ * @param replicas The replicas
+ */
+void replicas_destroy(replicas_t* replicas);
+
+/**
+ * Print the routing counters to stderr
+ * @param replicas The replicas
+ */
+void replicas_report(replicas_t* replicas);
+
+#endif // REPLICAS_H
@@ -0,0 +1,1454 @@
+#define _GNU_SOURCE
+#include "scheduler.h"
+#include "intern_table.h"
+#include "../plugins/plugin_sdk.h"
+#include "../plugins/sync/probes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <stdatomic.h>
+
+// How an activation of a stage ended
+typedef enum {
+    STAGE_IDLE,                         // Queue is empty
+    STAGE_MORE,                         // Batch used up, items are left
+    STAGE_BLOCKED                       // Next stage's queue (or the output) is full
+} stage_status_t;
+
+// Ingest lines remembered per pipeline for sharing repeats
+#define INGEST_INTERN_SLOTS 1024
+
+// Adaptive pipelines: one item in ADAPT_SAMPLE is timed, and a group of
+// fused stages reconsiders its boundaries every ADAPT_PERIOD items. A stage
+// is fused when its transform costs less than a hop to it, and split off
+// again when it costs more than ADAPT_SPLIT_FACTOR hops.
+#define ADAPT_SAMPLE 16
+#define ADAPT_PERIOD 1024
+#define ADAPT_SPLIT_FACTOR 4
+
+typedef struct stage {
+    consumer_producer_t queue;
+    scheduler_transform_func_t transform;
+    scheduler_pipeline_t* pipeline;
+    int index;
+    atomic_int scheduled;               // Queued as a task or running
+    atomic_int blocked;                 // Yielded until the next stage takes an item
+    char* pending;                      // Output waiting for room in the next stage (owned)
+    char* pending_item;                 // The input it was made from (may be pending itself)
+    int pending_lane;                   // Priority lane the item came from
+    scheduler_flush_func_t flush;       // End-of-stream output, or NULL
+    atomic_int* flush_arrivals;         // Shared with the stage's copies in other pipelines, or NULL
+    int flush_parties;
+    const char* (*in_place)(char*);     // Transforms owned copies in place, or NULL
+    pthread_mutex_t* serialize;         // Held around the transform, or NULL
+    int flushed;                        // flush already ran for this pipeline
+    char* deferred;                     // "<END>" held back while the flush output goes first
+    int deferred_lane;
+    // Tracked pipelines: tickets of the queued items, in queue order. The
+    // producer writes one before offering its item and the consumer reads it
+    // after taking the item, so the queue's lock orders the two.
+    unsigned long long* tickets;
+    unsigned int ticket_head;           // Next ticket to read (consumer)
+    unsigned int ticket_tail;           // Next slot to write (producer)
+    unsigned int ticket_mask;
+    unsigned long long pending_ticket;  // Ticket of pending
+    unsigned long long deferred_ticket;
+    // Adaptive pipelines: a stage heads a group of span fused stages after
+    // it, whose transforms its activations run back to back; the absorbed
+    // stages' queues stay empty. Only a group's head changes the group.
+    int span;
+    atomic_uintptr_t producer;          // Head of the group feeding this queue (stage_t*), or 0
+    atomic_ullong accepted;             // Items this queue took
+    atomic_ullong completed;            // Items taken from this queue whose fate is settled
+    atomic_llong transform_ns;          // Average sampled transform time
+    atomic_llong hop_ns;                // Average sampled time to take an item and hand its output on
+    long long hop_started;              // Take time of the item being timed, or -1
+    unsigned int sample_tick;
+    unsigned int adapt_tick;
+    int fusible;                        // Declares no side effects and no stream state
+    int ended;                          // "<END>" went through; the stage stays on its own
+} stage_t;
+
+struct scheduler_pipeline {
+    stage_t* stages;
+    int stage_count;
+    scheduler_output_func_t output;
+    scheduler_space_func_t on_space;
+    void* context;
+    atomic_int ingest_blocked;          // scheduler_offer is waiting for on_space
+    atomic_int active;                  // Activations running
+    monitor_t finished_monitor;
+    intern_table_t* intern;             // Shares repeated ingest lines in the first queue, or NULL
+    int lane_count;                     // Priority lanes of every stage queue
+    int home;                           // Worker that runs every stage, or -1 for any
+    int adaptive;                       // Fuses and splits stages while running
+    atomic_uintptr_t output_producer;   // Head of the group ending at the last stage (stage_t*)
+    scheduler_retire_func_t retire;     // Tracked pipelines: receives each item's fate, or NULL
+};
+
+/**
+ * Chase-Lev deque of stages: the owner pushes and pops at the bottom,
+ * thieves take from the top. A stage is in at most one deque at a time, so
+ * a capacity of the stage count never overflows.
+ */
+typedef struct {
+    atomic_long top;
+    atomic_long bottom;
+    long mask;
+    atomic_uintptr_t* slots;
+} task_deque_t;
+
+typedef struct {
+    pthread_t thread;
+    task_deque_t deque;
+    unsigned int seed;                  // Victim selection
+    int started;
+    stage_t** inbox;                    // Stages of pipelines pinned to this worker, FIFO
+    int inbox_head;
+    atomic_int inbox_count;             // Written under inject_lock
+    pthread_cond_t wakeup;              // Signalled to wake this worker alone (with idle_lock)
+    int sleeping;                       // Waiting on wakeup and not yet signalled (under idle_lock)
+} worker_t;
+
+static worker_t* workers = NULL;
+static int worker_count = 0;
+static int batch_size = 0;
+static int max_stages = 0;
+static int live_stages = 0;             // Stages of all pipelines (under inject_lock)
+
+// Rescheduled stages and stages scheduled from outside the pool, in FIFO order
+static stage_t** inject_ring = NULL;
+static int inject_head = 0;
+static int inject_count = 0;
+static pthread_mutex_t inject_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Idle workers sleep on their own condition variable until a task is queued
+static atomic_int queued_tasks;
+static atomic_int idle_workers;
+static atomic_int stopping;
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_ullong activations;
+static atomic_ullong steals;
+static atomic_ullong yields;
+static atomic_ullong batch_limits;
+static atomic_ullong deduplicated;      // Ingest lines that reused an interned buffer
+static int lane_count = 1;              // Priority lanes of the queues of new pipelines
+static lane_policy_t lane_policy = LANE_STRICT;
+static int bind_workers = 0;            // Pin worker i to the i-th CPU the process may use
+static int adaptive = 0;                // New pipelines fuse and split stages while running
+static atomic_ullong fusions;
+static atomic_ullong splits;
+
+static __thread int current_worker = -1;
+
+/**
+ * Push a stage at the bottom of a deque (owner only)
+ */
+static void deque_push(task_deque_t* deque, stage_t* task) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    atomic_store_explicit(&deque->slots[bottom & deque->mask], (uintptr_t)task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+/**
+ * Pop the newest stage from the bottom of a deque (owner only)
+ * Returns the stage, or NULL if the deque is empty
+ */
+static stage_t* deque_pop(task_deque_t* deque) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    stage_t* task = NULL;
+    if (top <= bottom) {
+        task = (stage_t*)atomic_load_explicit(&deque->slots[bottom & deque->mask], memory_order_relaxed);
+        if (top == bottom) {
+            // Last task: race the thieves for it
+            if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                         memory_order_seq_cst, memory_order_relaxed)) {
+                task = NULL;
+            }
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+/**
+ * Take the oldest stage from the top of another worker's deque
+ * Returns the stage, or NULL if the deque is empty or the race was lost
+ */
+static stage_t* deque_steal(task_deque_t* deque) {
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return NULL;
+    }
+    stage_t* task = (stage_t*)atomic_load_explicit(&deque->slots[top & deque->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return task;
+}
+
+/**
+ * Wake a sleeping worker unless it was already signalled (idle_lock must be held)
+ * Returns 1 if it was woken, 0 otherwise
+ */
+static int wake_worker(worker_t* worker) {
+    if (!worker->sleeping) {
+        return 0;
+    }
+    worker->sleeping = 0;
+    pthread_cond_signal(&worker->wakeup);
+    return 1;
+}
+
+/**
+ * Wake one idle worker after a task was queued
+ */
+static void notify_task(void) {
+    atomic_fetch_add(&queued_tasks, 1);
+    if (atomic_load(&idle_workers) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        for (int i = 0; i < worker_count; i++) {
+            if (wake_worker(&workers[i])) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+/**
+ * Append a stage to the shared FIFO
+ */
+static void inject_push(stage_t* task) {
+    pthread_mutex_lock(&inject_lock);
+    inject_ring[(inject_head + inject_count) % max_stages] = task;
+    inject_count++;
+    pthread_mutex_unlock(&inject_lock);
+    notify_task();
+}
+
+/**
+ * Take the oldest stage from the shared FIFO
+ * Returns the stage, or NULL if it is empty
+ */
+static stage_t* inject_take(void) {
+    pthread_mutex_lock(&inject_lock);
+    stage_t* task = NULL;
+    if (inject_count > 0) {
+        task = inject_ring[inject_head];
+        inject_head = (inject_head + 1) % max_stages;
+        inject_count--;
+    }
+    pthread_mutex_unlock(&inject_lock);
+    return task;
+}
+
+/**
+ * Append a stage of a pinned pipeline to its worker's inbox
+ * Pinned stages are not counted in queued_tasks: only their worker is woken
+ */
+static void inbox_push(stage_t* task) {
+    worker_t* worker = &workers[task->pipeline->home];
+    pthread_mutex_lock(&inject_lock);
+    int count = atomic_load(&worker->inbox_count);
+    worker->inbox[(worker->inbox_head + count) % max_stages] = task;
+    atomic_store(&worker->inbox_count, count + 1);
+    pthread_mutex_unlock(&inject_lock);
+
+    if (atomic_load(&idle_workers) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        wake_worker(worker);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+/**
+ * Take the oldest stage from a worker's inbox
+ * Returns the stage, or NULL if it is empty
+ */
+static stage_t* inbox_take(worker_t* worker) {
+    if (atomic_load(&worker->inbox_count) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&inject_lock);
+    stage_t* task = NULL;
+    int count = atomic_load(&worker->inbox_count);
+    if (count > 0) {
+        task = worker->inbox[worker->inbox_head];
+        worker->inbox_head = (worker->inbox_head + 1) % max_stages;
+        atomic_store(&worker->inbox_count, count - 1);
+    }
+    pthread_mutex_unlock(&inject_lock);
+    return task;
+}
+
+/**
+ * Queue a stage that is still scheduled at the back of the line
+ */
+static void requeue_stage(stage_t* stage) {
+    if (stage->pipeline->home >= 0) {
+        inbox_push(stage);
+    } else {
+        inject_push(stage);
+    }
+}
+
+/**
+ * Make a stage runnable unless it already is
+ * Workers queue it on their own deque, other threads on the shared FIFO;
+ * stages of a pinned pipeline always go to their worker's inbox
+ */
+static void schedule_stage(stage_t* stage) {
+    if (atomic_exchange(&stage->scheduled, 1)) {
+        return;
+    }
+    if (stage->pipeline->home >= 0) {
+        inbox_push(stage);
+    } else if (current_worker >= 0) {
+        deque_push(&workers[current_worker].deque, stage);
+        notify_task();
+    } else {
+        inject_push(stage);
+    }
+}
+
+/**
+ * Check whether a stage's queue holds items
+ */
+static int stage_has_items(stage_t* stage) {
+    pthread_mutex_lock(&stage->queue.lock);
+    int count = stage->queue.count;
+    pthread_mutex_unlock(&stage->queue.lock);
+    return count > 0;
+}
+
+/**
+ * Free a stage's input item: an interned buffer in an interning pipeline's
+ * first stage, a plain copy everywhere else
+ */
+static void release_input(stage_t* stage, char* item) {
+    if (!item) {
+        // A flush output has no input
+        return;
+    }
+    if (stage->index == 0 && stage->pipeline->intern) {
+        intern_release(item);
+    } else {
+        free(item);
+    }
+}
+
+/**
+ * Write the ticket of the item about to be offered to a stage's queue (tracked pipelines)
+ */
+static void ticket_push(stage_t* stage, unsigned long long ticket) {
+    if (stage->tickets) {
+        stage->tickets[stage->ticket_tail++ & stage->ticket_mask] = ticket;
+    }
+}
+
+/**
+ * Take back the ticket of an item the queue did not take
+ */
+static void ticket_unpush(stage_t* stage) {
+    if (stage->tickets) {
+        stage->ticket_tail--;
+    }
+}
+
+/**
+ * Read the ticket of the item just taken from a stage's queue
+ */
+static unsigned long long ticket_pop(stage_t* stage) {
+    if (!stage->tickets) {
+        return SCHEDULER_NO_TICKET;
+    }
+    return stage->tickets[stage->ticket_head++ & stage->ticket_mask];
+}
+
+/**
+ * Tell a tracked pipeline's owner that a stage dropped an item
+ */
+static void retire_dropped(scheduler_pipeline_t* pipeline, unsigned long long ticket) {
+    if (pipeline->retire && ticket != SCHEDULER_NO_TICKET) {
+        pipeline->retire(pipeline->context, ticket, NULL);
+    }
+}
+
+/**
+ * Read the monotonic clock in nanoseconds
+ */
+static long long clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Fold a sample into a running average (weight 1/8)
+ */
+static void average_in(atomic_llong* average, long long sample) {
+    long long value = atomic_load_explicit(average, memory_order_relaxed);
+    value = value == 0 ? sample : value + (sample - value) / 8;
+    atomic_store_explicit(average, value, memory_order_relaxed);
+}
+
+/**
+ * Count an item taken from a stage's queue as settled (adaptive pipelines);
+ * flush outputs were never in the queue
+ */
+static void settle(stage_t* stage, char* item) {
+    if (item && stage->pipeline->adaptive) {
+        atomic_fetch_add(&stage->completed, 1);
+    }
+}
+
+/**
+ * Run a stage's transform, in place when the value is a private copy it may
+ * rewrite, timing one call in ADAPT_SAMPLE on adaptive pipelines
+ */
+static char* run_transform(stage_t* stage, char* value, int owned, int timed) {
+    long long started = timed ? clock_ns() : 0;
+    if (stage->serialize) {
+        pthread_mutex_lock(stage->serialize);
+    }
+    PROBE3(stage_begin, stage->pipeline, stage->index, value);
+    char* result;
+    if (stage->in_place && owned) {
+        // The item is this stage's own plain copy: rewrite it instead of allocating
+        result = (char*)stage->in_place(value);
+    } else {
+        result = (char*)stage->transform(value);
+    }
+    PROBE3(stage_end, stage->pipeline, stage->index, result);
+    if (stage->serialize) {
+        pthread_mutex_unlock(stage->serialize);
+    }
+    if (timed) {
+        average_in(&stage->transform_ns, clock_ns() - started);
+    }
+    return result;
+}
+
+/**
+ * Set which group head feeds a stage's queue, so the stage wakes the right one
+ */
+static void set_producer(scheduler_pipeline_t* pipeline, int index, stage_t* head) {
+    if (index < pipeline->stage_count) {
+        atomic_store(&pipeline->stages[index].producer, (uintptr_t)head);
+    } else {
+        atomic_store(&pipeline->output_producer, (uintptr_t)head);
+    }
+}
+
+/**
+ * Check whether everything a stage's queue took has left the stage: with
+ * its one producer busy elsewhere, nothing can arrive meanwhile
+ */
+static int stage_drained(stage_t* stage) {
+    return atomic_load(&stage->completed) == atomic_load(&stage->accepted);
+}
+
+/**
+ * Reconsider a group's boundaries, between two items (its head's activation)
+ * Splits off the costliest fused stage if it has become a bottleneck other
+ * workers could share, otherwise fuses the next group if its head is
+ * fusible, cheaper than the hop to it, holds no items and is not scheduled:
+ * the group claims it first, so no activation of it can run meanwhile
+ */
+static void adapt_group(stage_t* head) {
+    scheduler_pipeline_t* pipeline = head->pipeline;
+    long long hop = atomic_load_explicit(&head->hop_ns, memory_order_relaxed);
+    if (hop <= 0) {
+        return;
+    }
+    int end = head->index + head->span;
+
+    if (head->span > 0 && worker_count > 1) {
+        int costliest = -1;
+        long long most = 0;
+        for (int i = head->index + 1; i <= end; i++) {
+            long long cost = atomic_load_explicit(&pipeline->stages[i].transform_ns, memory_order_relaxed);
+            if (cost > most) {
+                most = cost;
+                costliest = i;
+            }
+        }
+        if (costliest > 0 && most > ADAPT_SPLIT_FACTOR * hop) {
+            // Items already handed on are ahead of everything the new group gets
+            stage_t* split = &pipeline->stages[costliest];
+            split->span = end - costliest;
+            head->span = costliest - 1 - head->index;
+            set_producer(pipeline, costliest, head);
+            set_producer(pipeline, end + 1, split);
+            atomic_fetch_add(&splits, 1);
+            return;
+        }
+    }
+
+    if (end + 1 < pipeline->stage_count) {
+        stage_t* next = &pipeline->stages[end + 1];
+        long long cost = atomic_load_explicit(&next->transform_ns, memory_order_relaxed);
+        // Drained, next has no pending output and only this group feeds it, so
+        // nothing but a running or queued activation can hold the claim
+        if (next->fusible && !next->serialize && cost > 0 && cost < hop && stage_drained(next) &&
+            !atomic_exchange(&next->scheduled, 1)) {
+            head->span += 1 + next->span;
+            next->span = 0;
+            set_producer(pipeline, head->index + head->span + 1, head);
+            atomic_fetch_add(&fusions, 1);
+            // Once the group dissolves, the stage is scheduled as usual again
+            atomic_store(&next->scheduled, 0);
+        }
+    }
+}
+
+/**
+ * Give every stage of a group its own activations again, before "<END>"
+ * passes, so each flushes in turn
+ */
+static void dissolve_group(stage_t* head) {
+    scheduler_pipeline_t* pipeline = head->pipeline;
+    int end = head->index + head->span;
+    for (int i = head->index + 1; i <= end + 1; i++) {
+        if (i <= end) {
+            pipeline->stages[i].span = 0;
+        }
+        set_producer(pipeline, i, &pipeline->stages[i - 1]);
+    }
+    head->span = 0;
+}
+
+/**
+ * Hand a stage's pending output to the next stage, or to the output after
+ * the last one. The next stage's queue takes the output itself, no copy.
+ * Returns 0 if the receiver is full (the output stays pending)
+ */
+static int forward(stage_t* stage) {
+    scheduler_pipeline_t* pipeline = stage->pipeline;
+    char* value = stage->pending;
+    char* item = stage->pending_item;
+    int last = stage->index + stage->span;
+
+    if (last == pipeline->stage_count - 1) {
+        if (pipeline->retire) {
+            if (!pipeline->retire(pipeline->context, stage->pending_ticket, value)) {
+                return 0;
+            }
+        } else if (pipeline->output && !pipeline->output(pipeline->context, value)) {
+            return 0;
+        }
+        if (strcmp(value, "<END>") == 0) {
+            monitor_signal(&pipeline->finished_monitor);
+        }
+        if (value != item) {
+            free(value);
+        }
+        release_input(stage, item);
+        settle(stage, item);
+    } else {
+        stage_t* next = &pipeline->stages[last + 1];
+        int taken = 1;
+        ticket_push(next, stage->pending_ticket);
+        if (consumer_producer_offer_owned_lane(&next->queue, value, stage->pending_lane, &taken) != NULL) {
+            // Nothing the stage could do about it (or the pipeline was aborted); the item is lost
+            ticket_unpush(next);
+            retire_dropped(pipeline, stage->pending_ticket);
+            if (value != item) {
+                free(value);
+            }
+            release_input(stage, item);
+            settle(stage, item);
+        } else if (!taken) {
+            ticket_unpush(next);
+            return 0;
+        } else {
+            if (pipeline->adaptive) {
+                atomic_fetch_add(&next->accepted, 1);
+                settle(stage, item);
+            }
+            schedule_stage(next);
+            // The value (perhaps the input itself) now belongs to the next queue
+            if (value != item) {
+                release_input(stage, item);
+            }
+        }
+    }
+
+    stage->pending = NULL;
+    stage->pending_item = NULL;
+    return 1;
+}
+
+/**
+ * Run one activation of a stage: at most a batch of items
+ */
+static stage_status_t run_stage(stage_t* stage) {
+    scheduler_pipeline_t* pipeline = stage->pipeline;
+    int processed = 0;
+
+    while (1) {
+        if (stage->pending) {
+            long long started = stage->hop_started >= 0 ? clock_ns() : 0;
+            if (!forward(stage)) {
+                // Ask for a wake-up, then make sure the receiver did not just make room
+                stage->hop_started = -1;
+                atomic_store(&stage->blocked, 1);
+                if (!forward(stage)) {
+                    atomic_fetch_add(&yields, 1);
+                    return STAGE_BLOCKED;
+                }
+                atomic_store(&stage->blocked, 0);
+            }
+            if (stage->hop_started >= 0) {
+                average_in(&stage->hop_ns, stage->hop_started + clock_ns() - started);
+                stage->hop_started = -1;
+            }
+        }
+
+        if (processed >= batch_size) {
+            atomic_fetch_add(&batch_limits, 1);
+            return STAGE_MORE;
+        }
+
+        // Counted per item taken, so idle activations neither sample nor adapt
+        int adapting = pipeline->adaptive && !stage->ended && !stage->deferred;
+        int timed = adapting && (stage->sample_tick + 1) % ADAPT_SAMPLE == 0;
+
+        int lane;
+        char* item;
+        unsigned long long ticket;
+        long long taking = timed ? clock_ns() : 0;
+        if (stage->deferred) {
+            // Already out of the queue; no slot was freed
+            item = stage->deferred;
+            lane = stage->deferred_lane;
+            ticket = stage->deferred_ticket;
+            stage->deferred = NULL;
+        } else {
+            item = consumer_producer_try_get_lane(&stage->queue, &lane);
+            if (!item) {
+                return STAGE_IDLE;
+            }
+            ticket = ticket_pop(stage);
+            if (timed) {
+                stage->hop_started = clock_ns() - taking;
+            }
+            // Whoever feeds this stage may have been waiting for the slot
+            if (stage->index > 0) {
+                stage_t* previous = (stage_t*)atomic_load(&stage->producer);
+                if (atomic_exchange(&previous->blocked, 0)) {
+                    schedule_stage(previous);
+                }
+            } else if (atomic_exchange(&pipeline->ingest_blocked, 0) && pipeline->on_space) {
+                pipeline->on_space(pipeline->context);
+            }
+        }
+        processed++;
+
+        char* result = item;
+        int is_end = strcmp(item, "<END>") == 0;
+        if (adapting && !is_end) {
+            stage->sample_tick++;
+            if (++stage->adapt_tick % ADAPT_PERIOD == 0) {
+                adapt_group(stage);
+            }
+        }
+        if (is_end && !stage->ended) {
+            stage->ended = 1;
+            stage->hop_started = -1;
+            dissolve_group(stage);
+        }
+        if (is_end && stage->flush && !stage->flushed) {
+            // The stage's end-of-stream output goes first; "<END>" follows it
+            stage->flushed = 1;
+            // Copies of the stage share its state: only the last one summarizes it
+            int last = !stage->flush_arrivals ||
+                       atomic_fetch_add(stage->flush_arrivals, 1) + 1 >= stage->flush_parties;
+            char* summary = last ? (char*)stage->flush() : NULL;
+            if (summary) {
+                stage->pending = summary;
+                stage->pending_item = NULL;
+                stage->pending_lane = lane;
+                stage->pending_ticket = SCHEDULER_NO_TICKET;
+                stage->deferred = item;
+                stage->deferred_lane = lane;
+                stage->deferred_ticket = ticket;
+                continue;
+            }
+        } else if (!is_end) {
+            // Shared buffers of the first queue are never rewritten
+            int owned = !(stage->index == 0 && pipeline->intern);
+            result = run_transform(stage, item, owned, timed);
+            // Fused stages follow back to back; their outputs are always private
+            for (int i = 1; i <= stage->span && result && result != PLUGIN_DROP; i++) {
+                char* next = run_transform(&pipeline->stages[stage->index + i], result,
+                                           owned || result != item, timed);
+                if (next != result && result != item) {
+                    free(result);
+                }
+                result = next;
+            }
+            if (!result || result == PLUGIN_DROP) {
+                retire_dropped(pipeline, ticket);
+                release_input(stage, item);
+                settle(stage, item);
+                continue;
+            }
+        }
+        if (result == item && stage->index == 0 && pipeline->intern) {
+            // Shared buffers never leave the first queue; later stages own plain copies
+            result = strdup(item);
+            if (!result) {
+                retire_dropped(pipeline, ticket);
+                release_input(stage, item);
+                settle(stage, item);
+                continue;
+            }
+        }
+        stage->pending = result;
+        stage->pending_item = item;
+        stage->pending_lane = lane;
+        stage->pending_ticket = ticket;
+    }
+}
+
+/**
+ * Take the lane tag "<pK>" off an ingest line of a multi-lane pipeline
+ * Returns the lane (untagged lines and K beyond the last lane get the least
+ * urgent one) and points *item past the tag
+ */
+static int ingest_lane(scheduler_pipeline_t* pipeline, const char** item) {
+    const char* line = *item;
+    if (pipeline->lane_count <= 1) {
+        return 0;
+    }
+    if (line[0] == '<' && line[1] == 'p' && line[2] >= '0' && line[2] <= '9' && line[3] == '>') {
+        *item = line + 4;
+        int lane = line[2] - '0';
+        return lane < pipeline->lane_count ? lane : pipeline->lane_count - 1;
+    }
+    return pipeline->lane_count - 1;
+}
+
+/**
+ * Find a task: own deque, then the shared FIFO, then other workers' deques
+ * Returns the stage, or NULL if there is none
+ */
+static stage_t* find_task(int self) {
+    worker_t* worker = &workers[self];
+    stage_t* task = inbox_take(worker);
+    if (task) {
+        return task;
+    }
+    task = deque_pop(&worker->deque);
+    if (task) {
+        atomic_fetch_sub(&queued_tasks, 1);
+        return task;
+    }
+
+    task = inject_take();
+    if (task) {
+        atomic_fetch_sub(&queued_tasks, 1);
+        return task;
+    }
+
+    int start = (int)(rand_r(&worker->seed) % (unsigned int)worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        int victim = (start + i) % worker_count;
+        if (victim == self) {
+            continue;
+        }
+        task = deque_steal(&workers[victim].deque);
+        if (task) {
+            atomic_fetch_sub(&queued_tasks, 1);
+            atomic_fetch_add(&steals, 1);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Sleep until a task is queued (for any worker, or in this one's inbox) or the scheduler stops
+ */
+static void wait_for_task(worker_t* worker) {
+    pthread_mutex_lock(&idle_lock);
+    atomic_fetch_add(&idle_workers, 1);
+    while (atomic_load(&queued_tasks) == 0 && atomic_load(&worker->inbox_count) == 0 &&
+           !atomic_load(&stopping)) {
+        worker->sleeping = 1;
+        pthread_cond_wait(&worker->wakeup, &idle_lock);
+        worker->sleeping = 0;
+    }
+    atomic_fetch_sub(&idle_workers, 1);
+    pthread_mutex_unlock(&idle_lock);
+}
+
+/**
+ * Bind the calling worker to the index-th CPU the process may run on
+ * (wrapping around); failures leave the thread unbound
+ */
+static void bind_to_cpu(int index) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    int wanted = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && wanted-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+            return;
+        }
+    }
+}
+
+/**
+ * Worker thread body
+ */
+static void* worker_thread(void* arg) {
+    current_worker = (int)(long)arg;
+    if (bind_workers) {
+        bind_to_cpu(current_worker);
+    }
+
+    while (!atomic_load(&stopping)) {
+        stage_t* stage = find_task(current_worker);
+        if (!stage) {
+            if (atomic_load(&queued_tasks) > 0) {
+                // A task is being handed over; let its owner finish
+                sched_yield();
+            } else {
+                wait_for_task(&workers[current_worker]);
+            }
+            continue;
+        }
+        atomic_fetch_add(&activations, 1);
+
+        // Counted before the stage stops being scheduled, see scheduler_destroy_pipeline
+        scheduler_pipeline_t* pipeline = stage->pipeline;
+        atomic_fetch_add(&pipeline->active, 1);
+
+        switch (run_stage(stage)) {
+            case STAGE_MORE:
+                // Still scheduled; go to the back of the line
+                requeue_stage(stage);
+                break;
+
+            case STAGE_BLOCKED:
+                // The receiver wakes it up, unless it already tried to
+                atomic_store(&stage->scheduled, 0);
+                if (!atomic_load(&stage->blocked)) {
+                    schedule_stage(stage);
+                }
+                break;
+
+            case STAGE_IDLE:
+            default:
+                // An item may have arrived after the queue was found empty
+                atomic_store(&stage->scheduled, 0);
+                if (stage_has_items(stage)) {
+                    schedule_stage(stage);
+                }
+                break;
+        }
+
+        atomic_fetch_sub(&pipeline->active, 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Release the pool's memory
+ */
+static void release_pool(void) {
+    if (workers) {
+        for (int i = 0; i < worker_count; i++) {
+            free(workers[i].deque.slots);
+            free(workers[i].inbox);
+            pthread_cond_destroy(&workers[i].wakeup);
+        }
+    }
+    free(workers);
+    free(inject_ring);
+    workers = NULL;
+    inject_ring = NULL;
+    max_stages = 0;
+}
+
+/**
+ * Create the worker pool
+ */
+const char* scheduler_init(int workers_wanted, int stages_wanted, int batch) {
+    if (workers_wanted < 1 || stages_wanted < 1 || batch < 1) {
+        return "Invalid scheduler arguments";
+    }
+    if (workers) {
+        return "Scheduler is already initialized";
+    }
+
+    worker_count = workers_wanted;
+    max_stages = stages_wanted;
+    batch_size = batch;
+    live_stages = 0;
+
+    workers = calloc((size_t)worker_count, sizeof(worker_t));
+    for (int i = 0; workers && i < worker_count; i++) {
+        pthread_cond_init(&workers[i].wakeup, NULL);
+    }
+    inject_ring = calloc((size_t)max_stages, sizeof(stage_t*));
+    if (!workers || !inject_ring) {
+        release_pool();
+        return "Failed to allocate the scheduler";
+    }
+
+    long capacity = 1;
+    while (capacity < max_stages) {
+        capacity <<= 1;
+    }
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].deque.slots = calloc((size_t)capacity, sizeof(atomic_uintptr_t));
+        workers[i].inbox = calloc((size_t)max_stages, sizeof(stage_t*));
+        if (!workers[i].deque.slots || !workers[i].inbox) {
+            release_pool();
+            return "Failed to allocate the worker deques";
+        }
+        workers[i].deque.mask = capacity - 1;
+        atomic_init(&workers[i].deque.top, 0);
+        atomic_init(&workers[i].deque.bottom, 0);
+        workers[i].seed = (unsigned int)i * 2654435761u + 1;
+        workers[i].inbox_head = 0;
+        atomic_init(&workers[i].inbox_count, 0);
+    }
+
+    inject_head = 0;
+    inject_count = 0;
+    atomic_init(&queued_tasks, 0);
+    atomic_init(&idle_workers, 0);
+    atomic_init(&stopping, 0);
+    atomic_init(&activations, 0);
+    atomic_init(&steals, 0);
+    atomic_init(&yields, 0);
+    atomic_init(&batch_limits, 0);
+    atomic_init(&fusions, 0);
+    atomic_init(&splits, 0);
+
+    return NULL;
+}
+
+/**
+ * Start the worker threads
+ */
+const char* scheduler_start(void) {
+    if (!workers) {
+        return "Scheduler is not initialized";
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, (void*)(long)i) != 0) {
+            scheduler_shutdown();
+            return "Failed to create worker thread";
+        }
+        workers[i].started = 1;
+    }
+    return NULL;
+}
+
+/**
+ * Create a pipeline on the pool
+ */
+scheduler_pipeline_t* scheduler_create_pipeline(const scheduler_stage_t* setup, int stage_count, int queue_size,
+                                                scheduler_output_func_t output, scheduler_space_func_t on_space,
+                                                void* context, const char** error) {
+    const char* ignored;
+    error = error ? error : &ignored;
+    if (!workers) {
+        *error = "Scheduler is not initialized";
+        return NULL;
+    }
+    if (!setup || stage_count < 1 || queue_size < 1) {
+        *error = "Invalid pipeline arguments";
+        return NULL;
+    }
+    for (int i = 0; i < stage_count; i++) {
+        if (!setup[i].transform) {
+            *error = "Stage has no transform function";
+            return NULL;
+        }
+    }
+
+    // Deques and the shared FIFO hold at most max_stages tasks
+    pthread_mutex_lock(&inject_lock);
+    int fits = live_stages + stage_count <= max_stages;
+    if (fits) {
+        live_stages += stage_count;
+    }
+    pthread_mutex_unlock(&inject_lock);
+    if (!fits) {
+        *error = "Too many pipelines";
+        return NULL;
+    }
+
+    scheduler_pipeline_t* pipeline = calloc(1, sizeof(scheduler_pipeline_t));
+    stage_t* stages = calloc((size_t)stage_count, sizeof(stage_t));
+    if (!pipeline || !stages || monitor_init(&pipeline->finished_monitor) != 0) {
+        free(pipeline);
+        free(stages);
+        pthread_mutex_lock(&inject_lock);
+        live_stages -= stage_count;
+        pthread_mutex_unlock(&inject_lock);
+        *error = "Failed to allocate the pipeline";
+        return NULL;
+    }
+
+    pipeline->stages = stages;
+    pipeline->stage_count = stage_count;
+    pipeline->output = output;
+    pipeline->on_space = on_space;
+    pipeline->context = context;
+    pipeline->lane_count = lane_count;
+    pipeline->home = -1;
+    pipeline->adaptive = adaptive;
+    atomic_init(&pipeline->output_producer, (uintptr_t)&stages[stage_count - 1]);
+    atomic_init(&pipeline->ingest_blocked, 0);
+    atomic_init(&pipeline->active, 0);
+
+    for (int i = 0; i < stage_count; i++) {
+        *error = consumer_producer_init(&stages[i].queue, queue_size);
+        if (!*error) {
+            *error = consumer_producer_set_policy(&stages[i].queue, setup[i].policy, setup[i].sample_rate);
+            if (!*error) {
+                *error = consumer_producer_set_lanes(&stages[i].queue, lane_count, lane_policy);
+            }
+            if (!*error) {
+                *error = consumer_producer_set_max_bytes(&stages[i].queue, setup[i].max_bytes);
+            }
+            if (*error) {
+                consumer_producer_destroy(&stages[i].queue);
+            }
+        }
+        if (*error) {
+            pipeline->stage_count = i;
+            scheduler_destroy_pipeline(pipeline);
+            pthread_mutex_lock(&inject_lock);
+            live_stages -= stage_count - i;
+            pthread_mutex_unlock(&inject_lock);
+            return NULL;
+        }
+        stages[i].transform = setup[i].transform;
+        stages[i].flush = setup[i].flush;
+        stages[i].flush_arrivals = setup[i].flush_arrivals;
+        stages[i].flush_parties = setup[i].flush_parties;
+        stages[i].serialize = setup[i].serialize;
+        if (plugin_runs_in_place(setup[i].capabilities)) {
+            stages[i].in_place = setup[i].capabilities->transform_in_place;
+        }
+        // Fused, a stage would print in another's turn or flush with the group
+        stages[i].fusible = setup[i].capabilities &&
+                            !(setup[i].capabilities->flags & (PLUGIN_CAP_SIDE_EFFECTS | PLUGIN_CAP_STATEFUL));
+        stages[i].pipeline = pipeline;
+        stages[i].index = i;
+        atomic_init(&stages[i].scheduled, 0);
+        atomic_init(&stages[i].blocked, 0);
+        atomic_init(&stages[i].producer, i > 0 ? (uintptr_t)&stages[i - 1] : 0);
+        atomic_init(&stages[i].accepted, 0);
+        atomic_init(&stages[i].completed, 0);
+        atomic_init(&stages[i].transform_ns, 0);
+        atomic_init(&stages[i].hop_ns, 0);
+        stages[i].hop_started = -1;
+    }
+
+    // Spilled items come back as plain copies, so a spilling first queue is not shared
+    if (setup[0].policy != OVERLOAD_SPILL) {
+        pipeline->intern = intern_table_create(INGEST_INTERN_SLOTS, error);
+        if (!pipeline->intern) {
+            scheduler_destroy_pipeline(pipeline);
+            return NULL;
+        }
+        consumer_producer_set_release(&stages[0].queue, intern_release);
+    }
+
+    *error = NULL;
+    return pipeline;
+}
+
+/**
+ * Run every stage of a pipeline on one worker
+ */
+const char* scheduler_pin_pipeline(scheduler_pipeline_t* pipeline, int worker) {
+    if (!pipeline) {
+        return "Pipeline is not initialized";
+    }
+    if (worker < 0 || worker >= worker_count) {
+        return "No such worker";
+    }
+    pipeline->home = worker;
+    return NULL;
+}
+
+/**
+ * Fuse and split the stages of pipelines created from now on while they run
+ */
+void scheduler_set_adaptive(int enabled) {
+    adaptive = enabled;
+}
+
+/**
+ * Get the number of worker threads of the pool
+ */
+int scheduler_worker_count(void) {
+    return workers ? worker_count : 0;
+}
+
+/**
+ * Bind each worker thread to its own CPU
+ */
+void scheduler_set_affinity(int enabled) {
+    bind_workers = enabled;
+}
+
+/**
+ * Hand every item's fate to a retire function instead of the output function
+ */
+const char* scheduler_track_items(scheduler_pipeline_t* pipeline, scheduler_retire_func_t retire) {
+    if (!pipeline || !retire) {
+        return "Pipeline is not initialized";
+    }
+    for (int i = 0; i < pipeline->stage_count; i++) {
+        consumer_producer_t* queue = &pipeline->stages[i].queue;
+        if (queue->policy != OVERLOAD_BLOCK || queue->lane_count > 1) {
+            // A ticket must leave its queue exactly when its item does
+            return "Tracked pipelines need blocking, single-lane queues";
+        }
+    }
+
+    // A queue never holds more than its capacity, plus the item a producer is offering
+    unsigned int size = 1;
+    while (size < (unsigned int)pipeline->stages[0].queue.capacity + 2) {
+        size <<= 1;
+    }
+    for (int i = 0; i < pipeline->stage_count; i++) {
+        stage_t* stage = &pipeline->stages[i];
+        stage->tickets = malloc(size * sizeof(unsigned long long));
+        if (!stage->tickets) {
+            for (int j = 0; j < i; j++) {
+                free(pipeline->stages[j].tickets);
+                pipeline->stages[j].tickets = NULL;
+            }
+            return "Failed to allocate the ticket rings";
+        }
+        stage->ticket_mask = size - 1;
+        stage->ticket_head = 0;
+        stage->ticket_tail = 0;
+    }
+    pipeline->retire = retire;
+    return NULL;
+}
+
+/**
+ * Queue an item for the first stage
+ */
+const char* scheduler_place_work(scheduler_pipeline_t* pipeline, const char* item) {
+    return scheduler_place_work_ticket(pipeline, item, SCHEDULER_NO_TICKET);
+}
+
+/**
+ * Queue an item for the first stage with the ticket its retirement reports
+ */
+const char* scheduler_place_work_ticket(scheduler_pipeline_t* pipeline, const char* item,
+                                        unsigned long long ticket) {
+    if (!pipeline) {
+        return "Pipeline is not initialized";
+    }
+    if (!item) {
+        return "Input string cannot be NULL";
+    }
+
+    stage_t* first = &pipeline->stages[0];
+    int lane = ingest_lane(pipeline, &item);
+    if (!pipeline->intern) {
+        char* copy = strdup(item);
+        if (!copy) {
+            return "Memory allocation failed for item";
+        }
+        ticket_push(first, ticket);
+        const char* error = consumer_producer_put_owned_lane(&first->queue, copy, lane);
+        if (error) {
+            ticket_unpush(first);
+            free(copy);
+            return error;
+        }
+        schedule_stage(first);
+        return NULL;
+    }
+
+    int shared;
+    char* buffer = intern_table_acquire(pipeline->intern, item, &shared);
+    if (!buffer) {
+        return "Memory allocation failed for item";
+    }
+    ticket_push(first, ticket);
+    const char* error = consumer_producer_put_owned_lane(&first->queue, buffer, lane);
+    if (error) {
+        ticket_unpush(first);
+        intern_release(buffer);
+        return error;
+    }
+    if (shared) {
+        atomic_fetch_add(&deduplicated, 1);
+    }
+    schedule_stage(&pipeline->stages[0]);
+    return NULL;
+}
+
+/**
+ * Queue an item for the first stage without waiting
+ */
+const char* scheduler_offer(scheduler_pipeline_t* pipeline, const char* item, int* taken) {
+    if (!pipeline || !taken) {
+        return "Pipeline is not initialized";
+    }
+    if (!item) {
+        return "Input string cannot be NULL";
+    }
+
+    stage_t* first = &pipeline->stages[0];
+    int lane = ingest_lane(pipeline, &item);
+    int shared = 0;
+    char* buffer = pipeline->intern ? intern_table_acquire(pipeline->intern, item, &shared) : strdup(item);
+    if (!buffer) {
+        return "Memory allocation failed for item";
+    }
+
+    const char* error = consumer_producer_offer_owned_lane(&first->queue, buffer, lane, taken);
+    if (!error && !*taken) {
+        // Same hand-shake as between stages, with on_space as the wake-up
+        atomic_store(&pipeline->ingest_blocked, 1);
+        error = consumer_producer_offer_owned_lane(&first->queue, buffer, lane, taken);
+        if (!error && *taken) {
+            atomic_store(&pipeline->ingest_blocked, 0);
+        }
+    }
+    if (!error && *taken) {
+        if (shared) {
+            atomic_fetch_add(&deduplicated, 1);
+        }
+        schedule_stage(first);
+    } else {
+        first->queue.release(buffer);
+    }
+    return error;
+}
+
+/**
+ * Let the last stage continue after its output function refused an item
+ */
+void scheduler_resume_output(scheduler_pipeline_t* pipeline) {
+    if (!pipeline) {
+        return;
+    }
+    stage_t* last = (stage_t*)atomic_load(&pipeline->output_producer);
+    if (atomic_exchange(&last->blocked, 0)) {
+        schedule_stage(last);
+    }
+}
+
+/**
+ * Wait until "<END>" has passed the last stage
+ */
+const char* scheduler_wait_finished(scheduler_pipeline_t* pipeline) {
+    if (!pipeline) {
+        return "Pipeline is not initialized";
+    }
+    if (monitor_wait(&pipeline->finished_monitor) != 0) {
+        return "Failed to wait for processing to finish";
+    }
+    return NULL;
+}
+
+/**
+ * Stop a pipeline without draining it
+ */
+void scheduler_abort_pipeline(scheduler_pipeline_t* pipeline, unsigned long long* queued) {
+    if (!pipeline) {
+        return;
+    }
+    // Workers find the queues empty; outputs still pending are refused downstream
+    for (int i = 0; i < pipeline->stage_count; i++) {
+        unsigned long discarded = consumer_producer_close(&pipeline->stages[i].queue);
+        if (queued) {
+            queued[i] = discarded;
+        }
+    }
+    monitor_signal(&pipeline->finished_monitor);
+}
+
+/**
+ * Destroy a pipeline
+ */
+void scheduler_destroy_pipeline(scheduler_pipeline_t* pipeline) {
+    if (!pipeline) {
+        return;
+    }
+
+    // A worker counts itself active before it unschedules a stage, so once
+    // no stage is scheduled and none is active, no worker holds the pipeline
+    if (workers && !atomic_load(&stopping)) {
+        int busy = 1;
+        while (busy) {
+            busy = 0;
+            for (int i = 0; i < pipeline->stage_count; i++) {
+                busy |= atomic_load(&pipeline->stages[i].scheduled);
+            }
+            busy |= atomic_load(&pipeline->active) > 0;
+            if (busy) {
+                sched_yield();
+            }
+        }
+    }
+
+    for (int i = 0; i < pipeline->stage_count; i++) {
+        stage_t* stage = &pipeline->stages[i];
+        consumer_producer_destroy(&stage->queue);
+        if (stage->pending != stage->pending_item) {
+            free(stage->pending);
+        }
+        release_input(stage, stage->pending_item);
+        release_input(stage, stage->deferred);
+        free(stage->tickets);
+    }
+    intern_table_destroy(pipeline->intern);
+
+    if (workers) {
+        pthread_mutex_lock(&inject_lock);
+        live_stages -= pipeline->stage_count;
+        pthread_mutex_unlock(&inject_lock);
+    }
+
+    monitor_destroy(&pipeline->finished_monitor);
+    free(pipeline->stages);
+    free(pipeline);
+}
+
+/**
+ * Get the number of items a stage's overload policy discarded
+ */
+unsigned long scheduler_dropped(scheduler_pipeline_t* pipeline, int index) {
+    if (!pipeline || index < 0 || index >= pipeline->stage_count) {
+        return 0;
+    }
+    return consumer_producer_dropped(&pipeline->stages[index].queue);
+}
+
+/**
+ * Get the number of items that overflowed into a stage's spill file
+ */
+unsigned long scheduler_spilled(scheduler_pipeline_t* pipeline, int index) {
+    if (!pipeline || index < 0 || index >= pipeline->stage_count) {
+        return 0;
+    }
+    return consumer_producer_spilled(&pipeline->stages[index].queue);
+}
+
+/**
+ * Get the bytes queued now for a stage
+ */
+size_t scheduler_queued_bytes(scheduler_pipeline_t* pipeline, int index) {
+    if (!pipeline || index < 0 || index >= pipeline->stage_count) {
+        return 0;
+    }
+    return consumer_producer_bytes(&pipeline->stages[index].queue);
+}
+
+/**
+ * Get the most bytes queued at once for a stage
+ */
+size_t scheduler_peak_bytes(scheduler_pipeline_t* pipeline, int index) {
+    if (!pipeline || index < 0 || index >= pipeline->stage_count) {
+        return 0;
+    }
+    return consumer_producer_peak_bytes(&pipeline->stages[index].queue);
+}
+
+/**
+ * Get the counters of one priority lane of a stage's queue
+ */
+const char* scheduler_lane_stats(scheduler_pipeline_t* pipeline, int index, int lane,
+                                 consumer_producer_lane_stats_t* stats) {
+    if (!pipeline || index < 0 || index >= pipeline->stage_count) {
+        return "No such stage";
+    }
+    return consumer_producer_lane_stats(&pipeline->stages[index].queue, lane, stats);
+}
+
+/**
+ * Split the queues of pipelines created from now on into priority lanes
+ */
+const char* scheduler_set_lanes(int lanes, lane_policy_t policy) {
+    if (lanes < 1 || lanes > CONSUMER_PRODUCER_MAX_LANES) {
+        return "Invalid lane count";
+    }
+    lane_count = lanes;
+    lane_policy = policy;
+    return NULL;
+}
+
+/**
+ * Stop and join the worker threads and release the pool
+ */
+void scheduler_shutdown(void) {
+    if (!workers) {
+        return;
+    }
+
+    pthread_mutex_lock(&idle_lock);
+    atomic_store(&stopping, 1);
+    for (int i = 0; i < worker_count; i++) {
+        wake_worker(&workers[i]);
+    }
+    pthread_mutex_unlock(&idle_lock);
+
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].started) {
+            pthread_join(workers[i].thread, NULL);
+            workers[i].started = 0;
+        }
+    }
+
+    release_pool();
+}
+
+/**
+ * Print the scheduler's counters to stderr
+ */
+void scheduler_report(void) {
+    fprintf(stderr, "[stats] scheduler: workers=%d activations=%llu steals=%llu yields=%llu batch_limits=%llu"
+            " deduplicated=%llu\n",
+            worker_count, (unsigned long long)atomic_load(&activations),
+            (unsigned long long)atomic_load(&steals), (unsigned long long)atomic_load(&yields),
+            (unsigned long long)atomic_load(&batch_limits), (unsigned long long)atomic_load(&deduplicated));
+    if (adaptive) {
+        fprintf(stderr, "[stats] scheduler: fusions=%llu splits=%llu\n",
+                (unsigned long long)atomic_load(&fusions), (unsigned long long)atomic_load(&splits));
+    }
+}
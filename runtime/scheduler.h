@@ -0,0 +1,280 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "../plugins/sync/consumer_producer.h"
+#include "../plugins/plugin_sdk.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * Work-stealing scheduler - runs the stages of pipelines as tasks on a
+ * fixed pool of worker threads instead of one consumer thread per stage
+ *
+ * Every stage has a queue; a stage with queued items is a task in the deque
+ * of one worker. Workers run their own tasks newest first, take rescheduled
+ * ones from a shared FIFO, and steal the oldest task of another worker when
+ * they run dry. An activation processes at most a batch of items, so a busy
+ * stage cannot starve the others. Stages never block a worker: when the next
+ * stage's queue is full the stage yields, and is rescheduled by the next
+ * stage as soon as it takes an item.
+ *
+ * Any number of pipelines can share the pool; stages of the same plugin in
+ * different pipelines may then run concurrently.
+ */
+
+typedef struct scheduler_pipeline scheduler_pipeline_t;
+
+/**
+ * A stage's transformation; returns the input itself, a new string the
+ * scheduler frees, or PLUGIN_DROP (filtered) or NULL (failed) to skip the item
+ */
+typedef const char* (*scheduler_transform_func_t)(const char*);
+
+/**
+ * Receives the last stage's output, "<END>" included, from a worker thread
+ * Returns 1 if the item was taken, 0 to make the stage wait until
+ * scheduler_resume_output is called
+ */
+typedef int (*scheduler_output_func_t)(void* context, const char* item);
+
+/**
+ * Called from a worker thread when the first stage has room again after
+ * scheduler_offer found it full
+ */
+typedef void (*scheduler_space_func_t)(void* context);
+
+/**
+ * A stage's end-of-stream output; returns a new string the scheduler
+ * forwards ahead of "<END>" and frees, or NULL
+ */
+typedef const char* (*scheduler_flush_func_t)(void);
+
+/**
+ * Receives the fate of an item of a tracked pipeline, from a worker thread:
+ * the last stage's output, or NULL when a stage dropped the item. Flush
+ * outputs and "<END>" carry SCHEDULER_NO_TICKET. Returns 1 if taken, 0 to
+ * make the last stage wait like scheduler_output_func_t (never 0 for NULL)
+ */
+typedef int (*scheduler_retire_func_t)(void* context, unsigned long long ticket, const char* item);
+
+#define SCHEDULER_NO_TICKET (~0ULL)    /* Ticket of items placed without one */
+
+/**
+ * Setup of one stage
+ */
+typedef struct {
+    scheduler_transform_func_t transform;
+    scheduler_flush_func_t flush;      /* Called once per pipeline at "<END>" (may be NULL) */
+    const plugin_capabilities_t* capabilities;  /* In-place transform of owned copies (may be NULL) */
+    pthread_mutex_t* serialize;        /* Held around the transform, for one not safe to run
+                                          in several pipelines at once (may be NULL) */
+    overload_policy_t policy;          /* Overload policy of the stage's queue */
+    int sample_rate;                   /* N for OVERLOAD_SAMPLE */
+    size_t max_bytes;                  /* Byte budget of the stage's queue (0: none) */
+    atomic_int* flush_arrivals;        /* Shared by copies of the stage in flush_parties pipelines:
+                                          flush runs only in the last to reach "<END>" (may be NULL) */
+    int flush_parties;
+} scheduler_stage_t;
+
+/**
+ * Create the worker pool
+ * @param worker_count Number of worker threads (>= 1)
+ * @param max_stages Most stages of all pipelines alive at the same time
+ * @param batch_size Maximum number of items per stage activation (>= 1)
+ * @return NULL on success, error message on failure
+ */
+const char* scheduler_init(int worker_count, int max_stages, int batch_size);
+
+/**
+ * Start the worker threads
+ * @return NULL on success, error message on failure
+ */
+const char* scheduler_start(void);
+
+/**
+ * Create a pipeline on the pool
+ * @param stages Setup of each stage, in chain order
+ * @param stage_count Number of stages (>= 1)
+ * @param queue_size Capacity of each stage's queue
+ * @param output Receives the last stage's output (NULL: discarded)
+ * @param on_space Called when the first stage has room after scheduler_offer failed (may be NULL)
+ * @param context Passed to output and on_space
+ * @param error Receives an error message on failure
+ * @return The pipeline, or NULL on failure
+ */
+scheduler_pipeline_t* scheduler_create_pipeline(const scheduler_stage_t* stages, int stage_count, int queue_size,
+                                                scheduler_output_func_t output, scheduler_space_func_t on_space,
+                                                void* context, const char** error);
+
+/**
+ * Queue an item for the first stage; waits or drops according to its overload policy
+ * @param pipeline The pipeline
+ * @param item The item (copied)
+ * @return NULL on success, error message on failure
+ */
+const char* scheduler_place_work(scheduler_pipeline_t* pipeline, const char* item);
+
+/**
+ * Queue an item for the first stage of a tracked pipeline
+ * @param pipeline The pipeline
+ * @param item The item (copied)
+ * @param ticket Reported with the item's fate (SCHEDULER_NO_TICKET: untracked)
+ * @return NULL on success (the ticket will be retired), error message on failure
+ */
+const char* scheduler_place_work_ticket(scheduler_pipeline_t* pipeline, const char* item,
+                                        unsigned long long ticket);
+
+/**
+ * Report the fate of every item to a retire function instead of passing
+ * the last stage's output to the output function. Every stage must use the
+ * blocking overload policy and a single lane. Call before the first item.
+ * @param pipeline The pipeline
+ * @param retire Receives each item's ticket and output
+ * @return NULL on success, error message on failure
+ */
+const char* scheduler_track_items(scheduler_pipeline_t* pipeline, scheduler_retire_func_t retire);
+
+/**
+ * Run every stage of a pipeline on one worker instead of any; the worker
+ * still helps other pipelines when it has nothing of its own to do.
+ * Call before the first item.
+ * @param pipeline The pipeline
+ * @param worker Worker index
+ * @return NULL on success, error message on failure
+ */
+const char* scheduler_pin_pipeline(scheduler_pipeline_t* pipeline, int worker);
+
+/**
+ * Let pipelines created from now on fuse and split their stages while they
+ * run. A group's first stage times one item in 16: its transform, and the
+ * hop of taking an item and handing its output on. When the next stage's
+ * transform costs less than that hop and the stage holds no items, it joins
+ * the group, whose activations then run the transforms back to back and
+ * hand the result straight to the stage after it; a fused stage costing
+ * more than four hops is split off again when other workers could run it.
+ * Items already handed on always stay ahead, so nothing is lost or
+ * reordered. Stages held to one transform at a time are never fused, and
+ * a group comes apart before "<END>", so every stage flushes as usual.
+ * @param enabled 1 to adapt, 0 to keep every stage on its own
+ */
+void scheduler_set_adaptive(int enabled);
+
+/**
+ * Get the number of worker threads of the pool
+ * @return Worker count (0 before scheduler_init)
+ */
+int scheduler_worker_count(void);
+
+/**
+ * Bind worker i to the i-th CPU the process may run on (wrapping around);
+ * takes effect in scheduler_start
+ * @param enabled 1 to bind, 0 to let the kernel place the workers
+ */
+void scheduler_set_affinity(int enabled);
+
+/**
+ * Queue an item for the first stage without waiting
+ * If the stage is full, *taken is 0 and on_space is called once it has room;
+ * the same item must then be offered again
+ * @param pipeline The pipeline
+ * @param item The item (copied)
+ * @param taken Receives 1 if the item was queued or dropped by the overload policy
+ * @return NULL on success, error message on failure
+ */
+const char* scheduler_offer(scheduler_pipeline_t* pipeline, const char* item, int* taken);
+
+/**
+ * Let the last stage continue after its output function refused an item
+ * @param pipeline The pipeline
+ */
+void scheduler_resume_output(scheduler_pipeline_t* pipeline);
+
+/**
+ * Wait until "<END>" has passed the last stage
+ * @param pipeline The pipeline
+ * @return NULL on success, error message on failure
+ */
+const char* scheduler_wait_finished(scheduler_pipeline_t* pipeline);
+
+/**
+ * Stop a pipeline without draining it: discard the items queued at every
+ * stage and release scheduler_wait_finished. Items a stage is transforming
+ * are dropped once done. The pipeline must still be destroyed.
+ * @param pipeline The pipeline
+ * @param queued Receives, per stage, the number of items discarded (may be NULL)
+ */
+void scheduler_abort_pipeline(scheduler_pipeline_t* pipeline, unsigned long long* queued);
+
+/**
+ * Destroy a pipeline whose "<END>" has passed the last stage, or any pipeline
+ * once the pool is shut down; waits for activations still running
+ * @param pipeline The pipeline
+ */
+void scheduler_destroy_pipeline(scheduler_pipeline_t* pipeline);
+
+/**
+ * Get the number of items a stage's overload policy discarded
+ * @param pipeline The pipeline
+ * @param index Stage position in the chain
+ * @return Number of dropped items
+ */
+unsigned long scheduler_dropped(scheduler_pipeline_t* pipeline, int index);
+
+/**
+ * Get the number of items that overflowed into a stage's spill file
+ * @param pipeline The pipeline
+ * @param index Stage position in the chain
+ * @return Number of spilled items
+ */
+unsigned long scheduler_spilled(scheduler_pipeline_t* pipeline, int index);
+
+/**
+ * Get the bytes queued now for a stage
+ * @param pipeline The pipeline
+ * @param index Stage index
+ * @return Queued bytes, terminators included
+ */
+size_t scheduler_queued_bytes(scheduler_pipeline_t* pipeline, int index);
+
+/**
+ * Get the most bytes queued at once for a stage
+ * @param pipeline The pipeline
+ * @param index Stage index
+ * @return Peak queued bytes
+ */
+size_t scheduler_peak_bytes(scheduler_pipeline_t* pipeline, int index);
+
+/**
+ * Get the counters of one priority lane of a stage's queue
+ * @param pipeline The pipeline
+ * @param index Stage position in the chain
+ * @param lane Lane index (0 is the most urgent)
+ * @param stats Receives the counters
+ * @return NULL on success, error message on failure (e.g. a single-lane pipeline)
+ */
+const char* scheduler_lane_stats(scheduler_pipeline_t* pipeline, int index, int lane,
+                                 consumer_producer_lane_stats_t* stats);
+
+/**
+ * Split the queues of pipelines created from now on into priority lanes.
+ * An ingest line tagged "<pK>" (the tag is removed) enters lane K; untagged
+ * lines and "<END>" enter the least urgent lane. Items keep their lane
+ * through every stage. Cannot be combined with a spilling stage.
+ * @param lanes Number of lanes (1 turns lanes off)
+ * @param policy How each stage chooses among its lanes
+ * @return NULL on success, error message on failure
+ */
+const char* scheduler_set_lanes(int lanes, lane_policy_t policy);
+
+/**
+ * Stop and join the worker threads and release the pool
+ * Pipelines must be destroyed afterwards
+ */
+void scheduler_shutdown(void);
+
+/**
+ * Print the scheduler's counters to stderr
+ */
+void scheduler_report(void);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include "shm_channel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHM_WRAP_MARKER UINT32_MAX             // Rest of the ring up to its end is padding
+#define SHM_MIN_CAPACITY 4096
+
+// Shared header; producer and consumer fields live on separate cache lines
+typedef struct {
+    _Alignas(64) atomic_ulong head;            // Consumer position in bytes
+    atomic_uint space_seq;                     // Futex: bumped when space is freed for a waiter
+    atomic_int producer_waiting;
+    _Alignas(64) atomic_ulong tail;            // Producer position in bytes
+    atomic_uint data_seq;                      // Futex: bumped when data arrives for a waiter
+    atomic_int consumer_waiting;
+    _Alignas(64) atomic_int closed;
+    unsigned long capacity;
+} shm_ring_t;
+
+struct shm_channel {
+    shm_ring_t* ring;
+    char* data;
+    size_t mapping_size;
+    unsigned long pending_release;             // Size of the message being read
+};
+
+/**
+ * Bytes a message takes in the ring: header, message, NUL, padding
+ */
+static unsigned long record_size(size_t length) {
+    return (sizeof(uint32_t) + length + 1 + 7) & ~7UL;
+}
+
+/**
+ * Wait on a futex word shared between processes
+ * Returns 0 if woken (or the word changed), 1 on timeout
+ */
+static int futex_wait(atomic_uint* word, unsigned int expected, int timeout_ms) {
+    struct timespec timeout = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+    long result = syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+    return result != 0 && errno == ETIMEDOUT;
+}
+
+/**
+ * Wake every waiter of a futex word shared between processes
+ */
+static void futex_wake(atomic_uint* word) {
+    atomic_fetch_add(word, 1);
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Create a channel
+ */
+shm_channel_t* shm_channel_create(size_t capacity, const char** error) {
+    const char* ignored;
+    error = error ? error : &ignored;
+
+    unsigned long size = SHM_MIN_CAPACITY;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    shm_channel_t* channel = calloc(1, sizeof(shm_channel_t));
+    if (!channel) {
+        *error = "Failed to allocate channel";
+        return NULL;
+    }
+
+    int fd = memfd_create("analyzer-channel", MFD_CLOEXEC);
+    if (fd < 0) {
+        free(channel);
+        *error = "Failed to create shared memory";
+        return NULL;
+    }
+
+    channel->mapping_size = sizeof(shm_ring_t) + size;
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, (off_t)channel->mapping_size) == 0) {
+        mapping = mmap(NULL, channel->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        free(channel);
+        *error = "Failed to map shared memory";
+        return NULL;
+    }
+
+    channel->ring = (shm_ring_t*)mapping;
+    channel->data = (char*)mapping + sizeof(shm_ring_t);
+    atomic_init(&channel->ring->head, 0);
+    atomic_init(&channel->ring->tail, 0);
+    atomic_init(&channel->ring->space_seq, 0);
+    atomic_init(&channel->ring->data_seq, 0);
+    atomic_init(&channel->ring->producer_waiting, 0);
+    atomic_init(&channel->ring->consumer_waiting, 0);
+    atomic_init(&channel->ring->closed, 0);
+    channel->ring->capacity = size;
+
+    return channel;
+}
+
+/**
+ * Unmap the channel in the calling process
+ */
+void shm_channel_destroy(shm_channel_t* channel) {
+    if (!channel) {
+        return;
+    }
+    munmap(channel->ring, channel->mapping_size);
+    free(channel);
+}
+
+/**
+ * Copy a message into the ring (producer)
+ */
+int shm_channel_send(shm_channel_t* channel, const char* message, size_t length, int timeout_ms) {
+    shm_ring_t* ring = channel->ring;
+    unsigned long capacity = ring->capacity;
+    unsigned long needed = record_size(length);
+    if (length >= SHM_WRAP_MARKER || needed > capacity / 2) {
+        return SHM_CHANNEL_TOO_LARGE;
+    }
+
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned long offset = tail & (capacity - 1);
+    unsigned long contiguous = capacity - offset;
+    // A record never wraps; the end of the ring is skipped instead
+    unsigned long total = needed <= contiguous ? needed : contiguous + needed;
+
+    while (1) {
+        if (atomic_load(&ring->closed)) {
+            return SHM_CHANNEL_CLOSED;
+        }
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (capacity - (tail - head) >= total) {
+            break;
+        }
+
+        // Announce the wait, then check again so a release in between is not missed
+        unsigned int seq = atomic_load(&ring->space_seq);
+        atomic_store(&ring->producer_waiting, 1);
+        head = atomic_load(&ring->head);
+        int timed_out = 0;
+        if (capacity - (tail - head) < total && !atomic_load(&ring->closed)) {
+            timed_out = futex_wait(&ring->space_seq, seq, timeout_ms);
+        }
+        atomic_store(&ring->producer_waiting, 0);
+        if (timed_out) {
+            return SHM_CHANNEL_TIMEOUT;
+        }
+    }
+
+    if (needed > contiguous) {
+        uint32_t marker = SHM_WRAP_MARKER;
+        memcpy(channel->data + offset, &marker, sizeof(marker));
+        tail += contiguous;
+        offset = 0;
+    }
+
+    uint32_t header = (uint32_t)length;
+    memcpy(channel->data + offset, &header, sizeof(header));
+    memcpy(channel->data + offset + sizeof(header), message, length);
+    channel->data[offset + sizeof(header) + length] = '\0';
+    atomic_store(&ring->tail, tail + needed);
+
+    if (atomic_load(&ring->consumer_waiting)) {
+        futex_wake(&ring->data_seq);
+    }
+    return SHM_CHANNEL_OK;
+}
+
+/**
+ * Get the oldest message (consumer)
+ */
+int shm_channel_receive(shm_channel_t* channel, const char** message, size_t* length, int timeout_ms) {
+    shm_ring_t* ring = channel->ring;
+    unsigned long capacity = ring->capacity;
+
+    while (1) {
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+        if (head != tail) {
+            unsigned long offset = head & (capacity - 1);
+            uint32_t header;
+            memcpy(&header, channel->data + offset, sizeof(header));
+            if (header == SHM_WRAP_MARKER) {
+                atomic_store_explicit(&ring->head, head + (capacity - offset), memory_order_release);
+                continue;
+            }
+            *message = channel->data + offset + sizeof(header);
+            *length = header;
+            channel->pending_release = record_size(header);
+            return SHM_CHANNEL_OK;
+        }
+
+        if (atomic_load(&ring->closed)) {
+            return SHM_CHANNEL_CLOSED;
+        }
+
+        // Announce the wait, then check again so a send in between is not missed
+        unsigned int seq = atomic_load(&ring->data_seq);
+        atomic_store(&ring->consumer_waiting, 1);
+        int timed_out = 0;
+        if (atomic_load(&ring->tail) == head && !atomic_load(&ring->closed)) {
+            timed_out = futex_wait(&ring->data_seq, seq, timeout_ms);
+        }
+        atomic_store(&ring->consumer_waiting, 0);
+        if (timed_out) {
+            return SHM_CHANNEL_TIMEOUT;
+        }
+    }
+}
+
+/**
+ * Give the message returned by shm_channel_receive back to the producer
+ */
+void shm_channel_release(shm_channel_t* channel) {
+    shm_ring_t* ring = channel->ring;
+    if (channel->pending_release == 0) {
+        return;
+    }
+
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store(&ring->head, head + channel->pending_release);
+    channel->pending_release = 0;
+
+    if (atomic_load(&ring->producer_waiting)) {
+        futex_wake(&ring->space_seq);
+    }
+}
+
+/**
+ * Close the channel
+ */
+void shm_channel_close(shm_channel_t* channel) {
+    atomic_store(&channel->ring->closed, 1);
+    futex_wake(&channel->ring->space_seq);
+    futex_wake(&channel->ring->data_seq);
+}
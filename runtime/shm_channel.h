@@ -0,0 +1,71 @@
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <stddef.h>
+
+/**
+ * Shared-memory channel - a single-producer single-consumer ring of messages
+ * in a memfd segment, usable across fork()
+ *
+ * Messages are copied into the ring, behind a length header, and read in
+ * place. Producer and consumer only enter the kernel (futex) when the ring
+ * is full or empty and the other side has to be woken.
+ */
+
+typedef struct shm_channel shm_channel_t;
+
+// Results of shm_channel_send and shm_channel_receive
+#define SHM_CHANNEL_OK 0
+#define SHM_CHANNEL_TIMEOUT 1                  /* Nothing happened within the timeout */
+#define SHM_CHANNEL_CLOSED (-1)                /* Closed (and, for receive, drained) */
+#define SHM_CHANNEL_TOO_LARGE (-2)             /* Message can never fit */
+
+/**
+ * Create a channel; the mapping is inherited by forked processes
+ * @param capacity Ring size in bytes, rounded up to a power of two
+ * @param error Receives an error message on failure
+ * @return The channel, or NULL on failure
+ */
+shm_channel_t* shm_channel_create(size_t capacity, const char** error);
+
+/**
+ * Unmap the channel in the calling process
+ * @param channel The channel
+ */
+void shm_channel_destroy(shm_channel_t* channel);
+
+/**
+ * Copy a message into the ring (producer); waits while the ring is full
+ * @param channel The channel
+ * @param message Message bytes
+ * @param length Message length; a terminating NUL is added
+ * @param timeout_ms Longest wait for space
+ * @return SHM_CHANNEL_OK, SHM_CHANNEL_TIMEOUT, SHM_CHANNEL_CLOSED or SHM_CHANNEL_TOO_LARGE
+ */
+int shm_channel_send(shm_channel_t* channel, const char* message, size_t length, int timeout_ms);
+
+/**
+ * Get the oldest message (consumer); waits while the ring is empty
+ * The message stays in the ring until shm_channel_release
+ * @param channel The channel
+ * @param message Receives the NUL-terminated message
+ * @param length Receives the message length
+ * @param timeout_ms Longest wait for a message
+ * @return SHM_CHANNEL_OK, SHM_CHANNEL_TIMEOUT or SHM_CHANNEL_CLOSED
+ */
+int shm_channel_receive(shm_channel_t* channel, const char** message, size_t* length, int timeout_ms);
+
+/**
+ * Give the message returned by shm_channel_receive back to the producer
+ * @param channel The channel
+ */
+void shm_channel_release(shm_channel_t* channel);
+
+/**
+ * Close the channel: a waiting or later send fails, receive fails once
+ * the ring is drained
+ * @param channel The channel
+ */
+void shm_channel_close(shm_channel_t* channel);
+
+#endif // SHM_CHANNEL_H
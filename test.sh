@@ -67,7 +67,7 @@ print_status "Starting comprehensive test suite..."
 
 # First, build the project
 print_status "Building project..."
-./build.sh || {
+./build.sh all || {
     print_error "Build failed"
     exit 1
 }
@@ -383,6 +383,561 @@ else
     print_warning "Skipping indefinite wait test: timeout utility not available"
 fi
 
+display_test_category "Overload Policies"
+
+# drop-newest keeps ingest moving past a slow stage and reports the drops
+OUTPUT=$(printf 'a\nb\nc\nd\ne\n<END>\n' | timeout 20s ./output/analyzer 1 typewriter:overload=drop-newest 2>&1)
+DROPPED=$(echo "$OUTPUT" | sed -n 's/^\[stats\] typewriter: dropped=\([0-9]*\).*/\1/p')
+TESTS_TOTAL=$((TESTS_TOTAL + 1))
+if [ -n "$DROPPED" ] && [ "$DROPPED" -gt 0 ] && echo "$OUTPUT" | grep -q "Pipeline shutdown complete"; then
+    print_success "drop-newest policy (dropped $DROPPED items, END delivered)"
+    TESTS_PASSED=$((TESTS_PASSED + 1))
+else
+    print_error "drop-newest policy: unexpected output '$OUTPUT'"
+fi
+
+# drop-oldest keeps the most recent item
+EXPECTED="[typewriter] e"
+ACTUAL=$(printf 'a\nb\nc\nd\ne\n<END>\n' | timeout 20s ./output/analyzer 1 typewriter:overload=drop-oldest 2>&1 | grep -E "\[typewriter\]" | tail -n1)
+check_test_result "drop-oldest policy keeps newest item" "$EXPECTED" "$ACTUAL"
+
+# Sampling never loses the end-of-stream signal
+EXPECTED="Pipeline shutdown complete"
+ACTUAL=$( (for i in $(seq 1 2000); do echo "sample$i"; done; echo "<END>") \
+    | timeout 30s ./output/analyzer 1 uppercaser:overload=sample:5 logger:overload=sample:3 2>&1 | grep "Pipeline shutdown complete")
+check_test_result "sample policy delivers END" "$EXPECTED" "$ACTUAL"
+
+# The kept 1-in-N item replaces the oldest one, so a slow stage never holds up ingest
+ACTUAL=$( (for i in $(seq 1 200); do echo "x"; done; echo "<END>") \
+    | timeout 10s ./output/analyzer 1 typewriter:overload=sample:2 2>&1 | grep "Pipeline shutdown complete")
+check_test_result "sample policy does not block ingest" "$EXPECTED" "$ACTUAL"
+
+# Invalid policy
+TESTS_TOTAL=$((TESTS_TOTAL + 1))
+echo -e "x\n<END>" | timeout 10s ./output/analyzer 5 logger:overload=bogus >/dev/null 2>&1
+EXIT_CODE=$?
+if [ $EXIT_CODE -eq 2 ]; then
+    print_success "Invalid Overload Policy Detection"
+    TESTS_PASSED=$((TESTS_PASSED + 1))
+else
+    print_error "Invalid Overload Policy: wanted exit code 2, received $EXIT_CODE"
+fi
+
+# The stages that did start must still be stopped when a later or earlier one fails
+for CHAIN in "uppercaser logger:overload=bogus" "uppercaser:overload=bogus rotator logger"; do
+    TESTS_TOTAL=$((TESTS_TOTAL + 1))
+    echo -e "x\n<END>" | timeout 10s ./output/analyzer 5 $CHAIN >/dev/null 2>&1
+    EXIT_CODE=$?
+    if [ $EXIT_CODE -eq 2 ]; then
+        print_success "Failed init stops the rest of the chain ($CHAIN)"
+        TESTS_PASSED=$((TESTS_PASSED + 1))
+    else
+        print_error "Failed init stops the rest of the chain ($CHAIN): wanted exit code 2, received $EXIT_CODE"
+    fi
+done
+
+display_test_category "Hot Swap"
+
+# Replace a middle stage while input is flowing: nothing lost or reordered
+SWAP_FILE=$(mktemp)
+echo "rotator" > "$SWAP_FILE"
+SWAP_OUTPUT=$(mktemp)
+( for i in $(seq 1 30); do echo "swap$i"; sleep 0.05; done; echo "<END>" ) \
+    | timeout 30s ./output/analyzer --swap-file="$SWAP_FILE" 3 uppercaser rotator logger >"$SWAP_OUTPUT" 2>&1 &
+SWAP_PID=$!
+sleep 0.5
+pkill -HUP -f "^\./output/analyzer --swap-file=$SWAP_FILE"
+wait $SWAP_PID
+EXPECTED=$(for i in $(seq 1 30); do w="SWAP$i"; echo "[logger] ${w: -1}${w%?}"; done)
+ACTUAL=$(grep -E "\[logger\]" "$SWAP_OUTPUT")
+check_test_result "Hot swap keeps every item in order" "$EXPECTED" "$ACTUAL"
+EXPECTED="[swap] rotator replaced by ./output/rotator.so"
+ACTUAL=$(grep -E "^\[swap\]" "$SWAP_OUTPUT")
+check_test_result "Hot swap reports the replaced stage" "$EXPECTED" "$ACTUAL"
+
+# The first stage (fed by ingest) and a last stage whose transform is its output
+for SWAP_STAGE in uppercaser logger; do
+    echo "$SWAP_STAGE" > "$SWAP_FILE"
+    ( for i in $(seq 1 30); do echo "swap$i"; sleep 0.05; done; echo "<END>" ) \
+        | timeout 30s ./output/analyzer --swap-file="$SWAP_FILE" 3 uppercaser rotator logger >"$SWAP_OUTPUT" 2>&1 &
+    SWAP_PID=$!
+    sleep 0.5
+    pkill -HUP -f "^\./output/analyzer --swap-file=$SWAP_FILE"
+    wait $SWAP_PID
+    EXPECTED=$(for i in $(seq 1 30); do w="SWAP$i"; echo "[logger] ${w: -1}${w%?}"; done)
+    ACTUAL=$(grep -E "\[logger\]" "$SWAP_OUTPUT")
+    check_test_result "Hot swap of $SWAP_STAGE keeps every item in order" "$EXPECTED" "$ACTUAL"
+done
+rm -f "$SWAP_FILE" "$SWAP_OUTPUT"
+
+display_test_category "Static Plugin Registry"
+
+# Built-in plugins behave like the dynamically loaded ones
+EXPECTED="[logger] LLEHO"
+ACTUAL=$(echo -e "hello\n<END>" | timeout 20s ./output/analyzer-static 10 uppercaser rotator flipper logger 2>&1 | grep -E "\[logger\]")
+check_test_result "Built-in plugin chain" "$EXPECTED" "$ACTUAL"
+
+# Startup is reported and no built-in plugin is loaded from disk
+EXPECTED="3 stages (3 built-in, 0 loaded)"
+ACTUAL=$(echo "<END>" | timeout 10s ./output/analyzer-static --stats 10 uppercaser rotator logger 2>&1 \
+    | sed -n 's/^\[startup\] \(.*)\) ready in .*/\1/p')
+check_test_result "Startup report of built-in plugins" "$EXPECTED" "$ACTUAL"
+
+# The optimized monolithic build produces the same results
+EXPECTED="[logger] 1A % ! 6 5 3 T 3 2 "
+ACTUAL=$(echo -e "123t356!%a\n<END>" | timeout 25s ./output/analyzer-mono 15 flipper expander rotator uppercaser logger 2>&1 | grep -E "\[logger\]")
+check_test_result "Monolithic build chain" "$EXPECTED" "$ACTUAL"
+
+# Unknown names still fall back to dlopen and fail cleanly
+TESTS_TOTAL=$((TESTS_TOTAL + 1))
+echo -e "test\n<END>" | ./output/analyzer-static 10 invalid_plugin >/dev/null 2>&1
+EXIT_CODE=$?
+if [ $EXIT_CODE -eq 1 ]; then
+    print_success "Unknown Plugin Detection (static build)"
+    TESTS_PASSED=$((TESTS_PASSED + 1))
+else
+    print_error "Unknown Plugin (static build): wanted exit code 1, received $EXIT_CODE"
+fi
+
+display_test_category "Output Sink"
+
+# Records reach stdout raw, the shutdown message goes to stderr
+EXPECTED=$'OHELL\nDWORL'
+ACTUAL=$(echo -e "hello\nworld\n<END>" | timeout 10s ./output/analyzer --sink=- 10 uppercaser rotator 2>/dev/null)
+check_test_result "Sink to stdout" "$EXPECTED" "$ACTUAL"
+
+# Custom delimiter, per-record flushing
+EXPECTED="CBA|FED|"
+ACTUAL=$(echo -e "abc\ndef\n<END>" | timeout 10s ./output/analyzer --sink=- --sink-delimiter='|' --sink-flush=record 10 flipper uppercaser 2>/dev/null)
+check_test_result "Sink delimiter and record flush" "$EXPECTED" "$ACTUAL"
+
+# A large volume written to a file arrives complete and in order
+SINK_FILE=$(mktemp)
+seq 1 20000 | sed 's/^/line /' > "${SINK_FILE}.in"
+EXPECTED=$(tr a-z A-Z < "${SINK_FILE}.in" | md5sum)
+(cat "${SINK_FILE}.in"; echo "<END>") | timeout 20s ./output/analyzer-mono --sink="$SINK_FILE" 50 uppercaser >/dev/null 2>&1
+ACTUAL=$(md5sum < "$SINK_FILE")
+check_test_result "Sink to file" "$EXPECTED" "$ACTUAL"
+rm -f "$SINK_FILE" "${SINK_FILE}.in"
+
+# A sink that cannot be opened stops the stages already started
+EXPECTED=$(printf 'Error opening sink /nonexistent/dir/x: Failed to open sink file\nexit code 2')
+ACTUAL=$(echo -e "x\n<END>" | timeout -s KILL 10s ./output/analyzer --sink=/nonexistent/dir/x 10 uppercaser logger 2>&1; echo "exit code $?")
+check_test_result "Unopenable sink exits" "$EXPECTED" "$ACTUAL"
+
+# A reader that splices the pipe's pages on (instead of reading them) must see them unchanged
+if command -v python3 >/dev/null 2>&1; then
+    SPLICE_INPUT=$(mktemp)
+    seq 1 200000 | sed 's/^/spliced line /' > "$SPLICE_INPUT"
+    EXPECTED=$(tr a-z A-Z < "$SPLICE_INPUT" | md5sum)
+    ACTUAL=$(timeout 30s ./output/analyzer --sink=- 64 uppercaser < "$SPLICE_INPUT" 2>/dev/null | \
+        python3 -c 'import os
+while os.splice(0, 1, 1 << 16): pass' | (sleep 1; md5sum))
+    check_test_result "Sink to a splicing reader" "$EXPECTED" "$ACTUAL"
+    rm -f "$SPLICE_INPUT"
+fi
+
+display_test_category "Work-Stealing Scheduler"
+
+# Stages on a worker pool produce the same output as one thread per stage
+POOL_INPUT=$(seq 1 3000 | sed 's/^/item /'; echo "<END>")
+EXPECTED=$(echo "$POOL_INPUT" | timeout 20s ./output/analyzer --sink=- 8 uppercaser rotator flipper expander 2>/dev/null | md5sum)
+ACTUAL=$(echo "$POOL_INPUT" | timeout 20s ./output/analyzer --workers=3 --batch=4 --sink=- 8 uppercaser rotator flipper expander 2>/dev/null | md5sum)
+check_test_result "Worker pool output matches threaded output" "$EXPECTED" "$ACTUAL"
+
+EXPECTED="[logger] LLEHO"
+ACTUAL=$(echo -e "hello\n<END>" | timeout 10s ./output/analyzer-static --workers=1 10 uppercaser rotator flipper logger 2>&1 | grep -E "\[logger\]")
+check_test_result "Single worker runs a whole chain (static build)" "$EXPECTED" "$ACTUAL"
+
+EXPECTED="workers=2"
+ACTUAL=$(echo -e "a\n<END>" | timeout 10s ./output/analyzer-mono --workers=2 --stats 10 uppercaser logger 2>&1 \
+    | sed -n 's/^\[stats\] scheduler: \(workers=[0-9]*\).*/\1/p')
+check_test_result "Scheduler statistics" "$EXPECTED" "$ACTUAL"
+
+display_test_category "Daemon Mode"
+
+DAEMON_SOCKET=$(mktemp -u /tmp/analyzer-test-XXXXXX.sock)
+timeout 30s ./output/analyzer --listen="$DAEMON_SOCKET" --workers=2 10 uppercaser rotator >/dev/null 2>&1 &
+DAEMON_PID=$!
+for _ in $(seq 1 50); do
+    [ -S "$DAEMON_SOCKET" ] && break
+    sleep 0.1
+done
+
+EXPECTED=$'OHELL\nDWORL'
+ACTUAL=$(echo -e "hello\nworld\n<END>" | timeout 10s ./output/analyzer --connect="$DAEMON_SOCKET" 2>&1)
+check_test_result "Daemon serves a client" "$EXPECTED" "$ACTUAL"
+
+# Concurrent clients each get their own pipeline
+DAEMON_OUTPUT=$(mktemp)
+seq 1 5000 | sed 's/^/a/' | timeout 20s ./output/analyzer --connect="$DAEMON_SOCKET" > "$DAEMON_OUTPUT" &
+CLIENT_PID=$!
+EXPECTED=$(seq 1 5000 | sed 's/^/b/' | tr a-z A-Z | sed 's/^\(.*\)\(.\)$/\2\1/' | md5sum)
+ACTUAL=$(seq 1 5000 | sed 's/^/b/' | timeout 20s ./output/analyzer --connect="$DAEMON_SOCKET" | md5sum)
+wait $CLIENT_PID
+check_test_result "Concurrent daemon clients" "$EXPECTED" "$ACTUAL"
+EXPECTED=$(seq 1 5000 | sed 's/^/a/' | tr a-z A-Z | sed 's/^\(.*\)\(.\)$/\2\1/' | md5sum)
+ACTUAL=$(md5sum < "$DAEMON_OUTPUT")
+check_test_result "Concurrent daemon clients (second stream)" "$EXPECTED" "$ACTUAL"
+rm -f "$DAEMON_OUTPUT"
+
+# SIGTERM stops the daemon cleanly and removes its socket
+TESTS_TOTAL=$((TESTS_TOTAL + 1))
+kill -TERM $DAEMON_PID
+wait $DAEMON_PID
+EXIT_CODE=$?
+if [ $EXIT_CODE -eq 0 ] && [ ! -e "$DAEMON_SOCKET" ]; then
+    print_success "Daemon shutdown on SIGTERM"
+    TESTS_PASSED=$((TESTS_PASSED + 1))
+else
+    print_error "Daemon shutdown on SIGTERM: exit code $EXIT_CODE"
+fi
+rm -f "$DAEMON_SOCKET"
+
+display_test_category "Process Isolation"
+
+# Isolated stages produce the same records as in-process stages
+EXPECTED=$( (seq 1 3000 | sed 's/^/line /'; echo "<END>") | ./output/analyzer 20 uppercaser rotator flipper logger 2>&1 | md5sum)
+ACTUAL=$( (seq 1 3000 | sed 's/^/line /'; echo "<END>") | timeout 20s ./output/analyzer --isolate=rotator,flipper 20 uppercaser rotator flipper logger 2>&1 | md5sum)
+check_test_result "Isolated stages match in-process output" "$EXPECTED" "$ACTUAL"
+
+# A crashing worker is cut out and the pipeline still shuts down cleanly
+TESTS_TOTAL=$((TESTS_TOTAL + 1))
+ISOLATE_ERRORS=$(mktemp)
+(for i in 1 2 3 4 5; do echo "item$i"; sleep 0.3; done; echo "<END>") | \
+    timeout 20s ./output/analyzer --isolate=typewriter 20 uppercaser typewriter logger >/dev/null 2>"$ISOLATE_ERRORS" &
+ISOLATE_PID=$!
+sleep 1
+# timeout runs the analyzer, whose child is the typewriter worker
+pkill -KILL -P "$(pgrep -P $ISOLATE_PID)"
+wait $ISOLATE_PID
+EXIT_CODE=$?
+if [ $EXIT_CODE -eq 0 ] && grep -q "stage typewriter .* died" "$ISOLATE_ERRORS"; then
+    print_success "Crashed isolated stage is contained"
+    TESTS_PASSED=$((TESTS_PASSED + 1))
+else
+    print_error "Crashed isolated stage is contained: exit code $EXIT_CODE"
+fi
+rm -f "$ISOLATE_ERRORS"
+
+ACTUAL=$(echo "<END>" | ./output/analyzer --isolate=nope 20 uppercaser logger 2>&1 | head -1)
+check_test_result "Unknown isolated stage rejected" "Error: No stage named nope to isolate" "$ACTUAL"
+
+display_test_category "Spill to Disk"
+
+# A burst overflows into the spill file and comes back in order
+SPILL_STATS=$(mktemp)
+EXPECTED=$( (seq 1 50000 | sed 's/^/record /'; echo "<END>") | ./output/analyzer 2 uppercaser rotator logger | md5sum)
+ACTUAL=$( (seq 1 50000 | sed 's/^/record /'; echo "<END>") | ./output/analyzer --stats 2 uppercaser:overload=spill rotator logger 2>"$SPILL_STATS" | md5sum)
+check_test_result "Spilled records keep their order" "$EXPECTED" "$ACTUAL"
+
+TESTS_TOTAL=$((TESTS_TOTAL + 1))
+SPILLED=$(sed -n 's/^\[stats\] uppercaser: dropped=0 spilled=\([0-9]*\)$/\1/p' "$SPILL_STATS")
+if [ -n "$SPILLED" ] && [ "$SPILLED" -gt 0 ]; then
+    print_success "Spill counter reported ($SPILLED records)"
+    TESTS_PASSED=$((TESTS_PASSED + 1))
+else
+    print_error "Spill counter reported: $(cat "$SPILL_STATS")"
+fi
+rm -f "$SPILL_STATS"
+
+display_test_category "Result Cache"
+
+# Repeated inputs are served from the cache with identical output
+CACHE_STATS=$(mktemp)
+EXPECTED=$( (for i in $(seq 1 2000); do echo "request $((i % 50))"; done; echo "<END>") | ./output/analyzer 20 uppercaser flipper logger | md5sum)
+ACTUAL=$( (for i in $(seq 1 2000); do echo "request $((i % 50))"; done; echo "<END>") | ./output/analyzer --stats 20 uppercaser:cache=64k flipper:cache=64k logger 2>"$CACHE_STATS" | md5sum)
+check_test_result "Cached results match computed results" "$EXPECTED" "$ACTUAL"
+ACTUAL=$(grep "^\[stats\] uppercaser:" "$CACHE_STATS")
+check_test_result "Cache hit and miss counters" "[stats] uppercaser: dropped=0 spilled=0 cache_hits=1950 cache_misses=50" "$ACTUAL"
+rm -f "$CACHE_STATS"
+
+ACTUAL=$(echo "<END>" | ./output/analyzer 10 logger:cache=1m 2>&1 | head -1)
+check_test_result "Cache rejected for an impure plugin" "Error initializing plugin logger: Plugin results are not memoizable, they cannot be cached" "$ACTUAL"
+
+display_test_category "Ingest Interning"
+
+# Repeated lines share one buffer on the worker pool; output is unchanged
+INTERN_STATS=$(mktemp)
+EXPECTED=$( (for i in $(seq 1 2000); do echo "request $((i % 50))"; done; echo "<END>") | ./output/analyzer 20 uppercaser flipper logger | md5sum)
+ACTUAL=$( (for i in $(seq 1 2000); do echo "request $((i % 50))"; done; echo "<END>") | ./output/analyzer --workers=2 --stats 20 uppercaser flipper logger 2>"$INTERN_STATS" | md5sum)
+check_test_result "Interned pool output matches thread mode" "$EXPECTED" "$ACTUAL"
+ACTUAL=$(grep -o "deduplicated=[0-9]*" "$INTERN_STATS")
+check_test_result "Repeated lines are deduplicated" "deduplicated=1950" "$ACTUAL"
+rm -f "$INTERN_STATS"
+
+display_test_category "Chain Optimizer"
+
+# Runs collapse and the character-wise stage moves ahead of the others
+ACTUAL=$(echo "<END>" | ./output/analyzer --optimize --stats 10 rotator rotator flipper flipper expander uppercaser logger 2>&1 | grep "^\[optimize\]")
+check_test_result "Chain is rewritten" "[optimize] 7 stages rewritten to 4: uppercaser rotator:shift=2 expander logger" "$ACTUAL"
+
+EXPECTED=$(printf "Hello World\nabc def\n<END>\n" | ./output/analyzer 10 rotator expander flipper uppercaser logger | md5sum)
+ACTUAL=$(printf "Hello World\nabc def\n<END>\n" | ./output/analyzer --optimize 10 rotator expander flipper uppercaser logger | md5sum)
+check_test_result "Reordered chain gives the same output" "$EXPECTED" "$ACTUAL"
+
+ACTUAL=$(printf "Hello World\n<END>\n" | ./output/analyzer --optimize 10 rotator rotator rotator logger | head -1)
+check_test_result "Rotations add up" "[logger] rldHello Wo" "$ACTUAL"
+
+# Side-effecting stages are barriers
+ACTUAL=$(echo "<END>" | ./output/analyzer --optimize 10 uppercaser logger uppercaser 2>&1 | head -1)
+check_test_result "Logger is a barrier" "Error: Duplicate plugin 'uppercaser' found" "$ACTUAL"
+
+display_test_category "Rotation Views"
+
+# Rotations and reversals fold into one rotator that copies the string once
+ACTUAL=$(echo "<END>" | ./output/analyzer --optimize --stats 10 rotator flipper rotator logger 2>&1 | grep "^\[optimize\]")
+check_test_result "Rotate and reverse fold into one view" "[optimize] 4 stages rewritten to 2: rotator:shift=0,reverse=1 logger" "$ACTUAL"
+
+ACTUAL=$(printf "Hello World\n<END>\n" | ./output/analyzer --optimize 10 rotator flipper rotator logger | head -1)
+check_test_result "Folded view output" "[logger] dlroW olleH" "$ACTUAL"
+
+ACTUAL=$(printf "Hello World\n<END>\n" | ./output/analyzer 10 rotator:shift=2,reverse=1 logger | head -1)
+check_test_result "Reverse and rotate in one pass" "[logger] eHdlroW oll" "$ACTUAL"
+
+display_test_category "Bounded Shutdown"
+
+# The drain deadline discards the slow stage's backlog and reports it
+ACTUAL=$( (for i in $(seq 1 20); do echo "line $i"; done; echo "<END>") | \
+    timeout 10s ./output/analyzer --drain-timeout=300 32 uppercaser typewriter logger 2>&1 >/dev/null | grep "typewriter: queued")
+check_test_result "Drain deadline reports the backlog" "[shutdown] typewriter: queued=20" "$ACTUAL"
+
+ACTUAL=$( (for i in $(seq 1 20); do echo "line $i"; done; echo "<END>") | \
+    timeout 10s ./output/analyzer --workers=2 --drain-timeout=300 32 uppercaser typewriter logger 2>&1 >/dev/null | grep "typewriter: queued")
+check_test_result "Drain deadline on the worker pool" "[shutdown] typewriter: queued=20" "$ACTUAL"
+
+# SIGINT ends the input and drains what was read
+SHUTDOWN_OUTPUT=$(mktemp)
+timeout 10s ./output/analyzer 10 uppercaser logger < <(echo "hello"; sleep 5) >"$SHUTDOWN_OUTPUT" 2>/dev/null &
+SHUTDOWN_PID=$!
+sleep 0.5
+kill -INT $SHUTDOWN_PID
+wait $SHUTDOWN_PID
+EXIT_CODE=$?
+ACTUAL=$(tr '\n' '|' < "$SHUTDOWN_OUTPUT")
+check_test_result "SIGINT drains and exits cleanly" "[logger] HELLO|Pipeline shutdown complete|0" "$ACTUAL$EXIT_CODE"
+rm -f "$SHUTDOWN_OUTPUT"
+
+# A startup stuck opening a sink nobody reads still ends on SIGTERM
+SHUTDOWN_FIFO=$(mktemp -u)
+mkfifo "$SHUTDOWN_FIFO"
+echo -e "x\n<END>" | timeout -k 5s 1s ./output/analyzer --sink="$SHUTDOWN_FIFO" 10 uppercaser logger >/dev/null 2>&1
+check_test_result "SIGTERM ends a stuck startup" "124" "$?"
+rm -f "$SHUTDOWN_FIFO"
+
+display_test_category "Priority Lanes"
+
+# An urgent line overtakes the backlog: typewriter holds the single worker for over a second per
+# line, so b2 and b3 fill the 2-item queue and ingest waits; u gets in when b3 is taken and
+# must pass b4, which is already queued
+EXPECTED="[typewriter] b1|[typewriter] b2|[typewriter] b3|[typewriter] u|[typewriter] b4|"
+ACTUAL=$(printf 'b1\nb2\nb3\nb4\n<p0>u\n<END>\n' | timeout 30s ./output/analyzer --workers=1 --lanes=2 2 typewriter 2>&1 | \
+    grep "^\[typewriter\]" | tr '\n' '|')
+check_test_result "Urgent lane overtakes the backlog" "$EXPECTED" "$ACTUAL"
+
+ACTUAL=$(printf "a\n<p0>b\nc\n<p1>d\n<p0>e\n<END>\n" | \
+    ./output/analyzer --workers=1 --lanes=3:weighted --stats 16 uppercaser logger 2>&1 | \
+    grep -o "uppercaser lane [0-9]: served=[0-9]*" | tr '\n' '|')
+check_test_result "Served items counted per lane" \
+    "uppercaser lane 0: served=2|uppercaser lane 1: served=1|uppercaser lane 2: served=3|" "$ACTUAL"
+
+ACTUAL=$(echo -e "<p0>x\n<END>" | ./output/analyzer 10 uppercaser logger 2>&1 | head -1)
+check_test_result "Lane tags pass through without --lanes" "[logger] <P0>X" "$ACTUAL"
+
+ACTUAL=$(echo "<END>" | ./output/analyzer --lanes=2 10 uppercaser 2>&1 | head -1)
+check_test_result "Lanes need the worker pool" "Error: --lanes needs --workers or --listen" "$ACTUAL"
+
+display_test_category "Filter Stages"
+
+GREP_INPUT=$(printf "alpha error one\nbeta ok\ngamma ERROR\nan error near the end of a line longer than thirty-two bytes\n<END>\n")
+ACTUAL=$(echo "$GREP_INPUT" | ./output/analyzer 10 grep:pattern=error logger 2>&1 | tr '\n' '|')
+check_test_result "grep keeps matching lines" \
+    "[logger] alpha error one|[logger] an error near the end of a line longer than thirty-two bytes|Pipeline shutdown complete|" "$ACTUAL"
+
+ACTUAL=$(echo "$GREP_INPUT" | ./output/analyzer --stats 10 grep:pattern=error logger 2>&1 | grep "\[stats\] grep")
+check_test_result "grep selectivity counters" "[stats] grep: dropped=0 spilled=0 kept=2 filtered=2" "$ACTUAL"
+
+ACTUAL=$(echo "$GREP_INPUT" | ./output/analyzer --workers=2 10 grep:pattern=error,invert=1 uppercaser logger 2>&1 | tr '\n' '|')
+check_test_result "Inverted grep on the worker pool" "[logger] BETA OK|[logger] GAMMA ERROR|Pipeline shutdown complete|" "$ACTUAL"
+
+ACTUAL=$(echo "<END>" | ./output/analyzer 10 grep 2>&1 | head -1)
+check_test_result "grep needs a pattern" \
+    "Error initializing plugin grep: Missing or invalid pattern (expected 1 to 256 characters)" "$ACTUAL"
+
+display_test_category "Keyword Tagging"
+
+KEYWORDS_FILE=$(mktemp)
+printf "error\ntimeout\n\nuser=42\nout\n" > "$KEYWORDS_FILE"
+KEYWORDS_INPUT=$(printf "an error after a timeout\nnothing here\nuser=42 timed out\n<END>\n")
+ACTUAL=$(echo "$KEYWORDS_INPUT" | ./output/analyzer 10 "keywords:patterns=$KEYWORDS_FILE" logger 2>&1 | tr '\n' '|')
+check_test_result "Lines annotated with keyword IDs" \
+    "[logger] an error after a timeout [keywords=1,2,5]|[logger] nothing here|[logger] user=42 timed out [keywords=4,5]|Pipeline shutdown complete|" "$ACTUAL"
+
+ACTUAL=$(echo "$KEYWORDS_INPUT" | ./output/analyzer --workers=2 10 "keywords:patterns=$KEYWORDS_FILE,emit=ids" logger 2>&1 | tr '\n' '|')
+check_test_result "Keyword IDs only, unmatched lines dropped" "[logger] 1,2,5|[logger] 4,5|Pipeline shutdown complete|" "$ACTUAL"
+
+ACTUAL=$(echo "$KEYWORDS_INPUT" | ./output/analyzer --stats 10 "keywords:patterns=$KEYWORDS_FILE" 2>&1 | grep "\[stats\] keywords")
+check_test_result "Keyword counters" "[stats] keywords: dropped=0 spilled=0 matched=2 unmatched=1 states=23 truncated=0" "$ACTUAL"
+
+# A line with more keywords than are reported is tagged with the first 64 and counted
+seq -f "kw%02g" 1 70 > "$KEYWORDS_FILE"
+ACTUAL=$( (seq -f "kw%02g" 1 70 | tr '\n' ' '; echo; echo "<END>") | \
+    ./output/analyzer --stats 10 "keywords:patterns=$KEYWORDS_FILE,emit=ids" logger 2>&1 | \
+    sed -n 's/^\[logger\] .*,\([0-9]*\)$/last=\1/p; s/^\[stats\] keywords: .*\(truncated=[0-9]*\)/\1/p' | tr '\n' ' ')
+check_test_result "Keywords past the per-line limit are counted" "last=64 truncated=1 " "$ACTUAL"
+rm -f "$KEYWORDS_FILE"
+
+display_test_category "Windowed Aggregation"
+
+AGGREGATE_INPUT=$(printf "a b a\nb c\na\nc c c\nz\n<END>\n")
+ACTUAL=$(echo "$AGGREGATE_INPUT" | ./output/analyzer 10 aggregate:window=2 logger 2>&1 | tr '\n' '|')
+check_test_result "Record windows, the open one flushed at <END>" \
+    "[logger] window=1 lines=2 tokens=5 keys=3 evicted=0 top=a:2,b:2,c:1|[logger] window=2 lines=2 tokens=4 keys=2 evicted=0 top=c:3,a:1|[logger] window=3 lines=1 tokens=1 keys=1 evicted=0 top=z:1|Pipeline shutdown complete|" "$ACTUAL"
+
+ACTUAL=$(echo "$AGGREGATE_INPUT" | ./output/analyzer --workers=2 10 aggregate:window=10,top=1,field=1 uppercaser logger 2>&1 | tr '\n' '|')
+check_test_result "Flush on the worker pool" "[logger] WINDOW=1 LINES=5 TOKENS=5 KEYS=4 EVICTED=0 TOP=A:2|Pipeline shutdown complete|" "$ACTUAL"
+
+ACTUAL=$(printf "a a a b c\n<END>\n" | ./output/analyzer --isolate=aggregate 10 aggregate:max_keys=2 logger 2>&1 | grep -E "\[logger\]")
+check_test_result "Key bound evicts the least counted token" "[logger] window=1 lines=1 tokens=5 keys=2 evicted=1 top=a:3,c:2" "$ACTUAL"
+
+ACTUAL=$( (printf "x\ny\n"; sleep 0.3; printf "z\n<END>\n") | ./output/analyzer 10 aggregate:window=100ms logger 2>&1 | tr '\n' '|')
+check_test_result "Time window closed by a late line" \
+    "[logger] window=1 lines=2 tokens=2 keys=2 evicted=0 top=x:1,y:1|[logger] window=2 lines=1 tokens=1 keys=1 evicted=0 top=z:1|Pipeline shutdown complete|" "$ACTUAL"
+
+ACTUAL=$(timeout 10s ./output/analyzer --listen=/tmp/analyzer_aggregate_test.sock --workers=2 10 aggregate logger 2>&1 </dev/null | head -1)
+check_test_result "Aggregate is not shared by daemon connections" \
+    "Error: --listen cannot share stage aggregate between connections, it keeps state across records" "$ACTUAL"
+
+display_test_category "Framed Records"
+
+ACTUAL=$(printf '\005ab\ncd\003xyz' | ./output/analyzer --input-format=framed 10 uppercaser logger 2>&1 | tr '\n' '|')
+check_test_result "Framed input keeps newlines in records" "[logger] AB|CD|[logger] XYZ|Pipeline shutdown complete|" "$ACTUAL"
+
+ACTUAL=$(printf '\005ab\ncd' | ./output/analyzer --input-format=framed --sink=- --sink-format=framed 10 uppercaser 2>/dev/null | od -An -v -tx1 | tr -s ' \n' ' ')
+check_test_result "Framed sink output" " 05 41 42 0a 43 44 " "$ACTUAL"
+
+FRAMED_LONG=$( (printf '\310\001'; printf 'a%.0s' $(seq 200)) | ./output/analyzer --workers=2 --input-format=framed --sink=- --sink-format=framed 10 uppercaser 2>/dev/null | od -An -v -tx1 | tr -s ' \n' ' ')
+ACTUAL="$(echo "$FRAMED_LONG" | cut -d' ' -f2-4) $(echo "$FRAMED_LONG" | wc -w)"
+check_test_result "Two-byte length on the worker pool" "c8 01 41 202" "$ACTUAL"
+
+# stdout and stderr interleave in either order, so compare the sorted lines
+ACTUAL=$(printf '\003a\000b\002hi\005ab' | ./output/analyzer --input-format=framed 10 logger 2>&1 | LC_ALL=C sort | tr '\n' '|')
+check_test_result "NUL records skipped, truncated record ends the stream" \
+    "Error reading framed input: Truncated record at the end of the input; ending the stream|Pipeline shutdown complete|[input] skipped 1 framed records containing NUL bytes|[logger] hi|" "$ACTUAL"
+
+ACTUAL=$(printf '\005<END>\002hi' | ./output/analyzer --input-format=framed 10 logger 2>&1 | LC_ALL=C sort | tr '\n' '|')
+check_test_result "Framed <END> record skipped, not taken as the end" \
+    "Pipeline shutdown complete|[input] skipped 1 framed records equal to <END>|[logger] hi|" "$ACTUAL"
+
+ACTUAL=$(printf '\002hi' | ./output/analyzer --input-format=framed --isolate=logger 10 logger 2>&1 | head -1)
+check_test_result "Framed input rejected with isolated stages" "Error: --isolate cannot be combined with --input-format=framed" "$ACTUAL"
+
+display_test_category "Capability Descriptor"
+
+ACTUAL=$(printf '<END>\n' | ./output/analyzer --stats 10 uppercaser typewriter expander 2>&1 | grep '^\[startup\] [a-z]*:' | tr '\n' '|')
+check_test_result "Capabilities reported at startup" \
+    "[startup] uppercaser: in-place memoizable thread-safe output<=1x+0|[startup] typewriter: side-effects output<=1x+0|[startup] expander: memoizable thread-safe output<=2x+0|" "$ACTUAL"
+
+ACTUAL=$(printf 'abcdef\n<END>\n' | ./output/analyzer 10 rotator:shift=2 flipper uppercaser logger 2>&1 | head -1)
+check_test_result "In-place stages on stage threads" "[logger] DCBAFE" "$ACTUAL"
+
+ACTUAL=$(printf 'abcdef\nabcdef\n<END>\n' | ./output/analyzer --workers=2 10 rotator:shift=-1 uppercaser logger 2>&1 | head -2 | tr '\n' '|')
+check_test_result "In-place stages keep interned input intact" "[logger] BCDEFA|[logger] BCDEFA|" "$ACTUAL"
+
+display_test_category "Byte-Bounded Queues"
+
+QUEUE_BYTES_INPUT=$( (for i in $(seq 300); do printf 'x%.0s' $(seq $(( (i % 3) * 400 + 10 ))); echo; done; echo '<END>') )
+ACTUAL=$(echo "$QUEUE_BYTES_INPUT" | ./output/analyzer --stats 100 uppercaser:queue_bytes=2k logger 2>&1 | \
+    awk '/^\[logger\]/ { lines++ } /^\[stats\] uppercaser:/ { split($NF, peak, "="); bounded = peak[2] <= 2048 } END { print lines, bounded }')
+check_test_result "Byte budget bounds the queue" "300 1" "$ACTUAL"
+
+ACTUAL=$(echo "$QUEUE_BYTES_INPUT" | ./output/analyzer --workers=2 --queue-bytes=4k --stats 100 uppercaser logger:queue_bytes=2k 2>&1 | \
+    awk '/^\[logger\]/ { lines++ } /^\[stats\] (uppercaser|logger):/ { split($NF, peak, "="); budget = $1 ~ /logger/ ? 2048 : 4096; bounded += peak[2] <= budget } END { print lines, bounded }')
+check_test_result "Default and per-stage budgets on the worker pool" "300 2" "$ACTUAL"
+
+ACTUAL=$( (printf 'y%.0s' $(seq 800); printf '\n<END>\n') | ./output/analyzer 10 expander logger:queue_bytes=1k | head -1 | wc -c)
+check_test_result "Item larger than the budget enters an empty queue" "1609" "$ACTUAL"
+
+ACTUAL=$(echo "<END>" | ./output/analyzer 10 logger:queue_bytes=0 2>&1 | head -1)
+check_test_result "Invalid byte budget rejected" "Error initializing plugin logger: Invalid byte budget (expected e.g. 64k, 16m or 1g)" "$ACTUAL"
+
+# 2^54+1 kilobytes wraps around to 1k if the multiplication is not checked
+ACTUAL=$(echo "<END>" | ./output/analyzer 10 logger:queue_bytes=18014398509481985k 2>&1 | head -1)
+check_test_result "Overflowing byte budget rejected" "Error initializing plugin logger: Invalid byte budget (expected e.g. 64k, 16m or 1g)" "$ACTUAL"
+
+display_test_category "Replicated Chains"
+
+REPLICA_INPUT=$( (for i in $(seq 2000); do echo "user$((i % 7)) $i"; done; echo '<END>') )
+EXPECTED=$(echo "$REPLICA_INPUT" | ./output/analyzer --sink=- 16 uppercaser rotator 2>/dev/null | md5sum)
+ACTUAL=$(echo "$REPLICA_INPUT" | ./output/analyzer --replicas=4 --merge=input --sink=- 16 uppercaser rotator 2>/dev/null | md5sum)
+check_test_result "Input-order merge matches a single chain" "$EXPECTED" "$ACTUAL"
+
+ACTUAL=$(echo "$REPLICA_INPUT" | ./output/analyzer --replicas=3 --shard-key=field:1 --sink=- 4 uppercaser 2>/dev/null | \
+    awk '/^USER/ { if ($2 <= last[$1]) bad++; last[$1] = $2; lines++ } END { print lines, bad + 0 }')
+check_test_result "Key merge keeps the order of each key" "2000 0" "$ACTUAL"
+
+ACTUAL=$(echo "$REPLICA_INPUT" | ./output/analyzer --replicas=3 --merge=input --sink=- 8 grep:pattern=7 aggregate:window=100000 2>/dev/null | head -1 | cut -d' ' -f1-2)
+check_test_result "Stateful stage flushes once over all replicas" "window=1 lines=542" "$ACTUAL"
+
+ACTUAL=$(echo "$REPLICA_INPUT" | ./output/analyzer --replicas=2 --shard-key=field:1 --stats --sink=/dev/null 16 flipper 2>&1 | \
+    awk '/^\[stats\] replicas:/ { split($NF, routed, "="); split(routed[2], counts, ","); print $3, counts[1] + counts[2] }')
+check_test_result "Routing counters cover every line" "count=2 2000" "$ACTUAL"
+
+ACTUAL=$(echo "<END>" | ./output/analyzer --replicas=2 --merge=input 4 logger 2>&1 | head -1)
+check_test_result "Input-order merge needs a sink" "Error: --merge=input needs --sink" "$ACTUAL"
+
+ACTUAL=$(echo "$REPLICA_INPUT" | ./output/analyzer --replicas=2 --workers=4 16 uppercaser 2>&1 | head -1)
+check_test_result "No more workers than replicas" "Error: --workers cannot exceed --replicas" "$ACTUAL"
+
+ACTUAL=$(echo "<END>" | ./output/analyzer --replicas=2 --merge=input --sink=- 4 uppercaser:overload=drop-newest 2>&1 | head -1)
+check_test_result "Input-order merge needs blocking queues" "Error starting the worker pool: Tracked pipelines need blocking, single-lane queues" "$ACTUAL"
+
+display_test_category "Adaptive Stage Fusion"
+
+# Short lines first (cheap transforms fuse), then long ones (expander may be split off again)
+ADAPTIVE_INPUT=$( (for i in $(seq 8000); do echo "s$i"; done; for i in $(seq 1000); do printf 'L%.0s' $(seq 400); echo " $i"; done; echo '<END>') )
+EXPECTED=$(echo "$ADAPTIVE_INPUT" | ./output/analyzer --sink=- 8 uppercaser grep:pattern=7,invert=1 expander flipper 2>/dev/null | md5sum)
+ACTUAL=$(echo "$ADAPTIVE_INPUT" | ./output/analyzer --workers=3 --adaptive --sink=- 8 uppercaser grep:pattern=7,invert=1 expander flipper 2>/dev/null | md5sum)
+check_test_result "Fusing and splitting keeps every line in order" "$EXPECTED" "$ACTUAL"
+
+# Groups are reconsidered every 1024 items a stage takes
+FUSE_INPUT=$( (for i in $(seq 40000); do echo "s$i"; done; echo '<END>') )
+ACTUAL=$(echo "$FUSE_INPUT" | ./output/analyzer --workers=2 --adaptive --stats --sink=/dev/null 8 uppercaser rotator flipper 2>&1 | \
+    sed -n 's/^\[stats\] scheduler: fusions=\([0-9]*\).*/\1/p' | awk '{ print ($1 > 0) ? "fused" : "not fused" }')
+check_test_result "Cheap stages are fused" "fused" "$ACTUAL"
+
+ACTUAL=$(echo "$ADAPTIVE_INPUT" | ./output/analyzer --workers=2 --adaptive --sink=- 8 uppercaser aggregate:window=100000 2>/dev/null | head -1 | cut -d' ' -f1-2)
+check_test_result "Adaptive pools still flush at the end" "window=1 lines=9000" "$ACTUAL"
+
+ACTUAL=$(echo "$ADAPTIVE_INPUT" | ./output/analyzer --workers=2 --adaptive --stats --sink=/dev/null 8 uppercaser aggregate 2>&1 | \
+    sed -n 's/^\[stats\] scheduler: \(fusions=[0-9]*\).*/\1/p')
+check_test_result "Stages with stream state are never fused" "fusions=0" "$ACTUAL"
+
+ACTUAL=$(echo "<END>" | ./output/analyzer --adaptive 4 logger 2>&1 | head -1)
+check_test_result "Adaptive fusion needs the worker pool" "Error: --adaptive needs --workers, --replicas or --listen" "$ACTUAL"
+
+display_test_category "Open-Loop Load Generator"
+
+LOAD_INPUT=$(for i in $(seq 50); do echo "line $i"; done)
+ACTUAL=$(echo "$LOAD_INPUT" | ./output/analyzer --load=2000 --load-duration=100 4 uppercaser rotator 2>&1 | grep -o "^\[load\] rate=2000/s arrivals=fixed sent=200 done=200")
+check_test_result "Every offered record is timed" "[load] rate=2000/s arrivals=fixed sent=200 done=200" "$ACTUAL"
+
+ACTUAL=$(echo "$LOAD_INPUT" | ./output/analyzer --workers=1 --arrivals=poisson --load=3k,6k --load-duration=100 4 uppercaser 2>&1 | grep -c "^\[load\] .*arrivals=poisson .* p99=.* max_lag=")
+check_test_result "One report per offered rate" "2" "$ACTUAL"
+
+ACTUAL=$(echo "$LOAD_INPUT" | ./output/analyzer --load=1000 --load-duration=60 --sink=- 4 uppercaser 2>/dev/null | sed -n '1p;$p' | tr '\n' ' ')
+check_test_result "Timed records go on to the sink" "LINE 1 LINE 10 " "$ACTUAL"
+
+ACTUAL=$(echo "$LOAD_INPUT" | ./output/analyzer --load=1000 4 uppercaser grep:pattern=7 2>&1 | head -1)
+check_test_result "Filtering stages are rejected" "Error: --load needs every stage to pass each record on (stage grep filters or aggregates them)" "$ACTUAL"
+
+# typewriter takes over a second per record
+ACTUAL=$(echo "x" | timeout 20s ./output/analyzer --load=100 --load-duration=10 --load-stall=100 4 typewriter 2>&1 >/dev/null | grep "^Error")
+check_test_result "A stalled chain fails the step" "Error: Records did not come out of the last stage in time (dropped, reordered or stalled)" "$ACTUAL"
+
+ACTUAL=$(echo "$LOAD_INPUT" | ./output/analyzer --load=1000 4 logger:overload=drop-newest 2>&1 | head -1)
+check_test_result "Lossy stage queues are rejected" "Error: --load needs every stage to keep its records (stage logger drops them when full)" "$ACTUAL"
+
 display_test_category "Test Results Summary"
 
 print_status "Test suite execution completed!"